@@ -22,6 +22,107 @@ bool isNaN(T val)
     return (val != buf);
 }
 
+// number of pixels transformed together by the vectorized part of the cut loop
+constexpr size_t CUT_PIX_BLOCK_SIZE = 256;
+/* Ranges of the transformed pixel coordinates found by a thread. Aligned to cache line size
+ *  so threads updating their ranges do not share cache lines */
+struct alignas(64) cut_qe_range
+{
+    double qe_min[4];
+    double qe_max[4];
+    cut_qe_range()
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            qe_min[i] = FLT_MAX;
+            qe_max[i] = -FLT_MAX;
+        }
+    }
+};
+// GCC compiles the vectorized selection for AVX2 processors too and selects the version to use at runtime
+#if defined(__GNUC__) && !defined(__clang__) && (defined(__x86_64__) || defined(_M_X64))
+#define CUT_SELECT_TARGETS __attribute__((target_clones("avx2", "default")))
+#else
+#define CUT_SELECT_TARGETS
+#endif
+/* Parameters of the transformation from pixel coordinates into the cut coordinates,
+ *  copied into local variables to allow the compiler vectorizing the transformation */
+struct cut_transformation
+{
+    double rot[9];
+    double shift[3];
+    double cut_range[8];
+    // energy transformation. Set to identity when energy is not transformed
+    double ebin_inv, trans_elo;
+};
+/* Transform block of n_pix pixels into the cut coordinates and select the pixels within the cut range
+ *  and with signal and error not ignored.
+ * Outputs:
+ * qe          -- transformed coordinates of all pixels of the block
+ * selected    -- positions of the selected pixels within the block
+ * Returns number of selected pixels.
+ */
+template <class T>
+CUT_SELECT_TARGETS size_t select_cut_block(T const* const pix, size_t n_pix, const cut_transformation& tr,
+    bool ignore_nan, bool ignore_inf, T Inf,
+    double (&qe)[4][CUT_PIX_BLOCK_SIZE], unsigned int (&selected)[CUT_PIX_BLOCK_SIZE])
+{
+    // pixel data necessary for the selection, copied into contiguous arrays, so the selection can be vectorized
+    double v[6][CUT_PIX_BLOCK_SIZE];
+    // 1 for selected pixels and 0 for others. Double type allows the compiler to vectorize the selection
+    double keep[CUT_PIX_BLOCK_SIZE];
+    for (size_t j = 0; j < n_pix; j++)
+    {
+        T const* const p = pix + j * pix_flds::PIX_WIDTH;
+        v[0][j] = double(p[pix_flds::u1]);
+        v[1][j] = double(p[pix_flds::u2]);
+        v[2][j] = double(p[pix_flds::u3]);
+        v[3][j] = double(p[pix_flds::u4]);
+        v[4][j] = double(p[pix_flds::iSign]);
+        v[5][j] = double(p[pix_flds::iErr]);
+    }
+    const double r0 = tr.rot[0], r1 = tr.rot[1], r2 = tr.rot[2], r3 = tr.rot[3], r4 = tr.rot[4],
+        r5 = tr.rot[5], r6 = tr.rot[6], r7 = tr.rot[7], r8 = tr.rot[8];
+    const double x0 = tr.shift[0], y0 = tr.shift[1], z0 = tr.shift[2];
+    const double ebin_inv = tr.ebin_inv, trans_elo = tr.trans_elo;
+    const double x_min = tr.cut_range[0], x_max = tr.cut_range[1], y_min = tr.cut_range[2], y_max = tr.cut_range[3],
+        z_min = tr.cut_range[4], z_max = tr.cut_range[5], e_min = tr.cut_range[6], e_max = tr.cut_range[7];
+    const double inf = double(Inf);
+
+#pragma omp simd
+    for (long j = 0; j < (long)n_pix; j++)
+    {
+        double xt1 = v[0][j] - x0;
+        double yt1 = v[1][j] - y0;
+        double zt1 = v[2][j] - z0;
+        //    indx(4)=[(v(4,:)'-trans_elo)*(1/ebin)];  % nx4 matrix
+        double Et = (v[3][j] - trans_elo) * ebin_inv;
+
+        double xt = xt1 * r0 + yt1 * r3 + zt1 * r6;
+        double yt = xt1 * r1 + yt1 * r4 + zt1 * r7;
+        double zt = xt1 * r2 + yt1 * r5 + zt1 * r8;
+        qe[0][j] = xt;
+        qe[1][j] = yt;
+        qe[2][j] = zt;
+        qe[3][j] = Et;
+        // conditions are written as in the scalar loop, so pixels with NaN coordinates are treated identically
+        bool outside = (Et < e_min) | (Et > e_max) | (xt < x_min) | (xt > x_max) |
+            (yt < y_min) | (yt > y_max) | (zt < z_min) | (zt > z_max);
+        double sig = v[4][j];
+        double err = v[5][j];
+        bool ignored = (ignore_nan & ((sig != sig) | (err != err))) | (ignore_inf & ((sig == inf) | (err == inf)));
+        keep[j] = (outside | ignored) ? 0. : 1.;
+    }
+    // compress positions of the selected pixels
+    size_t n_selected = 0;
+    for (size_t j = 0; j < n_pix; j++)
+    {
+        selected[n_selected] = (unsigned int)j;
+        n_selected += (keep[j] != 0);
+    }
+    return n_selected;
+}
+
 //static std::unique_ptr<omp_storage> pStorHolder;
 /** Routine to calculate pixels data belonging to appropriate range */
 template <class T>
@@ -36,7 +137,6 @@ mwSize accumulate_cut(double* s, double* e, double* npix,
 
     T Inf(0);
     double ebin_inv = (1 / ebin);
-    bool ignore_something, ignore_all;
 
     //if we want to ignore nan and inf in the data
     bool ignore_nan(false);
@@ -49,8 +149,6 @@ mwSize accumulate_cut(double* s, double* e, double* npix,
     {
         ignore_inf = true;
     }
-    ignore_something = ignore_nan || ignore_inf;
-    ignore_all = ignore_nan && ignore_inf;
     if (ignore_inf)
     {
         Inf = static_cast<T>(mxGetInf());
@@ -131,151 +229,110 @@ mwSize accumulate_cut(double* s, double* e, double* npix,
     }
 #endif
 
-    std::vector<double> qe_min(4 * num_OMP_Threads, FLT_MAX);
-    std::vector<double> qe_max(4 * num_OMP_Threads, -FLT_MAX);
+    // per-thread ranges of the transformed pixels
+    std::vector<cut_qe_range> qe_range(num_OMP_Threads);
 
-    std::unique_ptr<omp_storage> pStorHolder(new omp_storage(num_OMP_Threads, distribution_size, s, e, npix));
+    std::unique_ptr<omp_storage> pStorHolder(new omp_storage(num_OMP_Threads, distribution_size, s, e, npix, data_size));
     auto pStor = pStorHolder.get();
 
+    cut_transformation tr;
+    for (int i = 0; i < 9; i++)
+        tr.rot[i] = rot_ustep[i];
+    for (int i = 0; i < 3; i++)
+        tr.shift[i] = trans_bott_left[i];
+    for (int i = 0; i < 8; i++)
+        tr.cut_range[i] = cut_range[i];
+    //% Catch special (and common) case of energy being an integration axis to save calculations:
+    // identity transformation gives exactly the same energies
+    tr.ebin_inv = transform_energy ? ebin_inv : 1;
+    tr.trans_elo = transform_energy ? trans_elo : 0;
+    long n_blocks = long((data_size + CUT_PIX_BLOCK_SIZE - 1) / CUT_PIX_BLOCK_SIZE);
+
 
 #pragma omp parallel default(none)                                                           \
-    shared(rot_ustep, trans_bott_left, cut_range, ok, ind, qe_min, qe_max,                   \
-           pStor)                                                                            \
-        firstprivate(data_size, distribution_size,                                           \
-                     trans_elo, ebin_inv, Inf, PIXEL_data_width,                             \
-                     ignore_all, ignore_nan, ignore_inf, ignore_something, transform_energy, \
+    shared(tr, ok, ind, qe_range, pStor)                                                     \
+        firstprivate(data_size, distribution_size, n_blocks,                                 \
+                     Inf, PIXEL_data_width, ignore_nan, ignore_inf,                          \
                      nDimX, nDimY, nDimZ, nDimE,                                             \
                      s, e, npix,pixel_data)                                                  \
         reduction(+: nPixel_retained)
     {
-#pragma omp for 
-        for (long i = 0; i < data_size; i++)
+        int n_thread = omp_get_thread_num();
+        cut_qe_range thread_range;
+        double qe[4][CUT_PIX_BLOCK_SIZE];
+        unsigned int selected[CUT_PIX_BLOCK_SIZE];
+#pragma omp for
+        for (long nb = 0; nb < n_blocks; nb++)
         {
-            mwSize j0 = i * PIXEL_data_width;
+            size_t i0 = size_t(nb) * CUT_PIX_BLOCK_SIZE;
+            size_t n_pix = data_size - i0;
+            if (n_pix > CUT_PIX_BLOCK_SIZE)
+                n_pix = CUT_PIX_BLOCK_SIZE;
+            // Transform the coordinates u1-u4 into the new projection axes, check if they are within the cut ranges
+            // and if signal or error contain NaNs or Infs to ignore according to options settings
+            //    indx=[(v(1:3,:)'-repmat(trans_bott_left',[size(v,2),1]))*rot_ustep',v(4,:)'];  % nx4 matrix
+            //  ok = indx(:,1)>=cut_range(1,1) & indx(:,1)<=cut_range(2,1) & indx(:,2)>=cut_range(1,2) & indx(:,2)<=urange_step(2,2) & ...
+            //       indx(:,3)>=cut_range(1,3) & indx(:,3)<=cut_range(2,3) & indx(:,4)>=cut_range(1,4) & indx(:,4)<=cut_range(2,4);
+            size_t n_selected = select_cut_block<T>(pixel_data + i0 * PIXEL_data_width, n_pix, tr,
+                ignore_nan, ignore_inf, Inf, qe, selected);
+            for (size_t j = 0; j < n_pix; j++)
+                ok[i0 + j] = false;
 
-            // Check for the case when either data.s or data.e contain NaNs or Infs, but data.npix is not zero.
-            // and handle according to options settings.
-            ok[i] = false;
-            if (ignore_something)
+            nPixel_retained += n_selected;
+            for (size_t k = 0; k < n_selected; k++)
             {
-                if (ignore_all)
+                size_t j = selected[k];
+                size_t i = i0 + j;
+                double xt = qe[0][j];
+                double yt = qe[1][j];
+                double zt = qe[2][j];
+                double Et = qe[3][j];
+                // variables used to calculate indexes and evaluate min-max differ
+                double xtt = xt;
+                if (xtt == tr.cut_range[1])
+                    xtt *= (1 - FLT_EPSILON);
+                double ytt = yt;
+                if (ytt == tr.cut_range[3])
+                    ytt *= (1 - FLT_EPSILON);
+                double ztt = zt;
+                if (ztt == tr.cut_range[5])
+                    ztt *= (1 - FLT_EPSILON);
+                double Ett = Et;
+                if (Ett == tr.cut_range[7])
+                    Ett *= (1 - FLT_EPSILON);
+
+                //     indx=indx(ok,:);    % get good indices (including integration axes and plot axes with only one bin)
+                mwSize indX = (mwSize)floor(xtt - tr.cut_range[0]);
+                mwSize indY = (mwSize)floor(ytt - tr.cut_range[2]);
+                mwSize indZ = (mwSize)floor(ztt - tr.cut_range[4]);
+                mwSize indE = (mwSize)floor(Ett - tr.cut_range[6]);
+
+                mwSize il = indX * nDimX + indY * nDimY + indZ * nDimZ + indE * nDimE;
+                // check for round-off errors; assure the errors are not bring pixel outside of the histogram
+                // range
+                if (il >= distribution_size)
+                    il = distribution_size - 1;
+                ok[i] = true;
+                ind[i] = il;
+                //
+                //    actual_pix_range = [min(actual_pix_range(1,:),min(indx,[],1));max(actual_pix_range(2,:),max(indx,[],1))];  % true range of data
+                for (int ike = 0; ike < 4; ike++)
                 {
-                    if (pixel_data[j0 + 7] == Inf || isNaN(pixel_data[j0 + 7]) ||
-                        pixel_data[j0 + 8] == Inf || isNaN(pixel_data[j0 + 8]))
-                        continue;
+                    double val = qe[ike][j];
+                    if (val < thread_range.qe_min[ike])
+                        thread_range.qe_min[ike] = val;
+                    if (val > thread_range.qe_max[ike])
+                        thread_range.qe_max[ike] = val;
                 }
-                else if (ignore_nan)
-                {
-                    if (isNaN(pixel_data[j0 + 7]) || isNaN(pixel_data[j0 + 8]))
-                        continue;
-                }
-                else if (ignore_inf)
-                {
-                    if (pixel_data[j0 + 7] == Inf || pixel_data[j0 + 8] == Inf)
-                        continue;
-                }
-            }
-
-            // Transform the coordinates u1-u4 into the new projection axes, if necessary
-            //    indx=[(v(1:3,:)'-repmat(trans_bott_left',[size(v,2),1]))*rot_ustep',v(4,:)'];  % nx4 matrix
-            double xt1 = double(pixel_data[j0]) - trans_bott_left[0];
-            double yt1 = double(pixel_data[j0 + 1]) - trans_bott_left[1];
-            double zt1 = double(pixel_data[j0 + 2]) - trans_bott_left[2];
 
-            double Et;
-            if (transform_energy)
-            {
-                //    indx(4)=[(v(4,:)'-trans_elo)*(1/ebin)];  % nx4 matrix
-                Et = (double(pixel_data[j0 + 3]) - trans_elo) * ebin_inv;
-            }
-            else
-            {
-                //% Catch special (and common) case of energy being an integration axis to save calculations
-                //  indx(4)=[(v(4,:)'];  % nx4 matrix
-                Et = double(pixel_data[j0 + 3]);
+                T const* const pix = pixel_data + i * PIXEL_data_width;
+                pStor->add_signal(double(pix[pix_flds::iSign]), double(pix[pix_flds::iErr]), n_thread, il);
             }
-
-            //  ok = indx(:,1)>=cut_range(1,1) & indx(:,1)<=cut_range(2,1) & indx(:,2)>=cut_range(1,2) & indx(:,2)<=urange_step(2,2) & ...
-            //       indx(:,3)>=cut_range(1,3) & indx(:,3)<=cut_range(2,3) & indx(:,4)>=cut_range(1,4) & indx(:,4)<=cut_range(2,4);
-            if (Et < cut_range[6] || Et > cut_range[7])
-                continue;
-            double Ett = Et; // variables used to calculate indexes and evaluate min-max differ
-            if (Ett == cut_range[7])
-                Ett *= (1 - FLT_EPSILON);
-
-            double xt = xt1 * rot_ustep[0] + yt1 * rot_ustep[3] + zt1 * rot_ustep[6];
-            if (xt < cut_range[0] || xt > cut_range[1])
-                continue;
-            double xtt = xt; // variables used to calculate indexes and evaluate min-max differ
-            if (xtt == cut_range[1])
-                xtt *= (1 - FLT_EPSILON);
-
-            double yt = xt1 * rot_ustep[1] + yt1 * rot_ustep[4] + zt1 * rot_ustep[7];
-            if (yt < cut_range[2] || yt > cut_range[3])
-                continue;
-            double ytt = yt; // variables used to calculate indexes and evaluate min-max differ
-            if (ytt == cut_range[3])
-                ytt *= (1 - FLT_EPSILON);
-
-            double zt = xt1 * rot_ustep[2] + yt1 * rot_ustep[5] + zt1 * rot_ustep[8];
-            if (zt < cut_range[4] || zt > cut_range[5])
-                continue;
-            double ztt = zt; // variables used to calculate indexes and evaluate min-max differ
-            if (ztt == cut_range[5])
-                ztt *= (1 - FLT_EPSILON);
-
-            nPixel_retained++;
-
-            //     indx=indx(ok,:);    % get good indices (including integration axes and plot axes with only one bin)
-
-            mwSize indX = (mwSize)floor(xtt - cut_range[0]);
-            mwSize indY = (mwSize)floor(ytt - cut_range[2]);
-            mwSize indZ = (mwSize)floor(ztt - cut_range[4]);
-            mwSize indE = (mwSize)floor(Ett - cut_range[6]);
-
-            mwSize il = indX * nDimX + indY * nDimY + indZ * nDimZ + indE * nDimE;
-            // check for round-off errors; assure the errors are not bring pixel outside of the histogram
-            // range
-            if (il >= distribution_size)
-                il = distribution_size - 1;
-            ok[i] = true;
-            ind[i] = il;
-            // i0=nPixel_retained*OUT_PIXEL_DATA_WIDTH;    // transformed pixels;
-            //
-            //
-            //    actual_pix_range = [min(actual_pix_range(1,:),min(indx,[],1));max(actual_pix_range(2,:),max(indx,[],1))];  % true range of data
-            int n_thread = omp_get_thread_num();
-
-            if (xt < qe_min[4 * n_thread + 0])
-                qe_min[4 * n_thread + 0] = xt;
-            if (xt > qe_max[4 * n_thread + 0])
-                qe_max[4 * n_thread + 0] = xt;
-
-            if (yt < qe_min[4 * n_thread + 1])
-                qe_min[4 * n_thread + 1] = yt;
-            if (yt > qe_max[4 * n_thread + 1])
-                qe_max[4 * n_thread + 1] = yt;
-
-            if (zt < qe_min[4 * n_thread + 2])
-                qe_min[4 * n_thread + 2] = zt;
-            if (zt > qe_max[4 * n_thread + 2])
-                qe_max[4 * n_thread + 2] = zt;
-
-            if (Et < qe_min[4 * n_thread + 3])
-                qe_min[4 * n_thread + 3] = Et;
-            if (Et > qe_max[4 * n_thread + 3])
-                qe_max[4 * n_thread + 3] = Et;
-
-            pStor->add_signal(double(pixel_data[j0 + 7]), double(pixel_data[j0 + 8]), n_thread, il);
-
         } // end for -- implicit barrier;
+        qe_range[n_thread] = thread_range;
         if (pStor->is_mutlithreaded)
         {
-#pragma omp for
-            for (long i = 0; i < distribution_size; i++)
-            {
-                pStor->combine_storage(s, e, npix, i);
-            }
+            pStor->combine_thread_storage(s, e, npix, n_thread);
         }
     } // end parallel region
     // delete OMP storage, free memory
@@ -291,10 +348,10 @@ mwSize accumulate_cut(double* s, double* e, double* npix,
     {
         for (int ike = 0; ike < 4; ike++)
         {
-            if (qe_min[4 * ii + ike] < actual_pix_range[2 * ike + 0])
-                actual_pix_range[2 * ike + 0] = qe_min[4 * ii + ike];
-            if (qe_max[4 * ii + ike] > actual_pix_range[2 * ike + 1])
-                actual_pix_range[2 * ike + 1] = qe_max[4 * ii + ike];
+            if (qe_range[ii].qe_min[ike] < actual_pix_range[2 * ike + 0])
+                actual_pix_range[2 * ike + 0] = qe_range[ii].qe_min[ike];
+            if (qe_range[ii].qe_max[ike] > actual_pix_range[2 * ike + 1])
+                actual_pix_range[2 * ike + 1] = qe_range[ii].qe_max[ike];
         }
     }
 #ifdef _DEBUG
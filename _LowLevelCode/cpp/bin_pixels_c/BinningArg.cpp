@@ -1,4 +1,5 @@
 #include "BinningArg.h"
+#include <algorithm>
 #include <cstdlib>
 #include <limits>
 #include <random>
@@ -247,7 +248,32 @@ void BinningArg::set_all_pix(mxArray const* const pField)
     }
     this->all_pix_ptr = pField;
     auto type = mxGetClassID(pField);
-    if (type == mxCELL_CLASS) {
+    if (type == mxCELL_CLASS && mxGetNumberOfElements(pField) == pix_flds::PIX_WIDTH) {
+        // column-oriented page of pixels, i.e. cellarray of 9 arrays containing pixel fields
+        std::string err;
+        switch (get_pix_page_class(pField)) {
+        case (mxDOUBLE_CLASS): {
+            pix_page_view<double> pix;
+            err = get_pix_page_view<double>(pField, pix);
+            this->n_data_points = pix.size();
+            break;
+        }
+        case (mxSINGLE_CLASS): {
+            pix_page_view<float> pix;
+            err = get_pix_page_view<float>(pField, pix);
+            this->n_data_points = pix.size();
+            break;
+        }
+        default:
+            err = "Column-oriented pixels page may contain only single or double precision data";
+        }
+        if (!err.empty()) {
+            mexErrMsgIdAndTxt("HORACE:bin_pixels_c:invalid_argument",
+                err.c_str());
+        }
+        this->in_pix_width = pix_flds::PIX_WIDTH;
+        this->n_Cells_to_bin = 0;
+    } else if (type == mxCELL_CLASS) {
         // check cell input and identify number of points stored in cell class
         this->binMode = opModes::sigerr_cell;
         auto nCells = mxGetNumberOfElements(pField);
@@ -566,8 +592,9 @@ void BinningArg::parse_bin_inputs(mxArray const* pAllParStruct)
             buf.str().c_str());
     }
     //
-    // calculate binning steps and projection axis in all binning directions
-    this->calc_step_sizes_pax_and_strides();
+    // calculate binning steps, projection axis and accumulators layout in all binning directions
+    // or take them from recently used plan with the same binning grid
+    this->select_binning_plan();
     if (this->in_pix_width == 0) {
         this->in_pix_width = this->in_coord_width;
     }
@@ -580,6 +607,9 @@ void BinningArg::parse_bin_inputs(mxArray const* pAllParStruct)
     mxClassID pix_type;
     if (this->all_pix_ptr) {
         pix_type = mxGetClassID(this->all_pix_ptr);
+        if (pix_type == mxCELL_CLASS && this->n_Cells_to_bin == 0) { // column-oriented page of pixels
+            pix_type = get_pix_page_class(this->all_pix_ptr);
+        }
     } else {
         pix_type = mxUNKNOWN_CLASS;
     }
@@ -828,6 +858,65 @@ mxArray* duplicate_or_allocate_array(mxArray const* const origin_ptr, mwSize nDi
     return target_ptr;
 };
 
+// build the key of binning plan and calculate its hash
+binning_plan_key::binning_plan_key(const std::vector<double>& range, const std::vector<uint32_t>& nbins, size_t coord_width, size_t ndims)
+    : data_range(range)
+    , nbins_all_dims(nbins)
+    , in_coord_width(coord_width)
+    , n_dims(ndims)
+    , hash(std::hash<size_t>{}(coord_width))
+{
+    auto combine = [this](size_t val_hash) {
+        this->hash ^= val_hash + 0x9e3779b97f4a7c15ULL + (this->hash << 6) + (this->hash >> 2);
+    };
+    combine(std::hash<size_t>{}(ndims));
+    for (auto val : this->data_range) {
+        combine(std::hash<double>{}(val));
+    }
+    for (auto val : this->nbins_all_dims) {
+        combine(std::hash<uint32_t>{}(val));
+    }
+};
+/* Set up binning steps, strides and accumulator layout for the binning grid defined by the binning parameters
+ * of the current call. If the grid has been used recently, the values are taken from the cache of recently
+ * used plans, otherwise they are calculated and added to the cache, releasing the least recently used plan
+ * if the cache is full. */
+void BinningArg::select_binning_plan()
+{
+    binning_plan_key key(this->data_range, this->nbins_all_dims, this->in_coord_width, this->n_dims);
+    auto it = std::find_if(this->plan_cache.begin(), this->plan_cache.end(),
+        [&key](const binning_plan& plan) { return plan.key == key; });
+    if (it != this->plan_cache.end()) {
+        // move the plan to the front of the list of recently used plans
+        this->plan_cache.splice(this->plan_cache.begin(), this->plan_cache, it);
+    } else {
+        this->calc_step_sizes_pax_and_strides();
+        this->calc_accumulator_layout();
+        this->n_plan_setups++;
+
+        binning_plan plan;
+        plan.key = std::move(key);
+        plan.bin_step = this->bin_step;
+        plan.pax = this->pax;
+        plan.stride = this->stride;
+        plan.bin_cell_idx_range = this->bin_cell_idx_range;
+        plan.accumulator_dims = this->accumulator_dims_holder;
+        plan.distr_size = this->distr_size;
+        this->plan_cache.push_front(std::move(plan));
+        if (this->plan_cache.size() > BINNING_PLAN_CACHE_SIZE) {
+            this->plan_cache.pop_back();
+        }
+        return;
+    }
+    const auto& plan = this->plan_cache.front();
+    this->bin_step = plan.bin_step;
+    this->pax = plan.pax;
+    this->stride = plan.stride;
+    this->bin_cell_idx_range = plan.bin_cell_idx_range;
+    this->accumulator_dims_holder = plan.accumulator_dims;
+    this->distr_size = plan.distr_size;
+};
+
 // check if input accumulators have not been changed and initialize them appropriately
 void BinningArg::check_and_init_accumulators(mxArray* plhs[], mxArray const* prhs[], bool force_update)
 {
@@ -862,12 +951,18 @@ void BinningArg::check_and_init_accumulators(mxArray* plhs[], mxArray const* prh
     }
     // pixels modes
     if (this->binMode >= opModes::sort_pix && this->binMode<opModes::siger_selected) {
-        if (this->n_data_points > this->pix_ok_bin_idx.size()) {
-            this->pix_ok_bin_idx.resize(this->n_data_points);
+        if (this->binMode >= opModes::nosort) {
+            if (this->n_data_points > this->pix_ok_bin_idx.size()) {
+                this->pix_ok_bin_idx.resize(this->n_data_points);
+            }
+            // fill all positions of the pix_ok vector with certainly invalid value. Index can not be negative
+            // this will indicate invalid elements
+            std::fill(this->pix_ok_bin_idx.begin(), this->pix_ok_bin_idx.end(), -1);
+        } else {
+            // sorting modes do not store image cells of all pixels, so release memory which may have been
+            // allocated in other modes
+            std::vector<mxInt64>().swap(this->pix_ok_bin_idx);
         }
-        // fill all positions of the pix_ok vector with certainly invalid value. Index can not be negative
-        // this will indicate invalid elements
-        std::fill(this->pix_ok_bin_idx.begin(), this->pix_ok_bin_idx.end(), -1);
         // allocate space for pixel data range, which is always calculated for
         // any pixel mode
         this->pix_data_range_ptr = mxCreateDoubleMatrix(2, pix_flds::PIX_WIDTH, mxREAL);
@@ -892,16 +987,17 @@ void BinningArg::check_and_init_accumulators(mxArray* plhs[], mxArray const* prh
 * pointer to MATLAB array which defines dimensions for mxCreateNumericArray function
 * distr_size -- total number of elements in this numerical array (product of all its dimensions)
 **/
-mwSize* BinningArg::get_Matlab_acc_dimensions(size_t& distr_size)
+// calculate dimensions of accumulator arrays and the number of their elements
+void BinningArg::calc_accumulator_layout()
 {
-    distr_size = 1;
+    this->distr_size = 1;
     this->accumulator_dims_holder.clear();
     if (this->n_dims == 0) {
         this->accumulator_dims_holder.push_back(1);
     } else {
         for (auto& element : this->nbins_all_dims) {
             if (element > 1) {
-                distr_size *= element;
+                this->distr_size *= element;
                 this->accumulator_dims_holder.push_back(mwSize(element));
             }
         }
@@ -919,6 +1015,11 @@ mwSize* BinningArg::get_Matlab_acc_dimensions(size_t& distr_size)
     if (this->accumulator_dims_holder.size() == 1) {
         this->accumulator_dims_holder.push_back(1);
     }
+}
+// get dimensions of accumulator arrays, calculated for the current binning plan
+mwSize* BinningArg::get_Matlab_acc_dimensions(size_t& distr_size)
+{
+    distr_size = this->distr_size;
     return this->accumulator_dims_holder.data();
 }
 
@@ -955,6 +1056,7 @@ BinningArg::BinningArg()
     , pix_ok_ptr(nullptr)
     , pix_img_idx_ptr(nullptr)
     , is_pix_selected_ptr(nullptr)
+    , n_plan_setups(0)
 {
     /* initialize input Matlab parameters map with methods which  associate
      * Matlab field names with the methods, which set appropriate property value  */
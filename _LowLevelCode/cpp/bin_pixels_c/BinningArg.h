@@ -3,6 +3,7 @@
 
 #include <include/CommonCode.h>
 #include <include/MatlabCppClassHolder.hpp>
+#include <list>
 #include <map>
 #include <unordered_set>
 #include <numeric>
@@ -65,6 +66,40 @@ enum opModes {
 // define the map type to keep functions which set up output parameters in a structure, specific for given binning mode;
 using OutHandlerMap = std::unordered_map<std::string, std::function<void(mxArray* p1, mxArray* p2, int idx, const std::string& name)>>;
 
+// number of binning plans (binning geometries with the binning steps and accumulator layout derived from them),
+// retained between calls to bin_pixels_c, so that switching between a few cuts does not recalculate them each time
+constexpr size_t BINNING_PLAN_CACHE_SIZE = 4;
+
+/* Key identifying binning plan, i.e. the binning grid the plan is derived from */
+struct binning_plan_key {
+    std::vector<double> data_range;
+    std::vector<uint32_t> nbins_all_dims;
+    size_t in_coord_width;
+    size_t n_dims;
+    size_t hash; // hash of the values above used for fast comparison of keys
+
+    binning_plan_key()
+        : in_coord_width(0)
+        , n_dims(0)
+        , hash(0) { };
+    binning_plan_key(const std::vector<double>& range, const std::vector<uint32_t>& nbins, size_t coord_width, size_t ndims);
+    bool empty() const { return nbins_all_dims.empty(); }
+    bool operator==(const binning_plan_key& other) const
+    {
+        return hash == other.hash && in_coord_width == other.in_coord_width && n_dims == other.n_dims && data_range == other.data_range && nbins_all_dims == other.nbins_all_dims;
+    }
+};
+/* Binning steps, strides and accumulator layout derived from the binning grid */
+struct binning_plan {
+    binning_plan_key key;
+    std::vector<double> bin_step;
+    std::vector<size_t> pax;
+    std::vector<size_t> stride;
+    std::vector<size_t> bin_cell_idx_range;
+    std::vector<mwSize> accumulator_dims;
+    size_t distr_size;
+};
+
 /* class describes all parameters used by binning procedure
  * use Matlab pointers for all transient array, which may change from call to call to mex function
  * and update these pointers on each call or vectors to all parameters which expect to be retained
@@ -126,6 +161,9 @@ public:
     // auxiliary array defining ranges of the bins to sort pixels over
     std::vector<size_t> npix_bin_start;
     std::vector<size_t> npix1; // pixel distribution over bins calculated in single call to bin_pixels routine;
+    // auxiliary arrays used by multithreaded binning
+    std::vector<size_t> chunk_bin_offsets; // distributions of pixels over bins calculated by each thread, converted into offsets of these pixels within sorted array
+    std::vector<size_t> pix_bin_order; // indices of retained pixels sorted by bins
 
 
     // calculate size of the binning grid
@@ -184,6 +222,11 @@ public:
     void return_results(mxArray* plhs[], mwSize nlhs);
     // check if input binning parameters are new or have been changed
     bool new_binning_arguments_present(mxArray const* prhs[]);
+    // set up binning steps, strides and accumulator layout for the current binning grid, taking them from the
+    // cache of recently used plans if this grid has been used recently
+    void select_binning_plan();
+    // number of times binning plan have been calculated rather than taken from the cache
+    size_t n_plan_setups;
     // check if input accumulators have not been changed and initialize them appropriately
     void check_and_init_accumulators(mxArray* plhs[], mxArray const* prhs[], bool force_update = false);
     // get number of dimensions for accumulator array to allocate using MATLAB methods
@@ -201,6 +244,12 @@ private:
     // helper function to calculate binning sizes in all non-unit directions
     void calc_step_sizes_pax_and_strides();
 
+    // helper function to calculate dimensions of accumulator arrays and the number of their elements
+    void calc_accumulator_layout();
+
+    // recently used binning plans, most recently used first
+    std::list<binning_plan> plan_cache;
+
     OutHandlerMap Mode0ParList;
     OutHandlerMap Mode4ParList;
     OutHandlerMap Mode5ParList;
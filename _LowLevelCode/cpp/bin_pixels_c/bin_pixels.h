@@ -1,10 +1,13 @@
 #pragma once
 #include "BinningArg.h"
+#include "bin_pixels_simd.h"
 #include <algorithm>
+#include <array>
 
 /**  Return true if input coordinates lie outside of the ranges specified as input.
 * 
-*    Template can be instantiated for any input numerical types convertible to double.
+*    Template can be instantiated for any input numerical types convertible to double
+*    and for 3 or 4 pixel coordinates (COORD_STRIDE).
 *
 * Inputs:
 * coord_ptr   --  pointer to the beginning of the  area containing 2-Dimensional array
@@ -13,11 +16,10 @@
 *                 Pixels coordinates are changed along first direction.
 * i           --  second index of the pixel array, indicating number of pixel to pick up
 *                 from pixels array
-* COORD_STRIDE -- size of the first dimension of the pixels array
 * cut_range    --  2*COORD_STRIDE array of pixel ranges to check. The ranges are
 *                  arranged in 2-Dimensional array with MATLAB allocation in the form:
 *                  [q1_min,q1_max,q2_min,q2_max,... q_COORD_STRIDE_min,q_COORD_STRIDE_max]
-* qi           --  Output vector of input q-coordinates converted in double
+* qi           --  Output array of input q-coordinates converted in double
                    if all input coordinates are in range. Undefined if they are not
 * Returns:
 *   true if all input coordinates are in range and false otherwise.
@@ -26,8 +28,8 @@
 *         at least by 10% or even more. Difficult to judge properly, as code in this form would not compile
 *         without inline.
  */
-template <class SRC>
-bool inline out_of_ranges(SRC const* const coord_ptr, long i, size_t COORD_STRIDE, const std::vector<double>& cut_range, std::vector<double>& qi)
+template <class SRC, size_t COORD_STRIDE>
+bool inline out_of_ranges(SRC const* const coord_ptr, size_t i, const std::array<double, 8>& cut_range, std::array<double, 4>& qi)
 {
     size_t ic0 = i * COORD_STRIDE;
     for (size_t upix = 0; upix < COORD_STRIDE; upix++) {
@@ -39,19 +41,21 @@ bool inline out_of_ranges(SRC const* const coord_ptr, long i, size_t COORD_STRID
     return false;
 };
 /** identifies 1D index of the image cell where the particular pixel belongs to
+*   Template is instantiated for 0 to 4 binning dimensions (NDIMS).
 * Inputs:
-* qi       -- 1-dimensional vector of pixel coordinates to process
-* pax      -- 1-to-4 elements vector of pixel indices accounted in binning. Indicates 
+* qi       -- array of pixel coordinates to process
+* geom     -- binning grid parameters, namely:
+*  pax     -- NDIMS elements array of pixel indices accounted in binning. Indicates 
 *             numbers of pixel coordinates from qi array to include in the binning.
-*             I.e. if pax.size()==1 only one coordinates needs to be binned or if
-*             pax.size()==4, all four qi coordinates have to be binned in 4-dimensional array
-* cut_range -- 6 or 8-elements array defining ranges allowed for pixels. The same as cut_range
+*             I.e. if NDIMS==1 only one coordinates needs to be binned or if
+*             NDIMS==4, all four qi coordinates have to be binned in 4-dimensional array
+*  cut_range -- 6 or 8-elements array defining ranges allowed for pixels. The same as cut_range
 *              provided in out_of_range routine above.
-* bin_step  -- 6 or 8-elements array defining bin step sizes e.g. (cut_range(2*n+1)-cut_range(2*n))/bin_cell_idx_range(n)
+*  bin_step -- NDIMS elements array defining bin step sizes e.g. (cut_range(2*n+1)-cut_range(2*n))/bin_cell_idx_range(n)
 *              where n is the number of pixel coordinate to bin.
-* bin_cell_idx_range
-*           -- number of bins in each binned direction.
-* stride    -- 1-to-4 element's vector which describes 1-D allocation of multidimensional array,
+*  bin_cell_idx_range
+*           -- maximal cell index in each binned direction.
+*  stride   -- NDIMS elements array which describes 1-D allocation of multidimensional array,
 *              i.e. change of linear index per change of 1-4 dimensional index by 1 in each direction.
 *             E.g.:
 *              if one have 1D array, stride has 1 element and contains 1.
@@ -61,59 +65,206 @@ bool inline out_of_ranges(SRC const* const coord_ptr, long i, size_t COORD_STRID
 * Returns:
 * index of pixel in input multidimensional array.
 */
-size_t inline pix_position(const std::vector<double>& qi, const std::vector<size_t>& pax,
-    const std::vector<double>& cut_range, const std::vector<double>& bin_step,
-    const std::vector<size_t>& bin_cell_idx_range, const std::vector<size_t>& stride)
+template <size_t NDIMS>
+size_t inline pix_position(const std::array<double, 4>& qi, const pix_bin_geometry& geom)
 {
     size_t il(0);
-    for (size_t j = 0; j < pax.size(); j++) {
-        auto bin_idx = pax[j];
-        auto cell_idx = (size_t)std::floor((qi[bin_idx] - cut_range[2 * bin_idx]) * bin_step[j]);
-        if (cell_idx > bin_cell_idx_range[j])
-            cell_idx = bin_cell_idx_range[j];
-        il += cell_idx * stride[j];
+    for (size_t j = 0; j < NDIMS; j++) {
+        auto bin_idx = geom.pax[j];
+        auto cell_idx = (size_t)std::floor((qi[bin_idx] - geom.cut_range[2 * bin_idx]) * geom.bin_step[j]);
+        if (cell_idx > geom.bin_cell_idx_range[j])
+            cell_idx = geom.bin_cell_idx_range[j];
+        il += cell_idx * geom.stride[j];
     }
     return il;
 };
-/* calculate pixels position in image array and update pixels accumulators using this position
+/* Class which calculates indices of image cells for blocks of pixels using the best vector instruction set
+ * available on current processor and scalar code for the remaining pixels or if vector instructions are not available.
+ * Instantiated for number of projection axes NDIMS and number of pixel coordinates COORD_STRIDE
+ * of the binning, so no runtime-sized containers are accessed while processing pixels.
+ */
+template <class SRC, size_t NDIMS, size_t COORD_STRIDE>
+class pix_bin_indexer {
+public:
+    pix_bin_indexer(BinningArg const* const bin_par_ptr, SimdLevel level = get_simd_level())
+        : simd_level(level)
+    {
+        if (bin_par_ptr->in_coord_width != COORD_STRIDE || bin_par_ptr->pax.size() != NDIMS) {
+            throw "pix_bin_indexer instantiated for number of dimensions or coordinates different from binning arguments";
+        }
+        geom.cut_range.fill(0);
+        std::copy(bin_par_ptr->data_range.begin(), bin_par_ptr->data_range.begin() + 2 * COORD_STRIDE, geom.cut_range.begin());
+        for (size_t j = 0; j < NDIMS; j++) {
+            geom.pax[j] = bin_par_ptr->pax[j];
+            geom.bin_step[j] = bin_par_ptr->bin_step[j];
+            geom.bin_cell_idx_range[j] = bin_par_ptr->bin_cell_idx_range[j];
+            geom.stride[j] = bin_par_ptr->stride[j];
+            geom.max_cell[j] = double(geom.bin_cell_idx_range[j]);
+            geom.cell_stride[j] = double(geom.stride[j]);
+        }
+    }
+    /* calculate indices of image cells for n_pix pixels starting from pixel i0 and place them into idx array.
+     *  Pixels outside of the binning range get index -1 */
+    void operator()(SRC const* const coord_ptr, size_t i0, size_t n_pix, mxInt64* const idx) const
+    {
+        SRC const* const block_ptr = coord_ptr + i0 * COORD_STRIDE;
+        size_t n_done(0);
+#ifdef HORACE_X86_SIMD
+        if (simd_level == simd_avx512) {
+            n_done = calc_bin_idx_avx512<SRC, NDIMS, COORD_STRIDE>(geom, block_ptr, n_pix, idx);
+        } else if (simd_level == simd_avx2) {
+            n_done = calc_bin_idx_avx2<SRC, NDIMS, COORD_STRIDE>(geom, block_ptr, n_pix, idx);
+        }
+#endif
+        std::array<double, 4> qi;
+        for (size_t i = n_done; i < n_pix; i++) {
+            if (out_of_ranges<SRC, COORD_STRIDE>(block_ptr, i, geom.cut_range, qi)) {
+                idx[i] = -1;
+            } else {
+                idx[i] = mxInt64(pix_position<NDIMS>(qi, geom));
+            }
+        }
+    }
+
+private:
+    SimdLevel simd_level;
+    pix_bin_geometry geom;
+};
+
+// number of pixels, which cell indices are calculated by single call to pix_bin_indexer
+constexpr size_t PIX_BLOCK_SIZE = 1024;
+
+/* Calculate image cells indices for pixels in the range [i_start, i_end) block by block and call
+ *  process_pixel(i, il) for every pixel i, where il is the index of the image cell pixel belongs to
+ *  or -1 if pixel lies outside of the binning range.
+ */
+template <class SRC, class Indexer, class PixProcessor>
+void inline bin_pixels_range(const Indexer& indexer, SRC const* const coord_ptr, size_t i_start, size_t i_end,
+    PixProcessor&& process_pixel)
+{
+    mxInt64 block_idx[PIX_BLOCK_SIZE];
+    for (size_t i0 = i_start; i0 < i_end; i0 += PIX_BLOCK_SIZE) {
+        size_t n_pix = std::min(PIX_BLOCK_SIZE, i_end - i0);
+        indexer(coord_ptr, i0, n_pix, block_idx);
+        for (size_t ib = 0; ib < n_pix; ib++) {
+            process_pixel(i0 + ib, block_idx[ib]);
+        }
+    }
+};
+
+/* update pixels accumulators using position of the pixel in the image array
  *  Inputs:
- * pix_coord_ptr    -- pointer to the array pixels coordinates
- * pix_in_pix_pos   -- position of the pixel in 2D pixel data array, represented as 1D array with pixels coordinates changing first
- * qi               -- 4-element array of pixels coordinates in target coordinate system
- * pax              -- 0 to 4 elements array defining projection axes
- * cut_range        -- 8-element array of cut ranges (min_q1,max_q1,min_q2,max_q2.... )
- * bin_step         -- size(pax) array of bin steps in every binned direction
- * bin_cell_idx_range
- *                  -- size(pax) array of maximal allowed pixel indices in every binned direction.
- * stride           -- size(pax) array of indices strides in each binning direction (e.g. change in the position
- *                     of pixel in 1D representation of multidimensional array, if index in one direction changes by one
+ * pix              -- page of pixels to bin
+ * i                -- number of the pixel in the page
+ * il               -- index of the image cell pixel belongs to
  * Accumulators:
  * npix             -- number of pixels contributing into given cell of image
  * s                -- accumulated signal per image cell
  * e                -- accumulated error per image cell
  */
-template <class SRC>
-size_t inline add_pix_to_accumulators(const SRC* pix_coord_ptr, size_t pix_in_pix_pos,
-    const std::vector<double>& qi, const std::vector<size_t>& pax,
-    const std::vector<double>& cut_range, const std::vector<double>& bin_step,
-    const std::vector<size_t>& bin_cell_idx_range, const std::vector<size_t>& stride,
+template <class SRC, class PIX>
+void inline add_pix_to_accumulators(const PIX& pix, size_t i, size_t il,
     span<double>& npix, span<double>& s, span<double>& e)
 {
-    // calculate location of pixel within the image grid
-    auto il = pix_position(qi, pax, cut_range, bin_step, bin_cell_idx_range, stride);
     // calculate npix accumulators
     npix[il]++;
     // calculate signal and error accumulators
-    s[il] += (double)pix_coord_ptr[pix_in_pix_pos + pix_flds::iSign];
-    e[il] += (double)pix_coord_ptr[pix_in_pix_pos + pix_flds::iErr];
+    s[il] += (double)pix(i, pix_flds::iSign);
+    e[il] += (double)pix(i, pix_flds::iErr);
+};
+// number of pixels in a tile of the sorted pixels array used by sort_pixels_tiled. The tile of double precision
+// pixels occupies ~1Mb and fits the L2 cache of a modern processor, and the position of a pixel within a tile fits uint16_t
+constexpr size_t SORT_TILE_SIZE = size_t(1) << 14;
+
+/* Copy pixels retained by binning into their positions within the array of pixels sorted by bins.
+ * The image cells of the pixels are calculated again rather than stored during binning, so no scratch array
+ * proportional to the number of input pixels is necessary. Pixels are first radix-partitioned into tiles of
+ * SORT_TILE_SIZE consecutive positions of the sorted array, which keeps memory writes sequential, and then moved
+ * into their final positions within each tile, which happens within processor cache. The order of the pixels
+ * within each bin is the order of these pixels in the input array.
+ * Inputs:
+ * indexer        -- calculator of image cells indices used for binning
+ * coord_ptr      -- pointer to pixel coordinates to bin
+ * pix            -- page of pixels to sort
+ * bin_par_ptr    -- binning parameters
+ * check_pix_selection -- if true, drop pixels marked as already selected (negative detector id)
+ * n_pix_retained -- number of pixels retained by binning
+ * Input/Output:
+ * bin_start      -- position of the first pixel of every bin in sorted array. Points to the end of every bin on output
+ * Output:
+ * sorted_pix_ptr -- pointer to the array of n_pix_retained sorted pixels
+ */
+template <class SRC, class TRG, class Indexer, class PIX>
+void sort_pixels_tiled(const Indexer& indexer, SRC const* const coord_ptr, const PIX& pix,
+    BinningArg* const bin_par_ptr, bool check_pix_selection, size_t n_pix_retained,
+    std::vector<size_t>& bin_start, TRG* const sorted_pix_ptr)
+{
+    size_t data_size = bin_par_ptr->n_data_points;
+    bool align_result = bin_par_ptr->alignment_matrix.size() == 9;
+    bool keep_unique_id = bin_par_ptr->binMode == opModes::sort_and_uid;
 
-    return il;
+    // copy pixel i into position targ_pos of the sorted array
+    auto place_pixel = [&](size_t i, size_t targ_pos) {
+        size_t targ_pix_pos;
+        if (align_result) {
+            // align q-coordinates and copy all other pixel data into the location requested
+            targ_pix_pos = align_and_copy_pixels<SRC, TRG>(bin_par_ptr->alignment_matrix, pix, i, sorted_pix_ptr, targ_pos);
+        } else {
+            targ_pix_pos = copy_pixels<SRC, TRG>(pix, i, sorted_pix_ptr, targ_pos); // copy all pixel data into the location requested
+        }
+        if (keep_unique_id) {
+            bin_par_ptr->unique_runID.insert(uint32_t(sorted_pix_ptr[targ_pix_pos + pix_flds::irun]));
+        }
+    };
+    size_t n_tiles = (n_pix_retained + SORT_TILE_SIZE - 1) / SORT_TILE_SIZE;
+    if (n_tiles < 2) {
+        // sorted array fits single tile, so pixels are placed directly
+        bin_pixels_range<SRC>(indexer, coord_ptr, 0, data_size, [&](size_t i, mxInt64 il) {
+            if (il < 0 || (check_pix_selection && pix(i, pix_flds::idet) < 0))
+                return;
+            place_pixel(i, bin_start[il]++);
+        });
+        return;
+    }
+    // next free position within every tile
+    std::vector<size_t> tile_fill(n_tiles);
+    for (size_t nt = 0; nt < n_tiles; nt++) {
+        tile_fill[nt] = nt * SORT_TILE_SIZE;
+    }
+    // final positions of partitioned pixels within their tiles
+    std::vector<uint16_t> tile_pix_pos(n_pix_retained);
+    bin_pixels_range<SRC>(indexer, coord_ptr, 0, data_size, [&](size_t i, mxInt64 il) {
+        if (il < 0 || (check_pix_selection && pix(i, pix_flds::idet) < 0))
+            return;
+        size_t cell_pix_ind = bin_start[il]++; // final position of the pixel
+        size_t part_pos = tile_fill[cell_pix_ind / SORT_TILE_SIZE]++; // position of the pixel after partitioning
+        tile_pix_pos[part_pos] = uint16_t(cell_pix_ind % SORT_TILE_SIZE);
+        place_pixel(i, part_pos);
+    });
+    // move pixels into their final positions within every tile
+    const size_t PIX_WIDTH = pix_flds::PIX_WIDTH;
+    int n_threads = int(std::min(size_t(bin_par_ptr->num_threads), n_tiles));
+#pragma omp parallel if (n_threads > 1) num_threads(n_threads)
+    {
+        std::vector<TRG> tile_buf(SORT_TILE_SIZE * PIX_WIDTH);
+#pragma omp for schedule(dynamic)
+        for (long nt = 0; nt < (long)n_tiles; nt++) {
+            size_t tile_start = size_t(nt) * SORT_TILE_SIZE;
+            size_t n_tile_pix = std::min(SORT_TILE_SIZE, n_pix_retained - tile_start);
+            TRG* const tile_ptr = sorted_pix_ptr + tile_start * PIX_WIDTH;
+            std::copy(tile_ptr, tile_ptr + n_tile_pix * PIX_WIDTH, tile_buf.begin());
+            for (size_t k = 0; k < n_tile_pix; k++) {
+                auto pix_ptr = tile_buf.begin() + k * PIX_WIDTH;
+                std::copy(pix_ptr, pix_ptr + PIX_WIDTH, tile_ptr + tile_pix_pos[tile_start + k] * PIX_WIDTH);
+            }
+        }
+    }
 };
 // copy selected pixels from original array to the target array, containing only selected pixels
 // pixels are not sorted and array of indices which correspond to pixels positions according
 // to image is returned instead
-template <class SRC, class TRG>
-void inline copy_resiults_to_final_arrays(BinningArg* const bin_par_ptr, const SRC* const pix_coord_ptr,
+template <class SRC, class TRG, class PIX>
+void inline copy_resiults_to_final_arrays(BinningArg* const bin_par_ptr, const PIX& pix,
     size_t data_size, size_t nPixel_retained, std::vector<mxInt64>& pix_ok_bin_idx)
 {
     // allocate memory for pixels to retain.
@@ -138,10 +289,10 @@ void inline copy_resiults_to_final_arrays(BinningArg* const bin_par_ptr, const S
 
         if (align_result) {
             // align q-coordinates and copy all other pixel data into the location requested
-            targ_pix_array_pos = align_and_copy_pixels<SRC, TRG>(bin_par_ptr->alignment_matrix, pix_coord_ptr, i, selected_pix_ptr, targ_pix_pos);
+            targ_pix_array_pos = align_and_copy_pixels<SRC, TRG>(bin_par_ptr->alignment_matrix, pix, i, selected_pix_ptr, targ_pix_pos);
         } else {
             // copy all pixel data into the location requested
-            targ_pix_array_pos = copy_pixels<SRC, TRG>(pix_coord_ptr, i, selected_pix_ptr, targ_pix_pos);
+            targ_pix_array_pos = copy_pixels<SRC, TRG>(pix, i, selected_pix_ptr, targ_pix_pos);
         }
         // search for unique run_id;
         bin_par_ptr->unique_runID.insert(uint32_t(selected_pix_ptr[targ_pix_array_pos + pix_flds::irun]));
@@ -150,6 +301,23 @@ void inline copy_resiults_to_final_arrays(BinningArg* const bin_par_ptr, const S
     }
 };
 
+/* Return view of the page of pixels to bin, containing signal, error and other pixel data.
+ * The view is empty if pixel data are not provided or provided as cellarray of values to bin
+ * in opModes::sigerr_cell mode */
+template <class SRC>
+pix_page_view<SRC> get_pix_to_bin(const BinningArg* const bin_par_ptr)
+{
+    pix_page_view<SRC> pix;
+    if (bin_par_ptr->all_pix_ptr && bin_par_ptr->n_Cells_to_bin == 0) {
+        auto err = get_pix_page_view<SRC>(bin_par_ptr->all_pix_ptr, pix);
+        if (err.empty() && pix.size() < bin_par_ptr->n_data_points)
+            err = "Pixels page contains fewer pixels than the number of pixel coordinates to bin";
+        if (!err.empty())
+            mexErrMsgIdAndTxt("HORACE:bin_pixels_c:invalid_argument", err.c_str());
+    }
+    return pix;
+};
+
 /** Procedure calculates positions of the input pixels coordinates within specified
  *   image box and various other values related to distributions of pixels over the image
  *   bins, including signal per image box, error per image box and distribution of pixels
@@ -163,8 +331,8 @@ void inline copy_resiults_to_final_arrays(BinningArg* const bin_par_ptr, const S
  * bin_par_ptr -- constant pointer to BinningArg class, containing input parameters which describe binning
  *                and output values calculated in some binning modes.
  */
-template <class SRC, class TRG>
-size_t bin_pixels(span<double>& npix, span<double>& s, span<double>& e, BinningArg* const bin_par_ptr)
+template <class SRC, class TRG, size_t NDIMS, size_t COORD_STRIDE, class PIX>
+size_t bin_pixels(span<double>& npix, span<double>& s, span<double>& e, BinningArg* const bin_par_ptr, const PIX& pix)
 {
     // numbers of bins in the grid
     auto distribution_size = bin_par_ptr->n_grid_points();
@@ -173,22 +341,12 @@ size_t bin_pixels(span<double>& npix, span<double>& s, span<double>& e, BinningA
     auto opMode = bin_par_ptr->binMode;
 
     SRC const* const coord_ptr = reinterpret_cast<SRC*>(mxGetPr(bin_par_ptr->coord_ptr));
-    SRC const* pix_coord_ptr(nullptr);
-    if (bin_par_ptr->all_pix_ptr) {
-        pix_coord_ptr = reinterpret_cast<SRC*>(mxGetPr(bin_par_ptr->all_pix_ptr));
-    }
-    auto COORD_STRIDE = bin_par_ptr->in_coord_width;
-    auto PIX_STRIDE = bin_par_ptr->in_pix_width;
 
     // internal loop variables (firstprivate)
     size_t nPixel_retained(0), nCellOccupied(0);
 
-    std::vector<double> qi(COORD_STRIDE);
-    std::vector<double> cut_range = bin_par_ptr->data_range;
-    std::vector<double> bin_step = bin_par_ptr->bin_step;
-    std::vector<size_t> pax = bin_par_ptr->pax; // projection axis
-    std::vector<size_t> stride = bin_par_ptr->stride;
-    std::vector<size_t> bin_cell_idx_range = bin_par_ptr->bin_cell_idx_range;
+    // calculator of the image cells indices, pixels belong to
+    pix_bin_indexer<SRC, NDIMS, COORD_STRIDE> indexer(bin_par_ptr);
 
     // initialize space for calculating pixel data ranges if necessary
     span<double> pix_ranges;
@@ -197,39 +355,34 @@ size_t bin_pixels(span<double>& npix, span<double>& s, span<double>& e, BinningA
         pix_ranges = span<double>(mxGetPr(bin_par_ptr->pix_data_range_ptr), pix_range_ids);
         init_min_max_range_calc(pix_ranges, pix_flds::PIX_WIDTH);
     }
-    bool check_pix_selection = bin_par_ptr->check_pix_selection && (pix_coord_ptr != nullptr);
+    bool check_pix_selection = bin_par_ptr->check_pix_selection && !pix.empty();
     auto bin_mode = bin_par_ptr->binMode;
 
-    long data_size = bin_par_ptr->n_data_points;
+    size_t data_size = bin_par_ptr->n_data_points;
     switch (bin_mode) {
     case (opModes::npix_only): {
-        for (long i = 0; i < data_size; i++) {
+        bin_pixels_range<SRC>(indexer, coord_ptr, 0, data_size, [&](size_t /*i*/, mxInt64 il) {
             // drop out coordinates outside of the binning range
-            if (out_of_ranges<SRC>(coord_ptr, i, COORD_STRIDE, cut_range, qi))
-                continue;
+            if (il < 0)
+                return;
             nPixel_retained++;
-
-            // calculate location of pixel within the image grid
-            size_t il = pix_position(qi, pax, cut_range, bin_step, bin_cell_idx_range, stride);
             npix[il]++;
-        }
+        });
         break;
     }
     case (opModes::sig_err): {
-        for (long i = 0; i < data_size; i++) {
+        bin_pixels_range<SRC>(indexer, coord_ptr, 0, data_size, [&](size_t i, mxInt64 il) {
             // drop out coordinates outside of the binning range
-            if (out_of_ranges<SRC>(coord_ptr, i, COORD_STRIDE, cut_range, qi))
-                continue;
+            if (il < 0)
+                return;
             // drop out already selected pixels, if requested
-            size_t ip0 = i * PIX_STRIDE;
-            if (check_pix_selection && pix_coord_ptr[ip0 + pix_flds::idet] < 0)
-                continue;
+            if (check_pix_selection && pix(i, pix_flds::idet) < 0)
+                return;
             nPixel_retained++;
 
-            // calculate location of pixel within the image grid and add values of this pixels to the accumulators
-            add_pix_to_accumulators<SRC>(pix_coord_ptr, ip0, qi, pax, cut_range, bin_step, bin_cell_idx_range, stride,
-                npix, s, e);
-        }
+            // add values of this pixels to the accumulators
+            add_pix_to_accumulators<SRC>(pix, i, il, npix, s, e);
+        });
         break;
     }
     case (opModes::sigerr_cell): {
@@ -248,15 +401,12 @@ size_t bin_pixels(span<double>& npix, span<double>& s, span<double>& e, BinningA
             cell_data_ptr[i] = mxGetPr(cell_array_ptr);
         }
 
-        for (long i = 0; i < data_size; i++) {
+        bin_pixels_range<SRC>(indexer, coord_ptr, 0, data_size, [&](size_t i, mxInt64 il) {
             // drop out coordinates outside of the binning range
-            if (out_of_ranges<SRC>(coord_ptr, i, COORD_STRIDE, cut_range, qi))
-                continue;
+            if (il < 0)
+                return;
             nPixel_retained++;
 
-            // calculate location of pixel within the image grid
-            size_t il = pix_position(qi, pax, cut_range, bin_step, bin_cell_idx_range, stride);
-
             if (npix_acc_separate) {
                 // calculate npix accumulators separately if their value is not provided as input
                 npix[il]++;
@@ -268,40 +418,33 @@ size_t bin_pixels(span<double>& npix, span<double>& s, span<double>& e, BinningA
                 auto data_ptr = cell_data_ptr[j];
                 acc_ptr[il] += data_ptr[i];
             }
-        }
+        });
         break;
     }
     case (opModes::sort_pix):
     case (opModes::sort_and_uid): {
-        std::vector<mxInt64> pix_ok_bin_idx;
-        pix_ok_bin_idx.swap(bin_par_ptr->pix_ok_bin_idx);
         std::vector<size_t> npix1;
         npix1.swap(bin_par_ptr->npix1);
-        for (long i = 0; i < data_size; i++) {
+        bin_pixels_range<SRC>(indexer, coord_ptr, 0, data_size, [&](size_t i, mxInt64 il) {
             // drop out coordinates outside of the binning range
-            if (out_of_ranges<SRC>(coord_ptr, i, COORD_STRIDE, cut_range, qi))
-                continue;
+            if (il < 0)
+                return;
             // drop out already selected pixels, if requested
-            size_t ip0 = i * PIX_STRIDE;
-            if (check_pix_selection && pix_coord_ptr[ip0 + pix_flds::idet] < 0)
-                continue;
+            if (check_pix_selection && pix(i, pix_flds::idet) < 0)
+                return;
             nPixel_retained++;
 
-            // calculate location of pixel within the image grid and add values of this pixels to the accumulators
+            // add values of this pixels to the accumulators
             // It is almost like add_pixels_to_accumulators but npix1 instead of npix and types of these arrays are different
-            // calculate location of pixel within the image grid
-            size_t il = pix_position(qi, pax, cut_range, bin_step, bin_cell_idx_range, stride);
             // calculate npix accumulators for single page of pixels
             npix1[il]++;
             // calculate signal and error accumulators
             // calculate signal and error accumulators taken from current pixel
-            s[il] += (double)pix_coord_ptr[ip0 + pix_flds::iSign];
-            e[il] += (double)pix_coord_ptr[ip0 + pix_flds::iErr];
-            // store indices of contributing pixels
-            pix_ok_bin_idx[i] = il;
+            s[il] += (double)pix(i, pix_flds::iSign);
+            e[il] += (double)pix(i, pix_flds::iErr);
             // calculate pix ranges
-            calc_pix_ranges<SRC>(pix_ranges, pix_coord_ptr, PIX_STRIDE, i);
-        }
+            calc_pix_ranges<SRC>(pix_ranges, pix, i);
+        });
         // allocate memory for pixels to retain.
         TRG* sorted_pix_ptr(nullptr); // pointer to the actual data position.
         bin_par_ptr->pix_ok_ptr = allocate_pix_memory<TRG>(pix_flds::PIX_WIDTH, nPixel_retained, sorted_pix_ptr);
@@ -316,28 +459,10 @@ size_t bin_pixels(span<double>& npix, span<double>& s, span<double>& e, BinningA
                 npix[i] += npix1[i]; // increase multi-call accumulators
             }
         }
-        bool align_result = bin_par_ptr->alignment_matrix.size() == 9;
-        size_t targ_pix_pos(0);
-        bool keep_unique_id = bin_par_ptr->binMode == opModes::sort_and_uid;
         // actually sort pixels and copy selected pixels into proper locations within the target array
-        for (size_t i = 0; i < data_size; i++) {
-            if (pix_ok_bin_idx[i] < 0) // drop pixels with have not been included above
-                continue;
-
-            size_t il = (size_t)pix_ok_bin_idx[i]; // number of cell pixel should go to
-            auto cell_pix_ind = bin_start[il]++; // pixel position within the array defined by cell
-            if (align_result) {
-                // align q-coordinates and copy all other pixel data into the location requested
-                targ_pix_pos = align_and_copy_pixels<SRC, TRG>(bin_par_ptr->alignment_matrix, pix_coord_ptr, i, sorted_pix_ptr, cell_pix_ind);
-            } else {
-                targ_pix_pos = copy_pixels<SRC, TRG>(pix_coord_ptr, i, sorted_pix_ptr, cell_pix_ind); // copy all pixel data into the location requested
-            }
-            if (keep_unique_id) {
-                bin_par_ptr->unique_runID.insert(uint32_t(sorted_pix_ptr[targ_pix_pos + pix_flds::irun]));
-            }
-        }
+        sort_pixels_tiled<SRC, TRG>(indexer, coord_ptr, pix, bin_par_ptr, check_pix_selection,
+            nPixel_retained, bin_start, sorted_pix_ptr);
         // swap memory of working arrays back to binning_arguments to retain it for the next call
-        bin_par_ptr->pix_ok_bin_idx.swap(pix_ok_bin_idx);
         bin_par_ptr->npix_bin_start.swap(bin_start);
         bin_par_ptr->npix1.swap(npix1);
         break;
@@ -346,26 +471,24 @@ size_t bin_pixels(span<double>& npix, span<double>& s, span<double>& e, BinningA
         std::vector<mxInt64> pix_ok_bin_idx;
         pix_ok_bin_idx.swap(bin_par_ptr->pix_ok_bin_idx);
 
-        for (long i = 0; i < data_size; i++) {
+        bin_pixels_range<SRC>(indexer, coord_ptr, 0, data_size, [&](size_t i, mxInt64 il) {
             // drop out coordinates outside of the binning range
-            if (out_of_ranges<SRC>(coord_ptr, i, COORD_STRIDE, cut_range, qi))
-                continue;
+            if (il < 0)
+                return;
 
             // drop out already selected pixels, if requested
-            size_t ip0 = i * PIX_STRIDE;
-            if (check_pix_selection && pix_coord_ptr[ip0 + pix_flds::idet] < 0)
-                continue;
+            if (check_pix_selection && pix(i, pix_flds::idet) < 0)
+                return;
             nPixel_retained++;
 
-            // calculate location of pixel within the image grid and add values of this pixels to the accumulators
-            auto il = add_pix_to_accumulators<SRC>(pix_coord_ptr, ip0, qi, pax, cut_range, bin_step, bin_cell_idx_range, stride,
-                npix, s, e);
+            // add values of this pixels to the accumulators
+            add_pix_to_accumulators<SRC>(pix, i, il, npix, s, e);
 
             // store indices of contributing pixels
             pix_ok_bin_idx[i] = il;
             // calculate pix ranges
-            calc_pix_ranges<SRC>(pix_ranges, pix_coord_ptr, PIX_STRIDE, i);
-        }
+            calc_pix_ranges<SRC>(pix_ranges, pix, i);
+        });
         // allocate memory for pixels to retain.
         TRG* selected_pix_ptr(nullptr); // pointer to the actual data position.
         bin_par_ptr->pix_ok_ptr = allocate_pix_memory<TRG>(pix_flds::PIX_WIDTH, nPixel_retained, selected_pix_ptr);
@@ -373,7 +496,7 @@ size_t bin_pixels(span<double>& npix, span<double>& s, span<double>& e, BinningA
         mxInt64 * pix_img_idx_ptr(nullptr);
         bin_par_ptr->pix_img_idx_ptr = allocate_pix_memory<mxInt64>(nPixel_retained, 1, pix_img_idx_ptr);
         span<mxInt64> pix_img_idx(pix_img_idx_ptr, nPixel_retained);
-        copy_resiults_to_final_arrays<SRC, TRG>(bin_par_ptr, pix_coord_ptr,
+        copy_resiults_to_final_arrays<SRC, TRG>(bin_par_ptr, pix,
             data_size, nPixel_retained, pix_ok_bin_idx);
         // swap memory of working arrays back to binning_arguments to retain it for the next call
         bin_par_ptr->pix_ok_bin_idx.swap(pix_ok_bin_idx);
@@ -393,37 +516,35 @@ size_t bin_pixels(span<double>& npix, span<double>& s, span<double>& e, BinningA
         bin_par_ptr->is_pix_selected_ptr = allocate_pix_memory<mxLogical>(1, data_size, is_pix_selected_ptr);
         is_pix_selected = span<mxLogical>(is_pix_selected_ptr, data_size);
 
-        for (long i = 0; i < data_size; i++) {
+        bin_pixels_range<SRC>(indexer, coord_ptr, 0, data_size, [&](size_t i, mxInt64 il) {
             // drop out coordinates outside of the binning range
-            if (out_of_ranges<SRC>(coord_ptr, i, COORD_STRIDE, cut_range, qi)) {
+            if (il < 0) {
                 is_pix_selected[i] = false;
-                continue;
+                return;
             } else {
                 is_pix_selected[i] = true;
             }
 
             // drop out already selected pixels, if requested
-            size_t ip0 = i * PIX_STRIDE;
-            if (check_pix_selection && pix_coord_ptr[ip0 + pix_flds::idet] < 0) {
+            if (check_pix_selection && pix(i, pix_flds::idet) < 0) {
                 is_pix_selected[i] = false;
-                continue;
+                return;
             }
 
             nPixel_retained++;
 
-            // calculate location of pixel within the image grid and add values of this pixels to the accumulators
-            auto il = add_pix_to_accumulators<SRC>(pix_coord_ptr, ip0, qi, pax, cut_range, bin_step, bin_cell_idx_range, stride,
-                npix, s, e);
+            // add values of this pixels to the accumulators
+            add_pix_to_accumulators<SRC>(pix, i, il, npix, s, e);
             if (!return_selected_only) {
                 pix_ok_bin_idx[i] = il;
                 // calculate pix ranges
-                calc_pix_ranges<SRC>(pix_ranges, pix_coord_ptr, PIX_STRIDE, i);
+                calc_pix_ranges<SRC>(pix_ranges, pix, i);
             }
-        }
+        });
         if (return_selected_only) {
             break;
         }
-        copy_resiults_to_final_arrays<SRC, TRG>(bin_par_ptr, pix_coord_ptr,
+        copy_resiults_to_final_arrays<SRC, TRG>(bin_par_ptr, pix,
             data_size, nPixel_retained, pix_ok_bin_idx);
         // swap memory of working arrays back to binning_arguments to retain it for the next call
         bin_par_ptr->pix_ok_bin_idx.swap(pix_ok_bin_idx);
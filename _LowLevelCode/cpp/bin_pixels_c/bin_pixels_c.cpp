@@ -1,4 +1,4 @@
-#include "bin_pixels.h"
+#include "bin_pixels_omp.h"
 #include <random>
 
 
@@ -15,6 +15,41 @@ static ::uint32_t CODE_SIGNATURE(0x7D58CDE3);
 // holder of the pointer to the instance of the binning arguments used in the previous call to the mex function.
 static std::unique_ptr<class_handle<BinningArg>> bin_par_ptr;
 
+/* select binning routine instantiated for the number of pixel coordinates and the number of projection axes
+ * of the current binning, so the binning loops work with compile-time sized arrays */
+template <class SRC, class TRG, size_t COORD_STRIDE>
+size_t bin_pixels_by_ndims(span<double>& npix, span<double>& s, span<double>& e, BinningArg* const bin_arg_ptr)
+{
+    switch (bin_arg_ptr->pax.size()) {
+    case (0):
+        return bin_pixels_page<SRC, TRG, 0, COORD_STRIDE>(npix, s, e, bin_arg_ptr);
+    case (1):
+        return bin_pixels_page<SRC, TRG, 1, COORD_STRIDE>(npix, s, e, bin_arg_ptr);
+    case (2):
+        return bin_pixels_page<SRC, TRG, 2, COORD_STRIDE>(npix, s, e, bin_arg_ptr);
+    case (3):
+        return bin_pixels_page<SRC, TRG, 3, COORD_STRIDE>(npix, s, e, bin_arg_ptr);
+    }
+    if constexpr (COORD_STRIDE == 4) {
+        if (bin_arg_ptr->pax.size() == 4)
+            return bin_pixels_page<SRC, TRG, 4, COORD_STRIDE>(npix, s, e, bin_arg_ptr);
+    }
+    std::stringstream buf;
+    buf << "Can not bin " << (short)bin_arg_ptr->in_coord_width << " pixel coordinates over "
+        << (short)bin_arg_ptr->pax.size() << " projection axes";
+    mexErrMsgIdAndTxt("HORACE:bin_pixels_c:invalid_argument", buf.str().c_str());
+    return 0;
+};
+template <class SRC, class TRG>
+size_t bin_pixels_by_dims(span<double>& npix, span<double>& s, span<double>& e, BinningArg* const bin_arg_ptr)
+{
+    if (bin_arg_ptr->in_coord_width == 3) {
+        return bin_pixels_by_ndims<SRC, TRG, 3>(npix, s, e, bin_arg_ptr);
+    } else {
+        return bin_pixels_by_ndims<SRC, TRG, 4>(npix, s, e, bin_arg_ptr);
+    }
+};
+
 void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[])
 {
     // identify special input requests (e.g. version or clear mex from memory) 
@@ -71,15 +106,15 @@ void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[])
         size_t num_pixels_retained(0);
         switch (transfType) {
         case (InOutTransf::InCrd8OutPix8): {
-            num_pixels_retained = bin_pixels<double, double>(npix, signal, error, bin_par_ptr->class_ptr);
+            num_pixels_retained = bin_pixels_by_dims<double, double>(npix, signal, error, bin_par_ptr->class_ptr);
             break;
         }
         case (InOutTransf::InCrd4OutPix8): {
-            num_pixels_retained = bin_pixels<float,double>(npix, signal, error, bin_par_ptr->class_ptr);
+            num_pixels_retained = bin_pixels_by_dims<float, double>(npix, signal, error, bin_par_ptr->class_ptr);
             break;
         }
         case (InOutTransf::InCrd4OutPix4): {
-            num_pixels_retained = bin_pixels<float,float>(npix, signal, error, bin_par_ptr->class_ptr);
+            num_pixels_retained = bin_pixels_by_dims<float, float>(npix, signal, error, bin_par_ptr->class_ptr);
             break;
         }
         }
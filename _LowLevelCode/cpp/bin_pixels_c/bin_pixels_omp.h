@@ -0,0 +1,424 @@
+#pragma once
+#include "bin_pixels.h"
+/*  Multithreaded version of the bin_pixels routine.
+ *
+ * The array of pixels is split into contiguous chunks, one chunk per thread. Binning is performed in two stages.
+ * First, every thread calculates the image cell indices of the pixels from its chunk together with private
+ * (per-chunk) distribution of pixels over the image cells. Then the private distributions are converted into
+ * per-chunk cell offsets (parallel counting sort) and each thread places its pixels exactly where the serial
+ * algorithm would place them. Signal and error accumulators are finally summed over the image cells, with each
+ * thread processing its range of cells and adding the pixels contributions in the order these pixels are stored
+ * in the input array. This keeps the results bit-identical to the results of the serial bin_pixels routine.
+ *
+ * In sorting modes the image cells of the pixels are not stored after the first stage but calculated again
+ * while pixels are placed into the sorted array.
+ *
+ * If the memory necessary for private distributions becomes too large (large image grids), only the first stage
+ * is performed in parallel and accumulation of signal and error is performed serially. Sorting modes are processed
+ * by the serial routine in this case.
+ */
+
+// minimal number of pixels, which is worth processing in a separate thread
+constexpr size_t OMP_MIN_PIX_PER_THREAD = 16384;
+// number of elements of private pixel distributions which may be allocated for multithreaded binning regardless
+// of the number of pixels to bin. Above this value, private distributions should not exceed the number of pixels.
+constexpr size_t OMP_MIN_PRIVATE_HIST_SIZE = size_t(1) << 22;
+
+// first pixel of the chunk nChunk, when data_size pixels are split into n_chunks chunks
+inline size_t chunk_start(size_t data_size, size_t n_chunks, size_t nChunk)
+{
+    return (data_size * nChunk) / n_chunks;
+};
+
+/* Calculate indices of image cells for all pixels from the input pixels array in parallel.
+ * Inputs:
+ * coord_ptr     -- pointer to pixel coordinates to bin
+ * pix           -- page of pixels data (may be empty)
+ * bin_par_ptr   -- binning parameters
+ * n_chunks      -- number of chunks to split pixels into
+ * check_pix_sel -- if true, drop pixels marked as already selected (negative detector id)
+ * Outputs (optional and ignored if empty or null):
+ * pix_bin_idx   -- array of cell indices of all pixels. -1 for pixels, which have not been retained
+ * is_pix_selected -- logical array of pixels retained by binning
+ * chunk_npix    -- n_chunks*distribution_size array of private distributions of pixels over bins
+ * npix          -- if no other distribution is requested, npix accumulator updated atomically
+ * chunk_ranges  -- n_chunks*2*PIX_WIDTH array of ranges of retained pixels, calculated over each chunk
+ * chunk_retained-- number of pixels retained by each chunk
+ */
+template <class SRC, size_t NDIMS, size_t COORD_STRIDE, class PIX>
+void calc_pix_bin_indices_omp(SRC const* const coord_ptr, const PIX& pix, BinningArg* const bin_par_ptr,
+    size_t n_chunks, bool check_pix_sel,
+    mxInt64* const pix_bin_idx, mxLogical* const is_pix_selected, std::vector<size_t>& chunk_npix, double* const npix,
+    std::vector<double>& chunk_ranges, std::vector<size_t>& chunk_retained)
+{
+    size_t data_size = bin_par_ptr->n_data_points;
+    auto distribution_size = bin_par_ptr->n_grid_points();
+
+    bool calc_ranges = chunk_ranges.size() > 0;
+    bool private_distr = chunk_npix.size() > 0;
+    bool atomic_npix = !private_distr && pix_bin_idx == nullptr && npix != nullptr;
+    const size_t range_width = 2 * pix_flds::PIX_WIDTH;
+    const pix_bin_indexer<SRC, NDIMS, COORD_STRIDE> indexer(bin_par_ptr);
+
+#pragma omp parallel for schedule(static, 1) num_threads(int(n_chunks))
+    for (long nc = 0; nc < (long)n_chunks; nc++) {
+        span<double> pix_ranges;
+        if (calc_ranges) {
+            pix_ranges = span<double>(chunk_ranges.data() + nc * range_width, range_width);
+            init_min_max_range_calc(pix_ranges, pix_flds::PIX_WIDTH);
+        }
+        size_t* const npix_chunk = private_distr ? chunk_npix.data() + nc * distribution_size : nullptr;
+
+        size_t n_retained(0);
+        size_t i_start = chunk_start(data_size, n_chunks, nc);
+        size_t i_end = chunk_start(data_size, n_chunks, nc + 1);
+        bin_pixels_range<SRC>(indexer, coord_ptr, i_start, i_end, [&](size_t i, mxInt64 il) {
+            // drop out coordinates outside of the binning range and already selected pixels, if requested
+            if (il < 0 || (check_pix_sel && pix(i, pix_flds::idet) < 0)) {
+                if (pix_bin_idx)
+                    pix_bin_idx[i] = -1;
+                if (is_pix_selected)
+                    is_pix_selected[i] = false;
+                return;
+            }
+            if (is_pix_selected)
+                is_pix_selected[i] = true;
+            n_retained++;
+
+            if (pix_bin_idx)
+                pix_bin_idx[i] = il;
+            if (private_distr) {
+                npix_chunk[il]++;
+            } else if (atomic_npix) {
+                // additions of integer values are exact so the result does not depend on the order of additions
+#pragma omp atomic
+                npix[il] += 1.;
+            }
+            if (calc_ranges)
+                calc_pix_ranges<SRC>(pix_ranges, pix, i);
+        });
+        chunk_retained[nc] = n_retained;
+    }
+};
+
+/* Convert private distributions of pixels over bins into positions of the first pixel of every chunk in every bin
+ *  of the array of pixels sorted by bins.
+ * Input/Output:
+ * chunk_npix  -- n_chunks*distribution_size array of private distributions on input.
+ *                Contains positions of first pixel of each chunk within each bin on output.
+ * Outputs:
+ * npix1       -- distribution_size array containing number of pixels in every bin.
+ * bin_start   -- distribution_size array containing position of first pixel of every bin in sorted array.
+ */
+inline void calc_chunk_bin_offsets(std::vector<size_t>& chunk_npix, size_t n_chunks, size_t distribution_size,
+    std::vector<size_t>& npix1, std::vector<size_t>& bin_start)
+{
+#pragma omp parallel for num_threads(int(n_chunks))
+    for (long ib = 0; ib < (long)distribution_size; ib++) {
+        size_t running(0);
+        for (size_t nc = 0; nc < n_chunks; nc++) {
+            auto n_pix = chunk_npix[nc * distribution_size + ib];
+            chunk_npix[nc * distribution_size + ib] = running;
+            running += n_pix;
+        }
+        npix1[ib] = running;
+    }
+    bin_start[0] = 0;
+    for (size_t ib = 1; ib < distribution_size; ib++) {
+        bin_start[ib] = bin_start[ib - 1] + npix1[ib - 1];
+    }
+#pragma omp parallel for num_threads(int(n_chunks))
+    for (long ib = 0; ib < (long)distribution_size; ib++) {
+        for (size_t nc = 0; nc < n_chunks; nc++) {
+            chunk_npix[nc * distribution_size + ib] += bin_start[ib];
+        }
+    }
+};
+
+/* Copy pixels retained by binning into the target array preserving their initial order and return
+ *  indices of image cells these pixels belong to. Multithreaded version of copy_resiults_to_final_arrays.
+ */
+template <class SRC, class TRG, class PIX>
+void copy_results_to_final_arrays_omp(BinningArg* const bin_par_ptr, const PIX& pix,
+    size_t n_chunks, size_t nPixel_retained, const std::vector<size_t>& chunk_retained, mxInt64 const* const pix_bin_idx)
+{
+    size_t data_size = bin_par_ptr->n_data_points;
+    TRG* selected_pix_ptr(nullptr);
+    bin_par_ptr->pix_ok_ptr = allocate_pix_memory<TRG>(pix_flds::PIX_WIDTH, nPixel_retained, selected_pix_ptr);
+    mxInt64* pix_img_idx_ptr(nullptr);
+    bin_par_ptr->pix_img_idx_ptr = allocate_pix_memory<mxInt64>(nPixel_retained, 1, pix_img_idx_ptr);
+
+    bool align_result = bin_par_ptr->alignment_matrix.size() == 9;
+    std::vector<size_t> chunk_targ_start(n_chunks, 0);
+    for (size_t nc = 1; nc < n_chunks; nc++) {
+        chunk_targ_start[nc] = chunk_targ_start[nc - 1] + chunk_retained[nc - 1];
+    }
+    std::vector<std::unordered_set<uint32_t>> chunk_runID(n_chunks);
+
+#pragma omp parallel for schedule(static, 1) num_threads(int(n_chunks))
+    for (long nc = 0; nc < (long)n_chunks; nc++) {
+        size_t targ_pix_pos = chunk_targ_start[nc];
+        size_t targ_pix_array_pos(0);
+        auto& unique_runID = chunk_runID[nc];
+        size_t i_end = chunk_start(data_size, n_chunks, nc + 1);
+        for (size_t i = chunk_start(data_size, n_chunks, nc); i < i_end; i++) {
+            if (pix_bin_idx[i] < 0)
+                continue;
+            pix_img_idx_ptr[targ_pix_pos] = pix_bin_idx[i] + 1; // MATLB indices start from 1 and these -- from 0
+            if (align_result) {
+                targ_pix_array_pos = align_and_copy_pixels<SRC, TRG>(bin_par_ptr->alignment_matrix, pix, i, selected_pix_ptr, targ_pix_pos);
+            } else {
+                targ_pix_array_pos = copy_pixels<SRC, TRG>(pix, i, selected_pix_ptr, targ_pix_pos);
+            }
+            unique_runID.insert(uint32_t(selected_pix_ptr[targ_pix_array_pos + pix_flds::irun]));
+            targ_pix_pos++;
+        }
+    }
+    for (auto& unique_runID : chunk_runID) {
+        bin_par_ptr->unique_runID.insert(unique_runID.begin(), unique_runID.end());
+    }
+};
+
+/** Multithreaded version of bin_pixels routine. Produces results bit-identical to the results
+ *  of the serial bin_pixels routine and falls back to the serial routine if the number of pixels
+ *  to bin is too small for parallel processing.
+ * Results:
+ * npix        -- 1D representation of multidimensional array of pixel distributions over bins
+ * s           -- 1D representation of multidimensional array of signal in bins
+ * err         -- 1D representation of multidimensional array of error in bins
+ * Input-Output parameter:
+ * bin_par_ptr -- constant pointer to BinningArg class, containing input parameters which describe binning
+ *                and output values calculated in some binning modes.
+ */
+template <class SRC, class TRG, size_t NDIMS, size_t COORD_STRIDE, class PIX>
+size_t bin_pixels_omp(span<double>& npix, span<double>& s, span<double>& e, BinningArg* const bin_par_ptr, const PIX& pix)
+{
+    size_t data_size = bin_par_ptr->n_data_points;
+    size_t n_chunks = std::min(size_t(bin_par_ptr->num_threads), data_size / OMP_MIN_PIX_PER_THREAD);
+    auto bin_mode = bin_par_ptr->binMode;
+    if (n_chunks < 2 || bin_mode < opModes::npix_only || bin_mode > opModes::siger_selected) {
+        return bin_pixels<SRC, TRG, NDIMS, COORD_STRIDE>(npix, s, e, bin_par_ptr, pix);
+    }
+    // number of threads is set for each parallel region to not change the number of threads used by other mex files
+    const int n_threads = int(n_chunks);
+
+    auto distribution_size = bin_par_ptr->n_grid_points();
+    // identify if private distributions of pixels over bins can be used. Reduce number of chunks
+    // if private distributions for all threads would require too much memory
+    size_t private_distr_size = std::max(data_size, OMP_MIN_PRIVATE_HIST_SIZE);
+    size_t n_distr_chunks = std::min(n_chunks, private_distr_size / distribution_size);
+    bool private_distr = n_distr_chunks > 1;
+    if (private_distr) {
+        n_chunks = n_distr_chunks;
+    }
+    bool sort_pixels = bin_mode == opModes::sort_pix || bin_mode == opModes::sort_and_uid;
+    if (sort_pixels && !private_distr) {
+        // the grid is too large for parallel sorting. Serial sorting does not store image cells of all pixels
+        return bin_pixels<SRC, TRG, NDIMS, COORD_STRIDE>(npix, s, e, bin_par_ptr, pix);
+    }
+
+    SRC const* const coord_ptr = reinterpret_cast<SRC*>(mxGetPr(bin_par_ptr->coord_ptr));
+    // serial algorithm does not check pixel selection in these modes
+    bool check_pix_sel = bin_par_ptr->check_pix_selection && !pix.empty()
+        && bin_mode != opModes::npix_only && bin_mode != opModes::sigerr_cell;
+
+    // initialize space for calculating pixel data ranges if necessary
+    span<double> pix_ranges;
+    std::vector<double> chunk_ranges;
+    auto pix_range_ids = (bin_par_ptr->pix_data_range_ptr == nullptr) ? 0 : 2 * pix_flds::PIX_WIDTH;
+    if (bin_mode > opModes::sigerr_cell && pix_range_ids > 0 && bin_mode < opModes::siger_selected) {
+        pix_ranges = span<double>(mxGetPr(bin_par_ptr->pix_data_range_ptr), pix_range_ids);
+        init_min_max_range_calc(pix_ranges, pix_flds::PIX_WIDTH);
+        chunk_ranges.resize(n_chunks * pix_range_ids);
+    }
+    // logical array of selected pixels
+    mxLogical* is_pix_selected_ptr(nullptr);
+    if (bin_mode == opModes::nosort_sel || bin_mode == opModes::siger_selected) {
+        bin_par_ptr->is_pix_selected_ptr = allocate_pix_memory<mxLogical>(1, data_size, is_pix_selected_ptr);
+    }
+    // indices of image cells for every pixel. Not necessary if only pixel distribution is calculated
+    // and not stored for sorting, where they are recalculated when pixels are sorted
+    std::vector<mxInt64> pix_ok_bin_idx;
+    mxInt64* pix_bin_idx(nullptr);
+    if (bin_mode != opModes::npix_only && !sort_pixels) {
+        pix_ok_bin_idx.swap(bin_par_ptr->pix_ok_bin_idx);
+        if (pix_ok_bin_idx.size() < data_size) {
+            pix_ok_bin_idx.resize(data_size);
+        }
+        pix_bin_idx = pix_ok_bin_idx.data();
+    }
+    std::vector<size_t> chunk_npix;
+    chunk_npix.swap(bin_par_ptr->chunk_bin_offsets);
+    if (private_distr) {
+        chunk_npix.assign(n_chunks * distribution_size, 0);
+    } else {
+        chunk_npix.clear();
+    }
+    std::vector<size_t> chunk_retained(n_chunks, 0);
+
+    //---------------------------------------------------------------------------------------------
+    // Stage 1: identify pixels retained by binning and their positions within the image grid
+    calc_pix_bin_indices_omp<SRC, NDIMS, COORD_STRIDE>(coord_ptr, pix, bin_par_ptr, n_chunks, check_pix_sel,
+        pix_bin_idx, is_pix_selected_ptr, chunk_npix, npix.data(), chunk_ranges, chunk_retained);
+
+    size_t nPixel_retained(0);
+    for (size_t nc = 0; nc < n_chunks; nc++) {
+        nPixel_retained += chunk_retained[nc];
+        if (pix_ranges.size() > 0) {
+            for (size_t j = 0; j < pix_flds::PIX_WIDTH; j++) {
+                pix_ranges[2 * j] = std::min(pix_ranges[2 * j], chunk_ranges[nc * pix_range_ids + 2 * j]);
+                pix_ranges[2 * j + 1] = std::max(pix_ranges[2 * j + 1], chunk_ranges[nc * pix_range_ids + 2 * j + 1]);
+            }
+        }
+    }
+    //---------------------------------------------------------------------------------------------
+    // Stage 2: accumulate signal and error and sort pixels if requested
+    std::vector<size_t> npix1, bin_start;
+    npix1.swap(bin_par_ptr->npix1);
+    bin_start.swap(bin_par_ptr->npix_bin_start);
+    if (private_distr) {
+        npix1.resize(distribution_size);
+        bin_start.resize(distribution_size);
+        calc_chunk_bin_offsets(chunk_npix, n_chunks, distribution_size, npix1, bin_start);
+    }
+
+    if (bin_mode == opModes::npix_only) {
+        if (private_distr) {
+#pragma omp parallel for num_threads(n_threads)
+            for (long ib = 0; ib < (long)distribution_size; ib++) {
+                npix[ib] += double(npix1[ib]);
+            }
+        } // otherwise npix have been already calculated using atomic operations
+    } else if (sort_pixels) {
+        TRG* sorted_pix_ptr(nullptr); // pointer to the actual data position.
+        bin_par_ptr->pix_ok_ptr = allocate_pix_memory<TRG>(pix_flds::PIX_WIDTH, nPixel_retained, sorted_pix_ptr);
+        bool align_result = bin_par_ptr->alignment_matrix.size() == 9;
+        bool keep_unique_id = bin_mode == opModes::sort_and_uid;
+        const pix_bin_indexer<SRC, NDIMS, COORD_STRIDE> indexer(bin_par_ptr);
+        // sort pixels in parallel using positions of first pixel of every chunk within every bin
+        std::vector<std::unordered_set<uint32_t>> chunk_runID(n_chunks);
+#pragma omp parallel for schedule(static, 1) num_threads(int(n_chunks))
+        for (long nc = 0; nc < (long)n_chunks; nc++) {
+            size_t* const bin_pos = chunk_npix.data() + nc * distribution_size;
+            auto& unique_runID = chunk_runID[nc];
+            size_t targ_pix_pos(0);
+            size_t i_start = chunk_start(data_size, n_chunks, nc);
+            size_t i_end = chunk_start(data_size, n_chunks, nc + 1);
+            bin_pixels_range<SRC>(indexer, coord_ptr, i_start, i_end, [&](size_t i, mxInt64 il) {
+                if (il < 0 || (check_pix_sel && pix(i, pix_flds::idet) < 0))
+                    return;
+                auto cell_pix_ind = bin_pos[il]++;
+                if (align_result) {
+                    targ_pix_pos = align_and_copy_pixels<SRC, TRG>(bin_par_ptr->alignment_matrix, pix, i, sorted_pix_ptr, cell_pix_ind);
+                } else {
+                    targ_pix_pos = copy_pixels<SRC, TRG>(pix, i, sorted_pix_ptr, cell_pix_ind);
+                }
+                if (keep_unique_id) {
+                    unique_runID.insert(uint32_t(sorted_pix_ptr[targ_pix_pos + pix_flds::irun]));
+                }
+            });
+        }
+        for (auto& unique_runID : chunk_runID) {
+            bin_par_ptr->unique_runID.insert(unique_runID.begin(), unique_runID.end());
+        }
+        // pixels of every bin are now located in the order of the input array, so signal and error
+        // are accumulated in the same order as in the serial algorithm
+#pragma omp parallel for num_threads(n_threads)
+        for (long ib = 0; ib < (long)distribution_size; ib++) {
+            npix[ib] += npix1[ib];
+            size_t pix_end = bin_start[ib] + npix1[ib];
+            for (size_t ip = bin_start[ib]; ip < pix_end; ip++) {
+                s[ib] += (double)sorted_pix_ptr[ip * pix_flds::PIX_WIDTH + pix_flds::iSign];
+                e[ib] += (double)sorted_pix_ptr[ip * pix_flds::PIX_WIDTH + pix_flds::iErr];
+            }
+        }
+    } else {
+        // modes which accumulate signal and error (or cell data) without sorting pixels
+        std::vector<double*> accum_ptr;
+        std::vector<const double*> cell_data_ptr;
+        bool npix_acc_separate(true);
+        if (bin_mode == opModes::sigerr_cell) {
+            auto n_cells_to_bin = bin_par_ptr->n_Cells_to_bin;
+            npix_acc_separate = n_cells_to_bin < 3;
+            accum_ptr = { s.data(), e.data(), npix.data() };
+            accum_ptr.resize(n_cells_to_bin);
+            for (size_t j = 0; j < n_cells_to_bin; j++) {
+                cell_data_ptr.push_back(mxGetPr(mxGetCell(bin_par_ptr->all_pix_ptr, j)));
+            }
+        }
+        if (private_distr) {
+            // sort indices of retained pixels by bins
+            std::vector<size_t> pix_order;
+            pix_order.swap(bin_par_ptr->pix_bin_order);
+            pix_order.resize(nPixel_retained);
+#pragma omp parallel for schedule(static, 1) num_threads(int(n_chunks))
+            for (long nc = 0; nc < (long)n_chunks; nc++) {
+                size_t* const bin_pos = chunk_npix.data() + nc * distribution_size;
+                size_t i_end = chunk_start(data_size, n_chunks, nc + 1);
+                for (size_t i = chunk_start(data_size, n_chunks, nc); i < i_end; i++) {
+                    if (pix_bin_idx[i] < 0)
+                        continue;
+                    pix_order[bin_pos[pix_bin_idx[i]]++] = i;
+                }
+            }
+#pragma omp parallel for num_threads(n_threads)
+            for (long ib = 0; ib < (long)distribution_size; ib++) {
+                if (npix_acc_separate) {
+                    npix[ib] += npix1[ib];
+                }
+                size_t pix_end = bin_start[ib] + npix1[ib];
+                for (size_t ip = bin_start[ib]; ip < pix_end; ip++) {
+                    size_t i = pix_order[ip];
+                    if (bin_mode == opModes::sigerr_cell) {
+                        for (size_t j = 0; j < cell_data_ptr.size(); j++) {
+                            accum_ptr[j][ib] += cell_data_ptr[j][i];
+                        }
+                    } else {
+                        s[ib] += (double)pix(i, pix_flds::iSign);
+                        e[ib] += (double)pix(i, pix_flds::iErr);
+                    }
+                }
+            }
+            bin_par_ptr->pix_bin_order.swap(pix_order);
+        } else {
+            for (size_t i = 0; i < data_size; i++) {
+                if (pix_bin_idx[i] < 0)
+                    continue;
+                size_t il = (size_t)pix_bin_idx[i];
+                if (npix_acc_separate) {
+                    npix[il]++;
+                }
+                if (bin_mode == opModes::sigerr_cell) {
+                    for (size_t j = 0; j < cell_data_ptr.size(); j++) {
+                        accum_ptr[j][il] += cell_data_ptr[j][i];
+                    }
+                } else {
+                    s[il] += (double)pix(i, pix_flds::iSign);
+                    e[il] += (double)pix(i, pix_flds::iErr);
+                }
+            }
+        }
+        if (bin_mode == opModes::nosort || bin_mode == opModes::nosort_sel) {
+            copy_results_to_final_arrays_omp<SRC, TRG>(bin_par_ptr, pix, n_chunks, nPixel_retained,
+                chunk_retained, pix_bin_idx);
+        }
+    }
+    // swap memory of working arrays back to binning_arguments to retain it for the next call
+    bin_par_ptr->npix1.swap(npix1);
+    bin_par_ptr->npix_bin_start.swap(bin_start);
+    bin_par_ptr->chunk_bin_offsets.swap(chunk_npix);
+    if (pix_bin_idx) {
+        bin_par_ptr->pix_ok_bin_idx.swap(pix_ok_bin_idx);
+    }
+    return nPixel_retained;
+}
+/* Bin pixels of the page provided by MATLAB. Interleaved pages are binned by the routines instantiated for
+ * pix_interleaved_view, so pixel fields are addressed with the fixed stride of the 9xN array */
+template <class SRC, class TRG, size_t NDIMS, size_t COORD_STRIDE>
+size_t bin_pixels_page(span<double>& npix, span<double>& s, span<double>& e, BinningArg* const bin_par_ptr)
+{
+    auto pix = get_pix_to_bin<SRC>(bin_par_ptr);
+    return with_pix_layout(pix, [&](const auto& page) {
+        return bin_pixels_omp<SRC, TRG, NDIMS, COORD_STRIDE>(npix, s, e, bin_par_ptr, page);
+    });
+};
@@ -0,0 +1,203 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <type_traits>
+#include <mex.h>
+/* Vectorized kernels, which identify image cells pixels belong to.
+ *
+ * Kernels process blocks of pixels with coordinates provided in 3 or 4 rows MATLAB arrays (COORD_STRIDE), binned
+ * along 0 to 4 projection axes (NDIMS), and calculate the linear index of the image cell, every pixel belongs to,
+ * or -1 if pixel lies outside of the binning range. Both numbers are template parameters, so all loops over
+ * coordinates and axes have compile-time bounds.
+ * The calculations are performed in double precision using the same sequence of floating point
+ * operations as the scalar pix_position routine, so the results are identical to the scalar results.
+ *
+ * AVX2 and AVX-512 kernels are compiled for x86-64 platforms only and selected at runtime depending on the
+ * capabilities of the processor. Other platforms use scalar code.
+ */
+#if defined(__x86_64__) || defined(_M_X64)
+#define HORACE_X86_SIMD
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define HORACE_TARGET_AVX2
+#define HORACE_TARGET_AVX512
+#else
+#define HORACE_TARGET_AVX2 __attribute__((target("avx2")))
+#define HORACE_TARGET_AVX512 __attribute__((target("avx512f,avx2")))
+#endif
+#endif
+
+// vector instructions set used by binning kernels
+enum SimdLevel {
+    simd_scalar = 0, // no vector instructions, scalar code
+    simd_avx2 = 1, // 4 pixels per iteration
+    simd_avx512 = 2 // 8 pixels per iteration
+};
+
+// identify the most advanced instruction set supported by current processor and operating system
+inline SimdLevel detect_simd_level()
+{
+#if defined(HORACE_X86_SIMD)
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return simd_scalar;
+    __cpuid(info, 1);
+    bool os_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)); // OSXSAVE & AVX
+    if (!os_avx)
+        return simd_scalar;
+    auto xcr0 = _xgetbv(0);
+    if ((xcr0 & 0x6) != 0x6) // XMM and YMM states are enabled by OS
+        return simd_scalar;
+    __cpuidex(info, 7, 0);
+    if ((info[1] & (1 << 16)) && (xcr0 & 0xE0) == 0xE0) // AVX512F and ZMM states enabled
+        return simd_avx512;
+    if (info[1] & (1 << 5)) // AVX2
+        return simd_avx2;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return simd_avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return simd_avx2;
+#endif
+#endif
+    return simd_scalar;
+};
+// return instruction set to use in binning kernels. Detected once on first call
+inline SimdLevel get_simd_level()
+{
+    static const SimdLevel level = detect_simd_level();
+    return level;
+};
+
+// parameters of the binning grid in the form of fixed size arrays, used by scalar and vectorized kernels
+struct pix_bin_geometry {
+    std::array<double, 8> cut_range; // min/max pairs of ranges in all coordinate directions
+    std::array<size_t, 4> pax; // projection axes
+    std::array<double, 4> bin_step; // inverse bin sizes along projection axes
+    std::array<size_t, 4> bin_cell_idx_range; // maximal cell index along projection axes
+    std::array<size_t, 4> stride; // linear index increment per cell along projection axes
+    std::array<double, 4> max_cell; // bin_cell_idx_range converted to double for vectorized kernels
+    std::array<double, 4> cell_stride; // stride converted to double for vectorized kernels
+};
+
+#if defined(HORACE_X86_SIMD)
+/* AVX2 kernel. Calculates indices of image cells for n_pix pixels, starting from pixel pointed by coord_ptr
+ * and returns number of pixels processed, which is multiple of 4. Remaining pixels should be processed by scalar code.
+ * Cell indices must be smaller than 2^52, which is always true for any reasonable image grid.
+ */
+template <class SRC, size_t NDIMS, size_t COORD_STRIDE>
+HORACE_TARGET_AVX2 size_t calc_bin_idx_avx2(const pix_bin_geometry& geom, SRC const* const coord_ptr, size_t n_pix, mxInt64* const idx)
+{
+    constexpr int CS = int(COORD_STRIDE);
+    const __m128i lane_offset = _mm_setr_epi32(0, CS, 2 * CS, 3 * CS);
+    // 2^52 added to the exact integer in double representation places this integer into mantissa bits
+    const __m256d magic = _mm256_set1_pd(4503599627370496.0);
+    const __m256i magic_bits = _mm256_castpd_si256(magic);
+
+    __m256d q_min[4], q_max[4], step[4], max_cell[4], stride[4];
+    for (size_t k = 0; k < COORD_STRIDE; k++) {
+        q_min[k] = _mm256_set1_pd(geom.cut_range[2 * k]);
+        q_max[k] = _mm256_set1_pd(geom.cut_range[2 * k + 1]);
+    }
+    for (size_t j = 0; j < NDIMS; j++) {
+        step[j] = _mm256_set1_pd(geom.bin_step[j]);
+        max_cell[j] = _mm256_set1_pd(geom.max_cell[j]);
+        stride[j] = _mm256_set1_pd(geom.cell_stride[j]);
+    }
+
+    size_t n_vec = n_pix - n_pix % 4;
+    __m256d q[4];
+    for (size_t i = 0; i < n_vec; i += 4) {
+        SRC const* const base = coord_ptr + i * CS;
+        __m256d out = _mm256_setzero_pd();
+        for (size_t k = 0; k < COORD_STRIDE; k++) {
+            if constexpr (std::is_same_v<SRC, float>) {
+                q[k] = _mm256_cvtps_pd(_mm_i32gather_ps(base + k, lane_offset, 4));
+            } else {
+                q[k] = _mm256_i32gather_pd(base + k, lane_offset, 8);
+            }
+            out = _mm256_or_pd(out, _mm256_cmp_pd(q[k], q_min[k], _CMP_LT_OQ));
+            out = _mm256_or_pd(out, _mm256_cmp_pd(q[k], q_max[k], _CMP_GT_OQ));
+        }
+        if (_mm256_movemask_pd(out) == 0xF) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(idx + i), _mm256_set1_epi64x(-1));
+            continue;
+        }
+        __m256d il = _mm256_setzero_pd();
+        for (size_t j = 0; j < NDIMS; j++) {
+            auto k = geom.pax[j];
+            __m256d cell = _mm256_floor_pd(_mm256_mul_pd(_mm256_sub_pd(q[k], q_min[k]), step[j]));
+            // NaN cell index is replaced by max_cell, similarly to scalar conversion of NaN into size_t
+            cell = _mm256_min_pd(cell, max_cell[j]);
+            il = _mm256_add_pd(il, _mm256_mul_pd(cell, stride[j]));
+        }
+        __m256i il_int = _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(il, magic)), magic_bits);
+        // out-of-range lanes contain all bits set, i.e. -1
+        il_int = _mm256_or_si256(il_int, _mm256_castpd_si256(out));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(idx + i), il_int);
+    }
+    return n_vec;
+};
+
+/* AVX-512 kernel. Calculates indices of image cells for n_pix pixels, starting from pixel pointed by coord_ptr
+ * and returns number of pixels processed, which is multiple of 8. Remaining pixels should be processed by scalar code.
+ */
+template <class SRC, size_t NDIMS, size_t COORD_STRIDE>
+HORACE_TARGET_AVX512 size_t calc_bin_idx_avx512(const pix_bin_geometry& geom, SRC const* const coord_ptr, size_t n_pix, mxInt64* const idx)
+{
+    constexpr int CS = int(COORD_STRIDE);
+    const __m256i lane_offset = _mm256_setr_epi32(0, CS, 2 * CS, 3 * CS, 4 * CS, 5 * CS, 6 * CS, 7 * CS);
+    const __m512d magic = _mm512_set1_pd(4503599627370496.0);
+    const __m512i magic_bits = _mm512_castpd_si512(magic);
+    const __m512i all_bits = _mm512_set1_epi64(-1);
+
+    __m512d q_min[4], q_max[4], step[4], max_cell[4], stride[4];
+    for (size_t k = 0; k < COORD_STRIDE; k++) {
+        q_min[k] = _mm512_set1_pd(geom.cut_range[2 * k]);
+        q_max[k] = _mm512_set1_pd(geom.cut_range[2 * k + 1]);
+    }
+    for (size_t j = 0; j < NDIMS; j++) {
+        step[j] = _mm512_set1_pd(geom.bin_step[j]);
+        max_cell[j] = _mm512_set1_pd(geom.max_cell[j]);
+        stride[j] = _mm512_set1_pd(geom.cell_stride[j]);
+    }
+
+    size_t n_vec = n_pix - n_pix % 8;
+    __m512d q[4];
+    for (size_t i = 0; i < n_vec; i += 8) {
+        SRC const* const base = coord_ptr + i * CS;
+        __mmask8 out = 0;
+        for (size_t k = 0; k < COORD_STRIDE; k++) {
+            if constexpr (std::is_same_v<SRC, float>) {
+                q[k] = _mm512_cvtps_pd(_mm256_i32gather_ps(base + k, lane_offset, 4));
+            } else {
+                q[k] = _mm512_i32gather_pd(lane_offset, base + k, 8);
+            }
+            out |= _mm512_cmp_pd_mask(q[k], q_min[k], _CMP_LT_OQ);
+            out |= _mm512_cmp_pd_mask(q[k], q_max[k], _CMP_GT_OQ);
+        }
+        if (out == 0xFF) {
+            _mm512_storeu_si512(idx + i, all_bits);
+            continue;
+        }
+        __m512d il = _mm512_setzero_pd();
+        for (size_t j = 0; j < NDIMS; j++) {
+            auto k = geom.pax[j];
+            __m512d cell = _mm512_roundscale_pd(_mm512_mul_pd(_mm512_sub_pd(q[k], q_min[k]), step[j]),
+                _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+            cell = _mm512_min_pd(cell, max_cell[j]);
+            il = _mm512_add_pd(il, _mm512_mul_pd(cell, stride[j]));
+        }
+        __m512i il_int = _mm512_sub_epi64(_mm512_castpd_si512(_mm512_add_pd(il, magic)), magic_bits);
+        il_int = _mm512_mask_blend_epi64(out, il_int, all_bits);
+        _mm512_storeu_si512(idx + i, il_int);
+    }
+    return n_vec;
+};
+#endif
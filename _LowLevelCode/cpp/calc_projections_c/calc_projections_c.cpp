@@ -2,6 +2,8 @@
 //
 #include "calc_projections_c.h"
 #include "../utility/version.h"
+#include <algorithm>
+#include <cstring>
 //
 // enumerate input parameters for easy references.
 enum inPar {
@@ -26,9 +28,11 @@ enum inPar {
 //
 // input parameters:
 // transf_matrix -- 3x3 rotational(Sp=1) matrix of transformation from device coordinates to the
-//                   crystal coordinated
+//                   crystal coordinated or 3x3xnRuns array of such matrices, one per run
 // data          -- structure with the data from experiment, has to have fields in accordance with the
 //                  enum dataStructure above; The program uses the field data.energy --an array of 1xnEnergy values
+//                  May be 1xnRuns array of structures for runs measured on the same detectors. Pixels
+//                  of all runs are calculated in one call and returned in one array in the order of the runs.
 //
 // detectors     -- structure with the data, which describes the detector positions with the field,
 //                  accordingly to enum detectorsStructure
@@ -61,6 +65,61 @@ void getMatlabVector(const mxArray *pPar, double *&pValue, size_t &NComponents,
     pValue = mxGetPr(pPar);
 };
 
+/* Retrieve the data of the run number nRun from the array of data structures and calculate the energy points
+ *  pixels of the run are calculated for */
+void get_run_data(const mxArray *pData, size_t nRun, double const * const pProj_matrix, size_t nDetectors,
+    run_projection_data &run) {
+    mxArray *maEnergy = mxGetField(pData, nRun, "en");
+    double *pEnergy = maEnergy ? (double *)mxGetPr(maEnergy) : nullptr;
+    if (pEnergy == NULL) {
+        mexErrMsgIdAndTxt("HORACE:sort_pixels_by_bins_mex:invalid_argument", 
+            "experimental data can not be empty");
+    }
+
+    mxArray *maSignal = mxGetField(pData, nRun, "S");
+    if (maSignal == NULL) {
+        mexErrMsgIdAndTxt("MEX:invalid_argument",
+            "Can not retrieve signal (S field) array from the data structure");
+    }
+    mxArray *maError = mxGetField(pData, nRun, "ERR");
+    run.pError = maError ? (double *)mxGetPr(maError) : nullptr;
+    if (run.pError == NULL) {
+        mexErrMsgIdAndTxt("MEX:invalid_argument", 
+            "Can not retrieve error (ERR field) array from the data structure");
+    }
+    run.pSignal = (double *)mxGetPr(maSignal);
+    run.pMatrix = pProj_matrix;
+    mxArray *maRunID = mxGetField(pData, nRun, "run_id");
+    if (maRunID == NULL || mxGetPr(maRunID) == NULL) {
+        mexWarnMsgIdAndTxt("MEX:invalid_argument",
+            "Can not retrieve pointer to run_id value from the data structure. Using default value (1)");
+        run.runID = 1;
+    }
+    else {
+        run.runID = *mxGetPr(maRunID);
+    }
+
+    size_t nDataPoints = mxGetN(maSignal);
+    size_t nEnShed = mxGetM(maSignal);
+    size_t nEnergies = mxGetM(maEnergy);
+
+    if (nDataPoints != nDetectors) {
+        mexErrMsgTxt("spectrum data are not consistent with the detectors data");
+    }
+    if (nEnergies == nEnShed) {     // energy is calculated on edges of energy bins
+        run.energies.assign(pEnergy, pEnergy + nEnergies);
+    }
+    else if (nEnShed + 1 == nEnergies) { // energy is calculated in centers of energy bins
+        run.energies.resize(nEnergies - 1);
+        for (size_t i = 0; i < nEnergies - 1; i++) {
+            run.energies[i] = 0.5*(pEnergy[i] + pEnergy[i + 1]);
+        }
+    }
+    else {
+        mexErrMsgTxt("Energies in data spectrum and in energy spectrum are not consistent");
+    }
+};
+
 
 
 //
@@ -68,8 +127,8 @@ void getMatlabVector(const mxArray *pPar, double *&pValue, size_t &NComponents,
 void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 {
     unsigned int nThreads(1), i;
-    size_t nDataPoints(0), nEnShed(0), nEfixed(0);
-    mwSize nDetectors, nEnergies;
+    size_t nEfixed(0);
+    mwSize nDetectors;
     double *pEfix(nullptr), k_to_e;
     urangeModes uRange_mode(urangeModes::noUrange);
 
@@ -115,7 +174,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     }
     if (!mxIsStruct(prhs[Data])) {
         mexErrMsgIdAndTxt("MEX:invalid_argument", 
-            "second argument (Data) has to be a single structure ");
+            "second argument (Data) has to be a structure or an array of structures");
     }
     if (!mxIsStruct(prhs[Detectors])) {
         mexErrMsgIdAndTxt("MEX:invalid_argument", 
@@ -123,8 +182,6 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     }
 
 
-    double *pProj_matrix = (double *)mxGetPr(prhs[Spec_to_proj]);
-    double *pEnergy = (double *)mxGetPr(mxGetField(prhs[Data], 0, "en"));
     double *pDetPhi = (double *)mxGetPr(mxGetField(prhs[Detectors], 0, "phi"));
     double *pDetPsi = (double *)mxGetPr(mxGetField(prhs[Detectors], 0, "azim"));
 
@@ -149,7 +206,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     //
     if (nrhs == NUM_IN_args) {
         int iMode = (int)getMatlabScalar<double>(prhs[uRangeMode], "proj_mode");
-        if (iMode > -1 && iMode < 3) {
+        if (iMode > -1 && iMode < 4) {
             uRange_mode = static_cast<urangeModes>(iMode);
         }
         else {
@@ -158,97 +215,40 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
         if (forceNoUrange)uRange_mode = urangeModes::noUrange;
     }
 
-    if (mxGetM(prhs[Spec_to_proj]) != 3 || mxGetN(prhs[Spec_to_proj]) != 3) {
+    // number of runs to process. Each run is described by its element of the data structures array and
+    // its 3x3 page of the projection matrices array
+    size_t nRuns = mxGetNumberOfElements(prhs[Data]);
+    if (mxGetM(prhs[Spec_to_proj]) != 3 || mxGetNumberOfElements(prhs[Spec_to_proj]) != 9 * nRuns) {
         mexErrMsgIdAndTxt("HORACE:sort_pixels_by_bins_mex:invalid_argument", 
-            "first argument (projection matrix) has to be 3x3 matrix");
-    }
-    if (pEnergy == NULL) {
-        mexErrMsgIdAndTxt("HORACE:sort_pixels_by_bins_mex:invalid_argument", 
-            "experimental data can not be empty");
-    }
-
-    mxArray *maSignal = mxGetField(prhs[Data], 0, "S");
-    if (maSignal == NULL) {
-        mexErrMsgIdAndTxt("MEX:invalid_argument",
-            "Can not retrieve signal (S field) array from the data structure");
-    }
-    double * pSignal = (double *)mxGetPr(maSignal);
-    double * pError = (double *)mxGetPr(mxGetField(prhs[Data], 0, "ERR"));
-    if (pError == NULL) {
-        mexErrMsgIdAndTxt("MEX:invalid_argument", 
-            "Can not retrieve error (ERR field) array from the data structure");
-    }
-    double *pRunID = (double *)mxGetPr(mxGetField(prhs[Data], 0, "run_id"));
-    double defaultValue(1);
-    if (pRunID == NULL) {
-        mexWarnMsgIdAndTxt("MEX:invalid_argument",
-            "Can not retrieve pointer to run_id value from the data structure. Using default value (1)");
-        pRunID = &defaultValue;
+            "first argument (projection matrix) has to be 3x3 matrix or 3x3xnRuns array of matrices for nRuns data structures");
     }
-
-
-    nDataPoints = mxGetN(maSignal);
-    nEnShed = mxGetM(maSignal);
+    double *pProj_matrix = (double *)mxGetPr(prhs[Spec_to_proj]);
 
     nDetectors = mxGetN(mxGetField(prhs[Detectors], 0, "phi"));
-    nEnergies = mxGetM(mxGetField(prhs[Data], 0, "en"));
-
-    if (nDataPoints != nDetectors) {
-        mexErrMsgTxt("spectrum data are not consistent with the detectors data");
-    }
     if (!(nEfixed == nDetectors || nEfixed == 1)) {
         mexErrMsgTxt("Efixed should be either single value or vector of nDetector's length");
     }
 
     mxArray *mapDet = mxGetField(prhs[Detectors], 0, "group");
     double * pDetGroup;
-    bool clearTmpDet(false);
+    std::vector<double> defaultDetGroup;
     if (mapDet == NULL)
     {
-        pDetGroup = new double[nDetectors];
-        clearTmpDet = true;
-        for (size_t i = 0; i < nDetectors; i++)pDetGroup[i] = double(i) + 1;
+        defaultDetGroup.resize(nDetectors);
+        for (size_t i = 0; i < nDetectors; i++)defaultDetGroup[i] = double(i) + 1;
+        pDetGroup = defaultDetGroup.data();
     }
     else
     {
         pDetGroup = (double *)mxGetPr(mapDet);
     }
 
-
-
-    mwSize nEnPoints;
-    double *pEnPoints;
-    if (nEnergies == nEnShed) {     // energy is calculated on edges of energy bins
-        nEnPoints = nEnergies;
-        pEnPoints = (double *)mxCalloc(nEnPoints, sizeof(double));
-        if (!pEnPoints) {
-            if (clearTmpDet) delete[] pDetGroup;
-            mexErrMsgTxt("error allocating memory for auxiliary energy points");
-        }
-
-        for (i = 0; i < nEnPoints; i++) {
-            pEnPoints[i] = pEnergy[i];
-        }
-
-    }
-    else if (nEnShed + 1 == nEnergies) { // energy is calculated in centers of energy bins
-        nEnPoints = nEnergies - 1;
-        pEnPoints = (double *)mxCalloc(nEnPoints, sizeof(double));
-
-        if (!pEnPoints)
-        {
-            if (clearTmpDet) delete[] pDetGroup;
-            mexErrMsgTxt("error allocating memory for auxiliary energy points");
-        }
-
-        for (i = 0; i < nEnPoints; i++) {
-            pEnPoints[i] = 0.5*(pEnergy[i] + pEnergy[i + 1]);
-        }
-
-    }
-    else {
-        if (clearTmpDet) delete[] pDetGroup;
-        mexErrMsgTxt("Energies in data spectrum and in energy spectrum are not consistent");
+    std::vector<run_projection_data> runs(nRuns);
+    size_t nPixels(0);
+    for (size_t nRun = 0; nRun < nRuns; nRun++) {
+        get_run_data(prhs[Data], nRun, pProj_matrix + 9 * nRun, nDetectors, runs[nRun]);
+        runs[nRun].pix_position = nPixels;
+        nPixels += nDetectors * runs[nRun].energies.size();
     }
 
 
@@ -271,254 +271,382 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     case urangeCoord:
     {
         pix_dims[0] = 4;
-        pix_dims[1] = nDetectors * nEnPoints;
+        pix_dims[1] = nPixels;
         plhs[1] = mxCreateNumericArray(2, pix_dims, mxDOUBLE_CLASS, mxREAL);
         break;
     }
     case urangePixels:
     {
         pix_dims[0] = pix_flds::PIX_WIDTH;
-        pix_dims[1] = nDetectors * nEnPoints;
+        pix_dims[1] = nPixels;
         plhs[1] = mxCreateNumericArray(2, pix_dims, mxDOUBLE_CLASS, mxREAL);
-
+        break;
+    }
+    case urangePixelsSingle:
+    {
+        pix_dims[0] = pix_flds::PIX_WIDTH;
+        pix_dims[1] = nPixels;
+        plhs[1] = mxCreateNumericArray(2, pix_dims, mxSINGLE_CLASS, mxREAL);
+        break;
     }
     default:
         break;
     }
     plhs[0] = mxCreateNumericArray(2, range_dims, mxDOUBLE_CLASS, mxREAL);
     if (!plhs[0]) {
-        if (clearTmpDet) delete[] pDetGroup;
         mexErrMsgTxt("Can not allocate memory for output data");
     }
 
     //
-    if (!plhs[1] && !forceNoUrange) {
-        if (clearTmpDet) delete[] pDetGroup;
+    if (!forceNoUrange && !plhs[1]) {
         mexErrMsgTxt("Can not allocate memory for output pixels data");
     }
 
     //
     double *pMinMax = (double *)mxGetPr(plhs[0]);
-    double *pTransfDet = (double *)mxGetPr(plhs[1]);
+    void *pTransfDet = forceNoUrange ? nullptr : mxGetData(plhs[1]);
     try {
-        calc_projections_emode(pMinMax, pTransfDet, *pRunID, mode, uRange_mode, pSignal, pError, pDetGroup,
-            pProj_matrix, pEnPoints, nEnPoints, pDetPhi, pDetPsi, nDetectors, pEfix, nEfixed, k_to_e, nThreads);
-        mxFree(pEnPoints);
+        if (uRange_mode == urangePixelsSingle) {
+            calc_projections_runs<float>(pMinMax, reinterpret_cast<float*>(pTransfDet), mode, uRange_mode, runs, pDetGroup,
+                pDetPhi, pDetPsi, nDetectors, pEfix, nEfixed, k_to_e, nThreads);
+        }
+        else {
+            calc_projections_runs<double>(pMinMax, reinterpret_cast<double*>(pTransfDet), mode, uRange_mode, runs, pDetGroup,
+                pDetPhi, pDetPsi, nDetectors, pEfix, nEfixed, k_to_e, nThreads);
+        }
     }
     catch (char const *err) {
-        mxFree(pEnPoints);
-        if (clearTmpDet) delete[] pDetGroup;
         mexErrMsgTxt(err);
     }
 
-    if (clearTmpDet) delete[] pDetGroup;
-
 
 }
 const double    Pi = 3.1415926535897932384626433832795028841968;
 const double    grad2rad = Pi / 180;
 
-void calc_projections_emode(double * const pMinMax,
-    double * const pTransfDetectors,
-    double runID, eMode emode, urangeModes urange_mode,
-    double const * const pSignal, double const * const pError, double const * const pDetGroup,
-    double const * const pMatrix, double const * const pEnergies, mwSize nEnergies,
-    double const * const pDetPhi, double const * const pDetPsi, mwSize nDetectors,
-    double const * const pEfix, size_t nEfixed, double k_to_e, int nThreads)
+// true if the array provided contains exactly the same values as the vector
+static bool same_values(std::vector<double> const& stored, double const* const pValues, size_t nValues)
 {
-    /********************************************************************************************************************
-    * Calculate projections in direct indirect or elastic mode;
-    * Output:
-    * pTransfDetectors[4*nDetectors*nEnergies] the matrix of 4D coordinates detectors. The coordinates are transformed  into the projections axis
-    * Inputs:
-    * pMatrix[3,3]    Matrix to convert components from the spectrometer frame to projection axes
-    * runID           The number uniquely identifying the experiment, the data are obtained from
-    * pEnergies[nEnergies]  Array of energies of arrival of detected particles
-    * pDetPhi[nDetectors]   ! -- arrays of  ... and
-    * pDetPsi[nDetectors]   ! -- azimuthal coordinates of the detectors
-    * efix      -- initial energy of the particles
-    * k_to_e    -- De-Broglie parameter to transform energy of particles into their wavelength
-    * enRange   -- how to treat energy array -- relate energies to the bin centre or to the bin edges
-    * nThreads  -- number of computational threads to start in parallel mode
-    */
-
+    if (stored.size() != nValues)
+        return false;
+    if (nValues == 0)
+        return true;
+    return std::memcmp(stored.data(), pValues, nValues * sizeof(double)) == 0;
+}
 
-    double ki(NAN), *pKf(nullptr);
-    bool singleEfixed(true);
-    if (nEfixed == 1) {
-        double efix = *pEfix;
-        ki = sqrt(efix / k_to_e);
+bool projection_tables::update(eMode emode, double const* const pDetPhi, double const* const pDetPsi, size_t nDetectors,
+    double const* const pEfix, size_t nEfixed, double const* const pEnergies, size_t nEnergies, double k_to_e)
+{
+    bool same_detectors = same_values(this->phi, pDetPhi, nDetectors) && same_values(this->psi, pDetPsi, nDetectors);
+    bool same_energies = same_detectors && emode == this->mode && k_to_e == this->k_to_e &&
+        same_values(this->efix, pEfix, nEfixed) && same_values(this->energies, pEnergies, nEnergies);
+    if (same_energies)
+        return false;
+    if (nEfixed != 1 && emode == Direct) {
+        throw(" Fixed energy per detector is supported in indirect mode only");
+    }
+
+    if (!same_detectors) {
+        this->phi.assign(pDetPhi, pDetPhi + nDetectors);
+        this->psi.assign(pDetPsi, pDetPsi + nDetectors);
+        this->ex.resize(nDetectors);
+        this->ey.resize(nDetectors);
+        this->ez.resize(nDetectors);
+        for (size_t i_det = 0; i_det < nDetectors; i_det++) {
+            //	detdcn=[cosd(det.phi); sind(det.phi).*cosd(det.azim); sind(det.phi).*sind(det.azim)];   % [3 x ndet]
+            double phi = pDetPhi[i_det] * grad2rad;
+            double psi = pDetPsi[i_det] * grad2rad;
+            double sPhi = sin(phi);
+            this->ex[i_det] = cos(phi);
+            this->ey[i_det] = sPhi * cos(psi);
+            this->ez[i_det] = sPhi * sin(psi);
+        }
+    }
+    this->mode = emode;
+    this->k_to_e = k_to_e;
+    this->efix.assign(pEfix, pEfix + nEfixed);
+    this->energies.assign(pEnergies, pEnergies + nEnergies);
+
+    this->ki = NAN;
+    this->en_k.clear();
+    this->det_k.clear();
+    if (nEfixed == 1 || emode == Elastic) {
+        double efix = nEfixed == 1 ? *pEfix : NAN;
+        this->ki = sqrt(efix / k_to_e);
         //    kf=sqrt((efix-eps)/k_to_e); % [nEnergies x 1]
-
-        pKf = (double *)mxCalloc(nEnergies, sizeof(double));
-        if (!pKf) { throw(" Can not allocate temporary memory for array of wave vectors"); }
-        //
-        for (mwSize i = 0; i < nEnergies; i++)
+        this->en_k.resize(nEnergies);
+        for (size_t i = 0; i < nEnergies; i++)
         {
             switch (emode)
             {
             case Direct:
             {
-                pKf[i] = sqrt((efix - pEnergies[i]) / k_to_e);
+                this->en_k[i] = sqrt((efix - pEnergies[i]) / k_to_e);
                 break;
             }
             case Indirect:
             {
-                pKf[i] = sqrt((efix + pEnergies[i]) / k_to_e);
+                this->en_k[i] = sqrt((efix + pEnergies[i]) / k_to_e);
                 break;
             }
             case Elastic:
             {
                 // in this case, energies array should contain wavelength
-                pKf[i] = 2 * Pi / (pEnergies[i]);
+                this->en_k[i] = 2 * Pi / (pEnergies[i]);
                 break;
             }
             }
         }
     }
-    else {
-        singleEfixed = false;
+    if (nEfixed != 1) {
+        this->det_k.resize(nEfixed);
+        for (size_t i_det = 0; i_det < nEfixed; i_det++)
+            this->det_k[i_det] = sqrt(pEfix[i_det] / k_to_e);
     }
+    return true;
+}
 
-    omp_set_num_threads(nThreads);
-    std::vector<double> qe_min, qe_max;
-    qe_min.assign(pix_flds::PIX_WIDTH * nThreads, FLT_MAX);
-    qe_max.assign(pix_flds::PIX_WIDTH * nThreads, -FLT_MAX);
+void calc_projections_emode(double * const pMinMax,
+    double * const pTransfDetectors,
+    double runID, eMode emode, urangeModes urange_mode,
+    double const * const pSignal, double const * const pError, double const * const pDetGroup,
+    double const * const pMatrix, double const * const pEnergies, mwSize nEnergies,
+    double const * const pDetPhi, double const * const pDetPsi, mwSize nDetectors,
+    double const * const pEfix, size_t nEfixed, double k_to_e, int nThreads)
+{
+    std::vector<run_projection_data> runs(1);
+    runs[0].runID = runID;
+    runs[0].pSignal = pSignal;
+    runs[0].pError = pError;
+    runs[0].pMatrix = pMatrix;
+    runs[0].energies.assign(pEnergies, pEnergies + nEnergies);
+    runs[0].pix_position = 0;
+    calc_projections_runs<double>(pMinMax, pTransfDetectors, emode, urange_mode, runs, pDetGroup,
+        pDetPhi, pDetPsi, nDetectors, pEfix, nEfixed, k_to_e, nThreads);
+}
 
-    mwSize pix_width;
-    switch (urange_mode) {
-    case (urangePixels):
-    {
-        pix_width = 9;
-    }default: {
-        pix_width = 4;
+template<class TG>
+void calc_projections_runs(double * const pMinMax, TG * const pTransfDetectors,
+    eMode emode, urangeModes urange_mode, std::vector<run_projection_data> &runs, double const * const pDetGroup,
+    double const * const pDetPhi, double const * const pDetPsi, mwSize nDetectors,
+    double const * const pEfix, size_t nEfixed, double k_to_e, int nThreads)
+{
+    /********************************************************************************************************************
+    * Calculate projections in direct indirect or elastic mode for all runs provided;
+    * Output:
+    * pTransfDetectors  the matrix of 4D coordinates or pixels of all detectors for all runs. The coordinates are
+    *                   transformed into the projections axis. Pixels of every run start from the run pix_position.
+    *                   Pixels may be returned in single (TG==float) or double precision. The ranges of the pixels
+    *                   are calculated from the values stored in the output array.
+    * Inputs:
+    * runs      -- signal, errors, energies, runID and the matrix to convert components from the spectrometer
+    *              frame to projection axes for every run
+    * pDetPhi[nDetectors]   ! -- arrays of  ... and
+    * pDetPsi[nDetectors]   ! -- azimuthal coordinates of the detectors, common for all runs
+    * efix      -- initial energy of the particles
+    * k_to_e    -- De-Broglie parameter to transform energy of particles into their wavelength
+    * nThreads  -- number of computational threads to start in parallel mode
+    *
+    * All pairs of run and detector are distributed between threads together, so all runs are processed
+    * by the same team of threads.
+    */
+
+
+    // detector directions and wave vectors do not change between runs, so are calculated only when they change
+    static projection_tables tables;
+    size_t max_nEnergies(0);
+    for (auto &run : runs) {
+        tables.update(emode, pDetPhi, pDetPsi, nDetectors, pEfix, nEfixed, run.energies.data(), run.energies.size(), k_to_e);
+        run.en_k = tables.en_k;
+        max_nEnergies = std::max(max_nEnergies, run.energies.size());
     }
+    if (runs.empty()) {
+        tables.update(emode, pDetPhi, pDetPsi, nDetectors, pEfix, nEfixed, nullptr, 0, k_to_e);
     }
+    bool singleEfixed = nEfixed == 1 || emode == Elastic;
+    double ki = tables.ki;
+    double const* const pEx = tables.ex.data();
+    double const* const pEy = tables.ey.data();
+    double const* const pEz = tables.ez.data();
+    double const* const pDetK = tables.det_k.data();
+    run_projection_data const* const pRuns = runs.data();
+    long nWork = long(runs.size() * nDetectors);
+
+    omp_set_num_threads(nThreads);
+    // ranges of pixels calculated by every thread
+    std::vector<thread_pix_range> thread_ranges(nThreads);
+
 #pragma omp parallel default(none)  \
-    shared(pKf,qe_min,qe_max) \
-    firstprivate(nDetectors,nEnergies,ki,urange_mode,emode,singleEfixed, \
-            pEfix,pEnergies,k_to_e,runID,pMatrix,pDetPhi,pDetPsi,pDetGroup,\
-            pSignal,pError,pTransfDetectors) //\
+    shared(thread_ranges) \
+    firstprivate(nDetectors,nWork,max_nEnergies,ki,urange_mode,emode,singleEfixed, \
+            pRuns,pEx,pEy,pEz,pDetK,pEfix,k_to_e,pDetGroup,pTransfDetectors) //\
     //reduction(min: q1_min,q2_min,q3_min,e_min; max: q1_max,q2_max,q3_max,e_max)
     {
-#pragma omp for
-        for (long i_det = 0; i_det < nDetectors; i_det++)
+        // transformed coordinates of the pixels of a detector, calculated together for all energies
+        std::vector<double> u1(max_nEnergies), u2(max_nEnergies), u3(max_nEnergies);
+        double* const pU[3] = { u1.data(), u2.data(), u3.data() };
+        thread_pix_range& range = thread_ranges[omp_get_thread_num()];
+        double* const thread_min = range.pix_min;
+        double* const thread_max = range.pix_max;
+#pragma omp for schedule(dynamic, CALC_PROJ_DETECTORS_CHUNK)
+        for (long n_work = 0; n_work < nWork; n_work++)
         {
-            //	detdcn=[cosd(det.phi); sind(det.phi).*cosd(det.azim); sind(det.phi).*sind(det.azim)];   % [3 x ndet]
-            double phi = pDetPhi[i_det] * grad2rad;
-            double psi = pDetPsi[i_det] * grad2rad;
-            double sPhi = sin(phi);
-            double ex = cos(phi);
-            double ey = sPhi * cos(psi);
-            double ez = sPhi * sin(psi);
+            run_projection_data const& run = pRuns[n_work / nDetectors];
+            long i_det = n_work % nDetectors;
+            double const* const pKf = run.en_k.data();
+            double const* const pEnergies = run.energies.data();
+            size_t nEnergies = run.energies.size();
+            double const* const pMatrix = run.pMatrix;
+            double runID = run.runID;
+            double ex = pEx[i_det];
+            double ey = pEy[i_det];
+            double ez = pEz[i_det];
             double k_f;
             if (singleEfixed)
                 k_f = ki; // Used in indirect mode only
             else
-                k_f = sqrt(pEfix[i_det] / k_to_e);
+                k_f = pDetK[i_det];
 
             //    q(1:3,:) = repmat([ki;0;0],[1,ne*ndet]) - ...
             //        repmat(kf',[3,ndet]).*reshape(repmat(reshape(detdcn,[3,1,ndet]),[1,ne,1]),[3,ne*ndet]);
-            size_t idet_rbase = i_det * nEnergies;
-            for (size_t j_transf = 0; j_transf < nEnergies; j_transf++)
+            switch (emode) {
+            case Direct:
             {
-                double q1, q2, q3, qe[4];
-                switch (emode) {
-                case Direct:
-                {
-                    q1 = ki - ex * pKf[j_transf];
-                    q2 = -ey * pKf[j_transf];
-                    q3 = -ez * pKf[j_transf];
-                    break;
+#pragma omp simd
+                for (long j = 0; j < (long)nEnergies; j++) {
+                    double q1 = ki - ex * pKf[j];
+                    double q2 = -ey * pKf[j];
+                    double q3 = -ez * pKf[j];
+                    u1[j] = pMatrix[0] * q1 + pMatrix[3] * q2 + pMatrix[6] * q3;
+                    u2[j] = pMatrix[1] * q1 + pMatrix[4] * q2 + pMatrix[7] * q3;
+                    u3[j] = pMatrix[2] * q1 + pMatrix[5] * q2 + pMatrix[8] * q3;
                 }
-                case Indirect:
-                {
-                    if (singleEfixed)
-                        q1 = pKf[j_transf] - ex * k_f;
-                    else {
-                        double k_i = sqrt((pEfix[i_det] + pEnergies[j_transf]) / k_to_e);
-                        q1 = k_i - ex * k_f;
+                break;
+            }
+            case Indirect:
+            {
+                double q2 = -ey * k_f;
+                double q3 = -ez * k_f;
+                if (singleEfixed) {
+#pragma omp simd
+                    for (long j = 0; j < (long)nEnergies; j++) {
+                        double q1 = pKf[j] - ex * k_f;
+                        u1[j] = pMatrix[0] * q1 + pMatrix[3] * q2 + pMatrix[6] * q3;
+                        u2[j] = pMatrix[1] * q1 + pMatrix[4] * q2 + pMatrix[7] * q3;
+                        u3[j] = pMatrix[2] * q1 + pMatrix[5] * q2 + pMatrix[8] * q3;
                     }
-                    q2 = -ey * k_f;
-                    q3 = -ez * k_f;
-                    break;
-
-                }
-                case Elastic:
-                {
-                    q1 = (1 - ex) * pKf[j_transf];
-                    q2 = -ey * pKf[j_transf];
-                    q3 = -ez * pKf[j_transf];
-                    break;
                 }
+                else {
+                    double efix = pEfix[i_det];
+#pragma omp simd
+                    for (long j = 0; j < (long)nEnergies; j++) {
+                        double k_i = sqrt((efix + pEnergies[j]) / k_to_e);
+                        double q1 = k_i - ex * k_f;
+                        u1[j] = pMatrix[0] * q1 + pMatrix[3] * q2 + pMatrix[6] * q3;
+                        u2[j] = pMatrix[1] * q1 + pMatrix[4] * q2 + pMatrix[7] * q3;
+                        u3[j] = pMatrix[2] * q1 + pMatrix[5] * q2 + pMatrix[8] * q3;
+                    }
                 }
+                break;
 
-                //u(1,i)=c(1,1)*q(1,i)+c(1,2)*q(2,i)+c(1,3)*q(3,i)
-                //u(2,i)=c(2,1)*q(1,i)+c(2,2)*q(2,i)+c(2,3)*q(3,i)
-                //u(3,i)=c(3,1)*q(1,i)+c(3,2)*q(2,i)+c(3,3)*q(3,i)
-                qe[0] = pMatrix[0] * q1 + pMatrix[3] * q2 + pMatrix[6] * q3;
-                qe[1] = pMatrix[1] * q1 + pMatrix[4] * q2 + pMatrix[7] * q3;
-                qe[2] = pMatrix[2] * q1 + pMatrix[5] * q2 + pMatrix[8] * q3;
-                //q(4,:)=repmat(eps',1,ndet);
-                qe[3] = pEnergies[j_transf];
-                int n_cur = pix_flds::PIX_WIDTH * omp_get_thread_num();
-                switch (urange_mode)
-                {
-                case noUrange:
-                {
-                    for (int ike = 0; ike < 4; ike++)
-                    {
-                        // min-max values;
-                        if (qe[ike] < qe_min[n_cur + ike])qe_min[n_cur + ike] = qe[ike];
-                        if (qe[ike] > qe_max[n_cur + ike])qe_max[n_cur + ike] = qe[ike];
-                    }
-                    break;
+            }
+            case Elastic:
+            {
+#pragma omp simd
+                for (long j = 0; j < (long)nEnergies; j++) {
+                    double q1 = (1 - ex) * pKf[j];
+                    double q2 = -ey * pKf[j];
+                    double q3 = -ez * pKf[j];
+                    u1[j] = pMatrix[0] * q1 + pMatrix[3] * q2 + pMatrix[6] * q3;
+                    u2[j] = pMatrix[1] * q1 + pMatrix[4] * q2 + pMatrix[7] * q3;
+                    u3[j] = pMatrix[2] * q1 + pMatrix[5] * q2 + pMatrix[8] * q3;
                 }
-                case urangeCoord:
-                {
-                    size_t j0 = 4 * (idet_rbase + j_transf);
-                    for (int ike = 0; ike < 4; ike++)
-                    {
-                        // min-max values;
-                        if (qe[ike] < qe_min[n_cur + ike])qe_min[n_cur + ike] = qe[ike];
-                        if (qe[ike] > qe_max[n_cur + ike])qe_max[n_cur + ike] = qe[ike];
-                        pTransfDetectors[j0 + ike] = qe[ike];
-                    }
+                break;
+            }
+            }
+            //u(1,i)=c(1,1)*q(1,i)+c(1,2)*q(2,i)+c(1,3)*q(3,i)
+            //u(2,i)=c(2,1)*q(1,i)+c(2,2)*q(2,i)+c(2,3)*q(3,i)
+            //u(3,i)=c(3,1)*q(1,i)+c(3,2)*q(2,i)+c(3,3)*q(3,i)
+            //q(4,:)=repmat(eps',1,ndet);
+
+            // min-max values of the coordinates, as they are stored in the output array;
+            for (int ike = 0; ike < 3; ike++) {
+                double const* const pu = pU[ike];
+                for (size_t j = 0; j < nEnergies; j++) {
+                    double val = double(TG(pu[j]));
+                    if (val < thread_min[ike])thread_min[ike] = val;
+                    if (val > thread_max[ike])thread_max[ike] = val;
+                }
+            }
+            for (size_t j = 0; j < nEnergies; j++) {
+                double val = double(TG(pEnergies[j]));
+                if (val < thread_min[3])thread_min[3] = val;
+                if (val > thread_max[3])thread_max[3] = val;
+            }
 
-                    break;
+            size_t idet_rbase = i_det * nEnergies;
+            // position of the first pixel of the detector in the output array
+            size_t idet_pbase = run.pix_position + idet_rbase;
+            switch (urange_mode)
+            {
+            case noUrange:
+                break;
+            case urangeCoord:
+            {
+                for (size_t j_transf = 0; j_transf < nEnergies; j_transf++)
+                {
+                    size_t j0 = 4 * (idet_pbase + j_transf);
+                    pTransfDetectors[j0 + 0] = TG(u1[j_transf]);
+                    pTransfDetectors[j0 + 1] = TG(u2[j_transf]);
+                    pTransfDetectors[j0 + 2] = TG(u3[j_transf]);
+                    pTransfDetectors[j0 + 3] = TG(pEnergies[j_transf]);
                 }
-                case urangePixels:
+                break;
+            }
+            case urangePixels:
+            case urangePixelsSingle:
+            {
+                double const* const pDetSignal = run.pSignal + idet_rbase;
+                double const* const pDetError = run.pError + idet_rbase;
+                for (size_t j_transf = 0; j_transf < nEnergies; j_transf++)
                 {
-
-                    size_t j0 = pix_flds::PIX_WIDTH  * (idet_rbase + j_transf);
-                    for (int ike = 0; ike < 4; ike++)
-                    {
-                        pTransfDetectors[j0 + ike] = qe[ike];
-                    }
-
+                    size_t j0 = pix_flds::PIX_WIDTH * (idet_pbase + j_transf);
+                    pTransfDetectors[j0 + 0] = TG(u1[j_transf]);
+                    pTransfDetectors[j0 + 1] = TG(u2[j_transf]);
+                    pTransfDetectors[j0 + 2] = TG(u3[j_transf]);
+                    pTransfDetectors[j0 + 3] = TG(pEnergies[j_transf]);
                     // to be consistent with MATLAB; should be i_det+1 to be correct
-                    pTransfDetectors[j0 + 4] = runID;
+                    pTransfDetectors[j0 + 4] = TG(runID);
                     // pix(6,:)=reshape(repmat(det.group,[ne,1]),[1,ne*ndet]); % detector index
-                    pTransfDetectors[j0 + 5] = pDetGroup[i_det];
+                    pTransfDetectors[j0 + 5] = TG(pDetGroup[i_det]);
                     //pix(7,:)=reshape(repmat((1:ne)',[1,ndet]),[1,ne*ndet]); % energy bin index
-                    pTransfDetectors[j0 + 6] = double(j_transf) + 1;
+                    pTransfDetectors[j0 + 6] = TG(double(j_transf) + 1);
                     //pix(8,:)=data.S(:)';
-                    pTransfDetectors[j0 + 7] = pSignal[idet_rbase + j_transf];
+                    TG signal = TG(pDetSignal[j_transf]);
+                    pTransfDetectors[j0 + 7] = signal;
                     //pix(9,:)=((data.ERR(:)).^2)';
-                    pTransfDetectors[j0 + 8] = pError[idet_rbase + j_transf] * pError[idet_rbase + j_transf];
+                    TG err2 = TG(pDetError[j_transf] * pDetError[j_transf]);
+                    pTransfDetectors[j0 + 8] = err2;
                     // min-max values;
-                    for (int ike = 0; ike < pix_flds::PIX_WIDTH; ike++) {
-                        if (pTransfDetectors[j0 + ike] < qe_min[n_cur + ike])qe_min[n_cur + ike] = pTransfDetectors[j0 + ike];
-                        if (pTransfDetectors[j0 + ike] > qe_max[n_cur + ike])qe_max[n_cur + ike] = pTransfDetectors[j0 + ike];
-                    }
-
+                    if (signal < thread_min[7])thread_min[7] = signal;
+                    if (signal > thread_max[7])thread_max[7] = signal;
+                    if (err2 < thread_min[8])thread_min[8] = err2;
+                    if (err2 > thread_max[8])thread_max[8] = err2;
                 }
+                if (nEnergies > 0) {
+                    // ranges of run id, detector group and energy bin index
+                    double fld_min[3] = { double(TG(runID)), double(TG(pDetGroup[i_det])), 1 };
+                    double fld_max[3] = { double(TG(runID)), double(TG(pDetGroup[i_det])), double(TG(double(nEnergies))) };
+                    for (int ike = 0; ike < 3; ike++) {
+                        if (fld_min[ike] < thread_min[4 + ike])thread_min[4 + ike] = fld_min[ike];
+                        if (fld_max[ike] > thread_max[4 + ike])thread_max[4 + ike] = fld_max[ike];
+                    }
                 }
             }
+            }
         } // end omp for
 
     }  // end parallel block
-    if (pKf)mxFree(pKf);
     // mvs do not support reduction min/max Shame! Calculate single threaded here
     for (int i = 0; i < pix_flds::PIX_WIDTH; i++) {
         pMinMax[2 * i + 0] = 1.e+38;
@@ -527,13 +655,19 @@ void calc_projections_emode(double * const pMinMax,
 
     for (int ii = 0; ii < nThreads; ii++) {
         for (int ike = 0; ike < pix_flds::PIX_WIDTH; ike++) {
-            if (qe_min[pix_flds::PIX_WIDTH * ii + ike] < pMinMax[2 * ike + 0])pMinMax[2 * ike + 0] = qe_min[pix_flds::PIX_WIDTH * ii + ike];
-            if (qe_max[pix_flds::PIX_WIDTH * ii + ike] > pMinMax[2 * ike + 1])pMinMax[2 * ike + 1] = qe_max[pix_flds::PIX_WIDTH * ii + ike];
+            if (thread_ranges[ii].pix_min[ike] < pMinMax[2 * ike + 0])pMinMax[2 * ike + 0] = thread_ranges[ii].pix_min[ike];
+            if (thread_ranges[ii].pix_max[ike] > pMinMax[2 * ike + 1])pMinMax[2 * ike + 1] = thread_ranges[ii].pix_max[ike];
         }
     }
 
 }
 
+template void calc_projections_runs<double>(double* const, double* const, eMode, urangeModes,
+    std::vector<run_projection_data>&, double const* const, double const* const, double const* const, mwSize,
+    double const* const, size_t, double, int);
+template void calc_projections_runs<float>(double* const, float* const, eMode, urangeModes,
+    std::vector<run_projection_data>&, double const* const, double const* const, double const* const, mwSize,
+    double const* const, size_t, double, int);
 
 /*
 case(1)
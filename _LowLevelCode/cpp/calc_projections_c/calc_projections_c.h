@@ -17,11 +17,80 @@ enum urangeModes
 {
     noUrange,     // do not return any coordinates, output, if present will be empty
     urangeCoord,  // the the output will contain the array of 4d coordinates (4xnPixels array of transformed coordinates)
-    urangePixels  // the the output will contain the array of pixels (9xnPixels array of pixels, including
+    urangePixels,  // the the output will contain the array of pixels (9xnPixels array of pixels, including
                // where each 9-element row contains 4 transformed coordinates, experiment ID (1 here),
                // detector group number, energy bin number, pixels signal, pixels error squared)
+    urangePixelsSingle // the same as urangePixels but pixels are returned in single precision, as they are stored in sqw files
 };
 
+/* Tables of detector directions and wave vectors, which do not change between the runs obtained on the same
+ *  instrument.
+ * The tables are kept between the calls to calc_projections_c and recalculated only when the detectors,
+ * fixed energies, energy bins or conversion constants differ from the values used to calculate them.
+ */
+class projection_tables
+{
+public:
+    projection_tables() : ki(NAN), mode(Elastic), k_to_e(NAN) {}
+    /* Recalculate the tables if the parameters provided differ from the parameters the tables were calculated for.
+     *  Returns true if the tables have been recalculated */
+    bool update(eMode emode, double const* const pDetPhi, double const* const pDetPsi, size_t nDetectors,
+        double const* const pEfix, size_t nEfixed, double const* const pEnergies, size_t nEnergies, double k_to_e);
+    // detdcn=[cosd(det.phi); sind(det.phi).*cosd(det.azim); sind(det.phi).*sind(det.azim)];   % [3 x ndet]
+    std::vector<double> ex, ey, ez;
+    // ki (direct mode) or kf (indirect mode) for the single fixed energy
+    double ki;
+    // kf (direct and elastic modes) or ki (indirect mode) for every energy bin in case of the single fixed energy
+    std::vector<double> en_k;
+    // kf for every detector in the indirect mode with fixed energy per detector
+    std::vector<double> det_k;
+
+private:
+    eMode mode;
+    double k_to_e;
+    std::vector<double> phi, psi, efix, energies;
+};
+
+// number of detectors of a run given to a thread at once
+constexpr long CALC_PROJ_DETECTORS_CHUNK = 64;
+/* Data of a run, pixels of which are calculated by calc_projections */
+struct run_projection_data
+{
+    double runID;
+    // nEnergies x nDetectors arrays of signal and error
+    double const* pSignal;
+    double const* pError;
+    // matrix to convert components from the spectrometer frame to projection axes
+    double const* pMatrix;
+    // energy points to calculate pixels at
+    std::vector<double> energies;
+    // position of the first pixel of the run in the output array
+    size_t pix_position;
+    // wave vectors for every energy point, calculated by calc_projections_runs
+    std::vector<double> en_k;
+};
+
+/* Ranges of pixels found by a thread. Aligned to cache line size, so threads do not share
+ *  cache lines while updating their ranges */
+struct alignas(64) thread_pix_range
+{
+    double pix_min[pix_flds::PIX_WIDTH];
+    double pix_max[pix_flds::PIX_WIDTH];
+    thread_pix_range()
+    {
+        for (int i = 0; i < pix_flds::PIX_WIDTH; i++) {
+            pix_min[i] = FLT_MAX;
+            pix_max[i] = -FLT_MAX;
+        }
+    }
+};
+
+template<class TG>
+void calc_projections_runs(double* const /*pMinMax */, TG* const /*pTransfDetectors*/,
+    eMode /*emode*/, urangeModes /*mode */, std::vector<run_projection_data>& runs, double const* const pDetGroup,
+    double const* const pDetPhi, double const* const pDetPsi, mwSize nDetectors,
+    double const* const pEfix, size_t nEfixed, double k_to_e, int nThreads);
+
 void calc_projections_emode(double * const /*pMinMax */,
                double * const /*pTransfDetectors*/,
                double runID, eMode /*emode*/, urangeModes, /*mode */
@@ -0,0 +1,66 @@
+#include "block_reader.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+block_reader::block_reader() :fd(-1) {}
+
+block_reader::~block_reader() {
+    this->close();
+}
+
+bool block_reader::open(const std::string &file_name, bool buffered) {
+    this->close();
+#ifndef _WIN32
+    if (!buffered) {
+        this->fd = ::open(file_name.c_str(), O_RDONLY);
+        return this->is_open();
+    }
+#endif
+    if (!buffered) {
+        this->h_file.rdbuf()->pubsetbuf(0, 0);
+    }
+    this->h_file.open(file_name, std::ios::in | std::ios::binary);
+    return this->is_open();
+}
+
+void block_reader::close() {
+#ifndef _WIN32
+    if (this->fd >= 0) {
+        ::close(this->fd);
+        this->fd = -1;
+    }
+#endif
+    if (this->h_file.is_open()) {
+        this->h_file.close();
+    }
+}
+
+bool block_reader::is_open()const {
+    return this->fd >= 0 || this->h_file.is_open();
+}
+
+size_t block_reader::read(uint64_t pos, char *const buffer, size_t n_bytes) {
+#ifndef _WIN32
+    if (this->fd >= 0) {
+        size_t n_read(0);
+        while (n_read < n_bytes) { // pread may return less then requested
+            ssize_t rez = ::pread(this->fd, buffer + n_read, n_bytes - n_read, off_t(pos + n_read));
+            if (rez < 0 && errno == EINTR) {
+                continue;
+            }
+            if (rez <= 0) {
+                break;
+            }
+            n_read += size_t(rez);
+        }
+        return n_read;
+    }
+#endif
+    auto pbuf = this->h_file.rdbuf();
+    pbuf->pubseekpos(std::streamoff(pos));
+    return size_t(pbuf->sgetn(buffer, std::streamsize(n_bytes)));
+}
@@ -0,0 +1,37 @@
+#ifndef H_BLOCK_READER
+#define H_BLOCK_READER
+
+#include <string>
+#include <fstream>
+#include <cstdint>
+
+//-----------------------------------------------------------------------------------------------------------------
+/* Class provides positioned reads of blocks of data from a binary file.
+
+   On POSIX systems unbuffered blocks are read by pread, which does not use a file position shared between
+   read requests, so reads of all files, executed by io_thread_pool, proceed concurrently without seeking
+   and copying data through stream buffers. Buffered reads and reads on other systems use std::ifstream.
+*/
+class block_reader {
+public:
+    block_reader();
+    ~block_reader();
+    block_reader(const block_reader &) = delete;
+    block_reader &operator=(const block_reader &) = delete;
+
+    /* open file for reading. If buffered is true, the file is read through the system stream buffer,
+       which is beneficial for small consecutive reads */
+    bool open(const std::string &file_name, bool buffered = false);
+    void close();
+    bool is_open()const;
+    /* true if blocks are read by positioned reads, so the reader may be used by several threads concurrently */
+    bool is_shareable()const { return this->fd >= 0; }
+    /* read n_bytes from the position pos of the file into the buffer provided.
+       Returns the number of bytes read, which is smaller than n_bytes at the end of file or on error */
+    size_t read(uint64_t pos, char *const buffer, size_t n_bytes);
+private:
+    std::ifstream h_file;
+    int fd; // file descriptor used by pread or -1 if the stream is used
+};
+
+#endif
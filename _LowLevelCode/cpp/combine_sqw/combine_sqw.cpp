@@ -2,6 +2,7 @@
 #include "combine_sqw.h"
 #include "nsqw_pix_reader.h"
 #include "sqw_pix_writer.h"
+#include "block_reader.h"
 #include <utility/version.h>
 #include "../file_parameters/fileParameters.h"
 
@@ -13,6 +14,9 @@
 #include <numeric>
 #include <iomanip>
 #include <chrono>
+#include <thread>
+#include <cmath>
+#include <limits>
 
 enum InputArguments {
     inFileParams,
@@ -64,6 +68,14 @@ enum OutputArguments { // unique output arguments,
 %                 read operations
 % multithreaded_combining - number, which define if or how to use multiple threads to read files and,
                   which combining subalgorithm to deploy
+% num_partitions -- number of ranges of bins to combine concurrently. If larger then 1, each range of bins
+                   is combined by its own reader and writer, which write pixels of the range directly into
+                   their positions in the output file. Readers of all ranges share the input files and their
+                   npix arrays are always mapped into memory. The read buffer size is split between ranges.
+% num_buffers    -- number of output buffers in the queue between reader and writer (at least 2, 2 by default). More
+                   buffers allow the reader to run ahead of the writer when writing stalls and vice versa.
+% map_npix       -- if 1, npix arrays of the input files are mapped into memory instead of being read into
+                   buffers.
 */
 
 
@@ -73,7 +85,7 @@ enum OutputArguments { // unique output arguments,
 /* combine range of input sqw files into single output sqw file */
 void combine_sqw(ProgParameters& param, std::vector<sqw_reader>& fileReaders, const fileParameters& outPar) {
 
-    exchange_buffer Buff(param.pixBufferSize, param.totNumBins, param.num_log_ticks);
+    exchange_buffer Buff(param.pixBufferSize, param.totNumBins, param.num_log_ticks, param.num_exchange_buffers);
 
     nsqw_pix_reader Reader(param, fileReaders, Buff);
 
@@ -148,6 +160,308 @@ void combine_sqw(ProgParameters& param, std::vector<sqw_reader>& fileReaders, co
     }
 }
 
+//--------------------------------------------------------------------------------------------------------------------
+//--------- PARTITIONED COMBINE JOB ----------------------------------------------------------------------------------
+//--------------------------------------------------------------------------------------------------------------------
+/* Split bins [first_bin,end_bin) of the combined image into n_partitions ranges of bins, containing approximately
+   equal numbers of pixels, and calculate the position of the first pixel of every range within the combined
+   pixel array.
+
+   The numbers of pixels in bins are read from the npix arrays of all input files and summed up by segments of
+   bins, much smaller then a partition, so the partitions are balanced with the accuracy of a segment.
+Outputs:
+@param part_bins -- n_partitions+1 bin numbers. Partition i contains bins [part_bins[i],part_bins[i+1]).
+                    Some partitions may contain no bins.
+@param part_pix  -- n_partitions+1 numbers of pixels, preceding the first bin of every partition. The last
+                    element is the total number of pixels in all bins.
+*/
+void calc_combine_partitions(const std::vector<fileParameters> &fileParam, size_t first_bin, size_t end_bin,
+    size_t n_partitions, std::vector<size_t> &part_bins, std::vector<size_t> &part_pix) {
+
+    n_partitions = std::max(n_partitions, size_t(1));
+    size_t n_bins = (end_bin > first_bin) ? end_bin - first_bin : 0;
+    size_t seg_size = std::max(size_t(1), n_bins / (n_partitions * PARTITION_SEGMENTS));
+    size_t n_segments = (n_bins + seg_size - 1) / seg_size;
+
+    // npix arrays of the input files are summed up by segments on separate threads
+    size_t n_files = fileParam.size();
+    size_t n_threads = std::max(size_t(1), std::min(n_partitions, n_files));
+    std::vector<std::vector<uint64_t> > thread_seg_pix(n_threads, std::vector<uint64_t>(n_segments, 0));
+    std::vector<std::string> thread_error(n_threads);
+    auto sum_npix_job = [&](size_t n_thread) {
+        std::vector<uint64_t> npix(std::min(n_bins, PARTITION_NPIX_CHUNK));
+        std::vector<uint64_t> &seg_pix = thread_seg_pix[n_thread];
+        for (size_t i = n_thread; i < n_files; i += n_threads) {
+            block_reader h_npix;
+            if (!h_npix.open(fileParam[i].fileName)) {
+                thread_error[n_thread] = "COMBINE_SQW: Can not open file: " + fileParam[i].fileName + " to read npix";
+                return;
+            }
+            for (size_t bin = first_bin; bin < end_bin; bin += npix.size()) {
+                size_t n_read = std::min(npix.size(), end_bin - bin);
+                size_t n_bytes = n_read * sizeof(uint64_t);
+                if (h_npix.read(fileParam[i].nbin_start_pos + bin * sizeof(uint64_t), reinterpret_cast<char *>(npix.data()), n_bytes) != n_bytes) {
+                    thread_error[n_thread] = "COMBINE_SQW: Error reading npix from file: " + fileParam[i].fileName;
+                    return;
+                }
+                for (size_t j = 0; j < n_read; j++) {
+                    seg_pix[(bin - first_bin + j) / seg_size] += npix[j];
+                }
+            }
+        }
+    };
+    std::vector<std::thread> sum_jobs;
+    for (size_t n = 1; n < n_threads; n++) {
+        sum_jobs.emplace_back(sum_npix_job, n);
+    }
+    sum_npix_job(0);
+    for (auto &job : sum_jobs) {
+        job.join();
+    }
+    for (size_t n = 0; n < n_threads; n++) {
+        if (!thread_error[n].empty()) {
+            mexErrMsgTxt(thread_error[n].c_str());
+        }
+    }
+    std::vector<uint64_t> &seg_pix = thread_seg_pix[0];
+    for (size_t n = 1; n < n_threads; n++) {
+        for (size_t j = 0; j < n_segments; j++) {
+            seg_pix[j] += thread_seg_pix[n][j];
+        }
+    }
+    uint64_t total_pix = std::accumulate(seg_pix.begin(), seg_pix.end(), uint64_t(0));
+
+    part_bins.assign(n_partitions + 1, end_bin);
+    part_pix.assign(n_partitions + 1, total_pix);
+    part_bins[0] = std::min(first_bin, end_bin);
+    part_pix[0] = 0;
+    size_t n_seg(0);
+    uint64_t seg_start_pix(0);
+    for (size_t p = 1; p < n_partitions; p++) {
+        uint64_t target_pix = total_pix / n_partitions * p + total_pix % n_partitions * p / n_partitions;
+        while (n_seg < n_segments && seg_start_pix + seg_pix[n_seg] <= target_pix) {
+            seg_start_pix += seg_pix[n_seg];
+            n_seg++;
+        }
+        part_bins[p] = std::min(end_bin, first_bin + n_seg * seg_size);
+        part_pix[p] = seg_start_pix;
+    }
+}
+/* runs on main thread and prints the progress of all partitions of the partitioned combine job */
+static void print_partitions_log(const std::vector<std::unique_ptr<exchange_buffer> > &Buff,
+    const std::vector<size_t> &first_bin, size_t n_bins_total, std::clock_t c_start, time_t t_start) {
+
+    size_t n_bins_done(0);
+    for (size_t k = 0; k < Buff.size(); k++) {
+        size_t n_bins_processed = Buff[k]->num_bins_processed();
+        if (n_bins_processed > first_bin[k]) {
+            n_bins_done += n_bins_processed - first_bin[k];
+        }
+    }
+    std::clock_t c_end = std::clock();
+    time_t t_end;
+    time(&t_end);
+    double seconds = difftime(t_end, t_start);
+    std::stringstream buf;
+    buf << "MEX::COMBINE_SQW: Completed " << std::setw(4) << std::setprecision(3)
+        << float(100 * n_bins_done) / float(std::max(n_bins_total, size_t(1)))
+        << "%  of task in " << std::setprecision(0) << std::setw(6) << int(seconds) << " sec; CPU time: "
+        << (c_end - c_start) / CLOCKS_PER_SEC << " sec";
+    mexPrintf("%s", buf.str().c_str());
+    mexEvalString("pause(.002);");
+}
+/* combine range of input sqw files into single output sqw file, splitting the bins into param.num_partitions
+   ranges, combined concurrently.
+
+   Positions of the pixels of every range of bins in the output file are calculated from the npix arrays of the
+   input files beforehand, so every range is combined by its own reader and writer pair, exchanging data through
+   its own exchange buffer. The writers write pixels into disjoint regions of the output pixel array.
+   The readers of the first range use fileReaders provided and the readers of other ranges share the pixel
+   files and mapped npix arrays of these readers, so the number of open files does not grow with the number
+   of partitions. Each reader allocates its own pixel buffer of read_buf_size pixels.
+*/
+void combine_sqw_partitioned(ProgParameters &param, std::vector<sqw_reader> &fileReaders,
+    const std::vector<fileParameters> &fileParam, size_t read_buf_size, int thread_mode, const fileParameters &outPar) {
+
+    std::clock_t c_start = std::clock();
+    time_t t_start;
+    time(&t_start);
+
+    std::vector<size_t> part_bins, part_pix;
+    calc_combine_partitions(fileParam, param.nBin2read, param.totNumBins, param.num_partitions, part_bins, part_pix);
+    // ranges which contain bins
+    std::vector<size_t> parts;
+    for (size_t p = 0; p + 1 < part_bins.size(); p++) {
+        if (part_bins[p + 1] > part_bins[p]) {
+            parts.push_back(p);
+        }
+    }
+    size_t n_parts = parts.size();
+    if (n_parts == 0) {
+        return;
+    }
+    size_t n_files = fileReaders.size();
+    size_t buf_size = std::max(size_t(1), param.pixBufferSize / n_parts);
+    // parameters of partitions have to stay at their places as readers refer to them
+    std::vector<ProgParameters> part_param(n_parts, param);
+    std::vector<std::vector<sqw_reader> > part_readers;
+    part_readers.reserve(n_parts);
+    std::vector<std::unique_ptr<exchange_buffer> > Buff;
+    std::vector<std::unique_ptr<nsqw_pix_reader> > Readers;
+    std::vector<std::unique_ptr<sqw_pix_writer> > Writers;
+    std::vector<size_t> first_bin(n_parts);
+    for (size_t k = 0; k < n_parts; k++) {
+        size_t p = parts[k];
+        first_bin[k] = part_bins[p];
+        part_param[k].nBin2read = part_bins[p];
+        // reader of a partition stops at the end of its range of bins
+        part_param[k].totNumBins = part_bins[p + 1];
+
+        std::vector<sqw_reader> *pReaders = &fileReaders;
+        if (k > 0) {
+            part_readers.emplace_back(n_files);
+            pReaders = &part_readers.back();
+            for (size_t i = 0; i < n_files; i++) {
+                (*pReaders)[i].init(fileReaders[i], read_buf_size, thread_mode);
+            }
+        }
+        Buff.emplace_back(new exchange_buffer(buf_size, part_bins[p + 1], param.num_log_ticks, param.num_exchange_buffers));
+        Readers.emplace_back(new nsqw_pix_reader(part_param[k], *pReaders, *Buff[k]));
+        Writers.emplace_back(new sqw_pix_writer(*Buff[k]));
+        Writers[k]->init(outPar, part_bins[p + 1], part_pix[p]);
+    }
+    int log_level = param.log_level;
+
+    std::vector<std::thread> jobs;
+    for (size_t k = 0; k < n_parts; k++) {
+        sqw_pix_writer *pWriter = Writers[k].get();
+        nsqw_pix_reader *pReader = Readers[k].get();
+        jobs.emplace_back([pWriter]() {
+            pWriter->run_write_pix_job();
+            });
+        jobs.emplace_back([pReader]() {
+            pReader->run_read_job();
+            });
+    }
+    //---------------------------------------------------------------------------------------------------------------
+    // Threads have been launched so logging run talking to Matlab session and displaying progress
+    //---------------------------------------------------------------------------------------------------------------
+    bool interrupted(false), failed(false);
+    std::mutex log_mutex;
+    std::unique_lock<std::mutex> l(log_mutex);
+    int c_sensitivity(2000); // msc
+    while (true) {
+        // wait for the first partition which is still being combined
+        size_t k_active(0);
+        while (k_active < n_parts && Buff[k_active]->is_write_job_completed()) {
+            k_active++;
+        }
+        if (k_active == n_parts) {
+            break;
+        }
+        exchange_buffer &activeBuff = *Buff[k_active];
+        activeBuff.logging_ready.wait_for(l, std::chrono::milliseconds(c_sensitivity), [&activeBuff]() {return activeBuff.do_logging; });
+        bool do_logging(false);
+        for (size_t k = 0; k < n_parts; k++) {
+            if (Buff[k]->do_logging) {
+                do_logging = true;
+                Buff[k]->do_logging = false;
+            }
+        }
+        if (do_logging) {
+            if (interrupted) {
+                mexPrintf("%s", ".\n");
+                mexEvalString("pause(.002);");
+            }
+            mexPrintf("%s", "\n");
+            if (log_level > 0) {
+                print_partitions_log(Buff, first_bin, param.totNumBins - param.nBin2read, c_start, t_start);
+            }
+        }
+
+        if (utIsInterruptPending()) {
+            if (!interrupted) {
+                mexPrintf("%s", "MEX::COMBINE_SQW: Interrupting by CTRL-C ..");
+                mexEvalString("pause(.002);");
+                for (size_t k = 0; k < n_parts; k++) {
+                    Buff[k]->set_interrupted("==> C-code interrupted by CTRL-C");
+                }
+                c_sensitivity = 1000;
+            }
+            interrupted = true;
+        }
+        // error in one partition stops all others
+        for (size_t k = 0; k < n_parts && !failed && !interrupted; k++) {
+            if (Buff[k]->is_interrupted()) {
+                failed = true;
+                for (size_t j = 0; j < n_parts; j++) {
+                    if (!Buff[j]->is_interrupted()) {
+                        Buff[j]->set_interrupted(Buff[k]->error_message);
+                    }
+                }
+            }
+        }
+
+        mexPrintf("%s", ".");
+        mexEvalString("pause(.002);");
+    }
+    for (auto &job : jobs) {
+        job.join();
+    }
+    for (size_t k = 0; k < n_parts; k++) {
+        Readers[k]->finish_read_jobs();
+    }
+
+    if (interrupted) {
+        mexPrintf("%s", ".\n");
+        mexEvalString("pause(.002);");
+    }
+    else {
+        mexPrintf("%s", "\n");
+        if (log_level > -1) {
+            size_t n_pix_total(0);
+            for (size_t k = 0; k < n_parts; k++) {
+                n_pix_total += Buff[k]->num_pix_processed();
+            }
+            std::clock_t c_end = std::clock();
+            time_t t_end;
+            time(&t_end);
+            double seconds = difftime(t_end, t_start);
+
+            std::stringstream buf;
+            buf << "MEX::COMBINE_SQW: Completed combining file with " << param.totNumBins - param.nBin2read << " bins and " << n_pix_total
+                << " pixels using " << n_parts << " partitions\n"
+                << " Spent: " << std::setprecision(0) << std::setw(6) << int(seconds) << " sec; CPU time: " << (c_end - c_start) / CLOCKS_PER_SEC << " sec\n";
+            if (log_level > 1) {
+                for (size_t k = 0; k < n_parts; k++) {
+                    buf << " Partition " << k + 1 << " exchange queue of " << Buff[k]->num_slots() << " buffers: average depth "
+                        << std::setprecision(2) << std::fixed << Buff[k]->average_queue_depth() << ", max depth "
+                        << Buff[k]->max_queue_depth() << "; reader waited " << Buff[k]->num_reader_waits()
+                        << " times, writer waited " << Buff[k]->num_writer_waits() << " times\n";
+                }
+            }
+            mexPrintf("%s", buf.str().c_str());
+        }
+    }
+    for (size_t k = 0; k < n_parts; k++) {
+        if (Buff[k]->is_interrupted()) {
+            mexErrMsgIdAndTxt("MEX_COMBINE_SQW:interrupted", Buff[k]->error_message.c_str());
+        }
+    }
+}
+
+/* retrieve program parameter N n_param, which has to be an integer not smaller than min_value */
+static size_t get_count_param(const double *pProg_settings, size_t n_param, const char *name, double min_value) {
+    double value = pProg_settings[n_param];
+    if (!(value >= min_value) || value != std::floor(value) || value > double(std::numeric_limits<uint32_t>::max())) {
+        std::stringstream buf;
+        buf << "ERROR::combine_sqw => program parameter N" << n_param + 1 << " (" << name
+            << ") should be an integer not smaller than " << min_value << " but got: " << value;
+        mexErrMsgIdAndTxt("HORACE:combine_sqw:invalid_argument", buf.str().c_str());
+    }
+    return size_t(value);
+}
+
 void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[])
 {
     if (nrhs == 0 && (nlhs == 0 || nlhs == 1)) {
@@ -175,8 +489,8 @@ void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[])
             debug_file_reader = true;
         }
         n_prog_params = mxGetN(prhs[programSettings]);
-        if (!(n_prog_params == 4 || n_prog_params == 8 || n_prog_params == 9)) {
-            std::string err = "ERROR::combine_sqw => array of program parameter settings (input N 3) should have  4 or 8 or 9 elements but got: " +
+        if (!(n_prog_params == 4 || (n_prog_params >= 8 && n_prog_params <= 12))) {
+            std::string err = "ERROR::combine_sqw => array of program parameter settings (input N 3) should have  4 or 8 to 12 elements but got: " +
                 std::to_string(n_prog_params);
             mexErrMsgTxt(err.c_str());
         }
@@ -244,9 +558,31 @@ void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[])
         case(8):
             read_files_multitreaded = int(pProg_settings[i]);
             break;
+        case(9):
+            ProgSettings.num_partitions = get_count_param(pProg_settings, i, "num_partitions", 1);
+            break;
+        case(10):
+            ProgSettings.num_exchange_buffers = get_count_param(pProg_settings, i, "num_buffers", 2);
+            break;
+        case(11):
+            if (!(pProg_settings[i] == 0 || pProg_settings[i] == 1)) {
+                std::stringstream buf;
+                buf << "ERROR::combine_sqw => program parameter N" << i + 1 << " (map_npix) should be 0 or 1 but got: "
+                    << pProg_settings[i];
+                mexErrMsgIdAndTxt("HORACE:combine_sqw:invalid_argument", buf.str().c_str());
+            }
+            ProgSettings.map_npix = pProg_settings[i] > 0;
+            break;
 
         }
     }
+    if (ProgSettings.num_partitions > 1 && !debug_file_reader) {
+        // readers of all partitions share the mapped npix arrays and split the read buffer between them
+        ProgSettings.map_npix = true;
+        if (read_buf_size > 0) {
+            read_buf_size = std::max(size_t(1), read_buf_size / ProgSettings.num_partitions);
+        }
+    }
     // set up the number of bins, which has to be equal for all input files
     for (size_t i = 0; i < n_files; i++) {
         fileParam[i].total_NfileBins = ProgSettings.totNumBins;
@@ -272,7 +608,7 @@ void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[])
         if (change_fileno && !fileno_provided) { // renumbering pixel id-s with file number
             fileParam[i].run_id = int(i + 1); // file numbers in Matlab start from 1 so adhere to this convention
         }
-        fileReader[i].init(fileParam[i], change_fileno,read_buf_size, read_files_multitreaded);
+        fileReader[i].init(fileParam[i], change_fileno,read_buf_size, read_files_multitreaded, ProgSettings.map_npix);
     }
     size_t n_buf_pixels(0), n_bins_processed(0);
 
@@ -310,6 +646,9 @@ void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[])
         plhs[npix_in_bins] = nbin_Buffer;
         plhs[pix_info] = OutParam;
     }
+    else if (ProgSettings.num_partitions > 1) { // production mode, combining ranges of bins concurrently
+        combine_sqw_partitioned(ProgSettings, fileReader, fileParam, read_buf_size, read_files_multitreaded, OutFilePar);
+    }
     else { // production mode
         combine_sqw(ProgSettings, fileReader, OutFilePar);
     }
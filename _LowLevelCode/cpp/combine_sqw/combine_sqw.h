@@ -10,3 +10,16 @@ enum readBinInfoOption {
     sumPixInfo,
     keepPixInfo
 };
+
+// number of segments per partition, used to balance the numbers of pixels in partitions
+const size_t PARTITION_SEGMENTS = 1024;
+// number of bins, which numbers of pixels are read together while calculating partitions
+const size_t PARTITION_NPIX_CHUNK = 65536;
+
+void calc_combine_partitions(const std::vector<fileParameters> &fileParam, size_t first_bin, size_t end_bin,
+    size_t n_partitions, std::vector<size_t> &part_bins, std::vector<size_t> &part_pix);
+
+void combine_sqw(ProgParameters &param, std::vector<sqw_reader> &fileReaders, const fileParameters &outPar);
+
+void combine_sqw_partitioned(ProgParameters &param, std::vector<sqw_reader> &fileReaders,
+    const std::vector<fileParameters> &fileParam, size_t read_buf_size, int thread_mode, const fileParameters &outPar);
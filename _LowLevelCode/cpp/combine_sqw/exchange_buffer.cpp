@@ -1,13 +1,17 @@
 #include "exchange_buffer.h"
+#include <new>
 
-exchange_buffer::exchange_buffer(size_t b_size, size_t num_bins_2_process, size_t num_log_ticks) :
+exchange_buffer::exchange_buffer(size_t b_size, size_t num_bins_2_process, size_t num_log_ticks, size_t n_slots) :
     do_logging(false),
     buf_size(b_size* PIX_SIZE),
-    n_read_pixels(0), n_bins_processed(0),
+    n_bins_processed(0),
     num_bins_to_process(num_bins_2_process),
-    interrupted(false), write_allowed(false),
-    write_job_completed(false), writer_ready(true),
-    break_step(1), num_log_messages(num_log_ticks), break_point(0), n_read_pix_total(0)
+    interrupted(false), write_job_completed(false),
+    break_step(1), num_log_messages(num_log_ticks), break_point(0), n_read_pix_total(0),
+    slots(std::max(n_slots, size_t(2))),
+    n_slots_sent(0), n_slots_written(0), write_slot_taken(false),
+    write_allowed(false),
+    sum_depth(0), max_depth(0), n_reader_waits(0), n_writer_waits(0)
 {
     break_step = num_bins_to_process / num_log_messages;
     break_point = break_step;
@@ -15,86 +19,138 @@ exchange_buffer::exchange_buffer(size_t b_size, size_t num_bins_2_process, size_
     time(&t_start);
     t_prev = t_start;
 
-
+    for (auto &slot : this->slots) {
+        this->allocate_slot(slot);
+    }
 };
 
+void exchange_buffer::page_deleter::operator()(float *p)const {
+    ::operator delete[](p, std::align_val_t(PAGE_SIZE));
+}
+/* (re)allocate slot buffer to accommodate buf_size pixel data */
+void exchange_buffer::allocate_slot(pix_slot &slot) {
+    if (this->buf_size == 0) {
+        return;
+    }
+    slot.data.reset(static_cast<float *>(::operator new[](this->buf_size * sizeof(float), std::align_val_t(PAGE_SIZE))));
+    slot.capacity = this->buf_size;
+}
 
+/* Return the buffer of the free slot to read pixels into. Waits until the writer frees a slot if all slots
+   are filled.
+@param changed_buf_size -- if non-zero, the new size (in pixels) of the buffers to use */
 float* const exchange_buffer::get_read_buffer(const size_t changed_buf_size) {
 
-    //this->read_lock.lock();
     if (changed_buf_size != 0) {
         this->buf_size = changed_buf_size * PIX_SIZE;
     }
-
-    if (this->read_buf.size() != this->buf_size)
-        this->read_buf.resize(this->buf_size);
-
-    return &read_buf[0];
+    size_t n_sent = this->n_slots_sent.load(std::memory_order_relaxed);
+    if (n_sent - this->n_slots_written.load(std::memory_order_acquire) >= this->slots.size()) {
+        // back-pressure: wait until writer frees a slot. Writer does not use slots any more when its job is completed
+        std::unique_lock<std::mutex> lock(this->queue_lock);
+        this->n_reader_waits++;
+        this->data_written.wait(lock, [this, n_sent]() {
+            return n_sent - this->n_slots_written.load(std::memory_order_acquire) < this->slots.size() || this->write_job_completed;
+            });
+    }
+    pix_slot &slot = this->slots[n_sent % this->slots.size()];
+    if (slot.capacity < this->buf_size) {
+        this->allocate_slot(slot);
+    }
+    return slot.data.get();
 }
 
-/* Initiate access to write buffer when read operation is completed and set up the write buffer parameters
+/* Send the slot, filled by the reader, to the writer
 @param nPixel        -- number of pixels to write
 @param nBinProcessed -- number of bins processed up to this moment of time. Indicates the stage of the combine job
 as job finishes when nBinsProcessed=nBinsTotal  */
 void exchange_buffer::send_read_buffer_to_writer(const size_t nPixels, const size_t nBinsProcessed) {
 
-    std::unique_lock<std::mutex> wlock(this->data_written_lock);
-    this->data_written.wait(wlock, [this]() {return (this->writer_ready); });
-    this->writer_ready = false;
-    // try lock in case write have not been completed yet and write buffer is locked
-    this->write_lock.lock();
-    this->write_buf.swap(this->read_buf);
-    this->n_read_pixels     = nPixels;
+    size_t n_sent = this->n_slots_sent.load(std::memory_order_relaxed);
+    pix_slot &slot = this->slots[n_sent % this->slots.size()];
+    slot.n_pixels = nPixels;
+    slot.n_bins_processed = nBinsProcessed;
     this->n_read_pix_total += nPixels;
-    this->n_bins_processed  = nBinsProcessed;
-    // notify writer thread that data are ready
-    std::unique_lock<std::mutex> lock(this->data_ready_lock);
+    this->n_slots_sent.store(n_sent + 1, std::memory_order_release);
+
+    size_t depth = n_sent + 1 - this->n_slots_written.load(std::memory_order_acquire);
+    this->sum_depth += depth;
+    if (depth > this->max_depth) {
+        this->max_depth = depth;
+    }
+    // notify writer thread that data are ready. The lock ensures the writer does not miss the notification
+    // between checking the queue and starting to wait
+    std::lock_guard<std::mutex> lock(this->queue_lock);
+    this->data_ready.notify_one();
+}
+/* Release writer waiting for data when reader job is completed */
+void exchange_buffer::set_write_allowed() {
+    std::lock_guard<std::mutex> lock(this->queue_lock);
     this->write_allowed = true;
     this->data_ready.notify_one();
-    // last bins may not contain pixels so set write allowed instead of npix>0
-    this->write_lock.unlock();
-
-
-
 }
 /* execute waiting until reader thread informs writer thread that data are ready*/
 void exchange_buffer::wait_for_reader_data() {
-    std::unique_lock<std::mutex> lock(this->data_ready_lock);
-    // wait until write_allowed is true and data_ready is unlocked
-    this->data_ready.wait(lock, [this]() {return (this->write_allowed); });
-    // lock write buffer until write operation is completed
-    this->write_lock.lock();
-    this->write_allowed = false;
+    size_t n_written = this->n_slots_written.load(std::memory_order_relaxed);
+    if (this->n_slots_sent.load(std::memory_order_acquire) > n_written) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(this->queue_lock);
+    this->n_writer_waits++;
+    this->data_ready.wait(lock, [this, n_written]() {
+        return this->n_slots_sent.load(std::memory_order_acquire) > n_written || this->write_allowed;
+        });
 }
 
-/* Give write thread access to the write buffer. Returns NULL if no pixels are currently in buffer and locks
-write buffer, which has to be unlocked later. */
+/* Give write thread access to the first filled slot. Returns NULL if no pixels are currently in the slot or
+   no slot has been sent. The slot taken has to be released by unlock_write_buffer later. */
 char* const exchange_buffer::get_write_buffer(size_t& n_pix_to_write, size_t& n_bins_processed) {
 
-
-    n_bins_processed = this->n_bins_processed;
-    if (this->n_read_pixels > 0) {
-        n_pix_to_write = this->n_read_pixels;
-        return reinterpret_cast<char* const>(&write_buf[0]);
+    size_t n_written = this->n_slots_written.load(std::memory_order_relaxed);
+    n_pix_to_write = 0;
+    this->write_slot_taken = this->n_slots_sent.load(std::memory_order_acquire) > n_written;
+    if (!this->write_slot_taken) {
+        n_bins_processed = this->n_bins_processed;
+        return NULL;
+    }
+    const pix_slot &slot = this->slots[n_written % this->slots.size()];
+    this->n_bins_processed = slot.n_bins_processed;
+    n_bins_processed = slot.n_bins_processed;
+    if (slot.n_pixels > 0) {
+        n_pix_to_write = slot.n_pixels;
+        return reinterpret_cast<char* const>(slot.data.get());
     }
     else {
-        n_pix_to_write = 0;
         return NULL;
     }
 
 }
-/* Indicates the end of single write-pixels operations and unlocks write buffer indicating that the data
-in the buffer can be discarded */
+/* Indicates the end of single write-pixels operations and returns the slot taken by get_write_buffer to the reader
+   indicating that the data in the slot can be discarded */
 void exchange_buffer::unlock_write_buffer() {
-    std::unique_lock<std::mutex> lock(this->data_written_lock);
-    this->n_read_pixels = 0;
+    if (!this->write_slot_taken) {
+        return;
+    }
+    this->write_slot_taken = false;
+    this->n_slots_written.fetch_add(1, std::memory_order_release);
 
-    // notify reader that it can start process of providing new data buffer. This is initial writer state
-    // when writer is initialized
-    this->writer_ready = true;
+    // notify reader that it can fill the slot released
+    std::lock_guard<std::mutex> lock(this->queue_lock);
     this->data_written.notify_one();
-
-    this->write_lock.unlock();
+}
+/* Interrupt combining and release reader waiting for a free slot */
+void exchange_buffer::set_interrupted(const std::string &err_message) {
+    std::lock_guard<std::mutex> lock(this->queue_lock);
+    this->error_message = err_message;
+    this->interrupted = true;
+}
+/* average number of filled slots in the queue after a slot is sent to writer */
+double exchange_buffer::average_queue_depth()const {
+    size_t n_sent = this->n_slots_sent.load();
+    if (n_sent == 0) {
+        return 0;
+    }
+    return double(this->sum_depth) / double(n_sent);
 }
 /* Verifies if logging is due and send messages to logging thread to report progress.
 Also verifies if operations should be terminated as user pressed CTRL-C */
@@ -123,7 +179,12 @@ void exchange_buffer::check_logging() {
 }
 /* Sets internal variables of exchange buffer to state, indicating end of operations*/
 void exchange_buffer::set_write_job_completed() {
-    this->write_job_completed = true;
+    {
+        // release reader, which may wait for a slot
+        std::lock_guard<std::mutex> lock(this->queue_lock);
+        this->write_job_completed = true;
+        this->data_written.notify_one();
+    }
     if (!this->do_logging) {
         this->do_logging = true;
         // release possible logging
@@ -171,6 +232,11 @@ void exchange_buffer::print_final_log_mess(int log_level)const {
         buf << "MEX::COMBINE_SQW: Completed combining file with " << n_bins_processed << " bins and " << n_read_pix_total
             << " pixels\n"
             << " Spent: " << std::setprecision(0) << std::setw(6) << int(seconds) << " sec; CPU time: " << (c_end - c_start) / CLOCKS_PER_SEC << " sec\n";
+        if (log_level > 1) {
+            buf << " Exchange queue of " << this->num_slots() << " buffers: average depth " << std::setprecision(2) << std::fixed
+                << this->average_queue_depth() << ", max depth " << this->max_depth << "; reader waited "
+                << this->n_reader_waits << " times, writer waited " << this->n_writer_waits << " times\n";
+        }
         mexPrintf("%s", buf.str().c_str());
     }
 
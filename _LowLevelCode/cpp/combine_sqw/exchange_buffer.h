@@ -4,6 +4,9 @@
 #include <vector>
 #include <ctime>
 #include <thread>
+#include <atomic>
+#include <memory>
+#include <mutex>
 //#include <chrono> // Use this for debugging various timing intervals between threads
 #include <condition_variable>
 // Matlab includes
@@ -16,7 +19,17 @@
 
 
 //-----------------------------------------------------------------------------------------------------------------
-/* Class provides unblocking read/write buffer and logging operations for asynchronous read and write operations on 3 threads */
+/* Class provides unblocking read/write buffer and logging operations for asynchronous read and write operations on 3 threads
+
+   Pixels are passed from the reader to the writer through the ring of n_slots pre-allocated, page-aligned pixel
+   buffers (slots). The reader fills free slots and sends them to the writer while the writer writes the slots
+   sent before, so short delays of reading or writing are absorbed by the slots in the queue. The reader waits
+   for the writer only when all slots are filled and the writer waits for the reader only when the queue is empty.
+
+   The ring is used by single reader and single writer. The positions of the reader and the writer in the ring
+   are atomic and slots are exchanged without locking. The mutex is used only to wait for the other side when
+   the queue is full or empty.
+*/
 class exchange_buffer {
 public:
     // write buffer synchronization
@@ -29,22 +42,14 @@ public:
     void send_read_buffer_to_writer(const size_t nPixels, const size_t nBinsProcessed);
 
 
-    void set_interrupted(const std::string &err_message) {
-        interrupted = true;
-        this->error_message = err_message;
-    }
+    void set_interrupted(const std::string &err_message);
     bool is_interrupted()const { return interrupted; }
     bool is_write_job_completed()const { return write_job_completed; }
     void set_write_job_completed();
 
-    exchange_buffer(size_t b_size, size_t num_bins_2_process, size_t num_log_ticks);
+    exchange_buffer(size_t b_size, size_t num_bins_2_process, size_t num_log_ticks, size_t n_slots = 2);
     //
-    void set_write_allowed() {
-        // Release write job in case it waits for read completed
-        std::lock_guard<std::mutex> lock(this->write_lock);
-        this->write_allowed = true;
-        this->data_ready.notify_one();
-    }
+    void set_write_allowed();
     //
     void check_logging();
     void print_log_meassage(int log_level);
@@ -53,6 +58,21 @@ public:
     size_t pix_buf_size()const {
         return(buf_size / PIX_SIZE);
     }
+    // number of the bin following the last bin sent to writer
+    size_t num_bins_processed()const { return n_bins_processed; }
+    // total number of pixels sent to writer
+    size_t num_pix_processed()const { return n_read_pix_total; }
+
+    // queue statistics
+    size_t num_slots()const { return slots.size(); }
+    // average number of filled slots in the queue after a slot is sent to writer
+    double average_queue_depth()const;
+    // maximal number of filled slots in the queue
+    size_t max_queue_depth()const { return max_depth; }
+    // number of times the reader waited for a free slot
+    size_t num_reader_waits()const { return n_reader_waits; }
+    // number of times the writer waited for a filled slot
+    size_t num_writer_waits()const { return n_writer_waits; }
 
 
     // logging semaphore
@@ -63,25 +83,42 @@ public:
 
 private:
     size_t buf_size;
-    size_t n_read_pixels, n_bins_processed, num_bins_to_process;
-    bool interrupted, write_job_completed;
+    std::atomic<size_t> n_bins_processed;
+    size_t num_bins_to_process;
+    std::atomic<bool> interrupted, write_job_completed;
     // logging and timing:
     size_t break_step, num_log_messages, break_point, n_read_pix_total;
     std::clock_t c_start;
     time_t t_start, t_prev;
 
+    // pixels buffer allocated on memory page boundary
+    struct page_deleter {
+        void operator()(float *p)const;
+    };
+    struct pix_slot {
+        std::unique_ptr<float[], page_deleter> data;
+        size_t capacity;         // size of the buffer (in floats)
+        size_t n_pixels;         // number of pixels in the slot
+        size_t n_bins_processed; // number of the bin following the last bin, which pixels are in the slot
+        pix_slot() :capacity(0), n_pixels(0), n_bins_processed(0) {}
+    };
+    void allocate_slot(pix_slot &slot);
+    std::vector<pix_slot> slots;
+    // numbers of slots sent by reader and written by writer. Slot n is at the position n%n_slots of the ring
+    std::atomic<size_t> n_slots_sent, n_slots_written;
+    // true if writer has taken the slot at n_slots_written
+    bool write_slot_taken;
+
     // thread synchronization
-    bool write_allowed;
+    std::atomic<bool> write_allowed;
+    std::mutex queue_lock;
     std::condition_variable data_ready;
-    std::mutex data_ready_lock;
-    bool writer_ready;
     std::condition_variable data_written;
-    std::mutex data_written_lock;
-    std::mutex write_lock;
 
-    std::vector<float> read_buf;
-    std::vector<float> write_buf;
+    // queue statistics
+    size_t sum_depth, max_depth, n_reader_waits, n_writer_waits;
 
     static const size_t PIX_SIZE = 9; // size of the pixel in pixel data units (float)
+    static const size_t PAGE_SIZE = 4096; // alignment of the slot buffers
 };
 #endif
@@ -0,0 +1,56 @@
+#include "io_thread_pool.h"
+
+#include <algorithm>
+
+io_thread_pool &io_thread_pool::instance() {
+    static io_thread_pool pool(std::min(size_t(std::max(std::thread::hardware_concurrency(), 2u)), MAX_IO_THREADS));
+    return pool;
+}
+
+io_thread_pool::io_thread_pool(size_t n_threads) :
+    n_threads(n_threads), stop_pool(false)
+{}
+
+io_thread_pool::~io_thread_pool() {
+    {
+        std::lock_guard<std::mutex> lock(this->requests_lock);
+        this->stop_pool = true;
+    }
+    this->request_submitted.notify_all();
+    for (auto &worker : this->workers) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+}
+
+void io_thread_pool::submit(std::function<void()> &&read_request) {
+    {
+        std::lock_guard<std::mutex> lock(this->requests_lock);
+        // threads are started lazily, so the pool does not occupy resources if multithreaded reading is not used
+        if (this->workers.empty()) {
+            for (size_t i = 0; i < this->n_threads; i++) {
+                this->workers.emplace_back([this]() {this->run_requests_job(); });
+            }
+        }
+        this->requests.push_back(std::move(read_request));
+    }
+    this->request_submitted.notify_one();
+}
+
+/* the job, executed by every pool thread: take the first request from the queue and execute it */
+void io_thread_pool::run_requests_job() {
+    while (true) {
+        std::function<void()> read_request;
+        {
+            std::unique_lock<std::mutex> lock(this->requests_lock);
+            this->request_submitted.wait(lock, [this]() {return this->stop_pool || !this->requests.empty(); });
+            if (this->requests.empty()) { // stop requested and all requests completed
+                return;
+            }
+            read_request = std::move(this->requests.front());
+            this->requests.pop_front();
+        }
+        read_request();
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef H_IO_THREAD_POOL
+#define H_IO_THREAD_POOL
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+//-----------------------------------------------------------------------------------------------------------------
+/* Fixed size pool of threads, performing read requests of all files combined by combine_sqw.
+
+   Readers of the input files (sqw_reader and pix_mem_map) do not own threads. Each of them submits
+   a request to read its next block of bins or pixels when the previous block has been taken and the
+   request is executed by the first free pool thread. Requests are executed in the order they have been
+   submitted, i.e. in the order the combine loop advances over bins of all files, so the number of threads
+   does not depend on the number of files combined.
+*/
+class io_thread_pool {
+public:
+    // the pool, shared by all file readers. Threads are started on the first request
+    static io_thread_pool &instance();
+    // add read request to the end of the requests queue
+    void submit(std::function<void()> &&read_request);
+    size_t num_threads()const { return this->n_threads; }
+
+    ~io_thread_pool();
+    io_thread_pool(const io_thread_pool &) = delete;
+    io_thread_pool &operator=(const io_thread_pool &) = delete;
+
+    // maximal number of threads the pool uses for reading files
+    static const size_t MAX_IO_THREADS = 8;
+private:
+    io_thread_pool(size_t n_threads);
+    void run_requests_job();
+
+    size_t n_threads;
+    std::deque<std::function<void()> > requests;
+    bool stop_pool;
+    std::mutex requests_lock;
+    std::condition_variable request_submitted;
+    std::vector<std::thread> workers;
+};
+
+#endif
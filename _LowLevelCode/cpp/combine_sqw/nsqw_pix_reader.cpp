@@ -1,4 +1,5 @@
 #include "nsqw_pix_reader.h"
+#include <cstring>
 //--------------------------------------------------------------------------------------------------------------------
 //--------------------------------------------------------------------------------------------------------------------
 //--------------------------------------------------------------------------------------------------------------------
@@ -40,28 +41,26 @@ void nsqw_pix_reader::read_and_combine_pixBuf_from_files(size_t &n_buf_pixels, s
     n_buf_pixels = 0;
     size_t first_bin = n_bins_processed;
 
-
-    size_t n_files = this->fileReaders.size();
     const size_t nBinsTotal(this->param.totNumBins);
-    size_t n_tot_bins(0);
-    size_t npix, pix_start_num;
-    //
-    bool common_position(false);
-    if (n_files == 1) {
-        common_position = true;
-    }
 
     float * pPixBuffer = Buff.get_read_buffer();
     size_t pix_buffer_size = Buff.pix_buf_size();
-    size_t ii(0);
 
+    // continue with the bins block retrieved by the previous call or retrieve a new one
+    if (first_bin < nBinsTotal && (first_bin < this->block_first_bin || first_bin >= this->block_end_bin)) {
+        this->load_bins_block(first_bin);
+    }
+    size_t copy_start_bin = first_bin; // first bin, which pixels are not copied into the buffer
+    size_t copy_end_bin = std::min(nBinsTotal, this->block_end_bin);
     for (size_t n_bin = first_bin; n_bin < nBinsTotal; n_bin++) {
-        size_t cell_pix = 0;
-        // estimate amount of space all files contribute into current cell.
-        for (size_t i = 0; i < n_files; i++) {
-            fileReaders[i].get_pix_map().get_npix_for_bin(n_bin, pix_start_num, npix);
-            cell_pix += npix;
+        if (n_bin >= this->block_end_bin) {
+            this->copy_block_pixels(copy_start_bin, n_bin, pPixBuffer);
+            copy_start_bin = n_bin;
+            this->load_bins_block(n_bin);
+            copy_end_bin = std::min(nBinsTotal, this->block_end_bin);
         }
+        size_t loc_bin = n_bin - this->block_first_bin;
+        size_t cell_pix = this->block_cell_pix[loc_bin];
         // Number of bins to read pixels to
         n_bins_processed = n_bin;
         if (nBinBuffer) {
@@ -78,24 +77,144 @@ void nsqw_pix_reader::read_and_combine_pixBuf_from_files(size_t &n_buf_pixels, s
                 }
                 else { // problem occurs if we have range of pixel read into buffer and written to target and then one large pixel. Currently we can only write complete pixels ranges
                     Buff.set_interrupted("==>output pixels buffer is too small to accommodate a single bin. Increase the size of output pixels buffer");
+                    copy_end_bin = n_bin;
                     break;
                 }
             }
-            else { // 
+            else { //
                 n_bins_processed--;
+                copy_end_bin = n_bin;
                 break;
             }
         }
+        // position of the pixels of the bin within the buffer
+        this->block_buf_pos[loc_bin] = n_buf_pixels;
+        n_buf_pixels += cell_pix;
+    }
+    if (copy_end_bin > copy_start_bin) {
+        this->copy_block_pixels(copy_start_bin, copy_end_bin, pPixBuffer);
+    }
+    // unlocks read buffer too
+    Buff.send_read_buffer_to_writer(n_buf_pixels, n_bins_processed + 1);
+}
+/* Retrieve numbers of pixels, all files contribute to the block of bins starting from the bin provided,
+   and calculate the number of pixels in every bin of the combined file */
+void nsqw_pix_reader::load_bins_block(size_t first_bin) {
+    size_t n_files = this->fileReaders.size();
+    if (this->block_size == 0) {
+        this->block_size = std::max(size_t(1), std::min(MAX_MERGE_BLOCK_BINS, MERGE_BLOCK_ENTRIES / std::max(n_files, size_t(1))));
+        this->block_npix.resize(this->block_size * n_files);
+        this->block_pix_pos.resize(this->block_size * n_files);
+        this->block_buf_pos.resize(this->block_size);
+        this->block_cell_pix.resize(this->block_size);
+    }
+    bool continue_block = (first_bin == this->block_end_bin && this->block_end_bin > this->block_first_bin);
+    this->block_first_bin = first_bin;
+    this->block_end_bin = std::min(first_bin + this->block_size, this->param.totNumBins);
+    size_t n_bins = this->block_end_bin - first_bin;
+
+    std::fill(this->block_cell_pix.begin(), this->block_cell_pix.begin() + n_bins, 0);
+    for (size_t i = 0; i < n_files; i++) {
+        uint64_t *const file_npix = &this->block_npix[i * this->block_size];
+        if (continue_block) { // the pixels of next block of a file follow the pixels of the previous block
+            this->fileReaders[i].get_pix_map().get_npix_for_bins(first_bin, n_bins, file_npix);
+        }
+        else {
+            this->fileReaders[i].get_pix_map().get_npix_for_bins(first_bin, n_bins, file_npix, this->file_next_pix[i]);
+        }
+        for (size_t j = 0; j < n_bins; j++) {
+            this->block_cell_pix[j] += file_npix[j];
+        }
+    }
+}
+/* Copy pixels of the bins [first_bin,end_bin) of the current block from all files into their places
+   in the pixels buffer.
 
-        // read pixels from all contributing files into the space, intended for the target bin
+   The bins are copied by ranges, containing approximately MERGE_COPY_PIXELS pixels, so the part of the
+   buffer, the pixels of all files are copied to, remains in cache */
+void nsqw_pix_reader::copy_block_pixels(size_t first_bin, size_t end_bin, float *const pPixBuffer) {
+    size_t range_start = first_bin;
+    size_t range_pix = 0;
+    for (size_t n_bin = first_bin; n_bin < end_bin; n_bin++) {
+        range_pix += this->block_cell_pix[n_bin - this->block_first_bin];
+        if (range_pix >= MERGE_COPY_PIXELS) {
+            this->copy_range_pixels(range_start, n_bin + 1, pPixBuffer);
+            range_start = n_bin + 1;
+            range_pix = 0;
+        }
+    }
+    if (range_start < end_bin) {
+        this->copy_range_pixels(range_start, end_bin, pPixBuffer);
+    }
+}
+/* Copy pixels of the bins [first_bin,end_bin) from all files into their places in the pixels buffer.
+
+   Pixels of every file are copied by contiguous runs. Files, which pixels are available without waiting for
+   the io_thread_pool read requests are copied first and the files, which pixels are still being read, are
+   copied in the order their reads complete */
+void nsqw_pix_reader::copy_range_pixels(size_t first_bin, size_t end_bin, float *const pPixBuffer) {
+    size_t n_files = this->fileReaders.size();
+    // positions of the pixels of every file within the bins. Pixels of a bin from a file follow
+    // the pixels of this bin from all previous files
+    for (size_t loc_bin = first_bin - this->block_first_bin; loc_bin < end_bin - this->block_first_bin; loc_bin++) {
+        if (this->block_cell_pix[loc_bin] == 0) continue;
+        size_t pix_pos = this->block_buf_pos[loc_bin];
         for (size_t i = 0; i < n_files; i++) {
-            fileReaders[i].get_pix_for_bin(n_bin, pPixBuffer, n_buf_pixels,
-                pix_start_num, npix, common_position);
-            n_buf_pixels += npix;
+            this->block_pix_pos[i * this->block_size + loc_bin] = pix_pos;
+            pix_pos += this->block_npix[i * this->block_size + loc_bin];
         }
     }
-    // unlocks read buffer too
-    Buff.send_read_buffer_to_writer(n_buf_pixels, n_bins_processed + 1);
+    pending_files.clear();
+    for (size_t i = 0; i < n_files; i++) {
+        if (fileReaders[i].pix_ready_for(file_next_pix[i], 1)) {
+            this->copy_file_pixels(i, first_bin, end_bin, pPixBuffer);
+        }
+        else {
+            pending_files.push_back(i);
+        }
+    }
+    while (!pending_files.empty()) {
+        size_t n_left(0);
+        for (size_t k = 0; k < pending_files.size(); k++) {
+            size_t i = pending_files[k];
+            if (fileReaders[i].pix_ready_for(file_next_pix[i], 1)) {
+                this->copy_file_pixels(i, first_bin, end_bin, pPixBuffer);
+            }
+            else {
+                pending_files[n_left++] = i;
+            }
+        }
+        if (n_left == pending_files.size()) { // nothing was ready, so wait for the first pending file
+            this->copy_file_pixels(pending_files[0], first_bin, end_bin, pPixBuffer);
+            pending_files.erase(pending_files.begin());
+        }
+        else {
+            pending_files.resize(n_left);
+        }
+    }
+}
+/* Copy pixels of the file n_file, contributing to bins [first_bin,end_bin) of the current block,
+   into their positions in the pixels buffer */
+void nsqw_pix_reader::copy_file_pixels(size_t n_file, size_t first_bin, size_t end_bin, float *const pPixBuffer) {
+    const uint64_t *const file_npix = &this->block_npix[n_file * this->block_size];
+    const size_t *const file_pix_pos = &this->block_pix_pos[n_file * this->block_size];
+    size_t next_pix = this->file_next_pix[n_file];
+    sqw_reader &reader = this->fileReaders[n_file];
+    for (size_t loc_bin = first_bin - this->block_first_bin; loc_bin < end_bin - this->block_first_bin; loc_bin++) {
+        size_t npix = file_npix[loc_bin];
+        if (npix == 0) continue;
+        float *pTarget = pPixBuffer + file_pix_pos[loc_bin] * PIX_SIZE;
+        while (npix > 0) {
+            size_t n_available;
+            const float *pSource = reader.get_pix_range(next_pix, n_available);
+            size_t n_copy = std::min(npix, n_available);
+            std::memcpy(pTarget, pSource, n_copy * PIX_SIZE * sizeof(float));
+            pTarget += n_copy * PIX_SIZE;
+            next_pix += n_copy;
+            npix -= n_copy;
+        }
+    }
+    this->file_next_pix[n_file] = next_pix;
 }
 
 void nsqw_pix_reader::finish_read_jobs() {
@@ -14,8 +14,12 @@ struct ProgParameters {
     size_t num_log_ticks; // how many times per combine files to print log message about completion percentage
                           // Default constructor
     int thread_mode;      // integer defining the thread spawn strategy to use while reading and combining files.
+    size_t num_partitions; // number of bin ranges, combined concurrently by independent reader/writer pairs
+    size_t num_exchange_buffers; // number of pixel buffers in the queue between the reader and the writer
+    bool map_npix;        // if true, npix arrays of input files are mapped into memory rather then read
     ProgParameters() :totNumBins(0), nBin2read(0),
-        pixBufferSize(10000000), log_level(1), num_log_ticks(100), thread_mode(0)
+        pixBufferSize(10000000), log_level(1), num_log_ticks(100), thread_mode(0), num_partitions(1),
+        num_exchange_buffers(2), map_npix(false)
     {};
 };
 
@@ -26,10 +30,39 @@ class nsqw_pix_reader {
     ProgParameters &param;
     std::vector<sqw_reader> &fileReaders;
     exchange_buffer &Buff;
+    // Block of bins, which numbers of pixels are retrieved from all files together.
+    size_t block_first_bin, block_end_bin, block_size;
+    // number of pixels in every bin of the block for every file (file-major, block_size bins per file)
+    std::vector<uint64_t> block_npix;
+    // position of the pixels of every bin of the block in the combined pixels buffer
+    std::vector<size_t> block_buf_pos;
+    // position of the pixels of every file and bin of the block in the combined pixels buffer
+    std::vector<size_t> block_pix_pos;
+    // number of pixels all files contribute to every bin of the block
+    std::vector<uint64_t> block_cell_pix;
+    // number of the first pixel of the first bin, which pixels are not yet copied, in every file
+    std::vector<size_t> file_next_pix;
+    // files, which pixels are still being read
+    std::vector<size_t> pending_files;
+
+    void load_bins_block(size_t first_bin);
+    void copy_block_pixels(size_t first_bin, size_t end_bin, float *const pPixBuffer);
+    void copy_range_pixels(size_t first_bin, size_t end_bin, float *const pPixBuffer);
+    void copy_file_pixels(size_t n_file, size_t first_bin, size_t end_bin, float *const pPixBuffer);
 public:
     nsqw_pix_reader(ProgParameters &prog_par, std::vector<sqw_reader> &tmpReaders, exchange_buffer &buf) :
-        param(prog_par), fileReaders(tmpReaders), Buff(buf)
-    { }
+        param(prog_par), fileReaders(tmpReaders), Buff(buf),
+        block_first_bin(0), block_end_bin(0), block_size(0),
+        file_next_pix(tmpReaders.size(), 0)
+    {
+        pending_files.reserve(tmpReaders.size());
+    }
+    // maximal number of bins times number of files, which numbers of pixels are processed together
+    static constexpr size_t MERGE_BLOCK_ENTRIES = size_t(1) << 20;
+    static constexpr size_t MAX_MERGE_BLOCK_BINS = size_t(1) << 16;
+    // approximate number of pixels of all files, copied into the combined pixels buffer together
+    static constexpr size_t MERGE_COPY_PIXELS = size_t(1) << 15;
+    static constexpr size_t PIX_SIZE = 9; // size of the pixel in pixel data units (float)
     // satisfy thread interface
     void operator()() {
         this->run_read_job();
@@ -1,4 +1,18 @@
 #include "pix_mem_map.h"
+#include <cstring>
+#include <numeric>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 //--------------------------------------------------------------------------------------------------------------------
 //---------------- BINS IN MEMORY ------------------------------------------------------------------------------------
 //--------------------------------------------------------------------------------------------------------------------
@@ -17,24 +31,43 @@ pix_mem_map::pix_mem_map() :
     //
     use_multithreading(false),
     nbins_read(false), read_job_completed(false), thread_read_to_end(false),
-    n_first_rbuf_bin(0), rbuf_nbin_end(0), rbuf_end(0)
-
+    n_first_rbuf_bin(0), rbuf_nbin_end(0), rbuf_end(0),
+    mapped_npix(nullptr), map_base(nullptr), map_length(0)
+#ifdef _WIN32
+    , h_map_file(nullptr), h_mapping(nullptr)
+#endif
 {}
 /* Destructor */
 pix_mem_map::~pix_mem_map() {
     this->finish_read_bin_job();
     h_data_file_bin.close();
-
+    this->_unmap_npix();
 
 }
 void pix_mem_map::get_map_param(size_t &first_mem_bin, size_t &last_mem_bin, size_t &n_tot_bins)const {
-    first_mem_bin = this->num_first_buf_bin;
-    last_mem_bin = this->num_last_buf_bin;
+    if (this->mapped_npix) { // whole npix array is mapped
+        first_mem_bin = 0;
+        last_mem_bin = this->_nTotalBins;
+    }
+    else {
+        first_mem_bin = this->num_first_buf_bin;
+        last_mem_bin = this->num_last_buf_bin;
+    }
     n_tot_bins = this->_nTotalBins;
 
 }
 
-void pix_mem_map::init(const std::string &full_file_name, size_t bin_start_pos, size_t n_tot_bins, size_t BufferSize, bool use_multithreading) {
+/* Initialize the map
+ * full_file_name     -- name of the file with npix array
+ * bin_start_pos      -- position of npix array within the file
+ * n_tot_bins         -- number of bins in the file
+ * BufferSize         -- number of bins to read in memory at once. 0 -- read bins through the stream buffer
+ * use_multithreading -- read bins by the requests to io_thread_pool
+ * map_npix           -- map npix array into memory instead of reading it into buffers. If mapping fails,
+ *                       the npix array is read into buffers as specified by other parameters
+*/
+void pix_mem_map::init(const std::string &full_file_name, size_t bin_start_pos, size_t n_tot_bins, size_t BufferSize, bool use_multithreading,
+    bool map_npix) {
 
     this->_nTotalBins = n_tot_bins;
     this->_binFileStartPos = bin_start_pos;
@@ -47,17 +80,22 @@ void pix_mem_map::init(const std::string &full_file_name, size_t bin_start_pos,
 
     this->full_file_name = full_file_name;
 
-    if (this->h_data_file_bin.is_open()) {
+    if (this->h_data_file_bin.is_open() || this->mapped_npix) {
         this->h_data_file_bin.close();
+        this->_unmap_npix();
         this->map_capacity_isknown = false;
         this->_numPixInMap = std::numeric_limits<uint64_t>::max();
     }
+    this->use_multithreading = false;
+    if (map_npix && this->_map_npix()) {
+        // bins are accessed directly in memory, so nothing to read
+        return;
+    }
     //
     if (BufferSize != 0) {
         this->BIN_BUF_SIZE = BufferSize;
         this->BUF_EXTENSION_STEP = BIN_BUF_SIZE;
         this->nbin_read_buffer.resize(BIN_BUF_SIZE);
-         h_data_file_bin.rdbuf()->pubsetbuf(0, 0);
         use_streambuf_direct = false;
         //
         nbin_buffer.resize(BIN_BUF_SIZE);
@@ -69,7 +107,8 @@ void pix_mem_map::init(const std::string &full_file_name, size_t bin_start_pos,
         nbin_read_buffer.resize(BIN_BUF_SIZE);
         nbin_buffer.resize(BUF_EXTENSION_STEP);
     }
-    h_data_file_bin.open(full_file_name, std::ios::in | std::ios::binary);
+    // bins are read into the buffers by unbuffered positioned reads or through the stream buffer in direct mode
+    h_data_file_bin.open(full_file_name, use_streambuf_direct);
     if (!h_data_file_bin.is_open()) {
         std::string error("Can not open file: ");
         error += full_file_name;
@@ -95,14 +134,20 @@ void pix_mem_map::init(const std::string &full_file_name, size_t bin_start_pos,
 
         this->thread_nbin_buffer.resize(BUF_EXTENSION_STEP);
 
-        std::thread read_bins([this]() {this->read_bins_job(); });
-        read_bins_job_holder.swap(read_bins);
+        std::lock_guard<std::mutex> lock(this->bin_read_lock);
+        this->_submit_read_request();
     }
 }
 //
 
 /* return number of pixels this memory map describes starting from the bin number provided*/
 size_t pix_mem_map::num_pix_described(size_t bin_number)const {
+    if (this->mapped_npix) {
+        if (bin_number >= this->_nTotalBins) {
+            mexErrMsgTxt("pix_mem_map::num_pix_described -- bin number out of bin range");
+        }
+        return size_t(std::accumulate(this->mapped_npix + bin_number, this->mapped_npix + this->_nTotalBins, uint64_t(0)));
+    }
     if (bin_number < this->num_first_buf_bin || bin_number >= this->num_last_buf_bin) {
         mexErrMsgTxt("pix_mem_map::num_pix_described -- bin number out of bin cache range");
     }
@@ -142,17 +187,13 @@ bool pix_mem_map::_read_bins(size_t num_bin, std::vector<bin_info> &inbuf, size_
     size_t tot_num_bins_to_read = bin_end - num_bin;
 
 
-    std::streamoff bin_pos = this->_binFileStartPos + num_bin*BIN_SIZE_BYTES;
-    auto pbuf = h_data_file_bin.rdbuf();
-    pbuf->pubseekpos(bin_pos);
+    uint64_t bin_pos = this->_binFileStartPos + num_bin*BIN_SIZE_BYTES;
 
     if (tot_num_bins_to_read > nbin_read_buffer.size()) {
         this->nbin_read_buffer.resize(tot_num_bins_to_read);
     }
-    std::streamoff length = tot_num_bins_to_read*BIN_SIZE_BYTES;
     char * buffer = reinterpret_cast<char *>(&nbin_read_buffer[0]);
-    //pbuf->pubsetbuf(buffer, length);
-    pbuf->sgetn(buffer, length);
+    h_data_file_bin.read(bin_pos, buffer, tot_num_bins_to_read*BIN_SIZE_BYTES);
 
     inbuf[0] = bin_info(this->nbin_read_buffer[0], 0);
     for (size_t i = 1; i < tot_num_bins_to_read; i++) {
@@ -196,11 +237,17 @@ void pix_mem_map::_thread_request_to_read(size_t start_bin) {
 
 
         this->n_first_rbuf_bin = start_bin;
-        this->nbins_read = false;
+        this->_submit_read_request();
     }
-    this->read_bins_needed.notify_one();
-
-
+}
+/* mark thread buffer as containing no data and request io_thread_pool to read the bins into it.
+   Called with bin_read_lock locked. No requests are submitted when read job has been finished */
+void pix_mem_map::_submit_read_request() {
+    if (this->read_job_completed) {
+        return;
+    }
+    this->nbins_read = false;
+    io_thread_pool::instance().submit([this]() {this->read_bins_job(); });
 }
 
 bool pix_mem_map::_thread_get_data(size_t &num_first_bin, std::vector<bin_info> &inbuf, size_t &num_last_bin, size_t &buf_end) {
@@ -225,10 +272,9 @@ bool pix_mem_map::_thread_get_data(size_t &num_first_bin, std::vector<bin_info>
 
         // set up parameters for the next read job
         this->n_first_rbuf_bin = num_last_bin;
-        this->nbins_read = false;
         end_of_map_reached = this->thread_read_to_end;
+        this->_submit_read_request();
     }
-    this->read_bins_needed.notify_one();
     return end_of_map_reached;
 
 
@@ -307,6 +353,15 @@ void pix_mem_map::_update_data_cash_(size_t bin_number, std::vector<bin_info> &n
 
 void pix_mem_map::get_npix_for_bin(size_t bin_number, size_t &pix_start_num, size_t &num_pix_in_bin) {
 
+    if (this->mapped_npix) {
+        if (bin_number >= this->_nTotalBins) {
+            mexErrMsgTxt("pix_mem_map::get_npix_for_bin -- bin number out of bin range");
+        }
+        num_pix_in_bin = this->mapped_npix[bin_number];
+        std::lock_guard<std::mutex> lock(this->index_lock);
+        pix_start_num = this->_get_index_page(bin_number / INDEX_PAGE_BINS)[bin_number % INDEX_PAGE_BINS];
+        return;
+    }
     //
     if (bin_number >= this->num_last_buf_bin || bin_number < this->num_first_buf_bin) {
         this->_update_data_cash(bin_number); // Advance cache or cache miss
@@ -317,6 +372,48 @@ void pix_mem_map::get_npix_for_bin(size_t bin_number, size_t &pix_start_num, siz
 
 }
 
+/** get numbers of pixels, stored in the block of bins
+*
+* Advances bin cache as necessary and copies numbers of pixels from all cached blocks of bins
+*@param
+* first_bin   -- number of first bin to get pixel information for
+* n_bins      -- number of bins to get pixel information for
+* Returns:
+* npix          -- array of n_bins numbers of pixels in the bins
+* first_pix_num -- position of the pixels of the first bin in the pixels array
+*/
+void pix_mem_map::get_npix_for_bins(size_t first_bin, size_t n_bins, uint64_t *const npix, size_t &first_pix_num) {
+    size_t num_pix_in_bin;
+    this->get_npix_for_bin(first_bin, first_pix_num, num_pix_in_bin);
+    this->get_npix_for_bins(first_bin, n_bins, npix);
+}
+/** get numbers of pixels, stored in the block of bins, without calculating the position of their pixels
+*
+* Mapped npix are copied directly from the mapping, so the readers sharing the map do not access the pixel index
+*/
+void pix_mem_map::get_npix_for_bins(size_t first_bin, size_t n_bins, uint64_t *const npix) {
+    size_t end_bin = first_bin + n_bins;
+    if (this->mapped_npix) {
+        if (end_bin > this->_nTotalBins) {
+            mexErrMsgTxt("pix_mem_map::get_npix_for_bins -- bins out of bin range");
+        }
+        std::memcpy(npix, this->mapped_npix + first_bin, n_bins * BIN_SIZE_BYTES);
+        return;
+    }
+    size_t n_bin = first_bin;
+    while (n_bin < end_bin) {
+        if (n_bin >= this->num_last_buf_bin || n_bin < this->num_first_buf_bin) {
+            this->_update_data_cash(n_bin);
+        }
+        size_t num_bin_in_buf = n_bin - this->num_first_buf_bin;
+        size_t n_copy = std::min(end_bin, this->num_last_buf_bin) - n_bin;
+        for (size_t i = 0; i < n_copy; i++) {
+            npix[n_bin - first_bin + i] = this->nbin_buffer[num_bin_in_buf + i].num_bin_pixels;
+        }
+        n_bin += n_copy;
+    }
+}
+
 /* function to compare two bin_info classes*/
 bool comp_fun(const pix_mem_map::bin_info & lhs, const size_t & rhs) {
     return lhs.pix_pos + lhs.num_bin_pixels <= rhs;
@@ -400,6 +497,23 @@ size_t pix_mem_map::check_expand_pix_map(size_t bin_number, size_t num_pix_to_fi
     if (num_pix_in_bin >= num_pix_to_fit) {
         return num_pix_in_bin;
     }
+    if (this->mapped_npix) { // whole map is in memory so just count pixels in the bins which fit
+        size_t num_pix(0);
+        size_t n_bin = bin_number;
+        while (n_bin < this->_nTotalBins && num_pix + this->mapped_npix[n_bin] <= num_pix_to_fit) {
+            num_pix += this->mapped_npix[n_bin];
+            n_bin++;
+        }
+        if (n_bin == this->_nTotalBins) {
+            end_of_pix_reached = num_pix < num_pix_to_fit;
+            std::lock_guard<std::mutex> lock(this->index_lock);
+            if (!this->map_capacity_isknown) {
+                this->map_capacity_isknown = true;
+                this->_numPixInMap = pix_start_num + num_pix;
+            }
+        }
+        return num_pix;
+    }
     size_t num_pix_in_map = this->num_pix_described(bin_number);
     if (num_pix_in_map == num_pix_to_fit) {
         return num_pix_in_map;
@@ -458,21 +572,13 @@ size_t pix_mem_map::check_expand_pix_map(size_t bin_number, size_t num_pix_to_fi
 
 }
 
-/**/
+/* read the block of bins, starting from n_first_rbuf_bin into the thread buffer and notify the
+   consumer that the data are ready. Nothing is read if the read job has been finished. */
 void pix_mem_map::read_bins_job() {
+    {
+        std::lock_guard<std::mutex> read_lock(this->bin_read_lock);// lock read operation as thread can be released from more then one place
 
-    std::unique_lock<std::mutex> lock(this->exchange_lock);
-    while (!this->read_job_completed) {
-        this->read_bins_needed.wait(lock, [this]() {return (!this->nbins_read) || this->read_job_completed; });
-        {
-            std::lock_guard<std::mutex> read_lock(this->bin_read_lock);// lock read operation as thread can be released from more then one place
-
-            if (this->read_job_completed) {
-                this->nbins_read = true;
-                this->bins_ready.notify_one(); // just in case
-                return;
-            }
-
+        if (!this->read_job_completed) {
             if (this->n_first_rbuf_bin < this->_nTotalBins) {
                 this->thread_read_to_end = this->_read_bins(this->n_first_rbuf_bin, this->thread_nbin_buffer, this->rbuf_nbin_end, this->rbuf_end);
             }
@@ -481,32 +587,144 @@ void pix_mem_map::read_bins_job() {
                 this->rbuf_end = 0;
                 this->thread_nbin_buffer[0] = bin_info(); // contains zeros
             }
-            this->nbins_read = true;
-
         }
-        this->bins_ready.notify_one();
     }
+    // notify under lock, as the map may be destroyed as soon as the consumer sees data ready
+    std::lock_guard<std::mutex> lock(this->exchange_lock);
+    this->nbins_read = true;
+    this->bins_ready.notify_all();
 }
 
-/**/
+/* finish reading bins and wait until the last submitted read request is completed */
 void pix_mem_map::finish_read_bin_job() {
     if (!this->use_multithreading || this->read_job_completed) {
         return;
     }
-    if (!read_bins_job_holder.joinable()) {
-        return;
-    }
     {
         // lock read operation as thread can be released from more then one place
         std::lock_guard<std::mutex> read_lock(this->bin_read_lock);
         // set up job completion tag
         this->read_job_completed = true;
-        // finish incomplete read job if it has not been finished naturally
-
-        this->nbins_read = false;
     }
-    this->read_bins_needed.notify_one();
-
-    read_bins_job_holder.join();
+    std::unique_lock<std::mutex> data_ready(this->exchange_lock);
+    this->bins_ready.wait(data_ready, [this]() {return this->nbins_read; });
 }
 
+/* map the npix array of the file into memory.
+   Returns false if the mapping is not possible, so the npix array has to be read into the bin buffers */
+bool pix_mem_map::_map_npix() {
+    if (this->_nTotalBins == 0) {
+        return false;
+    }
+    uint64_t npix_length = uint64_t(this->_nTotalBins) * BIN_SIZE_BYTES;
+    // mapping has to start at the boundary of the mapping allocation unit
+#ifdef _WIN32
+    SYSTEM_INFO sys_info;
+    GetSystemInfo(&sys_info);
+    uint64_t granularity = sys_info.dwAllocationGranularity;
+#else
+    uint64_t granularity = uint64_t(sysconf(_SC_PAGESIZE));
+#endif
+    uint64_t map_start = this->_binFileStartPos - this->_binFileStartPos % granularity;
+    size_t shift = size_t(this->_binFileStartPos - map_start);
+    size_t length = size_t(npix_length) + shift;
+#ifdef _WIN32
+    HANDLE h_file = CreateFileA(this->full_file_name.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (h_file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    HANDLE h_mapping = CreateFileMappingA(h_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (h_mapping == NULL) {
+        CloseHandle(h_file);
+        return false;
+    }
+    void *base = MapViewOfFile(h_mapping, FILE_MAP_READ, DWORD(map_start >> 32), DWORD(map_start & 0xFFFFFFFF), length);
+    if (base == NULL) {
+        CloseHandle(h_mapping);
+        CloseHandle(h_file);
+        return false;
+    }
+    this->h_map_file = h_file;
+    this->h_mapping = h_mapping;
+#else
+    int fd = ::open(this->full_file_name.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    // access to the mapping beyond the end of file fails, so the file has to contain whole npix array
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || uint64_t(file_stat.st_size) < this->_binFileStartPos + npix_length) {
+        ::close(fd);
+        return false;
+    }
+    void *base = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, off_t(map_start));
+    // the mapping remains valid after the file is closed
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+#endif
+    this->map_base = base;
+    this->map_length = length;
+    this->mapped_npix = reinterpret_cast<const uint64_t *>(static_cast<const char *>(base) + shift);
+    return true;
+}
+/* release npix mapping and the pixel index built for it */
+void pix_mem_map::_unmap_npix() {
+    if (this->map_base) {
+#ifdef _WIN32
+        UnmapViewOfFile(this->map_base);
+        CloseHandle(this->h_mapping);
+        CloseHandle(this->h_map_file);
+        this->h_mapping = nullptr;
+        this->h_map_file = nullptr;
+#else
+        munmap(this->map_base, this->map_length);
+#endif
+    }
+    this->map_base = nullptr;
+    this->map_length = 0;
+    this->mapped_npix = nullptr;
+    this->page_first_pix.clear();
+    for (size_t i = 0; i < N_INDEX_PAGES; i++) {
+        this->index_cache[i] = index_page();
+    }
+}
+/* return positions of the pixels of all bins of the page of bins provided within pixel array.
+
+   Positions are calculated when the page is not in the index cache. The numbers of pixels, preceding the pages
+   are calculated once for all pages up to the page requested, so a page is calculated in time proportional
+   to the page size after all preceding pages have been accessed */
+const uint64_t *pix_mem_map::_get_index_page(size_t n_page) {
+    index_page &page = this->index_cache[n_page % N_INDEX_PAGES];
+    if (page.n_page == n_page) {
+        return page.pix_pos.data();
+    }
+    size_t n_pages = (this->_nTotalBins + INDEX_PAGE_BINS - 1) / INDEX_PAGE_BINS;
+    if (this->page_first_pix.empty()) {
+        this->page_first_pix.push_back(0);
+    }
+    while (this->page_first_pix.size() <= n_page) {
+        size_t first_bin = (this->page_first_pix.size() - 1) * INDEX_PAGE_BINS;
+        const uint64_t *pNpix = this->mapped_npix + first_bin;
+        this->page_first_pix.push_back(std::accumulate(pNpix, pNpix + INDEX_PAGE_BINS, this->page_first_pix.back()));
+    }
+    size_t first_bin = n_page * INDEX_PAGE_BINS;
+    size_t n_bins = std::min(INDEX_PAGE_BINS, this->_nTotalBins - first_bin);
+    page.pix_pos.resize(n_bins);
+    uint64_t pix_pos = this->page_first_pix[n_page];
+    for (size_t i = 0; i < n_bins; i++) {
+        page.pix_pos[i] = pix_pos;
+        pix_pos += this->mapped_npix[first_bin + i];
+    }
+    page.n_page = n_page;
+    if (n_page + 1 == this->page_first_pix.size() && n_page + 1 < n_pages) {
+        this->page_first_pix.push_back(pix_pos);
+    }
+    if (n_page + 1 == n_pages && !this->map_capacity_isknown) {
+        this->map_capacity_isknown = true;
+        this->_numPixInMap = pix_pos;
+    }
+    return page.pix_pos.data();
+}
@@ -12,6 +12,9 @@
 #include <condition_variable>
 
 #include <algorithm>
+#include <limits>
+#include "io_thread_pool.h"
+#include "block_reader.h"
 // Matlab includes
 #include <mex.h>
 
@@ -36,9 +39,17 @@ public:
 
     pix_mem_map();
 
-    void init(const std::string &full_file_name, size_t bin_start_pos, size_t n_tot_bins, size_t BufferSize, bool use_multithreading);
+    void init(const std::string &full_file_name, size_t bin_start_pos, size_t n_tot_bins, size_t BufferSize, bool use_multithreading,
+        bool map_npix = false);
+    /* true if the npix array is accessed through the memory mapping of the file */
+    bool is_npix_mapped()const { return this->mapped_npix != nullptr; }
     /* get number of pixels, stored in the bin and the position of these pixels within pixel array */
     void   get_npix_for_bin(size_t bin_number, size_t &pix_start_num, size_t &num_bin_pix);
+    /* get numbers of pixels, stored in n_bins bins starting from first_bin and the position of the first pixel
+       of the first bin within pixel array */
+    void   get_npix_for_bins(size_t first_bin, size_t n_bins, uint64_t *const npix, size_t &first_pix_num);
+    /* get numbers of pixels, stored in n_bins bins starting from first_bin */
+    void   get_npix_for_bins(size_t first_bin, size_t n_bins, uint64_t *const npix);
     /* expand memory map to accommodate and address the specified number of pixels. Returns maximal number of pixels
     to fit into buffer addressed by the integer number of bins */
     size_t check_expand_pix_map(size_t bin_number,size_t num_pix_to_fit, bool &end_of_pix_reached);
@@ -69,6 +80,11 @@ protected: // for testing
     bool _thread_get_data(size_t &num_bin, std::vector<bin_info> &inbuf, size_t &bin_end, size_t &buf_end);
     void _thread_query_data(size_t &num_first_bin, size_t &num_last_bin, size_t &buf_end);
     void _thread_request_to_read(size_t start_bin);
+
+    // memory mapped npix mode
+    bool _map_npix();
+    void _unmap_npix();
+    const uint64_t *_get_index_page(size_t n_page);
 private:
     // the name of the file to process
     std::string full_file_name;
@@ -90,7 +106,8 @@ private:
     size_t  BUF_EXTENSION_STEP;
 
 
-    // thread buffer and thread reading operations ;
+    // thread buffer and thread reading operations. Bins are read into the thread buffer by
+    // the requests, executed by the shared io_thread_pool;
     bool use_multithreading;
 protected: // for testing only
     bool nbins_read, read_job_completed,thread_read_to_end;
@@ -98,11 +115,12 @@ protected: // for testing only
 
     std::vector<bin_info>  thread_nbin_buffer;
     std::mutex  exchange_lock,bin_read_lock;
-    std::thread read_bins_job_holder;
-    std::condition_variable read_bins_needed, bins_ready;
-
+    std::condition_variable bins_ready;
 
+    // read next block of bins into the thread buffer. Executed by io_thread_pool
     void read_bins_job();
+    // mark thread buffer as free and submit request to read bins into it
+    void _submit_read_request();
 
 
     //void calc_buf_range(size_t num_bin, size_t buf_size, size_t &tot_num_bins_to_read);
@@ -112,7 +130,30 @@ private:
     static const long BIN_SIZE_BYTES = 8;
     size_t BIN_BUF_SIZE; // physical size of the bins buffer
     //
-    std::ifstream h_data_file_bin;
+    block_reader h_data_file_bin;
+
+    // Memory mapped npix mode. The npix array of the file is mapped into memory, so the numbers of pixels in bins
+    // are accessed directly from the OS page cache, shared by all readers of the file.
+    // The positions of the bin pixels are calculated lazily by pages of INDEX_PAGE_BINS bins.
+    const uint64_t *mapped_npix; // npix of the first bin within the mapping or nullptr if npix is not mapped
+    void *map_base;              // the beginning of the mapping
+    size_t map_length;           // the size of the mapping
+#ifdef _WIN32
+    void *h_map_file, *h_mapping;
+#endif
+    // mapped npix may be shared by readers of several threads, which access the pixel index under this lock
+    std::mutex index_lock;
+    // number of pixels preceding the first bin of every page of bins, calculated so far
+    std::vector<uint64_t> page_first_pix;
+    // positions of the pixels of every bin of a page, cached for N_INDEX_PAGES pages
+    struct index_page {
+        size_t n_page;
+        std::vector<uint64_t> pix_pos;
+        index_page() :n_page(std::numeric_limits<size_t>::max()) {}
+    };
+    static const size_t INDEX_PAGE_BINS = 65536;
+    static const size_t N_INDEX_PAGES = 4;
+    index_page index_cache[N_INDEX_PAGES];
 
 
 };
@@ -25,6 +25,28 @@ void sqw_pix_writer::init(const fileParameters& fpar, const size_t n_bins2proces
     this->pix_array_position = fpar.pix_start_pos;
     this->nbin_position = fpar.nbin_start_pos;
 }
+/*Initialize writer, which writes pixels of a range of bins into their final positions within the pixel array of
+the output file, while other writers write pixels of other ranges of bins.
+The file is opened for update, so the pixels are written at the positions requested rather than appended.
+Input:
+@param fpar           -- input parameters describing the output file
+@param n_bins2process -- number of the bin following the last bin of the range to write
+@param first_pix_num  -- number of the first pixel of the range within the combined pixel array
+*/
+void sqw_pix_writer::init(const fileParameters& fpar, const size_t n_bins2process, const size_t first_pix_num) {
+
+    this->num_bins_to_process = n_bins2process;
+    this->filename = fpar.fileName;
+    this->h_out_sqw.open(fpar.fileName, std::ofstream::binary | std::ofstream::out | std::ofstream::in);
+    if (!this->h_out_sqw.is_open()) {
+        std::string err = "SQW_PIX_WRITER: Can not open target sqw file: " + fpar.fileName;
+        mexErrMsgTxt(err.c_str());
+    }
+
+    this->last_pix_written = 0;
+    this->pix_array_position = fpar.pix_start_pos + first_pix_num * PIX_BLOCK_SIZE_BYTES;
+    this->nbin_position = fpar.nbin_start_pos;
+}
 /* Operation which runs on separate thread and writes pixels */
 void sqw_pix_writer::run_write_pix_job() {
 
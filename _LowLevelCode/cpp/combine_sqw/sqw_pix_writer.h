@@ -13,6 +13,7 @@ public:
         num_bins_to_process(0) {}
 
     void init(const fileParameters &fpar, const size_t nBins2Process);
+    void init(const fileParameters &fpar, const size_t nBins2Process, const size_t first_pix_num);
     void write_pixels(const char * const buffer, const size_t n_pix_to_write);
     void run_write_pix_job();
     void operator()() {
@@ -4,12 +4,13 @@
 //-----------  SQW READER (FOR SINGLE SQW FILE)  ---------------------------------------------------------------------
 //--------------------------------------------------------------------------------------------------------------------
 sqw_reader::sqw_reader() :
-    pix_map(),
+    pix_map(std::make_shared<pix_mem_map>()),
     _nPixInFile(0),
     npix_in_buf_start(0), buf_pix_end(0),
+    h_data_file_pix(std::make_shared<block_reader>()),
     PIX_BUF_SIZE(1024), change_fileno(false), fileno(true),
     n_first_threadbuf_pix(0),
-    use_multithreading_pix(false), pix_read(false), pix_read_job_completed(true)
+    use_multithreading_pix(false), pix_read_job_completed(true), pix_read(false)
 {}
 
 sqw_reader::~sqw_reader() {
@@ -17,13 +18,9 @@ sqw_reader::~sqw_reader() {
     //mexEvalString("pause(.002);");
      
     this->finish_read_job();
-    h_data_file_pix.close();
 }
-
-//
-void sqw_reader::init(const fileParameters &fpar, bool changefileno, size_t pix_buf_size, int multithreading_settings) {
-    
-    bool bin_multithreading(false),pix_multithreading(false);
+/* convert multithreading settings into the modes of reading bins and pixels */
+static void get_multithreading_modes(int multithreading_settings, bool &bin_multithreading, bool &pix_multithreading) {
     switch (multithreading_settings) {
     case(-1,0):
         bin_multithreading = false;
@@ -45,29 +42,56 @@ void sqw_reader::init(const fileParameters &fpar, bool changefileno, size_t pix_
         mexErrMsgTxt("Input multithreading parameter should be 0 (no multithreading) 1 (multithreading)"
             ", 2 (debug mode, only bin thread used for reading ) or 3 (debug mode , use pix read thread, and disable bin read threading)");
     }
+}
 
+//
+void sqw_reader::init(const fileParameters &fpar, bool changefileno, size_t pix_buf_size, int multithreading_settings,
+    bool map_npix) {
+    
+    bool bin_multithreading(false),pix_multithreading(false);
+    get_multithreading_modes(multithreading_settings, bin_multithreading, pix_multithreading);
+
+    this->finish_read_job();
     this->fileDescr = fpar;
-    if (h_data_file_pix.is_open()) {
-        h_data_file_pix.close();
+    this->change_fileno = changefileno;
+
+    this->pix_map = std::make_shared<pix_mem_map>();
+    this->pix_map->init(fpar.fileName, fpar.nbin_start_pos, fpar.total_NfileBins, pix_buf_size, bin_multithreading, map_npix);
+
+    this->_init_pix_read(pix_buf_size, pix_multithreading, nullptr);
+}
+//
+void sqw_reader::init(sqw_reader &source, size_t pix_buf_size, int multithreading_settings) {
+
+    bool bin_multithreading(false), pix_multithreading(false);
+    get_multithreading_modes(multithreading_settings, bin_multithreading, pix_multithreading);
+
+    this->finish_read_job();
+    this->fileDescr = source.fileDescr;
+    this->change_fileno = source.change_fileno;
+
+    if (source.pix_map->is_npix_mapped()) {
+        this->pix_map = source.pix_map;
     }
-    if (this->use_multithreading_pix && !this->pix_read_job_completed){
-        this->finish_read_job();
+    else {
+        this->pix_map = std::make_shared<pix_mem_map>();
+        this->pix_map->init(fileDescr.fileName, fileDescr.nbin_start_pos, fileDescr.total_NfileBins, pix_buf_size,
+            bin_multithreading);
     }
-
+    this->_init_pix_read(pix_buf_size, pix_multithreading, source.h_data_file_pix);
+}
+/* allocate pixel buffers, open the file to read pixels from or use the shared file handle provided, if it
+   supports concurrent reads, and start reading pixels on io_thread_pool if requested */
+void sqw_reader::_init_pix_read(size_t pix_buf_size, bool pix_multithreading, const std::shared_ptr<block_reader> &shared_file) {
 
     _nPixInFile = 0;
     npix_in_buf_start = 0;
     buf_pix_end = 0;
 
-    this->pix_map.init(fpar.fileName, fpar.nbin_start_pos, fpar.total_NfileBins, pix_buf_size, bin_multithreading);
-
     if (pix_buf_size != 0) {
         this->PIX_BUF_SIZE = pix_buf_size;
         this->pix_buffer.resize(PIX_BUF_SIZE*PIX_SIZE);
         this->use_streambuf_direct = false;
-        // set up unbuffered IO.
-        h_data_file_pix.rdbuf()->pubsetbuf(0, 0);
-        //
     }
     else {
         this->use_streambuf_direct = true;
@@ -77,21 +101,24 @@ void sqw_reader::init(const fileParameters &fpar, bool changefileno, size_t pix_
     }
 
 
-    h_data_file_pix.open(this->fileDescr.fileName, std::ios::in | std::ios::binary);
-    if (!h_data_file_pix.is_open()) {
+    // pixels are read into the buffers by unbuffered positioned reads or through the stream buffer in direct mode
+    if (shared_file && shared_file->is_shareable() && !this->use_streambuf_direct) {
+        this->h_data_file_pix = shared_file;
+    }
+    else {
+        this->h_data_file_pix = std::make_shared<block_reader>();
+        h_data_file_pix->open(this->fileDescr.fileName, this->use_streambuf_direct);
+    }
+    if (!h_data_file_pix->is_open()) {
         std::string error("Can not open file: ");
         error += this->fileDescr.fileName;
         mexErrMsgTxt(error.c_str());
     }
 
-    this->change_fileno = changefileno;
-
     // read number of pixels defined in the file
-    std::streamoff pix_pos = this->fileDescr.pix_start_pos - 8;
-    auto pbuf = h_data_file_pix.rdbuf();
-    pbuf->pubseekpos(pix_pos);
+    uint64_t pix_pos = this->fileDescr.pix_start_pos - 8;
     char *buffer = reinterpret_cast<char *>(&_nPixInFile);
-    pbuf->sgetn(buffer, 8);
+    h_data_file_pix->read(pix_pos, buffer, 8);
     if (this->_nPixInFile == 0) {
         return; // file does not have pixels. 
     }
@@ -104,8 +131,8 @@ void sqw_reader::init(const fileParameters &fpar, bool changefileno, size_t pix_
         this->n_first_threadbuf_pix = 0;
         this->num_treadbuf_pix = 0;
 
-        std::thread read_pix([this]() {this->read_pixels_job(); });
-        read_pix_job_holder.swap(read_pix);
+        std::lock_guard<std::mutex> read_lock(this->pix_read_lock);
+        this->_submit_read_request();
     }
 }
 
@@ -130,7 +157,7 @@ void sqw_reader::get_pix_for_bin(size_t bin_number, float *const pix_info, size_
     size_t out_buf_start = buf_position*PIX_SIZE;
 
     if (!position_is_defined) {
-        this->pix_map.get_npix_for_bin(bin_number, pix_start_num, num_bin_pix);
+        this->pix_map->get_npix_for_bin(bin_number, pix_start_num, num_bin_pix);
     }
     if (num_bin_pix == 0) return;
 
@@ -144,6 +171,61 @@ void sqw_reader::get_pix_for_bin(size_t bin_number, float *const pix_info, size_
         }
     }
 }
+/* return pointer to the pixels, starting from the pixel pix_start_num
+* @param pix_start_num    -- number of the first pixel to return within the pixels array
+* @returns num_pix_available -- number of pixels available in the buffer after the first pixel
+*/
+const float *sqw_reader::get_pix_range(size_t pix_start_num, size_t &num_pix_available) {
+    if (pix_start_num < this->npix_in_buf_start || pix_start_num >= this->buf_pix_end) {
+        this->_update_range_cash(pix_start_num);
+    }
+    num_pix_available = this->buf_pix_end - pix_start_num;
+    return &this->pix_buffer[(pix_start_num - this->npix_in_buf_start) * PIX_SIZE];
+}
+/* fill pixel buffer with the pixels starting from the pixel requested. Takes the pixels read by io_thread_pool
+   if they are available and requests the pool to read the following block of pixels */
+void sqw_reader::_update_range_cash(size_t pix_start_num) {
+    if (pix_start_num >= this->_nPixInFile) {
+        mexErrMsgTxt("SQW_READER::get_pix_range =>Trying to read pixel outside of the pixel range");
+    }
+    if (this->pix_buffer.empty()) { // direct mode does not use pixel buffer for reading bins
+        this->pix_buffer.resize(PIX_BUF_DEFAULT_SIZE * PIX_SIZE);
+    }
+    size_t num_pix_to_read = this->pix_buffer.size() / PIX_SIZE;
+    if (this->use_multithreading_pix) {
+        size_t first_thbuf_pix, last_thbuf_pix, n_thrbuf_pix;
+        bool job_completed = this->_get_thread_pix_param(first_thbuf_pix, last_thbuf_pix, n_thrbuf_pix);
+        if (!job_completed) {
+            if (pix_start_num >= first_thbuf_pix && pix_start_num < last_thbuf_pix) {
+                // take the pixels read by the thread and request the following block
+                this->_get_thread_data(first_thbuf_pix, n_thrbuf_pix, this->pix_buffer, last_thbuf_pix);
+                this->npix_in_buf_start = first_thbuf_pix;
+                this->buf_pix_end = first_thbuf_pix + n_thrbuf_pix;
+                return;
+            }
+            // Cash missed. Request the thread to read the block following the one read here.
+            this->_get_thread_data(first_thbuf_pix, n_thrbuf_pix, this->pix_buffer, pix_start_num + num_pix_to_read);
+            num_pix_to_read = this->pix_buffer.size() / PIX_SIZE;
+        }
+        std::lock_guard<std::mutex> read_lock(this->pix_read_lock);
+        this->_read_pix(pix_start_num, &this->pix_buffer[0], num_pix_to_read);
+    }
+    else {
+        this->_read_pix(pix_start_num, &this->pix_buffer[0], num_pix_to_read);
+    }
+    this->npix_in_buf_start = pix_start_num;
+    this->buf_pix_end = pix_start_num + num_pix_to_read;
+}
+//
+bool sqw_reader::pix_ready_for(size_t pix_start_num, size_t num_bin_pix)const {
+    if (num_bin_pix == 0 || !this->use_multithreading_pix) {
+        return true;
+    }
+    if (pix_start_num >= this->npix_in_buf_start && pix_start_num + num_bin_pix <= this->buf_pix_end) {
+        return true;
+    }
+    return this->pix_read.load();
+}
 /*
  read pixels information, corresponding to the bin with the number requested
 
@@ -170,7 +252,7 @@ void sqw_reader::_update_cash(size_t bin_number, size_t pix_start_num, size_t nu
         else {
             pix_buf_size = this->pix_buffer.size() / PIX_SIZE;
         }
-        num_pix_to_read = this->pix_map.check_expand_pix_map(bin_number, pix_buf_size, end_of_pixmap_reached);
+        num_pix_to_read = this->pix_map->check_expand_pix_map(bin_number, pix_buf_size, end_of_pixmap_reached);
     }
     size_t num_pix_in_buffer;
     if (this->use_multithreading_pix) {
@@ -224,15 +306,13 @@ void sqw_reader::_update_cash(size_t bin_number, size_t pix_start_num, size_t nu
 bool sqw_reader::_get_thread_pix_param(size_t &first_thbuf_pix, size_t &last_thbuf_pix, size_t &n_buf_pix){
 
     std::unique_lock<std::mutex> lock(this->pix_exchange_lock);
-    this->pix_ready.wait(lock, [this]() {return this->pix_read; });
+    this->pix_ready.wait(lock, [this]() {return this->pix_read.load(); });
 
     std::lock_guard<std::mutex> read_lock(this->pix_read_lock);
     if (this->pix_read_job_completed) {
-        this->pix_read = false;
         n_buf_pix = 0;
         first_thbuf_pix = 0;
         last_thbuf_pix = 0;
-        this->read_pix_needed.notify_one();
         return true;
     }
 
@@ -247,12 +327,10 @@ bool sqw_reader::_get_thread_pix_param(size_t &first_thbuf_pix, size_t &last_thb
 void sqw_reader::_get_thread_data(size_t &first_buf_pix, size_t &n_pix_in_buf, std::vector<float> &pixbuf, size_t next_pix_to_read) {
     //
     std::unique_lock<std::mutex> lock(this->pix_exchange_lock);
-    this->pix_ready.wait(lock, [this]() {return this->pix_read; });
+    this->pix_ready.wait(lock, [this]() {return this->pix_read.load(); });
     {
         std::lock_guard<std::mutex> read_lock(this->pix_read_lock);
         if (this->pix_read_job_completed) {
-            this->pix_read = false;
-            this->read_pix_needed.notify_one();
             return;
         }
         bool buf_size_changed(false);
@@ -264,36 +342,34 @@ void sqw_reader::_get_thread_data(size_t &first_buf_pix, size_t &n_pix_in_buf, s
         n_pix_in_buf  = this->num_treadbuf_pix;
         this->thread_pix_buffer.swap(pixbuf);
         this->n_first_threadbuf_pix = next_pix_to_read;
-        this->pix_read = false;
 
         if (buf_size_changed) {
             size_t nex_size = this->thread_pix_buffer.size();
             this->PIX_BUF_SIZE = nex_size / PIX_SIZE;
             pixbuf.resize(nex_size);
         }
+        this->_submit_read_request();
     }
-    this->read_pix_needed.notify_one();
-
-
+}
+/* mark thread buffer as containing no data and request io_thread_pool to read pixels into it.
+   No requests are submitted when read job has been finished */
+void sqw_reader::_submit_read_request() {
+    if (this->pix_read_job_completed) {
+        return;
+    }
+    this->pix_read = false;
+    io_thread_pool::instance().submit([this]() {this->read_pixels_job(); });
 }
 //
 
+/* read the block of pixels, starting from n_first_threadbuf_pix into the thread buffer and notify the
+   consumer that the data are ready. Nothing is read if the read job has been finished. */
 void sqw_reader::read_pixels_job() {
+    {
+        std::lock_guard<std::mutex> read_lock(this->pix_read_lock);
 
-    std::unique_lock<std::mutex> lock(this->pix_exchange_lock);
-
-    while (!this->pix_read_job_completed) {
-        this->read_pix_needed.wait(lock, [this]() {return (!this->pix_read) || this->pix_read_job_completed; });
-        {
-            std::lock_guard<std::mutex> read_lock(this->pix_read_lock);
-
-            if (this->pix_read_job_completed) {
-                this->pix_read = true;
-                this->pix_ready.notify_one();
-                return;
-            }
-
-            size_t n_pix_to_read = thread_pix_buffer.size()/PIX_SIZE;
+        if (!this->pix_read_job_completed) {
+            size_t n_pix_to_read = thread_pix_buffer.size() / PIX_SIZE;
             if (this->n_first_threadbuf_pix + n_pix_to_read >= this->_nPixInFile) {
                 n_pix_to_read = this->_nPixInFile - this->n_first_threadbuf_pix;
             }
@@ -302,41 +378,27 @@ void sqw_reader::read_pixels_job() {
                 this->_read_pix(this->n_first_threadbuf_pix, &thread_pix_buffer[0], n_pix_to_read);
             }
             this->num_treadbuf_pix = n_pix_to_read;
-            this->pix_read = true;
         }
-        this->pix_ready.notify_one();
     }
-
+    // notify under lock, as the reader may be destroyed as soon as the consumer sees data ready
+    std::lock_guard<std::mutex> lock(this->pix_exchange_lock);
+    this->pix_read = true;
+    this->pix_ready.notify_all();
 }
 //
 void sqw_reader::finish_read_job() {
-    //mexPrintf("|MEX::COMBINE_SQW: in finish read job for file N %d  |",this->fileDescr.run_id);
-    //mexEvalString("pause(.002);");
-    
-    this->pix_map.finish_read_bin_job();
-    //mexPrintf(" completed pix map job|");
-    //mexEvalString("pause(.002);");
-    
+    this->pix_map->finish_read_bin_job();
 
     if (!this->use_multithreading_pix || this->pix_read_job_completed) {
         return;
     }
-    if (!read_pix_job_holder.joinable()) {
-        return;
-    }
-
     {
         std::lock_guard<std::mutex> read_lock(this->pix_read_lock);
-
         this->pix_read_job_completed = true;
-        // finish incomplete read job if it has not been finished naturally
-        this->pix_read = false;
     }
-    this->read_pix_needed.notify_one();
-    read_pix_job_holder.join();
-    //mexPrintf(" completed pix read job|\n",this->fileDescr.run_id);
-    //mexEvalString("pause(.002);");
-
+    // wait until the last submitted read request is completed
+    std::unique_lock<std::mutex> lock(this->pix_exchange_lock);
+    this->pix_ready.wait(lock, [this]() {return this->pix_read.load(); });
 }
 
 
@@ -351,15 +413,11 @@ void sqw_reader::_read_pix(size_t pix_start_num, float *const pix_buffer, size_t
         num_pix_to_read = this->_nPixInFile - pix_start_num;
     }
 
-    std::streamoff pix_pos = this->fileDescr.pix_start_pos + pix_start_num*PIX_SIZE_BYTES;
-    auto pbuf = h_data_file_pix.rdbuf();
-    pbuf->pubseekpos(pix_pos);
+    uint64_t pix_pos = this->fileDescr.pix_start_pos + pix_start_num*PIX_SIZE_BYTES;
 
     //
     char * buffer = reinterpret_cast<char *>(pix_buffer);
-    std::streamoff length = num_pix_to_read*PIX_SIZE_BYTES;
-    //pbuf->pubsetbuf(buffer, length);
-    pbuf->sgetn(buffer, length);
+    h_data_file_pix->read(pix_pos, buffer, num_pix_to_read*PIX_SIZE_BYTES);
 
 
     if (this->change_fileno) {
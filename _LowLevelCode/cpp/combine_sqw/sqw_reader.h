@@ -2,6 +2,9 @@
 #define H_SQW_READER
 
 #include "pix_mem_map.h"
+#include "block_reader.h"
+#include <atomic>
+#include <memory>
 #include "../file_parameters/fileParameters.h"
 //-----------------------------------------------------------------------------------------------------------------
 class sqw_reader
@@ -16,18 +19,34 @@ class sqw_reader
 public:
     sqw_reader();
     ~sqw_reader();
-    void init(const fileParameters &fpar, bool changefileno, size_t working_buf_size = 4096, int use_multithreading = 0);
+    void init(const fileParameters &fpar, bool changefileno, size_t working_buf_size = 4096, int use_multithreading = 0,
+        bool map_npix = false);
+    /* initialize the reader of the file, opened by the source reader, to read other range of its pixels.
+       The reader shares the pixel file handle and the npix map with the source where they may be accessed
+       concurrently, i.e. the file is read by positioned reads and the npix array is mapped into memory,
+       and opens the file again otherwise */
+    void init(sqw_reader &source, size_t working_buf_size = 4096, int use_multithreading = 0);
     /* return pixel information for the pixels stored in the bin */
     void get_pix_for_bin(size_t bin_number, float *const pix_info, size_t cur_buf_position,
         size_t &pix_start_num, size_t &num_bin_pix, bool position_is_defined = false);
 
+    /* return pointer to the pixels starting from the pixel pix_start_num and the number of pixels available
+       contiguously from this position. Pixels are read by blocks of the pixel buffer size regardless of bins */
+    const float *get_pix_range(size_t pix_start_num, size_t &num_pix_available);
+    /* return true if pixels of the bin, defined by their position and number, can be returned
+       without waiting for the read request, executed by io_thread_pool */
+    bool pix_ready_for(size_t pix_start_num, size_t num_bin_pix)const;
+
     size_t get_npix()const{return _nPixInFile;}
     void finish_read_job();
 
-    pix_mem_map & get_pix_map(){return pix_map;}
+    pix_mem_map & get_pix_map(){return *pix_map;}
 
 private:
     void _update_cash(size_t bin_number, size_t pix_start_num, size_t num_pix_in_bin, float *const pix_info);
+    void _update_range_cash(size_t pix_start_num);
+    // allocate pixel buffers, open pixel file or use the shared one and start reading pixels
+    void _init_pix_read(size_t pix_buf_size, bool pix_multithreading, const std::shared_ptr<block_reader> &shared_file);
 
     void _read_pix(size_t pix_start_num, float *const pix_buffer, size_t &num_pix_to_read);
     bool _get_thread_pix_param(size_t &first_thbuf_pix, size_t &last_thbuf_pix, size_t &n_tot_pix);
@@ -36,7 +55,7 @@ private:
 
     // parameters, which describe file 
     fileParameters fileDescr;
-    pix_mem_map pix_map;
+    std::shared_ptr<pix_mem_map> pix_map;
     // number of pixels, stored in the map;
     size_t _nPixInFile;
 
@@ -47,7 +66,7 @@ private:
     std::vector<float> pix_buffer; // buffer containing pixels (9*npix size)
 
     bool use_streambuf_direct;
-    std::ifstream h_data_file_pix;
+    std::shared_ptr<block_reader> h_data_file_pix;
 
 
    // number of pixels to read in pix buffer
@@ -63,15 +82,19 @@ private:
     static const size_t PIX_BUF_DEFAULT_SIZE = 512; // in pixels, real size x 9;
 
 
-    // thread buffer and thread reading operations ;
+    // thread buffer and thread reading operations. Pixels are read into the thread buffer by
+    // the requests, executed by the shared io_thread_pool;
     std::mutex pix_read_lock, pix_exchange_lock;
-    bool use_multithreading_pix, pix_read, pix_read_job_completed;
+    bool use_multithreading_pix, pix_read_job_completed;
+    std::atomic<bool> pix_read; // thread buffer contains data, checked by pix_ready_for without locking
     size_t n_first_threadbuf_pix,num_treadbuf_pix;
     std::vector<float> thread_pix_buffer;
-    std::condition_variable pix_ready, read_pix_needed;
-    std::thread read_pix_job_holder;
+    std::condition_variable pix_ready;
 
+    // read next block of pixels into the thread buffer. Executed by io_thread_pool
     void read_pixels_job();
+    // mark thread buffer as free and submit request to read pixels into it. Called with pix_read_lock locked
+    void _submit_read_request();
 
 
 
@@ -2,47 +2,236 @@
 
 #include <include/CommonCode.h>
 
-template <class T>
-void compute_pix_sums(double *const pSignal, double *const pVariance,
-                        size_t distr_size, double const *const pNpix,
-                        T const *const pPixelData, size_t nPixels,
-                        int num_OMP_Threads) {
-
-  omp_set_num_threads(num_OMP_Threads);
-  size_t pixProcessed = 0;
-  std::vector<size_t> cumSumData;
-  bool multithreaded(false);
-  if (num_OMP_Threads > 1) {
-    multithreaded = true;
-    cumSumData.resize(distr_size + 1);
-    cumSumData[0] = 0;
-    for (size_t i = 1; i <= distr_size; i++) {
-      cumSumData[i] = cumSumData[i - 1] + size_t(pNpix[i - 1]);
-    }
-  }
-
-#pragma omp parallel
-  {
-#pragma omp for
-    for (long i = 0; i < distr_size; i++) {
-      pSignal[i] = 0;
-      pVariance[i] = 0;
-    }
-#pragma omp for
-    for (long i = 0; i < distr_size; i++) {
+#include <cmath>
+#include <limits>
+
+/* Reductions which may be calculated over pixels of every bin.
+ * NaN values of the field are omitted by all reductions, unless the reductions
+ * are requested to propagate NaN. Then every reduction but red_count of a bin
+ * containing NaN is NaN and red_count counts all values */
+enum pix_reduction {
+  red_sum,      // sum of the field values
+  red_sum_sq,   // sum of squares of the field values
+  red_mean,     // average of the field values (0 for bins without values)
+  red_variance, // population variance of the field values (0 for bins without values)
+  red_min,      // minimal value (NaN for bins without values)
+  red_max,      // maximal value (NaN for bins without values)
+  red_count,    // number of values
+  N_REDUCTIONS
+};
+/* Request to reduce pixel field "field" (pix_flds) with reduction "operation"
+ * and place the result for every bin into the array "result" of distr_size
+ * elements */
+struct pix_reduction_request {
+  size_t field;
+  pix_reduction operation;
+  double *result;
+};
+// minimal number of bins processed by a thread while calculating the
+// positions of the first pixels of the bins
+constexpr size_t PIX_SUMS_MIN_BINS_PER_CHUNK = 4096;
+// number of chunks of bins per thread, used for balancing threads load
+constexpr size_t PIX_SUMS_CHUNKS_PER_THREAD = 4;
+
+/* Accumulators of all reductions of a single field over pixels of a bin. */
+struct bin_field_reductions {
+  double sum{0}, sum_sq{0}, count{0}, mean{0}, m2{0};
+  double min{std::numeric_limits<double>::quiet_NaN()};
+  double max{std::numeric_limits<double>::quiet_NaN()};
+  bool has_nan{false};
+  // values are counted and added into sums, min/max and variance
+  // accumulators (Welford algorithm). NaN values are either omitted or mark
+  // the bin as containing NaN
+  template <bool OMIT_NAN> void add_stat(double val) {
+    if (std::isnan(val)) {
+      if constexpr (!OMIT_NAN) {
+        has_nan = true;
+        count += 1;
+      }
+      return;
+    }
+    sum += val;
+    sum_sq += val * val;
+    count += 1;
+    double delta = val - mean;
+    mean += delta / count;
+    m2 += delta * (val - mean);
+    if (!(val >= min)) { // true for NaN min of empty accumulator
+      min = val;
+    }
+    if (!(val <= max)) {
+      max = val;
+    }
+  }
+  double get(pix_reduction operation) const {
+    if (has_nan && operation != red_count) {
+      return std::numeric_limits<double>::quiet_NaN();
+    }
+    switch (operation) {
+    case red_sum:
+      return sum;
+    case red_sum_sq:
+      return sum_sq;
+    case red_mean:
+      return count > 0 ? sum / count : 0;
+    case red_variance:
+      return count > 0 ? m2 / count : 0;
+    case red_min:
+      return min;
+    case red_max:
+      return max;
+    default:
+      return count;
+    }
+  }
+};
+
+/* Calculate the requested reductions of the pixel fields over pixels of each
+ * bin in a single pass over the page of pixels, sorted by bins. The page may be
+ * interleaved or column-oriented.
+ *
+ * Bins are split into chunks. Numbers of pixels in the chunks are summed in
+ * parallel and scanned into the positions of the first pixel of every chunk,
+ * so every chunk is then reduced independently without calculating the
+ * position of every bin in advance.
+ *
+ * If OMIT_NAN is true, NaN values are omitted by all reductions, otherwise
+ * they propagate into all reductions but red_count.
+ */
+template <bool OMIT_NAN, class PIX>
+void reduce_pix_page(const std::vector<pix_reduction_request> &requests,
+                     size_t distr_size, double const *const pNpix,
+                     const PIX &pix, int num_OMP_Threads) {
+  if (distr_size == 0 || requests.empty()) {
+    return;
+  }
+  for (const auto &req : requests) {
+    if (req.field >= pix_flds::PIX_WIDTH || req.operation >= N_REDUCTIONS ||
+        req.result == nullptr) {
+      throw("compute_pix_reductions: invalid reduction requested");
+    }
+  }
+  // distinct fields to reduce. Fields where only sums are requested are
+  // summed by the fast loop
+  std::vector<size_t> fields;
+  std::vector<bool> sum_only;
+  std::vector<size_t> request_field(requests.size());
+  for (size_t nr = 0; nr < requests.size(); nr++) {
+    size_t nf = 0;
+    for (; nf < fields.size(); nf++) {
+      if (fields[nf] == requests[nr].field)
+        break;
+    }
+    if (nf == fields.size()) {
+      fields.push_back(requests[nr].field);
+      sum_only.push_back(true);
+    }
+    if (requests[nr].operation != red_sum) {
+      sum_only[nf] = false;
+    }
+    request_field[nr] = nf;
+  }
+  size_t n_fields = fields.size();
+
+  size_t n_threads = size_t(std::max(num_OMP_Threads, 1));
+  size_t n_chunks = std::min(n_threads * PIX_SUMS_CHUNKS_PER_THREAD,
+                             distr_size / PIX_SUMS_MIN_BINS_PER_CHUNK);
+  if (n_threads < 2 || n_chunks < 2) {
+    n_chunks = 1;
+    n_threads = 1;
+  }
+  // parallel prefix scan: positions of the first pixel of every chunk
+  std::vector<size_t> chunk_start(n_chunks + 1, 0);
+#pragma omp parallel for num_threads(int(n_threads))
+  for (long nc = 0; nc < (long)n_chunks; nc++) {
+    size_t bin_begin = (distr_size * nc) / n_chunks;
+    size_t bin_end = (distr_size * (nc + 1)) / n_chunks;
+    size_t chunk_npix = 0;
+    for (size_t i = bin_begin; i < bin_end; i++) {
+      chunk_npix += size_t(pNpix[i]);
+    }
+    chunk_start[nc + 1] = chunk_npix;
+  }
+  for (size_t nc = 0; nc < n_chunks; nc++) {
+    chunk_start[nc + 1] += chunk_start[nc];
+  }
+  if (chunk_start[n_chunks] > pix.size()) {
+    throw("compute_pix_reductions: number of pixels in bins exceeds number of "
+          "pixels provided");
+  }
+
+#pragma omp parallel for schedule(dynamic, 1) num_threads(int(n_threads))
+  for (long nc = 0; nc < (long)n_chunks; nc++) {
+    size_t bin_begin = (distr_size * nc) / n_chunks;
+    size_t bin_end = (distr_size * (nc + 1)) / n_chunks;
+    size_t pix0 = chunk_start[nc];
+    std::vector<bin_field_reductions> acc(n_fields);
+    for (size_t i = bin_begin; i < bin_end; i++) {
       size_t npix_in_bin = (size_t)pNpix[i];
-      size_t pix0;
-      if (multithreaded) {  // multithreaded mode
-        pix0 = cumSumData[i];
-      } else {  // single threaded mode
-        pix0 = pixProcessed;
-        pixProcessed += npix_in_bin;
+      for (size_t nf = 0; nf < n_fields; nf++) {
+        const size_t fld = fields[nf];
+        acc[nf] = bin_field_reductions();
+        if (sum_only[nf]) {
+          double sum = 0;
+          for (size_t ip = 0; ip < npix_in_bin; ip++) {
+            double val = pix(pix0 + ip, fld);
+            if constexpr (OMIT_NAN) {
+              if (std::isnan(val))
+                continue;
+            }
+            sum += val;
+          }
+          acc[nf].sum = sum;
+        } else {
+          for (size_t ip = 0; ip < npix_in_bin; ip++) {
+            acc[nf].add_stat<OMIT_NAN>(pix(pix0 + ip, fld));
+          }
+        }
       }
-      for (size_t ip = 0; ip < npix_in_bin; ip++) {
-        size_t index = (pix0 + ip) * pix_flds::PIX_WIDTH;
-          pSignal[i] += pPixelData[index + pix_flds::iSign];
-        pVariance[i] += pPixelData[index + pix_flds::iErr];
+      for (size_t nr = 0; nr < requests.size(); nr++) {
+        requests[nr].result[i] =
+            acc[request_field[nr]].get(requests[nr].operation);
       }
+      pix0 += npix_in_bin;
     }
-  } // end parallel block
+  }
+}
+
+// reduce the page of pixels using the view specialised for the layout of the
+// page. NaN values are omitted, unless omit_nan is false
+template <class T>
+void compute_pix_reductions(const std::vector<pix_reduction_request> &requests,
+                            size_t distr_size, double const *const pNpix,
+                            const pix_page_view<T> &pix, int num_OMP_Threads,
+                            bool omit_nan = true) {
+  with_pix_layout(pix, [&](const auto &page) {
+    if (omit_nan) {
+      reduce_pix_page<true>(requests, distr_size, pNpix, page, num_OMP_Threads);
+    } else {
+      reduce_pix_page<false>(requests, distr_size, pNpix, page,
+                             num_OMP_Threads);
+    }
+  });
+}
+
+/* Calculate signal and variance of each bin from the page of pixels, sorted by
+ * bins. The page may be interleaved or column-oriented. As with summing pixels
+ * in MATLAB, NaN values propagate into the sums */
+template <class T>
+void compute_pix_sums(double *const pSignal, double *const pVariance,
+                      size_t distr_size, double const *const pNpix,
+                      const pix_page_view<T> &pix, int num_OMP_Threads) {
+  std::vector<pix_reduction_request> requests{
+      {pix_flds::iSign, red_sum, pSignal}, {pix_flds::iErr, red_sum, pVariance}};
+  compute_pix_reductions<T>(requests, distr_size, pNpix, pix, num_OMP_Threads,
+                            false);
+}
+// Calculate signal and variance of each bin from 9xnPixels array of pixels
+template <class T>
+void compute_pix_sums(double *const pSignal, double *const pVariance,
+                      size_t distr_size, double const *const pNpix,
+                      T const *const pPixelData, size_t nPixels,
+                      int num_OMP_Threads) {
+  compute_pix_sums<T>(pSignal, pVariance, distr_size, pNpix,
+                      pix_page_view<T>(pPixelData, nPixels), num_OMP_Threads);
 }
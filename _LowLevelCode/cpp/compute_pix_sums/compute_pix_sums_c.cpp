@@ -20,21 +20,26 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
   // npix can be 1-D to 4D double array
   const double *const pNpix = get_npix_array(prhs);
 
-  const double *const pPixelData = get_pixel_array(prhs);
+  const int n_threads = get_num_threads(nrhs, prhs);
 
-  const int n_threads = get_num_threads(prhs);
-
-  mxClassID pix_data_class{mxGetClassID(prhs[Pixel_data])};
-
-  const std::size_t nPixels = mxGetN(prhs[Pixel_data]);
+  mxClassID pix_data_class{get_pix_page_class(prhs[Pixel_data])};
 
   /***************************************************************************/
   /* Define outputs */
   mwSize num_of_dims = mxGetNumberOfDimensions(prhs[Npix_data]);
   const mwSize *p_dims = mxGetDimensions(prhs[Npix_data]);
 
-  double *pSignal = get_output_signal_ptr(num_of_dims, p_dims, plhs);
-  double *pVariance = get_output_variance_ptr(num_of_dims, p_dims, plhs);
+  std::vector<pix_reduction_request> requests =
+      get_reductions(nlhs, plhs, nrhs, prhs);
+  // requested reductions omit NaN values while signal and variance sums
+  // propagate them
+  const bool omit_nan = !requests.empty();
+  if (requests.empty()) { // signal and variance sums
+    double *pSignal = get_output_signal_ptr(num_of_dims, p_dims, plhs);
+    double *pVariance = get_output_variance_ptr(num_of_dims, p_dims, plhs);
+    requests = {{pix_flds::iSign, red_sum, pSignal},
+                {pix_flds::iErr, red_sum, pVariance}};
+  }
 
   /***************************************************************************/
   /* Do calculations */
@@ -45,12 +50,13 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
 
   try {
     if (pix_data_class == mxDOUBLE_CLASS) {
-      compute_pix_sums<double>(pSignal, pVariance, distr_size, pNpix,
-                                 pPixelData, nPixels, n_threads);
+      compute_pix_reductions<double>(requests, distr_size, pNpix,
+                                     get_pix_page<double>(prhs), n_threads,
+                                     omit_nan);
     } else if (pix_data_class == mxSINGLE_CLASS) {
-      float const *const fPixData = (float *)pPixelData;
-      compute_pix_sums<float>(pSignal, pVariance, distr_size, pNpix, fPixData,
-                                nPixels, n_threads);
+      compute_pix_reductions<float>(requests, distr_size, pNpix,
+                                    get_pix_page<float>(prhs), n_threads,
+                                    omit_nan);
     } else {
       throw("Invalid data type for pixel array. Must be float or double.");
     }
@@ -5,7 +5,7 @@
 
 void validate_inputs(const int &nlhs, mxArray *plhs[], const int &nrhs,
                      const mxArray *prhs[]) {
-  if (nrhs != N_INPUT_Arguments && nrhs != N_INPUT_Arguments - 1) {
+  if (nrhs < Num_threads || nrhs > N_INPUT_Arguments) {
     std::stringstream buf;
     buf << "ERROR::compute_pix_sums_c needs " << (short)N_INPUT_Arguments
         << " but got " << (short)nrhs << " input arguments and " << (short)nlhs
@@ -13,14 +13,14 @@ void validate_inputs(const int &nlhs, mxArray *plhs[], const int &nrhs,
     mexErrMsgTxt(buf.str().c_str());
   }
 
-  if (nlhs != N_OUTPUT_Arguments) {
+  if (nrhs <= Reductions && nlhs != N_OUTPUT_Arguments) {
     std::stringstream buf;
     buf << "ERROR::compute_pix_sums_c needs " << (short)N_OUTPUT_Arguments
         << " outputs but requested to return" << (short)nlhs << " arguments\n";
     mexErrMsgTxt(buf.str().c_str());
   }
 
-  for (int i = 0; i < nrhs - 1; i++) {
+  for (int i = 0; i < nrhs; i++) {
     if (prhs[i] == NULL) {
       std::stringstream buf;
       buf << "ERROR::compute_pix_sums_c => argument N" << i << " undefined\n";
@@ -38,24 +38,29 @@ const double *const get_npix_array(const mxArray *prhs[]) {
   return p_npix_data;
 }
 
-const double *const get_pixel_array(const mxArray *prhs[]) {
-  // Validate number of pixel data columns
-  std::size_t nPixDataCols = mxGetM(prhs[Pixel_data]);
-  if (nPixDataCols != pix_flds::PIX_WIDTH) {
-    mexErrMsgTxt("ERROR::compute_pix_sums_c-> the pixel data should be a "
-                 "9*num_of_pixels array");
+template <class T>
+pix_page_view<T> get_pix_page(const mxArray *prhs[]) {
+  pix_page_view<T> pix;
+  auto err = get_pix_page_view<T>(prhs[Pixel_data], pix);
+  if (!err.empty()) {
+    std::string buf = "ERROR::compute_pix_sums_c-> " + err +
+                      ". The pixel data should be a 9*num_of_pixels array "
+                      "or cellarray of 9 pixel fields";
+    mexErrMsgTxt(buf.c_str());
   }
-
-  const double *const p_pixel_data = (double *)mxGetPr(prhs[Pixel_data]);
-  if (!p_pixel_data) {
+  if (pix.empty()) {
     mexErrMsgTxt(
         "ERROR::compute_pix_sums_c-> undefined or empty pixels array");
   }
-
-  return p_pixel_data;
+  return pix;
 }
+template pix_page_view<double> get_pix_page<double>(const mxArray *prhs[]);
+template pix_page_view<float> get_pix_page<float>(const mxArray *prhs[]);
 
-int get_num_threads(const mxArray *prhs[]) {
+int get_num_threads(const int &nrhs, const mxArray *prhs[]) {
+  if (nrhs <= Num_threads || mxIsEmpty(prhs[Num_threads])) {
+    return 1;
+  }
   int n_threads{(int)*mxGetPr(prhs[Num_threads])};
   if (n_threads > 128) {
     n_threads = 8;
@@ -65,6 +70,53 @@ int get_num_threads(const mxArray *prhs[]) {
   return n_threads;
 }
 
+std::vector<pix_reduction_request> get_reductions(const int &nlhs,
+                                                  mxArray *plhs[],
+                                                  const int &nrhs,
+                                                  const mxArray *prhs[]) {
+  std::vector<pix_reduction_request> requests;
+  if (nrhs <= Reductions) {
+    return requests;
+  }
+  const mxArray *pReductions = prhs[Reductions];
+  if (!mxIsDouble(pReductions) || mxGetM(pReductions) != 2 ||
+      mxGetN(pReductions) == 0) {
+    mexErrMsgTxt("ERROR::compute_pix_sums_c-> reductions should be defined by "
+                 "2xNReductions array of pixel field numbers and reduction "
+                 "codes");
+  }
+  size_t n_reductions = mxGetN(pReductions);
+  if (nlhs != int(n_reductions)) {
+    std::stringstream buf;
+    buf << "ERROR::compute_pix_sums_c-> " << n_reductions
+        << " reductions requested but " << (short)nlhs
+        << " output arguments provided\n";
+    mexErrMsgTxt(buf.str().c_str());
+  }
+  const double *pRed = mxGetPr(pReductions);
+  mwSize num_dims = mxGetNumberOfDimensions(prhs[Npix_data]);
+  const mwSize *dims = mxGetDimensions(prhs[Npix_data]);
+  for (size_t nr = 0; nr < n_reductions; nr++) {
+    double field = pRed[2 * nr];
+    double operation = pRed[2 * nr + 1];
+    if (!(field >= 1 && field <= double(pix_flds::PIX_WIDTH)) ||
+        !(operation >= 0 && operation < double(N_REDUCTIONS))) {
+      std::stringstream buf;
+      buf << "ERROR::compute_pix_sums_c-> invalid reduction N" << nr + 1
+          << ": field " << field << " reduction " << operation << "\n";
+      mexErrMsgTxt(buf.str().c_str());
+    }
+    plhs[nr] = mxCreateNumericArray(num_dims, dims, mxDOUBLE_CLASS, mxREAL);
+    if (!plhs[nr]) {
+      mexErrMsgTxt("ERROR::compute_pix_sums_c-> can not allocate memory for "
+                   "output reduction array");
+    }
+    requests.push_back({size_t(field) - 1, pix_reduction(int(operation)),
+                        (double *)mxGetPr(plhs[nr])});
+  }
+  return requests;
+}
+
 double *get_output_signal_ptr(mwSize &num_dims, const mwSize *dims,
                               mxArray *plhs[]) {
   plhs[Signal] = mxCreateNumericArray(num_dims, dims, mxDOUBLE_CLASS, mxREAL);
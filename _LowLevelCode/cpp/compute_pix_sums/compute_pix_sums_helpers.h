@@ -1,8 +1,15 @@
 #pragma once
 
 #include <include/CommonCode.h>
-
-enum InputArguments { Npix_data, Pixel_data, Num_threads, N_INPUT_Arguments };
+#include "compute_pix_sums.h"
+
+enum InputArguments {
+  Npix_data,
+  Pixel_data,
+  Num_threads, // optional number of threads
+  Reductions,  // optional 2xNReductions array of reductions to calculate
+  N_INPUT_Arguments
+};
 enum OutputArguments { // unique output arguments,
   Signal,
   Variance,
@@ -12,11 +19,23 @@ enum OutputArguments { // unique output arguments,
 void validate_inputs(const int &nlhs, mxArray *plhs[], const int &nrhs,
                      const mxArray *prhs[]);
 
+// retrieve reductions requested by optional Reductions argument. Every column
+// of the argument contains 1-based number of the pixel field to reduce and
+// pix_reduction code of the reduction. The result of every reduction is
+// returned in separate output argument of the size of npix array. NaN pixel
+// values are omitted by the requested reductions
+std::vector<pix_reduction_request> get_reductions(const int &nlhs,
+                                                  mxArray *plhs[],
+                                                  const int &nrhs,
+                                                  const mxArray *prhs[]);
+
 const double *const get_npix_array(const mxArray *prhs[]);
 
-const double *const get_pixel_array(const mxArray *prhs[]);
+// retrieve page of pixels, provided either as 9xNpix array or as cellarray
+// of 9 arrays containing pixel fields
+template <class T> pix_page_view<T> get_pix_page(const mxArray *prhs[]);
 
-int get_num_threads(const mxArray *prhs[]);
+int get_num_threads(const int &nrhs, const mxArray *prhs[]);
 
 double *get_output_signal_ptr(mwSize &num_dims, const mwSize *dims,
                               mxArray *plhs[]);
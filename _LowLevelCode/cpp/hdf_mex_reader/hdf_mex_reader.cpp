@@ -14,7 +14,7 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
     //* Check and parse input  arguments. */
     double *pBlock_pos(nullptr);
     double *pBlock_sizes(nullptr);
-    size_t n_blocks, n_threads;
+    size_t n_blocks;
 
     size_t npix_to_read;
     input_types work_type;
@@ -27,7 +27,6 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
         pBlock_pos, pBlock_sizes, n_blocks, n_bytes,
         block_split_info, npix_to_read);
 
-    n_threads = pReaderHolder->n_threads;
     switch (work_type)
     {
     case(init_access):{
@@ -97,10 +96,12 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
         plhs[(int)read_Outputs::pix_array] = mxCreateNumericMatrix(9, npix_to_read, mxSINGLE_CLASS, mxREAL);
         pixArray = (float*)mxGetData(plhs[int(read_Outputs::pix_array)]);
     }
-    pReaderHolder->class_ptr->read_pixels(block_split_info[0], pixArray, npix_to_read);
+    // the last element of the split info describes the position of the following read operation
+    size_t n_parts = block_split_info.size() - 1;
+    pReaderHolder->class_ptr->read_pixels(block_split_info, n_parts, pixArray, npix_to_read);
     //
-    pReaderHolder->n_first_block = block_split_info[n_threads].n_blocks;
-    pReaderHolder->pos_in_first_block = block_split_info[n_threads].pos_in_first_block;
+    pReaderHolder->n_first_block = block_split_info[n_parts].n_blocks;
+    pReaderHolder->pos_in_first_block = block_split_info[n_parts].pos_in_first_block;
 
 
 
@@ -108,8 +109,8 @@ void mexFunction(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
         plhs[(int)read_Outputs::is_io_completed] = mxCreateNumericMatrix(1, 1, mxLOGICAL_CLASS, mxREAL);
         auto pIO_completed = (bool*)mxGetData(plhs[int(read_Outputs::is_io_completed)]);
 
-        size_t n_blocks_processed = block_split_info[n_threads].n_blocks;
-        size_t pos_in_first_block = block_split_info[n_threads].pos_in_first_block;
+        size_t n_blocks_processed = block_split_info[n_parts].n_blocks;
+        size_t pos_in_first_block = block_split_info[n_parts].pos_in_first_block;
         if (n_blocks_processed >= n_blocks && pos_in_first_block == 0)
             *pIO_completed = true;
         else
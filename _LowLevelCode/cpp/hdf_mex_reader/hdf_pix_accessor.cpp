@@ -1,4 +1,9 @@
 #include "hdf_pix_accessor.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+std::mutex hdf_pix_accessor::hdf_lock;
 
 /* Simple initializer providing access to pixel data
  Assumes that all files and all groups are present.
@@ -75,7 +80,7 @@ void hdf_pix_accessor::init(const std::string &in_filename, const std::string &n
 	hsize_t chunk_size[2];
 	n_dims = H5Pget_chunk(dcpl_id, 2, chunk_size);
 	if (n_dims != 2) {
-		H5Dclose(dcpl_id);
+		H5Pclose(dcpl_id);
 		std::ostringstream  err_ss("pixels array chunk dimensions should be equal to 2 but actually is: ");
 		err_ss << n_dims;
 		std::string err = err_ss.str();
@@ -83,11 +88,15 @@ void hdf_pix_accessor::init(const std::string &in_filename, const std::string &n
 	}
 
 	this->io_chunk_size_ = chunk_size[0];
+	this->pix_chunk_size_ = chunk_size[0];
 	const hsize_t block_dims[2] = { this->io_chunk_size_ , 9 };
 
 	this->io_mem_space = H5Screate_simple(2, block_dims, block_dims);
 
-	H5Dclose(dcpl_id);
+	this->check_direct_chunk_read(dcpl_id, chunk_size);
+	H5Pclose(dcpl_id);
+	// default cache may be smaller then a chunk, which would make every read to decompress the chunk again
+	this->set_chunk_cache(2);
 
 }
 /* Return information about opened pixels dataset */
@@ -100,7 +109,7 @@ void hdf_pix_accessor::get_info(size_t &n_pixels, size_t &max_num_pixels, size_t
 		throw_error("HDF_MEX_ACCESS:runtime_error", "can not retrieve pixels array dimensions");
 
 	max_num_pixels = static_cast<size_t>(max_dims[0]);
-	chunk_size = static_cast<size_t>(this->io_chunk_size_);
+	chunk_size = static_cast<size_t>(this->pix_chunk_size_);
 
 	auto pix_dapl_id = H5Dget_access_plist(this->pix_dataset);
 
@@ -109,7 +118,7 @@ void hdf_pix_accessor::get_info(size_t &n_pixels, size_t &max_num_pixels, size_t
 	if (err < 0)
 		throw_error("HDF_MEX_ACCESS:runtime_error", "can not retrieve pixels dataset access property parameters");
 
-	H5Dclose(pix_dapl_id);
+	H5Pclose(pix_dapl_id);
 
 }
 
@@ -131,58 +140,314 @@ void hdf_pix_accessor::close_pix_dataset() {
 
 size_t hdf_pix_accessor::read_pixels(const pix_block_processor&pix_split_info, float *const pix_buffer, size_t buf_size) {
 
-	//hsize_t n_hs_blocks[2]    = { 1,1 };
+	pix_read_plan plan;
+	plan.init(pix_split_info, buf_size);
+	if (plan.truncated)
+		mexWarnMsgIdAndTxt("HDF_MEX_ACCESSOR:logical_error",
+			"Selected number of pixels exceeds allocated buffer. Pixels truncated but result may be incomplete");
+	if (plan.merged.empty())
+		return 0;
+	if (plan.file_end() > this->max_num_pixels_)
+		throw_error("HDF_MEX_ACCESS:runtime_error", "Attempt to read pixels beyond of defined range of the pixels");
+
+	// merged ranges are read directly into the pixels buffer or into the buffer of merged ranges
+	std::vector<float> merged_buf;
+	float *target = pix_buffer;
+	if (!plan.in_place) {
+		merged_buf.resize(plan.n_pix_merged * 9);
+		target = merged_buf.data();
+	}
+	// each batch of ranges is read by single H5Dread call. The cache keeps all chunks of a batch and the chunk,
+	// which the batch shares with the following batch or the following read operation
+	size_t n_ranges = plan.merged.size();
+	size_t max_batch_chunks(0);
+	for (size_t first = 0; first < n_ranges; first += MAX_RANGES_PER_READ) {
+		size_t last = std::min(first + MAX_RANGES_PER_READ, n_ranges);
+		max_batch_chunks = std::max(max_batch_chunks, plan.n_chunks(first, last, this->pix_chunk_size_));
+	}
+	this->set_chunk_cache(max_batch_chunks + 1);
+
 	hsize_t block_start[2] = { 0,0 };
 	hsize_t pix_chunk_size[2] = { 0,9 };
-	hsize_t n_pix_processed(0), n_pix_selected(0);
-
 	herr_t err;
-	// input block positions provided as in Matlab/Fortran (starting from 1) so C position is one less
-
-	size_t n_blocks = pix_split_info.n_blocks;
-	size_t pix_buf_pos = pix_split_info.pix_buf_pos;
-	size_t pix_buf_0pos = pix_buf_pos * 9;
-
-
-	for (size_t i = 0; i < n_blocks; ++i) {
-		hsize_t block_pos = pix_split_info.block_pos(i);
-		n_pix_selected = pix_split_info.block_size(i);
-		if (pix_buf_pos + n_pix_processed + n_pix_selected > buf_size) {
-			mexWarnMsgIdAndTxt("HDF_MEX_ACCESSOR:logical_error",
-				"Selected number of pixels exceeds allocated buffer. Pixels truncated but result may be incomplete");
-			n_pix_selected = buf_size - pix_buf_pos + n_pix_processed;
+	for (size_t first = 0; first < n_ranges; first += MAX_RANGES_PER_READ) {
+		size_t last = std::min(first + MAX_RANGES_PER_READ, n_ranges);
+		hsize_t n_batch_pix(0);
+		for (size_t i = first; i < last; ++i) {
+			block_start[0] = plan.merged[i].file_pos;
+			pix_chunk_size[0] = plan.merged[i].n_pix;
+			err = H5Sselect_hyperslab(this->file_space_id, i == first ? H5S_SELECT_SET : H5S_SELECT_OR, block_start, NULL, pix_chunk_size, NULL);
+			if (err < 0)
+				throw_error("HDF_MEX_ACCESS:runtime_error", "Can not select hyperslab while selecting pixels");
+			n_batch_pix += plan.merged[i].n_pix;
 		}
 
-
-		if (block_pos + n_pix_selected > this->max_num_pixels_)
-			throw_error("HDF_MEX_ACCESS:runtime_error", "Attempt to read pixels beyond of defined range of the pixels");
-
-		block_start[0] = block_pos;
-		pix_chunk_size[0] = n_pix_selected;
-
-		err = H5Sselect_hyperslab(this->file_space_id, H5S_SELECT_SET, block_start, NULL, pix_chunk_size, NULL);
-		if (err < 0)
-			throw_error("HDF_MEX_ACCESS:runtime_error", "Can not select hyperslab while selecting pixels");
-
-		if (this->io_chunk_size_ != n_pix_selected) {
+		if (this->io_chunk_size_ != n_batch_pix) {
+			pix_chunk_size[0] = n_batch_pix;
 			err = H5Sset_extent_simple(this->io_mem_space, 2, pix_chunk_size, pix_chunk_size);
 			if (err < 0)
 				throw_error("HDF_MEX_ACCESS:runtime_error", "Can not extend memory dataspace to load pixels");
-			this->io_chunk_size_ = n_pix_selected;
+			this->io_chunk_size_ = n_batch_pix;
 		}
 
-		err = H5Dread(this->pix_dataset, this->pix_data_id, this->io_mem_space, this->file_space_id, H5P_DEFAULT, pix_buffer + pix_buf_0pos + n_pix_processed * 9);
+		err = H5Dread(this->pix_dataset, this->pix_data_id, this->io_mem_space, this->file_space_id, H5P_DEFAULT, target + plan.merged[first].buf_pos * 9);
 		if (err < 0)
 			throw_error("HDF_MEX_ACCESS:runtime_error", "Error reading pixels");
+	}
+	if (!plan.in_place)
+		plan.copy_to_requested(merged_buf.data(), pix_buffer);
+
+	return plan.n_pix_requested();
+
+}
 
-		n_pix_processed += n_pix_selected;
+/* Set the size of the pixel dataset chunk cache to keep n_chunks chunks. The cache is only increased.
+   The cache is the property of the opened dataset so the dataset is reopened with the new cache settings */
+void hdf_pix_accessor::set_chunk_cache(size_t n_chunks) {
+	size_t chunk_bytes = size_t(this->pix_chunk_size_) * 9 * sizeof(float);
+	size_t cache_bytes = std::max(chunk_bytes, std::min(n_chunks * chunk_bytes, MAX_CHUNK_CACHE_BYTES));
+	if (cache_bytes <= this->cache_size_)
+		return;
+
+	// HDF5 recommends the number of cache hash slots to be a prime number ~100 times larger then the number of chunks in the cache
+	size_t n_slots = 100 * (cache_bytes / chunk_bytes) + 1;
+	auto is_prime = [](size_t n) {
+		for (size_t d = 2; d * d <= n; d++)
+			if (n % d == 0) return false;
+		return true;
+	};
+	while (!is_prime(n_slots))
+		n_slots += 2;
+
+	hid_t dapl_id = H5Pcreate(H5P_DATASET_ACCESS);
+	// fully read chunks are evicted first
+	herr_t err = H5Pset_chunk_cache(dapl_id, n_slots, cache_bytes, 1.);
+	if (err < 0) {
+		H5Pclose(dapl_id);
+		throw_error("HDF_MEX_ACCESS:runtime_error", "can not set pixels dataset chunk cache parameters");
 	}
+	H5Dclose(this->pix_dataset);
+	this->pix_dataset = H5Dopen(this->pix_group_id, "pixels", dapl_id);
+	H5Pclose(dapl_id);
+	if (this->pix_dataset < 0) {
+		std::stringstream err;
+		err << "can not reopen pixels dataset in file : " << this->filename;
+		throw_error("HDF_MEX_ACCESS:runtime_error", err.str().c_str());
+	}
+	this->cache_size_ = cache_bytes;
+}
+
 
-	return n_pix_processed;
 
+/* Identify if chunks of the pixel dataset can be read directly and decoded by the reader.
+   This is possible for single precision pixels, stored in chunks of whole pixels (chunk_size[1] == 9),
+   which are either not filtered or filtered by shuffle and/or deflate filters only */
+void hdf_pix_accessor::check_direct_chunk_read([[maybe_unused]] hid_t dcpl_id, [[maybe_unused]] const hsize_t chunk_size[2]) {
+	this->direct_chunk_read_ = false;
+	this->shuffle_filter_num_ = -1;
+	this->deflate_filter_num_ = -1;
+	this->fill_value_ = 0;
+#ifdef HDF_DIRECT_CHUNK_READ
+	// raw chunks are decoded as chunk_size[0] pixels of 9 consecutive values
+	if (chunk_size[1] != 9)
+		return;
+	hid_t type_id = H5Dget_type(this->pix_dataset);
+	bool supported = H5Tequal(type_id, H5T_NATIVE_FLOAT) > 0;
+	H5Tclose(type_id);
+	// chunks which have not been written are read as the fill value of the dataset
+	H5D_fill_value_t fill_status;
+	if (supported && H5Pfill_value_defined(dcpl_id, &fill_status) >= 0) {
+		if (fill_status != H5D_FILL_VALUE_UNDEFINED)
+			supported = H5Pget_fill_value(dcpl_id, H5T_NATIVE_FLOAT, &this->fill_value_) >= 0;
+	}
+	else
+		supported = false;
+
+	int n_filters = H5Pget_nfilters(dcpl_id);
+	for (int i = 0; i < n_filters && supported; i++) {
+		unsigned int flags, filter_config;
+		unsigned int cd_values[8];
+		size_t cd_nelmts(8);
+		char name[256];
+		H5Z_filter_t filter_id = H5Pget_filter2(dcpl_id, unsigned(i), &flags, &cd_nelmts, cd_values, sizeof(name), name, &filter_config);
+		// shuffle is applied to data before compression so it has to be undone after decompression
+		if (filter_id == H5Z_FILTER_SHUFFLE && this->shuffle_filter_num_ < 0 && this->deflate_filter_num_ < 0)
+			this->shuffle_filter_num_ = i;
+		else if (filter_id == H5Z_FILTER_DEFLATE && this->deflate_filter_num_ < 0)
+			this->deflate_filter_num_ = i;
+		else
+			supported = false;
+	}
+	this->direct_chunk_read_ = supported && n_filters >= 0;
+#endif
 }
 
+/* Read and decode single chunk of pixel dataset into chunk buffer.
+Inputs:
+chunk_num   -- number of the chunk to read
+raw_buf     -- buffer to read chunk as it is stored in the file
+inflate_buf -- buffer to decompress compressed chunk into
+Outputs:
+chunk_buf   -- buffer containing pix_chunk_size_ pixels of the chunk
+error       -- the reason of failure if the function returns false
+*/
+bool hdf_pix_accessor::read_chunk([[maybe_unused]] hsize_t chunk_num, [[maybe_unused]] std::vector<char> &raw_buf,
+	[[maybe_unused]] std::vector<char> &inflate_buf, [[maybe_unused]] std::vector<float> &chunk_buf, std::string &error) {
+#ifdef HDF_DIRECT_CHUNK_READ
+	size_t chunk_bytes = size_t(this->pix_chunk_size_) * 9 * sizeof(float);
+	chunk_buf.resize(size_t(this->pix_chunk_size_) * 9);
+
+	hsize_t offset[2] = { chunk_num * this->pix_chunk_size_, 0 };
+	hsize_t n_bytes(0);
+	uint32_t filter_mask(0);
+	{
+		std::lock_guard<std::mutex> lock(hdf_lock);
+		// chunks which have not been written have no storage address
+		haddr_t chunk_addr(HADDR_UNDEF);
+		if (H5Dget_chunk_info_by_coord(this->pix_dataset, offset, &filter_mask, &chunk_addr, &n_bytes) < 0) {
+			error = "Can not retrieve the size of pixels chunk";
+			return false;
+		}
+		if (chunk_addr == HADDR_UNDEF)
+			n_bytes = 0;
+		if (n_bytes > 0) {
+			raw_buf.resize(size_t(n_bytes));
+			if (H5Dread_chunk(this->pix_dataset, H5P_DEFAULT, offset, &filter_mask, raw_buf.data()) < 0) {
+				error = "Error reading pixels chunk";
+				return false;
+			}
+		}
+	}
+	if (n_bytes == 0) { // chunk has not been written. Pixels have the fill value of the dataset
+		std::fill(chunk_buf.begin(), chunk_buf.end(), this->fill_value_);
+		return true;
+	}
+	// inverse filters are applied in reverse order. Filters skipped while writing are marked in filter mask
+	const char *data = raw_buf.data();
+	size_t data_size = size_t(n_bytes);
+	if (this->deflate_filter_num_ >= 0 && !(filter_mask & (1u << this->deflate_filter_num_))) {
+		inflate_buf.resize(chunk_bytes);
+		uLongf inflated_size = uLongf(chunk_bytes);
+		if (uncompress(reinterpret_cast<Bytef *>(inflate_buf.data()), &inflated_size,
+			reinterpret_cast<const Bytef *>(data), uLong(data_size)) != Z_OK) {
+			error = "Error decompressing pixels chunk";
+			return false;
+		}
+		data = inflate_buf.data();
+		data_size = size_t(inflated_size);
+	}
+	data_size = std::min(data_size, chunk_bytes);
+	char *chunk_data = reinterpret_cast<char *>(chunk_buf.data());
+	if (this->shuffle_filter_num_ >= 0 && !(filter_mask & (1u << this->shuffle_filter_num_))) {
+		// shuffle filter stores first bytes of all values, then second bytes and so on
+		size_t n_values = data_size / sizeof(float);
+		for (size_t b = 0; b < sizeof(float); b++) {
+			const char *src = data + b * n_values;
+			for (size_t i = 0; i < n_values; i++) {
+				chunk_data[i * sizeof(float) + b] = src[i];
+			}
+		}
+	}
+	else {
+		std::memcpy(chunk_data, data, data_size);
+	}
+	return true;
+#else
+	error = "Direct chunk read is not supported by the HDF5 library used";
+	return false;
+#endif
+}
 
+/* Read pixels described by a part of the split info reading and decoding whole chunks of the dataset.
+   The pixels are read in the order of merged ranges of the read plan, so each chunk is decoded once.
+   Executed by reading threads, so reports errors through the error message instead of throwing them */
+size_t hdf_pix_accessor::read_part_direct(const pix_block_processor &pix_split_info, float *const pix_buffer, size_t buf_size,
+	bool &truncated, std::string &error) {
+
+	pix_read_plan plan;
+	plan.init(pix_split_info, buf_size);
+	truncated = plan.truncated;
+	if (plan.merged.empty())
+		return 0;
+	if (plan.file_end() > this->max_num_pixels_) {
+		error = "Attempt to read pixels beyond of defined range of the pixels";
+		return 0;
+	}
+	std::vector<float> merged_buf;
+	float *target = pix_buffer;
+	if (!plan.in_place) {
+		merged_buf.resize(plan.n_pix_merged * 9);
+		target = merged_buf.data();
+	}
+
+	std::vector<char> raw_buf, inflate_buf;
+	std::vector<float> chunk_buf;
+	hsize_t cur_chunk = std::numeric_limits<hsize_t>::max();
+	for (auto &range : plan.merged) {
+		float *dest = target + range.buf_pos * 9;
+		hsize_t pix_pos = range.file_pos;
+		size_t n_pix_left = range.n_pix;
+		while (n_pix_left > 0) {
+			hsize_t chunk_num = pix_pos / this->pix_chunk_size_;
+			if (chunk_num != cur_chunk) {
+				if (!this->read_chunk(chunk_num, raw_buf, inflate_buf, chunk_buf, error))
+					return 0;
+				cur_chunk = chunk_num;
+			}
+			size_t pos_in_chunk = size_t(pix_pos - chunk_num * this->pix_chunk_size_);
+			size_t n_copy = std::min(n_pix_left, size_t(this->pix_chunk_size_) - pos_in_chunk);
+			std::memcpy(dest, chunk_buf.data() + pos_in_chunk * 9, n_copy * 9 * sizeof(float));
+			dest += n_copy * 9;
+			pix_pos += n_copy;
+			n_pix_left -= n_copy;
+		}
+	}
+	if (!plan.in_place)
+		plan.copy_to_requested(merged_buf.data(), pix_buffer);
+	return plan.n_pix_requested();
+}
+
+/* Read pixels described by the first n_parts elements of the split info.
+ If chunks can be read directly, each part is read and decoded by separate thread filling its part of the pixel buffer.
+ Otherwise the parts are read one after another through the library.
+*/
+size_t hdf_pix_accessor::read_pixels(const std::vector<pix_block_processor> &pix_split_info, size_t n_parts, float *const pix_buffer, size_t buf_size) {
+	size_t n_pix_processed(0);
+	if (n_parts <= 1 || !this->direct_chunk_read_) {
+		for (size_t i = 0; i < n_parts; i++) {
+			n_pix_processed += this->read_pixels(pix_split_info[i], pix_buffer, buf_size);
+		}
+		return n_pix_processed;
+	}
+
+	std::vector<size_t> n_pix_read(n_parts, 0);
+	std::vector<std::string> errors(n_parts);
+	std::vector<char> truncated(n_parts, 0);
+	auto read_part = [&](size_t i) {
+		bool part_truncated(false);
+		n_pix_read[i] = this->read_part_direct(pix_split_info[i], pix_buffer, buf_size, part_truncated, errors[i]);
+		truncated[i] = part_truncated;
+	};
+	std::vector<std::thread> readers;
+	readers.reserve(n_parts - 1);
+	for (size_t i = 1; i < n_parts; i++) {
+		readers.emplace_back(read_part, i);
+	}
+	read_part(0);
+	for (auto &reader : readers) {
+		reader.join();
+	}
+
+	for (size_t i = 0; i < n_parts; i++) {
+		if (!errors[i].empty())
+			throw_error("HDF_MEX_ACCESS:runtime_error", errors[i].c_str());
+		if (truncated[i])
+			mexWarnMsgIdAndTxt("HDF_MEX_ACCESSOR:logical_error",
+				"Selected number of pixels exceeds allocated buffer. Pixels truncated but result may be incomplete");
+		n_pix_processed += n_pix_read[i];
+	}
+	return n_pix_processed;
+}
 
 hdf_pix_accessor::~hdf_pix_accessor()
 {
@@ -216,6 +481,12 @@ hdf_pix_accessor::hdf_pix_accessor()
 
 	this->io_mem_space = -1;
 
+	this->pix_chunk_size_ = 0;
+	this->cache_size_ = 0;
+	this->direct_chunk_read_ = false;
+	this->shuffle_filter_num_ = -1;
+	this->deflate_filter_num_ = -1;
+	this->fill_value_ = 0;
 
 }
 
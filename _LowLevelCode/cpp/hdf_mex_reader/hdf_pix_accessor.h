@@ -12,17 +12,19 @@
 #include <mex.h>
 #include "input_parser.h"
 #include "pix_block_processor.h"
+#include "pix_read_plan.h"
 #include <memory>
 
-// OMP does not work with hdf5 unless protected by mutexes
-//#ifndef _OPENMP
-//void omp_set_num_threads(int nThreads) {};
-//#define omp_get_num_threads() 1
-//#define omp_get_max_threads() 1
-//#define omp_get_thread_num()  0
-//#else
-//#include <omp.h>
-//#endif
+#include <mutex>
+#include <thread>
+
+// HDF5 library is not thread safe so concurrent readers have to serialize their calls to it. From version 1.10.5 on,
+// raw chunks of a dataset may be located and read directly, so the reading threads only take turns to read chunks and decode them
+// (apply inverse filters and copy pixels) in parallel. Deflated chunks are decompressed by zlib, so direct reads
+// need the reader to be linked with zlib, which is indicated by HDF_USE_ZLIB.
+#if H5_VERSION_GE(1,10,5) && defined(HDF_USE_ZLIB)
+#define HDF_DIRECT_CHUNK_READ
+#endif
 
 
 class hdf_pix_accessor
@@ -30,8 +32,13 @@ class hdf_pix_accessor
 public:
     void init(const std::string &filename, const std::string &pix_group_name);
     size_t read_pixels(const pix_block_processor&pix_split_info, float *const pix_buffer,size_t buf_size);
+    /* read pixels described by the first n_parts elements of the split info using a thread per part.
+       Each thread fills its part of the pixels buffer */
+    size_t read_pixels(const std::vector<pix_block_processor> &pix_split_info, size_t n_parts, float *const pix_buffer, size_t buf_size);
 
 	void get_info(size_t &n_pixels,size_t &max_num_pixels,size_t &chunk_size,size_t &cache_nslots, size_t &cache_size);
+    // true if chunks of the pixel dataset can be read and decoded by multiple threads
+    bool is_direct_chunk_read()const { return this->direct_chunk_read_; }
 
     hdf_pix_accessor();
     ~hdf_pix_accessor();
@@ -51,7 +58,28 @@ private:
 
     hsize_t max_num_pixels_;
     size_t  io_chunk_size_;
+    hsize_t pix_chunk_size_;   // number of pixels in a dataset chunk
+    size_t  cache_size_;       // size of the dataset chunk cache set by the accessor
+
+    // maximal number of ranges of pixels selected for single read operation
+    static const size_t MAX_RANGES_PER_READ = 1024;
+    // maximal size of the chunk cache the accessor sets
+    static const size_t MAX_CHUNK_CACHE_BYTES = 64 * 1024 * 1024;
+
+    // direct chunk read parameters
+    bool direct_chunk_read_;
+    int  shuffle_filter_num_; // number of the shuffle filter in the dataset filter pipeline or -1 if not used
+    int  deflate_filter_num_; // number of the deflate filter in the dataset filter pipeline or -1 if not used
+    float fill_value_;        // value of the pixels of the chunks which have not been written
+    // serializes calls to HDF5 library from reading threads
+    static std::mutex hdf_lock;
 
     void close_pix_dataset();
+    void set_chunk_cache(size_t n_chunks);
+    void check_direct_chunk_read(hid_t dcpl_id, const hsize_t chunk_size[2]);
+    size_t read_part_direct(const pix_block_processor &pix_split_info, float *const pix_buffer, size_t buf_size,
+        bool &truncated, std::string &error);
+    bool read_chunk(hsize_t chunk_num, std::vector<char> &raw_buf, std::vector<char> &inflate_buf, std::vector<float> &chunk_buf,
+        std::string &error);
 };
 
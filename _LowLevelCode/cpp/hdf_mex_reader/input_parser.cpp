@@ -1,4 +1,5 @@
 #include "input_parser.h"
+#include <algorithm>
 #include <vector>
 #include <hdf5.h>
 #include "hdf_pix_accessor.h"
@@ -187,8 +188,6 @@ class_handle<hdf_pix_accessor>* parse_inputs(int nlhs, int nrhs, const mxArray *
 				<< " This does not look like a reasonable value. Something may get wrong\n";
 			throw_error("HDF_MEX_ACCESS:invalid_argument", err.str().c_str());
 		}
-		else
-			reader->n_threads = 1;
 
 		return reader;
 	}case(read_data): {
@@ -225,10 +224,9 @@ class_handle<hdf_pix_accessor>* parse_inputs(int nlhs, int nrhs, const mxArray *
 
 		if (n_blocks_provided == 0 || buf_size == 0 || num_first_block >= n_blocks) { // nothing to do. 
 			// reader will retrive this information after the read operation. The read operation would be idle in this case 
-			size_t n_threads = reader->n_threads;
-			block_split_info.resize(n_threads + 1);
-			block_split_info[n_threads].n_blocks = num_first_block;
-			block_split_info[n_threads].pos_in_first_block = pos_in_the_first_block;
+			block_split_info.resize(2);
+			block_split_info[1].n_blocks = num_first_block;
+			block_split_info[1].pos_in_first_block = pos_in_the_first_block;
 			return reader;
 		}
 		break;
@@ -284,7 +282,9 @@ class_handle<hdf_pix_accessor>* parse_inputs(int nlhs, int nrhs, const mxArray *
 			npix_to_read = buf_size;
 	}
 
-	block_split_info = pix_block_processor::split_pix_block(block_pos, block_size, n_blocks_provided, num_first_block, pos_in_the_first_block, buf_size, reader->n_threads);
+	// the last element of the split info describes the position of the following read operation
+	size_t n_parts = std::min(reader->n_threads, std::max(size_t(1), buf_size / MIN_PIX_PER_READ_THREAD));
+	block_split_info = pix_block_processor::split_pix_block(block_pos, block_size, n_blocks_provided, num_first_block, pos_in_the_first_block, buf_size, n_parts);
 	return reader;
 }
 
@@ -20,7 +20,7 @@ enum class initInputs : int { // all input for init procedure
     filename,
     pixel_group_name,
 
-    num_threads,  // not currently supported but left for the future
+    num_threads,  // number of threads to read pixels. Used if the pixels chunks can be read directly
     N_INPUT_Arguments
 };
 enum class readInputs : int { // all input arguments for read procedure
@@ -73,6 +73,9 @@ enum class read_info_out :int { // output arguments for read procedure
 
 void throw_error(char const * const MESS_ID, char const * const error_message);
 
+// minimal number of pixels to read by a thread. Smaller reads are not split between threads
+const size_t MIN_PIX_PER_READ_THREAD = 16384;
+
 /*The class holding a selected C++ class and providing the exchange mechanism between this class and Matlab*/
 #define CLASS_HANDLE_SIGNATURE 0x7D58FAB9
 template<class T> class class_handle
@@ -0,0 +1,98 @@
+#include "pix_read_plan.h"
+#include <algorithm>
+#include <cstring>
+
+void pix_read_plan::init(const pix_block_processor &pix_split_info, size_t buf_size) {
+    this->requested.clear();
+    this->merged.clear();
+    this->in_place = true;
+    this->truncated = false;
+    this->n_pix_merged = 0;
+
+    size_t n_blocks = pix_split_info.n_blocks;
+    size_t buf_pos = pix_split_info.pix_buf_pos;
+    this->requested.reserve(n_blocks);
+    for (size_t i = 0; i < n_blocks; ++i) {
+        size_t n_pix = static_cast<size_t>(pix_split_info.block_size(i));
+        if (buf_pos + n_pix > buf_size) {
+            this->truncated = true;
+            n_pix = buf_pos < buf_size ? buf_size - buf_pos : 0;
+        }
+        if (n_pix == 0)
+            continue;
+        hsize_t file_pos = pix_split_info.block_pos(i);
+        // sorted non-overlapping blocks are read in place
+        if (!this->requested.empty()) {
+            const read_range &last = this->requested.back();
+            if (file_pos < last.file_pos + last.n_pix)
+                this->in_place = false;
+        }
+        this->requested.push_back(read_range{ file_pos, n_pix, buf_pos });
+        buf_pos += n_pix;
+    }
+    if (this->requested.empty())
+        return;
+
+    std::vector<read_range> sorted(this->requested);
+    if (!this->in_place) {
+        std::sort(sorted.begin(), sorted.end(),
+            [](const read_range &a, const read_range &b) { return a.file_pos < b.file_pos; });
+    }
+    // merge adjacent and overlapping ranges
+    size_t merged_buf_pos = this->in_place ? sorted[0].buf_pos : 0;
+    this->merged.push_back(read_range{ sorted[0].file_pos, sorted[0].n_pix, merged_buf_pos });
+    for (size_t i = 1; i < sorted.size(); ++i) {
+        read_range &last = this->merged.back();
+        hsize_t last_end = last.file_pos + last.n_pix;
+        if (sorted[i].file_pos <= last_end) {
+            hsize_t range_end = sorted[i].file_pos + sorted[i].n_pix;
+            if (range_end > last_end)
+                last.n_pix += static_cast<size_t>(range_end - last_end);
+        }
+        else {
+            merged_buf_pos = last.buf_pos + last.n_pix;
+            this->merged.push_back(read_range{ sorted[i].file_pos, sorted[i].n_pix, merged_buf_pos });
+        }
+    }
+    for (auto &range : this->merged)
+        this->n_pix_merged += range.n_pix;
+}
+
+size_t pix_read_plan::n_pix_requested()const {
+    size_t n_pix(0);
+    for (auto &range : this->requested)
+        n_pix += range.n_pix;
+    return n_pix;
+}
+
+hsize_t pix_read_plan::file_end()const {
+    if (this->merged.empty())
+        return 0;
+    return this->merged.back().file_pos + this->merged.back().n_pix;
+}
+
+size_t pix_read_plan::n_chunks(size_t first_range, size_t last_range, hsize_t chunk_size)const {
+    size_t n_chunks(0);
+    hsize_t last_chunk(0);
+    for (size_t i = first_range; i < last_range; ++i) {
+        hsize_t first = this->merged[i].file_pos / chunk_size;
+        hsize_t last = (this->merged[i].file_pos + this->merged[i].n_pix - 1) / chunk_size;
+        if (n_chunks > 0 && first == last_chunk) // ranges are sorted so may share only the boundary chunk
+            first++;
+        if (last >= first)
+            n_chunks += static_cast<size_t>(last - first + 1);
+        last_chunk = last;
+    }
+    return n_chunks;
+}
+
+void pix_read_plan::copy_to_requested(const float *const merged_buf, float *const pix_buffer)const {
+    for (auto &range : this->requested) {
+        // merged range containing the requested one
+        auto it = std::upper_bound(this->merged.begin(), this->merged.end(), range.file_pos,
+            [](hsize_t pos, const read_range &mr) { return pos < mr.file_pos; });
+        --it;
+        size_t merged_pos = it->buf_pos + static_cast<size_t>(range.file_pos - it->file_pos);
+        std::memcpy(pix_buffer + range.buf_pos * 9, merged_buf + merged_pos * 9, range.n_pix * 9 * sizeof(float));
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <vector>
+#include <hdf5.h>
+#include "pix_block_processor.h"
+
+/* The class which plans reading of the blocks of pixels described by pix_block_processor.
+
+ Requested blocks are sorted by their position in the file and adjacent or overlapping blocks are merged
+ into contiguous ranges, so each range is selected and read once and the ranges, belonging to
+ the same dataset chunk, are read together. If the requested blocks are already sorted and do not overlap,
+ merged ranges are read directly into the pixels buffer. Otherwise they are read into the buffer of merged
+ ranges and copied into requested positions afterwards.
+*/
+class pix_read_plan {
+public:
+    // contiguous range of pixels in the file and its position in a pixels buffer
+    struct read_range {
+        hsize_t file_pos; // position of the first pixel of the range in the file (0-based, in pixels)
+        size_t  n_pix;    // number of pixels in the range
+        size_t  buf_pos;  // position of the first pixel of the range in the buffer (in pixels)
+    };
+    // blocks as requested. Buffer positions refer to the pixels buffer
+    std::vector<read_range> requested;
+    // sorted non-overlapping ranges to read. Buffer positions refer to the pixels buffer if
+    // the plan is in_place or to the buffer of merged ranges otherwise
+    std::vector<read_range> merged;
+    // true if merged ranges can be read directly into the pixels buffer
+    bool in_place;
+    // true if requested blocks have been truncated to fit the pixels buffer
+    bool truncated;
+    // number of pixels in all merged ranges
+    size_t n_pix_merged;
+
+    pix_read_plan() :in_place(true), truncated(false), n_pix_merged(0) {}
+    /* build plan for the blocks described by split info which should be placed into pixels buffer of size buf_size */
+    void init(const pix_block_processor &pix_split_info, size_t buf_size);
+    // number of pixels requested
+    size_t n_pix_requested()const;
+    // position of the first pixel after the last pixel to read
+    hsize_t file_end()const;
+    // number of different chunks of chunk_size pixels, merged ranges from first_range to last_range (exclusive) belong to
+    size_t n_chunks(size_t first_range, size_t last_range, hsize_t chunk_size)const;
+    /* copy pixels from the buffer of merged ranges into requested positions of the pixels buffer.
+       Not used if plan is in place */
+    void copy_to_requested(const float *const merged_buf, float *const pix_buffer)const;
+};
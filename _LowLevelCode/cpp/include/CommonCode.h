@@ -6,12 +6,15 @@
 #include <mex.h>
 #include <matrix.h>
 #include <vector>
+#include <array>
+#include <string>
 #include <cmath>
 #include <iostream>
 #include <sstream>
 #include <memory>
 #include <mutex>
 #include <type_traits>
+#include <unordered_map>
 //#include <omp_guard.hpp>
 
 #ifndef _OPENMP
@@ -142,6 +145,177 @@ void inline calc_pix_ranges(span<double>& pix_ranges, SRC const* const pix_data_
     }
 };
 
+/* Read-only view of a page of pixels. The page may be stored either in the interleaved form (9xN MATLAB array,
+ * where each pixel occupies PIX_WIDTH consecutive elements) or in the column-oriented form (structure of arrays),
+ * where each pixel field of all pixels is stored in a separate contiguous array. Kernels accessing pixels through
+ * the view work with both layouts, but kernels which need only some pixel fields (e.g. signal and error) read
+ * only the memory occupied by these fields when the page is column-oriented.
+ */
+template <class T>
+class pix_page_view {
+public:
+    pix_page_view()
+        : n_pix(0)
+        , pix_stride(0)
+    {
+        fld_ptr.fill(nullptr);
+    }
+    // view of the interleaved page of n_pixels
+    pix_page_view(T const* const data, size_t n_pixels)
+        : n_pix(n_pixels)
+        , pix_stride(pix_flds::PIX_WIDTH)
+    {
+        for (size_t fld = 0; fld < pix_flds::PIX_WIDTH; fld++) {
+            fld_ptr[fld] = data ? data + fld : nullptr;
+        }
+    }
+    // view of the column-oriented page of n_pixels, defined by pointers to arrays of every pixel field
+    pix_page_view(const std::array<T const*, pix_flds::PIX_WIDTH>& fields, size_t n_pixels)
+        : fld_ptr(fields)
+        , n_pix(n_pixels)
+        , pix_stride(1)
+    {
+    }
+    // value of the field fld of the pixel i
+    T operator()(size_t i, size_t fld) const { return fld_ptr[fld][i * pix_stride]; }
+    size_t size() const { return n_pix; }
+    bool empty() const { return fld_ptr[0] == nullptr; }
+    bool is_column_oriented() const { return pix_stride == 1; }
+    // pointer to the data of the interleaved page or nullptr if the page is column-oriented or empty
+    T const* interleaved_data() const { return pix_stride == pix_flds::PIX_WIDTH ? fld_ptr[0] : nullptr; }
+
+private:
+    std::array<T const*, pix_flds::PIX_WIDTH> fld_ptr;
+    size_t n_pix;
+    size_t pix_stride; // distance between the same fields of neighbouring pixels
+};
+/* Read-only view of the interleaved page of pixels (9xN array) with the interface of pix_page_view.
+ * Kernels instantiated with this view address pixel fields with the fixed stride PIX_WIDTH */
+template <class T>
+class pix_interleaved_view {
+public:
+    pix_interleaved_view(T const* const data, size_t n_pixels)
+        : data_ptr(data)
+        , n_pix(n_pixels)
+    {
+    }
+    T operator()(size_t i, size_t fld) const { return data_ptr[i * pix_flds::PIX_WIDTH + fld]; }
+    size_t size() const { return n_pix; }
+    bool empty() const { return data_ptr == nullptr; }
+    bool is_column_oriented() const { return false; }
+
+private:
+    T const* data_ptr;
+    size_t n_pix;
+};
+/* Call the kernel, accepting a view of the page of pixels, with the view specialised for the layout of the page.
+ * Interleaved pages are passed as pix_interleaved_view and column-oriented pages as pix_page_view */
+template <class T, class Kernel>
+decltype(auto) with_pix_layout(const pix_page_view<T>& pix, Kernel&& kernel)
+{
+    if (pix.is_column_oriented())
+        return kernel(pix);
+    return kernel(pix_interleaved_view<T>(pix.interleaved_data(), pix.size()));
+};
+
+// Copy pixel source_pos from the page of pixels into position targ_pos of the interleaved target array
+template <class SRC, class TRG, class PIX>
+inline size_t copy_pixels(const PIX& pix, size_t source_pos, TRG* const pix_sorted_ptr, size_t targ_pos)
+{
+    targ_pos *= pix_flds::PIX_WIDTH;
+    for (size_t i = 0; i < pix_flds::PIX_WIDTH; i++) {
+        pix_sorted_ptr[targ_pos + i] = static_cast<TRG>(pix(source_pos, i));
+    }
+    return targ_pos;
+};
+// Align and copy pixel source_pos from the page of pixels into position targ_pos of the interleaved target array
+template <class SRC, class TRG, class PIX>
+inline size_t align_and_copy_pixels(std::vector<double>& al_matr, const PIX& pix, size_t source_pos, TRG* const pix_sorted_ptr, size_t targ_pos)
+{
+    targ_pos *= pix_flds::PIX_WIDTH;
+    for (size_t i = 0; i < 3; i++) {
+        double accum(0);
+        for (size_t j = 0; j < 3; j++) {
+            accum += double(pix(source_pos, j)) * al_matr[j * 3 + i];
+        }
+        pix_sorted_ptr[targ_pos + i] = static_cast<TRG>(accum);
+    }
+    for (size_t i = 3; i < pix_flds::PIX_WIDTH; i++) {
+        pix_sorted_ptr[targ_pos + i] = static_cast<TRG>(pix(source_pos, i));
+    }
+    return targ_pos;
+};
+// identify range of all pixel fields for pixel i of the page of pixels
+template <class SRC, class PIX>
+void inline calc_pix_ranges(span<double>& pix_ranges, const PIX& pix, size_t i)
+{
+    for (size_t j = 0; j < pix_flds::PIX_WIDTH; j++) {
+        pix_ranges[2 * j] = std::min(pix_ranges[2 * j], (double)pix(i, j));
+        pix_ranges[2 * j + 1] = std::max(pix_ranges[2 * j + 1], (double)pix(i, j));
+    }
+};
+// convert page of pixels into column-oriented form, i.e. copy every pixel field into separate array of pix.size() elements
+template <class SRC, class TRG>
+void pix_to_columns(const pix_page_view<SRC>& pix, const std::array<TRG*, pix_flds::PIX_WIDTH>& fields)
+{
+    for (size_t fld = 0; fld < pix_flds::PIX_WIDTH; fld++) {
+        TRG* const fld_ptr = fields[fld];
+        for (size_t i = 0; i < pix.size(); i++) {
+            fld_ptr[i] = static_cast<TRG>(pix(i, fld));
+        }
+    }
+};
+// convert page of pixels into interleaved form, i.e. into 9xpix.size() array
+template <class SRC, class TRG>
+void pix_to_interleaved(const pix_page_view<SRC>& pix, TRG* const pix_out)
+{
+    for (size_t i = 0; i < pix.size(); i++) {
+        copy_pixels<SRC, TRG>(pix, i, pix_out, i);
+    }
+};
+/* Return MATLAB class of the data in the page of pixels provided by MATLAB either as 9xN array (interleaved page)
+ * or as cellarray of 9 arrays with N elements each (column-oriented page, e.g. num2cell(pix_data,2)) */
+inline mxClassID get_pix_page_class(mxArray const* const pix_ptr)
+{
+    if (mxGetClassID(pix_ptr) == mxCELL_CLASS) {
+        auto fld_ptr = mxGetNumberOfElements(pix_ptr) > 0 ? mxGetCell(pix_ptr, 0) : nullptr;
+        return fld_ptr ? mxGetClassID(fld_ptr) : mxUNKNOWN_CLASS;
+    }
+    return mxGetClassID(pix_ptr);
+};
+/* Build view of the page of pixels provided by MATLAB either as 9xN array or as cellarray of 9 arrays
+ * with N elements each. Returns empty string if the page is valid or the reason it is not */
+template <class T>
+std::string get_pix_page_view(mxArray const* const pix_ptr, pix_page_view<T>& pix)
+{
+    mxClassID data_class = std::is_same_v<T, float> ? mxSINGLE_CLASS : mxDOUBLE_CLASS;
+    if (mxGetClassID(pix_ptr) != mxCELL_CLASS) {
+        if (mxGetClassID(pix_ptr) != data_class)
+            return "Pixels page contains data of unexpected type";
+        if (mxGetNumberOfDimensions(pix_ptr) != 2 || mxGetM(pix_ptr) != pix_flds::PIX_WIDTH)
+            return "Pixels page has to be 9xNpix array";
+        pix = pix_page_view<T>(reinterpret_cast<T const*>(mxGetPr(pix_ptr)), mxGetN(pix_ptr));
+        return "";
+    }
+    if (mxGetNumberOfElements(pix_ptr) != pix_flds::PIX_WIDTH)
+        return "Column-oriented pixels page has to be a cellarray with 9 elements";
+    std::array<T const*, pix_flds::PIX_WIDTH> fields;
+    size_t n_pix(0);
+    for (size_t fld = 0; fld < pix_flds::PIX_WIDTH; fld++) {
+        auto fld_ptr = mxGetCell(pix_ptr, fld);
+        if (fld_ptr == nullptr || mxGetClassID(fld_ptr) != data_class)
+            return "Column-oriented pixels page contains field data of unexpected type";
+        if (fld == 0) {
+            n_pix = mxGetNumberOfElements(fld_ptr);
+        } else if (mxGetNumberOfElements(fld_ptr) != n_pix) {
+            return "Fields of column-oriented pixels page have different number of elements";
+        }
+        fields[fld] = reinterpret_cast<T const*>(mxGetPr(fld_ptr));
+    }
+    pix = pix_page_view<T>(fields, n_pix);
+    return "";
+};
+
 // allocate pixels memory 
 template<class TRG> 
 mxArray* allocate_pix_memory(size_t PIX_WIDTH, size_t N_ELEMENTS, TRG*& data_ptr)
@@ -213,10 +387,28 @@ T getMatlabScalar(const mxArray* pPar, const char* const fieldName) {
 
 
 
+/* Ways omp_storage may accumulate signal, error and number of pixels contributed by OMP threads */
+enum omp_storage_mode {
+    direct_storage,  // single thread adds contributions directly to the target arrays
+    dense_storage,   // every thread has its own copy of the target arrays; copies are added together at the end
+    sparse_storage,  // every thread keeps hash map of the cells it contributed to; maps are added together at the end
+    atomic_storage   // all threads add contributions directly to the target arrays using atomic operations
+};
+// maximal number of doubles omp_storage may allocate for per-thread dense copies of the target arrays (512Mb)
+constexpr size_t OMP_STORAGE_DENSE_LIMIT = size_t(1) << 26;
+// approximate size (in doubles) of an element of a per-thread hash map used by sparse storage
+constexpr size_t OMP_STORAGE_SPARSE_ELEMENT_SIZE = 8;
+
 class omp_storage
     /** Class to manage dynamical storage used in OMP loops
     with various sources depending on the size of the storage and
-    number of OMP threads  */
+    number of OMP threads.
+
+    Per-thread dense copies of the target arrays are used while their size remains
+    below OMP_STORAGE_DENSE_LIMIT. Larger distributions are accumulated in per-thread hash maps
+    if the number of contributions is known to be small comparing with the size of the distribution
+    and hash maps fit the same limit. Otherwise threads add their contributions to the target arrays
+    using atomic operations, so the memory used by the storage does not depend on number of threads.*/
 
 {
 public:
@@ -227,10 +419,10 @@ public:
     place on heap or on stack */
     double* pSignal, * pError, * pNpix;
 
-    omp_storage(int num_OMP_Threads, size_t distribution_size, double* s, double* e, double* npix) :
+    omp_storage(int num_OMP_Threads, size_t distribution_size, double* s, double* e, double* npix, size_t n_contributions = 0) :
         distr_size(distribution_size), data_size(0), num_threads(num_OMP_Threads), largeMemory(NULL)
     {
-        this->init_storage(num_OMP_Threads, distribution_size, s, e, npix);
+        this->init_storage(num_OMP_Threads, distribution_size, s, e, npix, n_contributions);
     };
     /* Initialize OMP storage
       *@param num_OMP_Threads   -- number of OMP threads to use
@@ -238,31 +430,31 @@ public:
       *@param s     -- array of pixels signals (size of distribution_size)
       *@param e     -- array of pixels errors (size of distribution_size)
       *@param npix  -- array of number of pixels in each cell (size of distribution_size)
+      *@param n_contributions -- maximal number of contributions to add to the storage or 0 if unknown.
+      *                          Used to select sparse storage for large distributions.
     */
-    void init_storage(int num_OMP_Threads, size_t distribution_size, double* s, double* e, double* npix) {
+    void init_storage(int num_OMP_Threads, size_t distribution_size, double* s, double* e, double* npix, size_t n_contributions = 0) {
         num_threads = num_OMP_Threads;
-        size_t new_data_size = 3 * num_threads * distribution_size;
         distr_size = distribution_size;
+        size_t new_data_size = 0;
+        this->mode = select_mode(num_OMP_Threads, distribution_size, n_contributions);
+        if (this->mode == dense_storage) {
+            new_data_size = 3 * num_threads * distribution_size;
+        }
+        else if (this->mode == sparse_storage) {
+            sparse_stor.assign(num_threads, sparse_map());
+            size_t n_thread_contrib = (n_contributions + num_threads - 1) / num_threads;
+            for (auto& thread_map : sparse_stor) {
+                thread_map.reserve(n_thread_contrib);
+            }
+        }
+        if (new_data_size != data_size) {
+            release_dense_memory();
+        }
 
-        if (num_threads > 1) {
+        if (this->mode == dense_storage) {
             is_mutlithreaded = true;
-            bool allocate_memory = true;
-            if (largeMemory) {
-                if (new_data_size == data_size) {
-                    allocate_memory = false;
-                }
-                else {
-                    allocate_memory = true;
-                    if (se_vec_stor.size() == 0) {
-                        mxFree(largeMemory);
-                        largeMemory = NULL;
-                    }
-                    else {
-                        se_vec_stor.resize(0);
-                    }
-                }
-            }
-            if (allocate_memory) {
+            if (!largeMemory) {
                 // allocate storage for particular threads
                 try {
                     se_vec_stor.assign(new_data_size, 0.);
@@ -289,28 +481,67 @@ public:
 
         }
         else {
-            is_mutlithreaded = false;
+            // sparse and atomic storages add results to the target arrays directly too
+            is_mutlithreaded = this->mode != direct_storage;
             pSignal = s;
             pError = e;
             pNpix = npix;
-            num_threads = 1;
+            if (this->mode == direct_storage) {
+                num_threads = 1;
+            }
         }
         data_size = new_data_size;
 
 
 
     }
+    /* Select the way to accumulate contributions, keeping memory used by the storage below
+       OMP_STORAGE_DENSE_LIMIT */
+    static omp_storage_mode select_mode(int num_OMP_Threads, size_t distribution_size, size_t n_contributions = 0) {
+        if (num_OMP_Threads <= 1) {
+            return direct_storage;
+        }
+        size_t dense_size = 3 * size_t(num_OMP_Threads) * distribution_size;
+        if (dense_size <= OMP_STORAGE_DENSE_LIMIT) {
+            return dense_storage;
+        }
+        size_t sparse_size = n_contributions * OMP_STORAGE_SPARSE_ELEMENT_SIZE;
+        if (n_contributions > 0 && n_contributions < distribution_size && sparse_size <= OMP_STORAGE_DENSE_LIMIT) {
+            return sparse_storage;
+        }
+        return atomic_storage;
+    }
+    omp_storage_mode get_mode()const { return this->mode; }
 
     void add_signal(const double& signal, const double& error, int n_thread, size_t index)
     {
         /*  signal_stor[n_thread][il] += ;
         stor.error_stor[n_thread][il] += ;
         stor.ind_stor[n_thread][il]++; */
-
-        size_t ind = n_thread * distr_size + index;
-        pSignal[ind] += signal;
-        pError[ind] += error;
-        pNpix[ind] += 1;
+        switch (this->mode) {
+        case(sparse_storage): {
+            auto& cell = sparse_stor[n_thread][index];
+            cell[0] += signal;
+            cell[1] += error;
+            cell[2] += 1;
+            break;
+        }
+        case(atomic_storage): {
+#pragma omp atomic
+            pSignal[index] += signal;
+#pragma omp atomic
+            pError[index] += error;
+#pragma omp atomic
+            pNpix[index] += 1;
+            break;
+        }
+        default: {
+            size_t ind = n_thread * distr_size + index;
+            pSignal[ind] += signal;
+            pError[ind] += error;
+            pNpix[ind] += 1;
+        }
+        }
     }
 
     void combine_storage(double* const s, double* const e, double* const npix, long i) {
@@ -321,20 +552,53 @@ public:
             npix[i] += pNpix[ind];
         }
     }
+    /* Add results accumulated by threads to the target arrays.
+       Has to be called by all threads of the parallel region after all contributions have been added */
+    void combine_thread_storage(double* const s, double* const e, double* const npix, int n_thread) {
+        if (this->mode == dense_storage) {
+#pragma omp for
+            for (long i = 0; i < (long)distr_size; i++) {
+                this->combine_storage(s, e, npix, i);
+            }
+        }
+        else if (this->mode == sparse_storage) {
+            for (const auto& cell : sparse_stor[n_thread]) {
+                size_t i = cell.first;
+#pragma omp atomic
+                s[i] += cell.second[0];
+#pragma omp atomic
+                e[i] += cell.second[1];
+#pragma omp atomic
+                npix[i] += cell.second[2];
+            }
+            sparse_map().swap(sparse_stor[n_thread]);
+        }
+    }
 
     ~omp_storage() {
+        release_dense_memory();
+    }
+
+private:
+    typedef std::unordered_map<size_t, std::array<double, 3> > sparse_map;
+
+    void release_dense_memory() {
         if (largeMemory && se_vec_stor.size() == 0) {
             mxFree(largeMemory);
-            largeMemory = NULL;
         }
+        else {
+            std::vector<double>().swap(se_vec_stor);
+        }
+        largeMemory = NULL;
     }
 
-private:
     size_t distr_size;
     size_t data_size;
     int    num_threads;
+    omp_storage_mode mode;
 
     std::vector<double > se_vec_stor;
     double* largeMemory;
+    std::vector<sparse_map> sparse_stor;
 
 };
@@ -0,0 +1,204 @@
+#include "async_pix_writer.h"
+#include <cstring>
+
+async_pix_writer::async_pix_writer()
+    : max_queue_bytes(DEFAULT_MAX_QUEUE_BYTES)
+    , n_pixels_queued(0)
+    , queued_bytes(0)
+    , writing(false)
+    , stop_writing(false)
+    , write_failed(false)
+{
+};
+//
+async_pix_writer::~async_pix_writer()
+{
+    this->finish_write_job();
+    // bin_io_handler destructor writes final pixel metadata
+    this->io_handler.reset();
+};
+/* Open the file and start the writing thread. If the writer has been initialized before,
+ * pixels queued to the previous file are written and the previous file is closed.
+ */
+void async_pix_writer::init(const fileParameters& fpar, size_t max_queue_bytes, bool direct_io)
+{
+    this->finish_write_job();
+    this->io_handler.reset();
+    this->write_queue.clear();
+    this->queue_npix.clear();
+
+    this->max_queue_bytes = max_queue_bytes;
+    this->n_pixels_queued = 0;
+    this->queued_bytes = 0;
+    this->writing = false;
+    this->stop_writing = false;
+    this->write_failed = false;
+    this->error_message.clear();
+
+    this->io_handler = std::make_unique<bin_io_handler>();
+    this->io_handler->init(fpar, direct_io);
+    this->write_job_holder = std::thread(&async_pix_writer::write_pixels_job, this);
+};
+//
+size_t async_pix_writer::get_pixel_width() const
+{
+    if (!this->io_handler) {
+        return 0;
+    }
+    return this->io_handler->get_pixel_width();
+};
+// stop writing thread after it has written all queued pixels and wait for it to finish
+void async_pix_writer::finish_write_job()
+{
+    {
+        std::lock_guard<std::mutex> lock(this->exchange_lock);
+        this->stop_writing = true;
+    }
+    this->data_ready.notify_all();
+    if (this->write_job_holder.joinable()) {
+        this->write_job_holder.join();
+    }
+};
+// report error occurred on the writing thread to MATLAB. Has to be called from MATLAB thread only.
+void async_pix_writer::check_write_error()
+{
+    bool failed;
+    std::string err_mess;
+    {
+        std::lock_guard<std::mutex> lock(this->exchange_lock);
+        failed = this->write_failed;
+        err_mess = this->error_message;
+    }
+    if (failed) {
+        mexErrMsgIdAndTxt(MEX_ERR_IO, err_mess.c_str());
+    }
+};
+//
+void async_pix_writer::write_pixels(const char* const buffer, size_t n_pixels)
+{
+    if (!this->io_handler) {
+        mexErrMsgIdAndTxt(MEX_ERR_IO, "Attempt to write pixels using uninitialized pixel writer");
+    }
+    this->check_write_error();
+    if (n_pixels == 0) {
+        return;
+    }
+    size_t block_size = n_pixels * this->io_handler->get_pixel_width();
+
+    std::vector<char> block;
+    {
+        std::unique_lock<std::mutex> lock(this->exchange_lock);
+        // block larger then the limit is accepted when nothing else is in memory
+        this->data_written.wait(lock, [this, block_size]() {
+            return this->queued_bytes == 0 || this->queued_bytes + block_size <= this->max_queue_bytes || this->write_failed;
+        });
+        if (this->write_failed) {
+            lock.unlock();
+            this->check_write_error();
+        }
+        if (!this->free_buffers.empty()) {
+            block = std::move(this->free_buffers.back());
+            this->free_buffers.pop_back();
+        }
+        this->queued_bytes += block_size;
+    }
+    // the block is not visible to the writing thread until it is placed in the queue
+    block.resize(block_size);
+    std::memcpy(block.data(), buffer, block_size);
+    {
+        std::lock_guard<std::mutex> lock(this->exchange_lock);
+        this->write_queue.push_back(std::move(block));
+        this->queue_npix.push_back(n_pixels);
+    }
+    this->n_pixels_queued += n_pixels;
+    this->data_ready.notify_one();
+};
+//
+void async_pix_writer::flush()
+{
+    if (!this->io_handler) {
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(this->exchange_lock);
+        this->data_written.wait(lock, [this]() { return (this->write_queue.empty() && !this->writing) || this->write_failed; });
+    }
+    this->check_write_error();
+};
+// the job, executed by the writing thread: write queued blocks in turn until stopped and queue is empty
+void async_pix_writer::write_pixels_job()
+{
+    while (true) {
+        std::vector<char> block;
+        size_t n_pixels;
+        {
+            std::unique_lock<std::mutex> lock(this->exchange_lock);
+            this->data_ready.wait(lock, [this]() { return !this->write_queue.empty() || this->stop_writing; });
+            if (this->write_queue.empty()) {
+                return;
+            }
+            block = std::move(this->write_queue.front());
+            n_pixels = this->queue_npix.front();
+            this->write_queue.pop_front();
+            this->queue_npix.pop_front();
+            this->writing = true;
+        }
+        std::string err_mess;
+        bool success = this->io_handler->write_pixels(block.data(), n_pixels, err_mess);
+
+        {
+            std::lock_guard<std::mutex> lock(this->exchange_lock);
+            this->writing = false;
+            this->queued_bytes -= block.size();
+            if (this->free_buffers.size() < 2) {
+                this->free_buffers.push_back(std::move(block));
+            }
+            if (!success) {
+                this->write_failed = true;
+                this->error_message = err_mess;
+                // blocks queued after failed one can not be written at their positions
+                for (auto& qblock : this->write_queue) {
+                    this->queued_bytes -= qblock.size();
+                }
+                this->write_queue.clear();
+                this->queue_npix.clear();
+            }
+        }
+        this->data_written.notify_all();
+        if (!success) {
+            return;
+        }
+    }
+};
+//
+void async_pix_writer::write_pix_info(uint64_t num_pixels)
+{
+    this->flush();
+    this->io_handler->write_pix_info(num_pixels);
+};
+//
+void async_pix_writer::read_pix_info(size_t& num_pixels, uint32_t& pix_width)
+{
+    this->flush();
+    this->io_handler->read_pix_info(num_pixels, pix_width);
+};
+//
+size_t async_pix_writer::read_pixels(char* const buffer, size_t num_pixels, size_t pix_position)
+{
+    this->flush();
+    return this->io_handler->read_pixels(buffer, num_pixels, pix_position);
+};
+//
+void async_pix_writer::close()
+{
+    if (!this->io_handler) {
+        return;
+    }
+    this->finish_write_job();
+    bool failed = this->write_failed;
+    std::string err_mess = this->error_message;
+    this->io_handler.reset();
+    if (failed) {
+        mexErrMsgIdAndTxt(MEX_ERR_IO, err_mess.c_str());
+    }
+};
@@ -0,0 +1,81 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bin_io_handler.h"
+
+/* Class writes blocks of pixels into a binary sqw file on a background thread.
+ *
+ * Used by mex_bin_plugin to overlap writing pixels to disk with MATLAB producing the following block of pixels.
+ * Each block provided by MATLAB is copied into a queue buffer and the call returns as soon as the block is queued.
+ * The writing thread appends queued blocks to the pixel array through bin_io_handler::write_pixels.
+ *
+ * The amount of memory held by queued blocks is limited by max_queue_bytes. When the limit is reached,
+ * the caller waits until the writing thread frees enough space. Errors, occurred on the writing thread, are
+ * reported to MATLAB on the following call to the writer.
+ */
+class async_pix_writer {
+public:
+    // default limit on the memory occupied by blocks of pixels waiting to be written
+    static const size_t DEFAULT_MAX_QUEUE_BYTES = 256 * 1024 * 1024;
+
+    async_pix_writer();
+    ~async_pix_writer();
+    /* Inputs:
+     * fpar            -- parameters of the file to write pixels to
+     * max_queue_bytes -- maximal size of the pixels (in bytes) queued for writing
+     * direct_io       -- if true, write pixels bypassing system cache where possible
+     */
+    void init(const fileParameters& fpar, size_t max_queue_bytes = DEFAULT_MAX_QUEUE_BYTES, bool direct_io = false);
+    // queue block of n_pixels pixels for writing. The block contents is copied.
+    void write_pixels(const char* const buffer, size_t n_pixels);
+    // wait until all queued pixels are written to the file
+    void flush();
+    // flush queued pixels and write pixel metadata
+    void write_pix_info(uint64_t num_pixels);
+    // flush queued pixels and read pixel metadata
+    void read_pix_info(size_t& num_pixels, uint32_t& pix_width);
+    // flush queued pixels and read pixels written before
+    size_t read_pixels(char* const buffer, size_t num_pixels, size_t pix_position = 0);
+    // flush queued pixels, stop writing thread and close the file writing final pixel metadata
+    void close();
+
+    // number of pixels queued for writing since initialization, including pixels already written
+    size_t num_pixels_queued() const { return this->n_pixels_queued; }
+    // how many bytes single pixel occupies in the file
+    size_t get_pixel_width() const;
+    bool is_initialized() const { return bool(this->io_handler); }
+
+private:
+    void write_pixels_job();
+    void finish_write_job();
+    void check_write_error();
+
+    std::unique_ptr<bin_io_handler> io_handler;
+    size_t max_queue_bytes;
+    size_t n_pixels_queued;
+
+    // blocks of pixels waiting to be written and number of pixels in each block
+    std::deque<std::vector<char>> write_queue;
+    std::deque<size_t> queue_npix;
+    // buffers of the blocks already written, kept for reuse
+    std::vector<std::vector<char>> free_buffers;
+    size_t queued_bytes; // bytes in queue including block being written
+    bool writing;        // writing thread is writing a block taken from the queue
+
+    // thread synchronization
+    bool stop_writing;
+    bool write_failed;
+    std::string error_message;
+    std::mutex exchange_lock;
+    std::condition_variable data_ready, data_written;
+    std::thread write_job_holder;
+
+    // message ID this class return to Matlab in case of errors
+    inline static const char* MEX_ERR_IO{"HORACE:mex_bin_plugin:io_error"};
+};
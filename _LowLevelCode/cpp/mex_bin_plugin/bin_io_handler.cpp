@@ -1,18 +1,39 @@
 #include "bin_io_handler.h"
+#include <cstring>
 
-void bin_io_handler::init(const fileParameters& fpar) {
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
 
+void bin_io_handler::init(const fileParameters& fpar, bool direct_io) {
+
+    this->close();
     this->last_pix_written = 0;
+    this->n_pixels_written_info = 0;
     this->pix_array_position = fpar.pix_start_pos;
     this->nbin_position = fpar.nbin_start_pos;
     this->pixel_width = fpar.pixel_width;
 
     this->filename = fpar.fileName;
-    bool new_file(false);
+    bool new_file = !std::filesystem::exists(filename);
+#ifndef _WIN32
+    this->fd = ::open(this->filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if (this->fd < 0) {
+        std::string err = "Can not open target sqw file: " + fpar.fileName;
+        mexErrMsgIdAndTxt(MEX_ERR_ARGUMENTS, err.c_str());
+    }
+    // identify actual file size
+    struct stat file_stat;
+    if (fstat(this->fd, &file_stat) == 0) {
+        this->file_size = size_t(file_stat.st_size);
+    }
+#else
     auto file_mode = std::ios::binary | std::ios::in | std::ios::out;
-    if (!std::filesystem::exists(filename)) {
+    if (new_file) {
         file_mode = file_mode | std::ios::trunc;
-        new_file  = true;
     }
     this->h_inout.open(this->filename, file_mode);
     if (!this->h_inout.is_open()) {
@@ -22,18 +43,161 @@ void bin_io_handler::init(const fileParameters& fpar) {
     // identify actual file size
     this->h_inout.seekp(0, std::ios::end);
     this->file_size = this->h_inout.tellg();
+#endif
 
     // expand file to be of requested size. to allow writing pixel info or npix data at specified positions
     if ((this->pix_array_position > this->file_size + fileParameters::PIX_INFO_SIZE) || (this->nbin_position > this->file_size)) {
 
         size_t add_size = std::max(this->pix_array_position, this->nbin_position);
+#ifndef _WIN32
+        if (::ftruncate(this->fd, off_t(add_size)) != 0) {
+            std::stringstream buf;
+            buf << "Can not expand file: " << this->filename << " to size: " << add_size;
+            mexErrMsgIdAndTxt(MEX_ERR_IO, buf.str().c_str());
+        }
+#else
         std::filesystem::path file(this->filename);
         std::filesystem::resize_file(file, add_size);
+#endif
+        this->file_size = add_size;
+    }
+#if !defined(_WIN32) && defined(O_DIRECT)
+    // direct IO descriptor is used for aligned parts of pixel blocks only. Metadata and unaligned
+    // heads and tails of pixel blocks are written through cached descriptor
+    if (direct_io) {
+        this->direct_fd = ::open(this->filename.c_str(), O_WRONLY | O_DIRECT);
+        if (this->direct_fd >= 0) {
+            this->staging_buf.reset(static_cast<char*>(
+                ::operator new[](DIRECT_IO_STAGING_SIZE, std::align_val_t(DIRECT_IO_ALIGNMENT))));
+        }
+        // if the file system does not support direct IO, cached IO is used
+    }
+#endif
+    if (fpar.total_nPixels != std::numeric_limits<size_t>::max()) {
+        this->reserve_pixels(fpar.total_nPixels);
     }
     if (new_file) // write pix width
         this->write_pix_info(0);
 }
 
+/** Allocate disk space for the pixel array in advance to avoid file system fragmentation
+  * and metadata updates while pixels are appended. The file size is not changed.
+  * Reservation is advisory, so its failure is ignored.
+  */
+void bin_io_handler::reserve_pixels(const size_t num_pixels) {
+#if defined(__linux__)
+    if (this->fd >= 0 && num_pixels > 0) {
+        int rez;
+        do {
+            rez = ::fallocate(this->fd, FALLOC_FL_KEEP_SIZE, off_t(this->pix_array_position),
+                off_t(num_pixels * this->pixel_width));
+        } while (rez != 0 && errno == EINTR);
+    }
+#endif
+}
+
+// write n_bytes from buffer to the position pos of the file
+bool bin_io_handler::write_at(uint64_t pos, const char* buffer, size_t n_bytes, std::string& error_message) {
+#ifndef _WIN32
+    if (this->fd >= 0) {
+        size_t n_written(0);
+        while (n_written < n_bytes) { // pwrite may write less then requested
+            ssize_t rez = ::pwrite(this->fd, buffer + n_written, n_bytes - n_written, off_t(pos + n_written));
+            if (rez < 0 && errno == EINTR) {
+                continue;
+            }
+            if (rez <= 0) {
+                std::stringstream err_buf;
+                err_buf << "ERROR writing " << n_bytes << " bytes at position " << pos << " of file: " << this->filename
+                    << " Reason: " << std::strerror(errno);
+                error_message = err_buf.str();
+                return false;
+            }
+            n_written += size_t(rez);
+        }
+        return true;
+    }
+#endif
+    this->h_inout.seekp(pos, std::ios::beg);
+    this->h_inout.write(buffer, n_bytes);
+    if (!this->h_inout.good()) {
+        std::stringstream err_buf;
+        err_buf << "ERROR writing " << n_bytes << " bytes at position " << pos << " of file: " << this->filename;
+        error_message = err_buf.str();
+        return false;
+    }
+    return true;
+}
+
+/* write n_bytes from buffer to the position pos of the file using direct IO for the part of the block
+*  which starts and ends at aligned positions. The data are copied into aligned staging buffer provided.
+*  Unaligned head and tail of the block are written through cached descriptor.
+*/
+bool bin_io_handler::write_direct(uint64_t pos, const char* buffer, size_t n_bytes, char* const staging, std::string& error_message) {
+    uint64_t aligned_start = (pos + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+    uint64_t aligned_end = (pos + n_bytes) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+    if (this->direct_fd < 0 || aligned_end <= aligned_start) {
+        return this->write_at(pos, buffer, n_bytes, error_message);
+    }
+    if (aligned_start > pos && !this->write_at(pos, buffer, size_t(aligned_start - pos), error_message)) {
+        return false;
+    }
+#ifndef _WIN32
+    const char* source = buffer + (aligned_start - pos);
+    uint64_t cur_pos = aligned_start;
+    while (cur_pos < aligned_end) {
+        size_t chunk = size_t(std::min(uint64_t(DIRECT_IO_STAGING_SIZE), aligned_end - cur_pos));
+        std::memcpy(staging, source, chunk);
+        ssize_t rez;
+        do {
+            rez = ::pwrite(this->direct_fd, staging, chunk, off_t(cur_pos));
+        } while (rez < 0 && errno == EINTR);
+        if (rez < 0) {
+            std::stringstream err_buf;
+            err_buf << "ERROR writing " << chunk << " bytes at position " << cur_pos << " of file: " << this->filename
+                << " using direct IO. Reason: " << std::strerror(errno);
+            error_message = err_buf.str();
+            return false;
+        }
+        // short direct write may end at unaligned position. The rest of the chunk is written through cache
+        if (size_t(rez) < chunk && !this->write_at(cur_pos + rez, source + rez, chunk - size_t(rez), error_message)) {
+            return false;
+        }
+        source += chunk;
+        cur_pos += chunk;
+    }
+#endif
+    size_t tail = size_t(pos + n_bytes - aligned_end);
+    if (tail > 0) {
+        return this->write_at(aligned_end, buffer + (aligned_end - pos), tail, error_message);
+    }
+    return true;
+}
+
+// read n_bytes from the position pos of the file. Returns number of bytes actually read
+size_t bin_io_handler::read_at(uint64_t pos, char* const buffer, size_t n_bytes) {
+#ifndef _WIN32
+    if (this->fd >= 0) {
+        size_t n_read(0);
+        while (n_read < n_bytes) { // pread may return less then requested
+            ssize_t rez = ::pread(this->fd, buffer + n_read, n_bytes - n_read, off_t(pos + n_read));
+            if (rez < 0 && errno == EINTR) {
+                continue;
+            }
+            if (rez <= 0) {
+                break;
+            }
+            n_read += size_t(rez);
+        }
+        return n_read;
+    }
+#endif
+    this->h_inout.clear();
+    this->h_inout.seekg(pos, std::ios::beg);
+    this->h_inout.read(buffer, n_bytes);
+    return size_t(this->h_inout.gcount());
+}
+
 /**
   * Write pixel metadata containing information about pixel width
   * and number of pixels stored in pixels array
@@ -47,17 +211,35 @@ void bin_io_handler::write_pix_info(const uint64_t& num_pixels) {
     size_t pix_info_position = this->pix_array_position - fileParameters::PIX_INFO_SIZE;
     uint32_t pix_width = uint32_t(this->pixel_width);
 
-    this->h_inout.seekp(pix_info_position, std::ios::beg);
-    if (!this->h_inout.good()) {
-        std::stringstream buf;
-        buf << "Can not seek to pixel into position:" << pix_info_position;
-        mexErrMsgIdAndTxt(MEX_ERR_IO, buf.str().c_str());
+    bool written(false);
+#ifndef _WIN32
+    if (this->fd >= 0) {
+        // both fields are written by single call
+        struct iovec fields[2];
+        fields[0].iov_base = &pix_width;
+        fields[0].iov_len = sizeof(pix_width);
+        fields[1].iov_base = const_cast<uint64_t*>(&num_pixels);
+        fields[1].iov_len = sizeof(num_pixels);
+        ssize_t rez;
+        do {
+            rez = ::pwritev(this->fd, fields, 2, off_t(pix_info_position));
+        } while (rez < 0 && errno == EINTR);
+        written = (rez == ssize_t(fileParameters::PIX_INFO_SIZE));
     }
-
-
-    this->h_inout.write(reinterpret_cast<const char*>(&pix_width), sizeof(pix_width));
-    this->h_inout.write(reinterpret_cast<const char*>(&num_pixels), sizeof(num_pixels));
-    if (!this->h_inout.good()) {
+    else
+#endif
+    {
+        this->h_inout.seekp(pix_info_position, std::ios::beg);
+        if (!this->h_inout.good()) {
+            std::stringstream buf;
+            buf << "Can not seek to pixel into position:" << pix_info_position;
+            mexErrMsgIdAndTxt(MEX_ERR_IO, buf.str().c_str());
+        }
+        this->h_inout.write(reinterpret_cast<const char*>(&pix_width), sizeof(pix_width));
+        this->h_inout.write(reinterpret_cast<const char*>(&num_pixels), sizeof(num_pixels));
+        written = this->h_inout.good();
+    }
+    if (!written) {
         std::stringstream buf;
         buf << "Can not write number of pixels:" << num_pixels;
         mexErrMsgIdAndTxt(MEX_ERR_IO,buf.str().c_str());
@@ -73,35 +255,28 @@ Restore information about pixels block stored in the file
 void bin_io_handler::read_pix_info(size_t& num_pixels, uint32_t& pix_width) {
     size_t pix_info_position = this->pix_array_position - fileParameters::PIX_INFO_SIZE;
 
-    //this->seek_within_bounds(pix_info_position);
-    this->h_inout.seekg(pix_info_position, std::ios::beg);
-    if (!this->h_inout.good()) {
+    char info_buf[fileParameters::PIX_INFO_SIZE];
+    if (this->read_at(pix_info_position, info_buf, fileParameters::PIX_INFO_SIZE) != fileParameters::PIX_INFO_SIZE) {
         std::stringstream buf;
-        buf << "Can not seek to pixel into position for reading:" << pix_info_position;
+        buf << "Can not read pixel info from position:" << pix_info_position;
         mexErrMsgIdAndTxt(MEX_ERR_IO, buf.str().c_str());
     }
-
-
-    this->h_inout.read(reinterpret_cast<char*>(&pix_width), sizeof(pix_width));
-    this->h_inout.read(reinterpret_cast<char*>(&num_pixels), sizeof(num_pixels));
-    //this->h_inout.read(reinterpret_cast<char*>(&pix_width), sizeof(num_pixels));
+    uint64_t n_pixels;
+    std::memcpy(&pix_width, info_buf, sizeof(pix_width));
+    std::memcpy(&n_pixels, info_buf + sizeof(pix_width), sizeof(n_pixels));
+    num_pixels = size_t(n_pixels);
 }
 
 /**
 */
 size_t  bin_io_handler::read_pixels(char* const buffer, size_t num_pixels_to_read, const size_t pix_position/* wrt the pixel block start */) {
+    if (pix_position >= this->last_pix_written)
+        return 0;
     if (pix_position + num_pixels_to_read > this->last_pix_written)
         num_pixels_to_read = this->last_pix_written - pix_position;
 
-    this->h_inout.seekg(this->pix_array_position + pix_position * this->pixel_width);
-    if (!this->h_inout.good()) {
-        std::stringstream err_buf;
-        err_buf << "Can not seek to pixel array postion to read pixels:" << this->pix_array_position + pix_position;
-        mexErrMsgIdAndTxt(MEX_ERR_IO, err_buf.str().c_str());
-    }
-
-    this->h_inout.read(buffer, num_pixels_to_read * sizeof(this->pixel_width));
-    if (!this->h_inout.good()) {
+    size_t n_bytes = num_pixels_to_read * this->pixel_width;
+    if (this->read_at(this->pix_array_position + pix_position * this->pixel_width, buffer, n_bytes) != n_bytes) {
         std::stringstream err_buf;
         err_buf << "ERROR reading " << num_pixels_to_read << "pixels ";
         mexErrMsgIdAndTxt(MEX_ERR_IO, err_buf.str().c_str());
@@ -117,35 +292,75 @@ size_t  bin_io_handler::read_pixels(char* const buffer, size_t num_pixels_to_rea
 *  end of the existing pixel block
 */
 void bin_io_handler::write_pixels(const char* buffer, size_t num_pixels) {
+    std::string err_mess;
+    if (!this->write_pixels(buffer, num_pixels, err_mess)) {
+        mexErrMsgIdAndTxt(MEX_ERR_IO, err_mess.c_str());
+    }
+}
+/** Write chunk of pixels returning error message instead of throwing MATLAB error
+*
+*  @return true if pixels were written successfully and false and the reason for failure
+*          in error_message otherwise
+*/
+bool bin_io_handler::write_pixels(const char* buffer, size_t num_pixels, std::string& error_message) {
     // where to write next block of pixels
     size_t pix_pos = this->pix_array_position + this->last_pix_written * this->pixel_width;
 
     size_t length = num_pixels * this->pixel_width;
-    this->h_inout.write(buffer, length);
-    if (!this->h_inout.good()) {
+    if (!this->write_direct(pix_pos, buffer, length, this->staging_buf.get(), error_message)) {
         std::stringstream err_buf;
         err_buf << "ERROR adding to file containing " << this->last_pix_written
-            << " pixels " << num_pixels << "additional pixels";
-        mexErrMsgIdAndTxt(MEX_ERR_IO, err_buf.str().c_str());
+            << " pixels " << num_pixels << " additional pixels. " << error_message;
+        error_message = err_buf.str();
+        return false;
     }
 
     this->last_pix_written += num_pixels;
-    auto last_pos = this->h_inout.tellp();
+    size_t last_pos = pix_pos + length;
     if (last_pos > this->file_size) {
         this->file_size = last_pos;
     }
-
+    return true;
+}
+/** Write chunk of pixels at specified position of the pixel array
+*
+*  Uses own staging buffer for direct IO, so different threads may write different
+*  regions of the file concurrently.
+*/
+bool bin_io_handler::write_pixels_at(const char* buffer, size_t num_pixels, size_t first_pix, std::string& error_message) {
+    size_t pix_pos = this->pix_array_position + first_pix * this->pixel_width;
+    size_t length = num_pixels * this->pixel_width;
+    if (this->direct_fd < 0) {
+        return this->write_at(pix_pos, buffer, length, error_message);
+    }
+    std::unique_ptr<char[], aligned_deleter> staging(static_cast<char*>(
+        ::operator new[](DIRECT_IO_STAGING_SIZE, std::align_val_t(DIRECT_IO_ALIGNMENT))));
+    return this->write_direct(pix_pos, buffer, length, staging.get(), error_message);
 }
 
-
+// close file descriptors or stream used to access the file
+void bin_io_handler::close() {
+#ifndef _WIN32
+    if (this->direct_fd >= 0) {
+        ::close(this->direct_fd);
+        this->direct_fd = -1;
+    }
+    if (this->fd >= 0) {
+        ::close(this->fd);
+        this->fd = -1;
+    }
+#endif
+    if (this->h_inout.is_open()) {
+        this->h_inout.close();
+    }
+}
 
 bin_io_handler::~bin_io_handler() {
-    if (this->last_pix_written > this->n_pixels_written_info) {
+    // pixel metadata written explicitly are left unchanged, as other handler may have
+    // written other parts of the pixel array
+    if ((this->fd >= 0 || this->h_inout.is_open()) && this->last_pix_written > this->n_pixels_written_info) {
         this->write_pix_info(this->last_pix_written);
     }
-    else {
-        this->write_pix_info(this->n_pixels_written_info);
-    }
 
-    this->h_inout.close();
+    this->close();
 }
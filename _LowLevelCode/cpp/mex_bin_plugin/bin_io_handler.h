@@ -18,6 +18,7 @@
 #include <limits>
 #include <sys/stat.h>
 #include <filesystem>
+#include <new>
 
 #include "../file_parameters/fileParameters.h"
 
@@ -25,35 +26,72 @@
 //-----------------------------------------------------------------------------------------------------------------
 /** @brief
   *Class responsible for reading and writing block of pixels and pixel distributin information on HDD
+  *
+  * On POSIX systems the file is accessed through a file descriptor by positioned pwrite/pwritev/pread calls,
+  * which do not use a file position, so multiple handlers may write different regions of the same file
+  * concurrently. If direct IO is requested, aligned parts of pixel blocks are copied into aligned staging
+  * buffer and written bypassing system cache (O_DIRECT). On other systems the file is accessed through std::fstream.
   */
 class bin_io_handler {
 public:
     bin_io_handler() :
         last_pix_written(0), pix_array_position(fileParameters::PIX_INFO_SIZE), pixel_width(36), nbin_position(0),
+        fd(-1), direct_fd(-1),
         n_pixels_written_info(0), nbins_field_size(0), file_size(0)
     {}
+    bin_io_handler(const bin_io_handler&) = delete;
+    bin_io_handler& operator=(const bin_io_handler&) = delete;
 
-
-    void init(const fileParameters& fpar);
+    /* open the file and prepare it for writing pixels.
+       If direct_io is true, pixels are written bypassing system cache where the system supports it */
+    void init(const fileParameters& fpar, bool direct_io = false);
     void write_pixels(const char* const buffer, const size_t n_pix_to_write);
+    // write pixels without raising MATLAB error. Used by background threads, which may not call MATLAB API.
+    bool write_pixels(const char* const buffer, const size_t n_pix_to_write, std::string& error_message);
+    /* write pixels at the position first_pix wrt the pixel block start. Does not change the number of pixels
+       appended by write_pixels, so pixel metadata have to be written explicitly. On POSIX systems the method may be
+       called concurrently by different threads or by different handlers writing different regions of the same file */
+    bool write_pixels_at(const char* const buffer, const size_t n_pix_to_write, const size_t first_pix, std::string& error_message);
+    // allocate disk space for the pixel array of num_pixels pixels without changing the file size
+    void reserve_pixels(const size_t num_pixels);
     void write_pix_info(const uint64_t& num_pixels);
 
     void read_pix_info(size_t& num_pixels, uint32_t& pix_width);
+    // number of pixels written by this handler after initialization
+    size_t num_pixels_written() const { return this->last_pix_written; }
+    // how many bytes single pixel occupies in the file
+    size_t get_pixel_width() const { return this->pixel_width; }
+    // true if pixels are written bypassing system cache
+    bool is_direct_io() const { return this->direct_fd >= 0; }
     size_t read_pixels(char* const buffer, size_t num_pixels,const size_t pix_position = 0/* wrt the pixel block start */);
 
     ~bin_io_handler();
 
+    // alignment of buffers, file positions and sizes of blocks written by direct IO
+    static const size_t DIRECT_IO_ALIGNMENT = 4096;
+    // size of the staging buffer used by direct IO
+    static const size_t DIRECT_IO_STAGING_SIZE = 4 * 1024 * 1024;
 private:
+    bool write_at(uint64_t pos, const char* buffer, size_t n_bytes, std::string& error_message);
+    bool write_direct(uint64_t pos, const char* buffer, size_t n_bytes, char* const staging, std::string& error_message);
+    size_t read_at(uint64_t pos, char* const buffer, size_t n_bytes);
+    void close();
 
     //VARIABLES:
     std::string filename;       // name of the file this class works with
-    std::fstream h_inout;      // holder for the stream, operated with the file
+    std::fstream h_inout;      // holder for the stream, operated with the file where positioned IO is not available
     //
     size_t last_pix_written;   // counter for number of pixels stored in subsequent write operations
     size_t pix_array_position; // location of pix_array within the binary file
     size_t pixel_width;        // how many bytes single pixels block takes
     size_t nbin_position;      // where nbin_info field is stored.
 
+    int fd;                    // file descriptor used by positioned IO or -1 if the stream is used
+    int direct_fd;             // file descriptor opened for direct IO or -1 if direct IO is not used
+    struct aligned_deleter {
+        void operator()(char* p) const { ::operator delete[](p, std::align_val_t(DIRECT_IO_ALIGNMENT)); }
+    };
+    std::unique_ptr<char[], aligned_deleter> staging_buf; // aligned buffer for direct IO
 
     //tests and internal variables
     size_t n_pixels_written_info; // contains the information about pixels metadata parameters written to disk
@@ -66,5 +104,3 @@ private:
     inline static const char* MEX_ERR_IO{"HORACE:bin_io_handler:io_error"};
 
 };
-
-
@@ -1,21 +1,244 @@
 #include <include/CommonCode.h>
-#include "bin_io_handler.h"
+#include <include/MatlabCppClassHolder.hpp>
+#include "async_pix_writer.h"
 
 #include <utility/version.h>
 
-//--------------------------------------------------------------------------------------------------------------------
-//----------- PIX WRITER ---------------------------------------------------------------------------------------------
-//--------------------------------------------------------------------------------------------------------------------
-/*Initialize writer parameters
-Input:
-@param fpar           -- input parameters describing the output file
-@param n_bins2process -- number of bins to process (combine)
+/* The mex file writes blocks of pixels into binary sqw file, overlapping disk IO with MATLAB calculations.
+
+ Usage:
+
+   varargout = mex_bin_plugin('operation',[writer_holder],varargin);
+   where:
+ --  'operation':   the string, describing the operation the plugin should perform.
+ -- writer_holder:  the value of the Matlab pointer to the pixel writer. All operations except 'init'
+                    need this pointer. 'init' creates and returns it.
+
+ Called without arguments the function returns Horace version.
+
+The allowed operations and their parameters are:
+
+*** 'init'  opens the file and starts background writing thread.
+Inputs:
+  2  -- structure with file parameters (file_name, npix_start_pos, pix_start_pos, pixel_with, ...)
+  3  -- optional, maximal size (in bytes) of the pixels queued for writing. Default 256Mb
+  4  -- optional, if true, pixels are written bypassing system cache (O_DIRECT) where the system supports it.
+        Default false
+Outputs:
+  1  -- pointer to the initialized writer.
+
+*** 'write'  queues block of pixels for writing and returns without waiting for the write to complete.
+Inputs:
+  2  -- pointer to the writer
+  3  -- (pixel_width/4)xNpix array of pixels, e.g. 9xNpix array. Single precision pixels are queued as they are,
+        double precision pixels (as PixelData keeps them in memory) are converted to single precision
+Outputs:
+  1  -- pointer to the writer
+
+*** 'flush'  waits until all queued pixels are written
+Inputs:
+  2  -- pointer to the writer
+Outputs:
+  1  -- pointer to the writer
+  2  -- number of pixels written to the file
+
+*** 'write_pix_info'  flushes queued pixels and writes pixel metadata
+Inputs:
+  2  -- pointer to the writer
+  3  -- number of pixels to store in metadata
+Outputs:
+  1  -- pointer to the writer
+
+*** 'read_pix_info'  flushes queued pixels and reads pixel metadata
+Outputs:
+  1  -- pointer to the writer
+  2  -- number of pixels stored in metadata
+  3  -- pixel width
+
+*** 'read'  flushes queued pixels and reads pixels written before
+Inputs:
+  2  -- pointer to the writer
+  3  -- number of pixels to read
+  4  -- optional, position of the first pixel to read wrt the beginning of the pixel array. Default 0
+Outputs:
+  1  -- pointer to the writer
+  2  -- (pixel_width/4)xNpix single precision array of pixels read
+
+*** 'close'  writes all queued pixels and final pixel metadata, closes the file and destroys the writer
+Inputs:
+  2  -- pointer to the writer
 */
+#define BIN_PLUGIN_SIGNATURE 0x7D58CDE4
+
+static const char* MEX_ERR_ARGUMENTS{ "HORACE:mex_bin_plugin:invalid_argument" };
+
+enum class Inputs : int {
+    mode_name,
+    writer_ptr,
+    data,
+    position,
+};
+
+enum class Outputs : int {
+    writer_ptr,
+    result1,
+    result2
+};
+
+// retrieve scalar numerical input as size_t value
+size_t retrieve_size(const mxArray* pInput, const char* par_name)
+{
+    if (mxGetNumberOfElements(pInput) != 1 || !mxIsNumeric(pInput)) {
+        std::stringstream buf;
+        buf << "Input " << par_name << " should be numerical scalar";
+        mexErrMsgIdAndTxt(MEX_ERR_ARGUMENTS, buf.str().c_str());
+    }
+    double val = mxGetScalar(pInput);
+    if (val < 0) {
+        std::stringstream buf;
+        buf << "Input " << par_name << " should be non-negative but it is: " << val;
+        mexErrMsgIdAndTxt(MEX_ERR_ARGUMENTS, buf.str().c_str());
+    }
+    return size_t(val);
+}
+
 void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[])
 {
     if (nrhs == 0 && (nlhs == 0 || nlhs == 1)) {
         plhs[0] = mxCreateString(Horace::VERSION);
         return;
     }
+    if (!mxIsChar(prhs[(int)Inputs::mode_name])) {
+        mexErrMsgIdAndTxt(MEX_ERR_ARGUMENTS, "First argument of mex_bin_plugin should be the string, describing the operation");
+    }
+    char* mode_str = mxArrayToString(prhs[(int)Inputs::mode_name]);
+    std::string mode(mode_str);
+    mxFree(mode_str);
 
-}
\ No newline at end of file
+    class_handle<async_pix_writer>* writer_holder(nullptr);
+    if (mode == "init") {
+        if (nrhs < 2) {
+            mexErrMsgIdAndTxt(MEX_ERR_ARGUMENTS, "'init' operation requires structure with file parameters as second argument");
+        }
+        fileParameters fpar(prhs[1]);
+        size_t max_queue_bytes = async_pix_writer::DEFAULT_MAX_QUEUE_BYTES;
+        if (nrhs > 2) {
+            max_queue_bytes = retrieve_size(prhs[2], "max_queue_bytes");
+        }
+        bool direct_io(false);
+        if (nrhs > 3) {
+            direct_io = retrieve_size(prhs[3], "direct_io") > 0;
+        }
+        writer_holder = new class_handle<async_pix_writer>(BIN_PLUGIN_SIGNATURE);
+        try {
+            writer_holder->class_ptr->init(fpar, max_queue_bytes, direct_io);
+        }
+        catch (...) {
+            delete writer_holder;
+            throw;
+        }
+        plhs[(int)Outputs::writer_ptr] = writer_holder->export_handler_toMatlab();
+        return;
+    }
+
+    if (nrhs < 2) {
+        std::stringstream buf;
+        buf << "Operation '" << mode << "' requires pointer to the initialized writer as second argument";
+        mexErrMsgIdAndTxt(MEX_ERR_ARGUMENTS, buf.str().c_str());
+    }
+    writer_holder = get_handler_fromMatlab<async_pix_writer>(prhs[(int)Inputs::writer_ptr], BIN_PLUGIN_SIGNATURE, true);
+    auto writer = writer_holder->class_ptr;
+
+    if (mode == "write") {
+        if (nrhs < 3) {
+            mexErrMsgIdAndTxt(MEX_ERR_ARGUMENTS, "'write' operation requires array of pixels to write as third argument");
+        }
+        const mxArray* pPix = prhs[(int)Inputs::data];
+        if (!(mxIsSingle(pPix) || mxIsDouble(pPix)) || mxIsComplex(pPix)) {
+            mexErrMsgIdAndTxt(MEX_ERR_ARGUMENTS, "pixels to write should be real single or double precision array");
+        }
+        size_t n_rows = writer->get_pixel_width() / sizeof(float);
+        if (mxGetNumberOfDimensions(pPix) != 2 || mxGetM(pPix) != n_rows) {
+            std::stringstream buf;
+            buf << "pixels to write should be " << n_rows << "xNpix array but array has "
+                << mxGetM(pPix) << " rows and " << mxGetNumberOfDimensions(pPix) << " dimensions";
+            mexErrMsgIdAndTxt(MEX_ERR_ARGUMENTS, buf.str().c_str());
+        }
+        size_t n_pixels = mxGetN(pPix);
+        if (mxIsSingle(pPix)) {
+            writer->write_pixels(reinterpret_cast<const char*>(mxGetData(pPix)), n_pixels);
+        }
+        else {
+            // pixels are stored in single precision
+            const double* pDouble = mxGetPr(pPix);
+            std::vector<float> pix_single(pDouble, pDouble + n_rows * n_pixels);
+            writer->write_pixels(reinterpret_cast<const char*>(pix_single.data()), n_pixels);
+        }
+    }
+    else if (mode == "flush") {
+        writer->flush();
+        if (nlhs > (int)Outputs::result1) {
+            plhs[(int)Outputs::result1] = mxCreateDoubleScalar(double(writer->num_pixels_queued()));
+        }
+    }
+    else if (mode == "write_pix_info") {
+        if (nrhs < 3) {
+            mexErrMsgIdAndTxt(MEX_ERR_ARGUMENTS, "'write_pix_info' operation requires number of pixels as third argument");
+        }
+        writer->write_pix_info(retrieve_size(prhs[(int)Inputs::data], "num_pixels"));
+    }
+    else if (mode == "read_pix_info") {
+        size_t num_pixels;
+        uint32_t pix_width;
+        writer->read_pix_info(num_pixels, pix_width);
+        if (nlhs > (int)Outputs::result1) {
+            plhs[(int)Outputs::result1] = mxCreateDoubleScalar(double(num_pixels));
+        }
+        if (nlhs > (int)Outputs::result2) {
+            plhs[(int)Outputs::result2] = mxCreateDoubleScalar(double(pix_width));
+        }
+    }
+    else if (mode == "read") {
+        if (nrhs < 3) {
+            mexErrMsgIdAndTxt(MEX_ERR_ARGUMENTS, "'read' operation requires number of pixels to read as third argument");
+        }
+        size_t num_pixels = retrieve_size(prhs[(int)Inputs::data], "num_pixels");
+        size_t pix_position(0);
+        if (nrhs > (int)Inputs::position) {
+            pix_position = retrieve_size(prhs[(int)Inputs::position], "pix_position");
+        }
+        size_t pix_width = writer->get_pixel_width();
+        std::vector<char> buffer(num_pixels * pix_width);
+        size_t n_read = writer->read_pixels(buffer.data(), num_pixels, pix_position);
+        if (nlhs > (int)Outputs::result1) {
+            size_t n_rows = pix_width / sizeof(float);
+            plhs[(int)Outputs::result1] = mxCreateNumericMatrix(n_rows, n_read, mxSINGLE_CLASS, mxREAL);
+            std::memcpy(mxGetData(plhs[(int)Outputs::result1]), buffer.data(), n_rows * n_read * sizeof(float));
+        }
+    }
+    else if (mode == "close") {
+        writer_holder->clear_mex_locks();
+        try {
+            writer->close();
+        }
+        catch (...) {
+            delete writer_holder;
+            throw;
+        }
+        delete writer_holder;
+        for (int i = 0; i < nlhs; ++i) {
+            plhs[i] = mxCreateNumericMatrix(0, 0, mxUINT64_CLASS, mxREAL);
+        }
+        return;
+    }
+    else {
+        std::stringstream buf;
+        buf << "Unknown mex_bin_plugin operation: '" << mode
+            << "'. Allowed operations are: 'init', 'write', 'flush', 'write_pix_info', 'read_pix_info', 'read' and 'close'";
+        mexErrMsgIdAndTxt(MEX_ERR_ARGUMENTS, buf.str().c_str());
+    }
+    if (nlhs > 0) {
+        plhs[(int)Outputs::writer_ptr] = writer_holder->export_handler_toMatlab();
+    }
+}
+#undef BIN_PLUGIN_SIGNATURE
@@ -50,7 +50,7 @@ InputOutputTypes process_types(bool float_pix, InputIndexesType index_type, bool
 }
 
 std::string  verify_pix_array(const mxArray* pix_cell_array_ptr, bool& single_precision, std::vector<size_t>& pix_block_sizes,
-    std::vector<const void*>& pPix_blocks, size_t& n_tot_pixels) {
+    std::vector<const mxArray*>& pPix_blocks, size_t& n_tot_pixels) {
     /* function processes and validates cell array of input pixels
 
     in particular, it calculates each cell size and number of pixels, containing in each array.
@@ -71,7 +71,7 @@ std::string  verify_pix_array(const mxArray* pix_cell_array_ptr, bool& single_pr
     pPix_blocks.assign(num_of_cells, nullptr);
 
     /* Each cell mxArray contains 1-by-n cells; Each of these cells
-    is an 9xNpix mxArray. */
+    is an 9xNpix mxArray or column-oriented page of pixels, i.e. cellarray of 9 pixel fields */
     for (int ind = 0; ind < num_of_cells; ind++) {
 
         cell_element_ptr = mxGetCell(pix_cell_array_ptr, ind);
@@ -85,10 +85,12 @@ std::string  verify_pix_array(const mxArray* pix_cell_array_ptr, bool& single_pr
         }
         else {
             // check if a contributing pixels have the same parameters
-            category = mxGetClassID(cell_element_ptr);
+            category = get_pix_page_class(cell_element_ptr);
+            std::string err;
+            size_t n_block_pixels(0);
             switch (category)
             {
-            case (mxDOUBLE_CLASS):
+            case (mxDOUBLE_CLASS): {
                 if (array_type_is_known) {
                     if (single_precision)
                         return "Double precision input pixels array contains blocks with single pixels. Only one type of pixels (single or double) is supported";
@@ -96,9 +98,12 @@ std::string  verify_pix_array(const mxArray* pix_cell_array_ptr, bool& single_pr
                 else {
                     single_precision = false;
                 }
-                pPix_blocks[ind] = reinterpret_cast<const double*>(mxGetPr(cell_element_ptr));
+                pix_page_view<double> pix;
+                err = get_pix_page_view<double>(cell_element_ptr, pix);
+                n_block_pixels = pix.size();
                 break;
-            case (mxSINGLE_CLASS):
+            }
+            case (mxSINGLE_CLASS): {
                 if (array_type_is_known) {
                     if (!single_precision)
                         return "Single precision input pixels array contains blocks with double pixels. Only one type of pixels (single or double) is supported";
@@ -106,26 +111,40 @@ std::string  verify_pix_array(const mxArray* pix_cell_array_ptr, bool& single_pr
                 else {
                     single_precision = true;
                 }
-                pPix_blocks[ind] = reinterpret_cast<const float*>(mxGetPr(cell_element_ptr));
+                pix_page_view<float> pix;
+                err = get_pix_page_view<float>(cell_element_ptr, pix);
+                n_block_pixels = pix.size();
                 break;
+            }
             default:
                 return "Input pixels array contains unsupported type of pixels. Only single and double precision pixels are supported";
             }
             array_type_is_known = true;
+            if (err.size() > 0)
+                return "Input pixels array contains invalid block of pixels: " + err;
 
-            auto number_of_dimensions = mxGetNumberOfDimensions(cell_element_ptr);
-            auto dims = mxGetDimensions(cell_element_ptr);
-            if (number_of_dimensions != 2)return "Input pixels array contains non-2D block of pixels";
-
-            if (dims[0] != pix_flds::PIX_WIDTH)return "Input pixels array contains block of pixels with dimension 1 not equal to 9. Can not process this";
             // retrieve pixels block data
-            n_tot_pixels += dims[1];
-            pix_block_sizes[ind] = dims[1];
+            pPix_blocks[ind] = cell_element_ptr;
+            n_tot_pixels += n_block_pixels;
+            pix_block_sizes[ind] = n_block_pixels;
         }
     }
 
     return "";
 };
+/* build views of the blocks of pixels verified by verify_pix_array */
+template<class ST>
+std::vector<pix_page_view<ST> > get_pix_pages(const std::vector<const mxArray*>& pPix_blocks) {
+    std::vector<pix_page_view<ST> > pages(pPix_blocks.size());
+    for (size_t ind = 0; ind < pPix_blocks.size(); ind++) {
+        if (pPix_blocks[ind] == nullptr)
+            continue;
+        auto err = get_pix_page_view<ST>(pPix_blocks[ind], pages[ind]);
+        if (!err.empty())
+            mexErrMsgIdAndTxt("HORACE:sort_pixels_by_bins_mex:invalid_argument", err.c_str());
+    }
+    return pages;
+};
 
 std::string  verify_index_array(const mxArray* pix_cell_array_ptr, InputIndexesType& ind_type, std::vector<size_t>& ind_block_sizes,
     std::vector<const void*>& pInd_blocks, size_t& n_tot_pixels) {
@@ -226,18 +245,25 @@ std::string  verify_index_array(const mxArray* pix_cell_array_ptr, InputIndexesT
 ! 1 -- cellarray of arrays of pixels for sorting
 ! 2 -- cellarray of arrays of indexes of pixels within cells (a cell has more then one pixel and all pixels within this cell have the same index)
 ! 3 -- total numbers of pixels in each cell (densities, npix in Horace terminology)
+! 4 -- if true, keep the precision of the input pixels. If false, output pixels are converted to double
+! 5 -- (optional) number of threads to use for sorting. Pixels are sorted serially if not provided.
 !
 /**********************************************************************************************/
 void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[])
 {
     if (nrhs == 0 && (nlhs == 0 || nlhs == 1)) {
+#ifdef _OPENMP
         plhs[0] = mxCreateString(Horace::VERSION);
+#else
+        plhs[0] = mxCreateString(Horace::VER_NOOMP);
+#endif
         return;
     }
 
     std::stringstream buf;
-    if (nrhs != N_INPUT_Arguments) {
-        buf << "ERROR::sort_pixels_by_bins needs" << (short)N_INPUT_Arguments << "  but got " << (short)nrhs << " input arguments\n";
+    if (nrhs != N_INPUT_Arguments && nrhs != N_INPUT_Arguments - 1) {
+        buf << "ERROR::sort_pixels_by_bins needs " << (short)(N_INPUT_Arguments - 1) << " or " << (short)N_INPUT_Arguments
+            << " but got " << (short)nrhs << " input arguments\n";
         mexErrMsgIdAndTxt("HORACE:sort_pixels_by_bins_mex:invalid_argument",
             buf.str().c_str());
     }
@@ -257,12 +283,19 @@ void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[])
     // check if routine should keep input type
     bool keep_input_type(true);
     keep_input_type = (bool)getMatlabScalar<double>(prhs[keep_type], "keep_type");
+    int num_threads(1);
+    if (nrhs == N_INPUT_Arguments) {
+        num_threads = (int)getMatlabScalar<double>(prhs[Num_Threads], "num_threads");
+        if (num_threads < 1) {
+            num_threads = 1;
+        }
+    }
 
 
     // evaluate input pixels cell array
     bool pix_single_precision(false);
     std::vector<size_t> pix_sizes;
-    std::vector<const void*> pPix_blocks;
+    std::vector<const mxArray*> pPix_blocks;
     size_t n_Input_pixels;
     std::string err_code = verify_pix_array(prhs[Pixel_data], pix_single_precision, pix_sizes, pPix_blocks, n_Input_pixels);
     if (err_code.size() > 0) {
@@ -339,79 +372,79 @@ void mexFunction(int nlhs, mxArray* plhs[], int nrhs, const mxArray* prhs[])
         case Pix8IndIOut8: {
             double* const pPixelSorted = (double*)mxGetPr(plhs[Pixels_Sorted]);
             //
-            sort_pixels_by_bins<double, int64_t, double>(pPixelSorted, nPixelsSorted, pPixelRange, pPix_blocks, pix_sizes,
+            sort_pixels_by_bins<double, int64_t, double>(pPixelSorted, nPixelsSorted, pPixelRange, get_pix_pages<double>(pPix_blocks), pix_sizes,
                 pIndex_blocks, index_sizes,
                 pCellDens, distribution_size,
-                reinterpret_cast<size_t*>(ppInd));
+                reinterpret_cast<size_t*>(ppInd), num_threads);
             break;
         }
         case Pix8IndDOut8: {
             double* const pPixelSorted = (double*)mxGetPr(plhs[Pixels_Sorted]);
-            sort_pixels_by_bins<double, double, double>(pPixelSorted, nPixelsSorted, pPixelRange, pPix_blocks, pix_sizes,
+            sort_pixels_by_bins<double, double, double>(pPixelSorted, nPixelsSorted, pPixelRange, get_pix_pages<double>(pPix_blocks), pix_sizes,
                 pIndex_blocks, index_sizes,
                 pCellDens, distribution_size,
-                reinterpret_cast<size_t*>(ppInd));
+                reinterpret_cast<size_t*>(ppInd), num_threads);
             break;
         }
         case Pix4IndIOut8: {
             double* const pPixelSorted = (double*)mxGetPr(plhs[Pixels_Sorted]);
-            sort_pixels_by_bins<float, int64_t, double>(pPixelSorted, nPixelsSorted, pPixelRange, pPix_blocks, pix_sizes,
+            sort_pixels_by_bins<float, int64_t, double>(pPixelSorted, nPixelsSorted, pPixelRange, get_pix_pages<float>(pPix_blocks), pix_sizes,
                 pIndex_blocks, index_sizes,
                 pCellDens, distribution_size,
-                reinterpret_cast<size_t*>(ppInd));
+                reinterpret_cast<size_t*>(ppInd), num_threads);
             break;
         }
         case Pix4IndDOut8: {
             double* const pPixelSorted = (double*)mxGetPr(plhs[Pixels_Sorted]);
             //
-            sort_pixels_by_bins<float, double, double>(pPixelSorted, nPixelsSorted, pPixelRange, pPix_blocks, pix_sizes,
+            sort_pixels_by_bins<float, double, double>(pPixelSorted, nPixelsSorted, pPixelRange, get_pix_pages<float>(pPix_blocks), pix_sizes,
                 pIndex_blocks, index_sizes,
                 pCellDens, distribution_size,
-                reinterpret_cast<size_t*>(ppInd));
+                reinterpret_cast<size_t*>(ppInd), num_threads);
             break;
         }
         case Pix4IndIOut4: {
             float* const pPixelSorted = (float*)mxGetPr(plhs[Pixels_Sorted]);
             //
-            sort_pixels_by_bins<float, int64_t, float>(pPixelSorted, nPixelsSorted, pPixelRange, pPix_blocks, pix_sizes,
+            sort_pixels_by_bins<float, int64_t, float>(pPixelSorted, nPixelsSorted, pPixelRange, get_pix_pages<float>(pPix_blocks), pix_sizes,
                 pIndex_blocks, index_sizes,
                 pCellDens, distribution_size,
-                reinterpret_cast<size_t*>(ppInd));
+                reinterpret_cast<size_t*>(ppInd), num_threads);
             break;
         }
         case Pix4IndDOut4: {
             float* const pPixelSorted = (float*)mxGetPr(plhs[Pixels_Sorted]);
             //
-            sort_pixels_by_bins<float, double, float>(pPixelSorted, nPixelsSorted, pPixelRange, pPix_blocks, pix_sizes,
+            sort_pixels_by_bins<float, double, float>(pPixelSorted, nPixelsSorted, pPixelRange, get_pix_pages<float>(pPix_blocks), pix_sizes,
                 pIndex_blocks, index_sizes,
                 pCellDens, distribution_size,
-                reinterpret_cast<size_t*>(ppInd));
+                reinterpret_cast<size_t*>(ppInd), num_threads);
             break;
         }
         case Pix4Ind4Out4: {
             float* const pPixelSorted = (float*)mxGetPr(plhs[Pixels_Sorted]);
-            sort_pixels_by_bins<float, float, float>(pPixelSorted, nPixelsSorted, pPixelRange, pPix_blocks, pix_sizes,
+            sort_pixels_by_bins<float, float, float>(pPixelSorted, nPixelsSorted, pPixelRange, get_pix_pages<float>(pPix_blocks), pix_sizes,
                 pIndex_blocks, index_sizes,
                 pCellDens, distribution_size,
-                reinterpret_cast<size_t*>(ppInd));
+                reinterpret_cast<size_t*>(ppInd), num_threads);
             break;
         }
         case Pix4Ind4Out8: {
             double* const pPixelSorted = (double*)mxGetPr(plhs[Pixels_Sorted]);
 
-            sort_pixels_by_bins<float, float, double>(pPixelSorted, nPixelsSorted, pPixelRange, pPix_blocks, pix_sizes,
+            sort_pixels_by_bins<float, float, double>(pPixelSorted, nPixelsSorted, pPixelRange, get_pix_pages<float>(pPix_blocks), pix_sizes,
                 pIndex_blocks, index_sizes,
                 pCellDens, distribution_size,
-                reinterpret_cast<size_t*>(ppInd));
+                reinterpret_cast<size_t*>(ppInd), num_threads);
             break;
         }
         case Pix8Ind4Out8: {
             double* const pPixelSorted = (double*)mxGetPr(plhs[Pixels_Sorted]);
 
-            sort_pixels_by_bins <double, float, double >(pPixelSorted, nPixelsSorted, pPixelRange, pPix_blocks, pix_sizes,
+            sort_pixels_by_bins <double, float, double >(pPixelSorted, nPixelsSorted, pPixelRange, get_pix_pages<double>(pPix_blocks), pix_sizes,
                 pIndex_blocks, index_sizes,
                 pCellDens, distribution_size,
-                reinterpret_cast<size_t*>(ppInd));
+                reinterpret_cast<size_t*>(ppInd), num_threads);
             break;
         }
         case ERROR:
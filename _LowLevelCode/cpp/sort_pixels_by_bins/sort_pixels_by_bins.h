@@ -8,6 +8,7 @@ enum Input_Arguments {
     Pixel_Indexes,
     Pixel_Distribution,
     keep_type,
+    Num_Threads, // optional number of threads to use for sorting
     N_INPUT_Arguments
 };
 enum Out_Arguments {
@@ -40,13 +41,58 @@ enum InputIndexesType {
 
 InputOutputTypes process_types(bool float_pix, InputIndexesType index_type, bool double_out);
 
-//
+// minimal number of pixels, which is worth sorting in a separate thread
+constexpr size_t SORT_MIN_PIX_PER_THREAD = 16384;
+// number of elements of per-thread pixel distributions which may be allocated for multithreaded sorting
+// regardless of the number of pixels to sort. Above this value, these distributions should not exceed
+// the number of pixels.
+constexpr size_t SORT_MIN_PRIVATE_HIST_SIZE = size_t(1) << 22;
+
+/* Split pixels from all contributing blocks, considered as single array, into n_chunks contiguous chunks
+ *  and call process_range(nblock, j_start, j_end) for all parts of the blocks belonging to the chunk nChunk.
+ * block_start -- position of the first pixel of every block within the joint array of pixels (size n_blocks+1)
+ */
+template<class RangeProcessor>
+void inline for_chunk_ranges(const std::vector<size_t>& block_start, size_t n_chunks, size_t nChunk,
+    RangeProcessor&& process_range) {
+    size_t n_pix = block_start.back();
+    size_t chunk_begin = (n_pix * nChunk) / n_chunks;
+    size_t chunk_end = (n_pix * (nChunk + 1)) / n_chunks;
+    // first block containing pixels of this chunk
+    size_t nblock = std::upper_bound(block_start.begin(), block_start.end(), chunk_begin) - block_start.begin() - 1;
+    for (; nblock + 1 < block_start.size() && block_start[nblock] < chunk_end; nblock++) {
+        size_t j_start = std::max(chunk_begin, block_start[nblock]) - block_start[nblock];
+        size_t j_end = std::min(chunk_end, block_start[nblock + 1]) - block_start[nblock];
+        if (j_end > j_start)
+            process_range(nblock, j_start, j_end);
+    }
+};
+
+/* Sort pixels from all contributing blocks according to their cell indices and place them into
+ *  the target array.
+ * Inputs:
+ * PixelData, NPixels       -- views of the blocks of pixels and numbers of pixels in each block. Blocks
+ *                             may be interleaved (9xNpix) or column-oriented
+ * PixelIndexes, NIndexes   -- pointers to the blocks of cells indices of these pixels and their sizes
+ * pCellDens                -- number of pixels in every cell (npix)
+ * distribution_size        -- number of cells
+ * num_threads              -- number of threads to use for sorting
+ * Outputs:
+ * pPixelSorted, nPixelsSorted -- target array and number of pixels in it
+ * pPixRange                -- if not null, ranges of all sorted pixels
+ * ppInd                    -- work array of distribution_size elements
+ *
+ * Multithreaded sorting splits pixels into contiguous chunks, calculates distributions of pixels of
+ * each chunk over cells and converts them into positions of the first pixel of every chunk within every cell.
+ * Every chunk is then placed into target array independently, so the resulting order of pixels is
+ * the same as the order produced by sorting the pixels serially.
+ */
 template<class ST, class N, class TG>
 void sort_pixels_by_bins( TG * const pPixelSorted, size_t nPixelsSorted, double *const pPixRange,
-    std::vector<const void *> &PixelData, std::vector<size_t> &NPixels,
+    const std::vector<pix_page_view<ST> > &PixelData, std::vector<size_t> &NPixels,
     std::vector<const void *> &PixelIndexes, std::vector<size_t> NIndexes,
     double const *const pCellDens, size_t distribution_size,
-    size_t *const ppInd) {
+    size_t *const ppInd, int num_threads = 1) {
 
 
     ppInd[0] = 0;
@@ -63,29 +109,110 @@ void sort_pixels_by_bins( TG * const pPixelSorted, size_t nPixelsSorted, double
         pix_range = span<double>(pPixRange, 2 * pix_flds::PIX_WIDTH);
         init_min_max_range_calc(pix_range, (size_t)pix_flds::PIX_WIDTH);
     }
+    // positions of blocks within the joint array of pixels. Blocks without data do not contribute
+    size_t n_blocks = PixelIndexes.size();
+    std::vector<size_t> block_start(n_blocks + 1, 0);
+    for (size_t nblock = 0; nblock < n_blocks; nblock++) {
+        bool has_data = PixelIndexes[nblock] != nullptr && !PixelData[nblock].empty();
+        block_start[nblock + 1] = block_start[nblock] + (has_data ? NIndexes[nblock] : 0);
+    }
+    size_t n_pix = block_start.back();
+    // number of chunks to sort in parallel, limited by the memory necessary for per-chunk distributions
+    size_t n_chunks = std::min(size_t(std::max(num_threads, 1)), n_pix / SORT_MIN_PIX_PER_THREAD);
+    size_t private_distr_size = std::max(n_pix, SORT_MIN_PRIVATE_HIST_SIZE);
+    n_chunks = std::min(n_chunks, private_distr_size / distribution_size);
 
+    if (n_chunks < 2) {
+        for (size_t nblock = 0; nblock < n_blocks; nblock++)
+        {
+            size_t nBlockInd = block_start[nblock + 1] - block_start[nblock];
+            const N* pCellInd = reinterpret_cast<const N*>(PixelIndexes[nblock]);
 
-    //#pragma omp parallel
-    for(size_t nblock=0; nblock < PixelIndexes.size();nblock++)
-    {
-        size_t nBlockInd = NIndexes[nblock];
-        const N* pCellInd = reinterpret_cast<const N*>(PixelIndexes[nblock]);
-        if (pCellInd == nullptr)continue;
-
-        const ST* pPixData= reinterpret_cast<const ST *>(PixelData[nblock]);
-        if (pPixData == nullptr)continue;
-
-        // sort pixels according to cells
-        for (size_t j = 0; j < nBlockInd ; j++) {
-            size_t ind = (size_t)(pCellInd[j] - 1); // -1 as Matlab arrays start from one;
-            auto cell_pix_ind = ppInd[ind]++;       // pixel position within a cell
+            // sort pixels according to cells
+            with_pix_layout(PixelData[nblock], [&](const auto& pix) {
+                for (size_t j = 0; j < nBlockInd; j++) {
+                    size_t ind = (size_t)(pCellInd[j] - 1); // -1 as Matlab arrays start from one;
+                    auto cell_pix_ind = ppInd[ind]++;       // pixel position within a cell
 
-            if (calc_pix_range) {
-                calc_pix_ranges<ST>(pix_range, pPixData,pix_flds::PIX_WIDTH, j);
+                    if (calc_pix_range) {
+                        calc_pix_ranges<ST>(pix_range, pix, j);
+                    }
+                    copy_pixels<ST, TG>(pix, j, pPixelSorted, cell_pix_ind); // copy all pixel data into the location requested
+                }
+            });
+        }
+        return;
+    }
+    // distributions of pixels of every chunk over cells
+    std::vector<size_t> chunk_pos(n_chunks * distribution_size, 0);
+#pragma omp parallel for schedule(static, 1) num_threads(int(n_chunks))
+    for (long nc = 0; nc < (long)n_chunks; nc++) {
+        size_t* const chunk_distr = chunk_pos.data() + nc * distribution_size;
+        for_chunk_ranges(block_start, n_chunks, nc, [&](size_t nblock, size_t j_start, size_t j_end) {
+            const N* pCellInd = reinterpret_cast<const N*>(PixelIndexes[nblock]);
+            for (size_t j = j_start; j < j_end; j++) {
+                chunk_distr[(size_t)(pCellInd[j] - 1)]++;
+            }
+        });
+    }
+    // convert distributions into positions of first pixel of every chunk within every cell
+#pragma omp parallel for num_threads(int(n_chunks))
+    for (long ib = 0; ib < (long)distribution_size; ib++) {
+        size_t cell_pos = ppInd[ib];
+        for (size_t nc = 0; nc < n_chunks; nc++) {
+            auto n_chunk_pix = chunk_pos[nc * distribution_size + ib];
+            chunk_pos[nc * distribution_size + ib] = cell_pos;
+            cell_pos += n_chunk_pix;
+        }
+    }
+    // pixel ranges calculated by every chunk
+    std::vector<double> chunk_ranges;
+    if (calc_pix_range) {
+        chunk_ranges.resize(n_chunks * 2 * pix_flds::PIX_WIDTH);
+    }
+#pragma omp parallel for schedule(static, 1) num_threads(int(n_chunks))
+    for (long nc = 0; nc < (long)n_chunks; nc++) {
+        size_t* const chunk_cell_pos = chunk_pos.data() + nc * distribution_size;
+        span<double> chunk_range;
+        if (calc_pix_range) {
+            chunk_range = span<double>(chunk_ranges.data() + nc * 2 * pix_flds::PIX_WIDTH, 2 * pix_flds::PIX_WIDTH);
+            init_min_max_range_calc(chunk_range, (size_t)pix_flds::PIX_WIDTH);
+        }
+        for_chunk_ranges(block_start, n_chunks, nc, [&](size_t nblock, size_t j_start, size_t j_end) {
+            const N* pCellInd = reinterpret_cast<const N*>(PixelIndexes[nblock]);
+            with_pix_layout(PixelData[nblock], [&](const auto& pix) {
+                for (size_t j = j_start; j < j_end; j++) {
+                    auto cell_pix_ind = chunk_cell_pos[(size_t)(pCellInd[j] - 1)]++;
+                    if (calc_pix_range) {
+                        calc_pix_ranges<ST>(chunk_range, pix, j);
+                    }
+                    copy_pixels<ST, TG>(pix, j, pPixelSorted, cell_pix_ind);
+                }
+            });
+        });
+    }
+    if (calc_pix_range) {
+        for (size_t nc = 0; nc < n_chunks; nc++) {
+            for (size_t i = 0; i < pix_flds::PIX_WIDTH; i++) {
+                pix_range[2 * i] = std::min(pix_range[2 * i], chunk_ranges[nc * 2 * pix_flds::PIX_WIDTH + 2 * i]);
+                pix_range[2 * i + 1] = std::max(pix_range[2 * i + 1], chunk_ranges[nc * 2 * pix_flds::PIX_WIDTH + 2 * i + 1]);
             }
-            copy_pixels<ST, TG>(pPixData, j, pPixelSorted, cell_pix_ind); // copy all pixel data into the location requested
         }
     }
+}
+/* Sort pixels provided as blocks of 9xNPixels arrays */
+template<class ST, class N, class TG>
+void sort_pixels_by_bins(TG* const pPixelSorted, size_t nPixelsSorted, double* const pPixRange,
+    std::vector<const void*>& PixelData, std::vector<size_t>& NPixels,
+    std::vector<const void*>& PixelIndexes, std::vector<size_t> NIndexes,
+    double const* const pCellDens, size_t distribution_size,
+    size_t* const ppInd, int num_threads = 1) {
 
-
+    std::vector<pix_page_view<ST> > pix_pages(PixelData.size());
+    for (size_t nblock = 0; nblock < PixelData.size(); nblock++) {
+        if (PixelData[nblock])
+            pix_pages[nblock] = pix_page_view<ST>(reinterpret_cast<const ST*>(PixelData[nblock]), NPixels[nblock]);
+    }
+    sort_pixels_by_bins<ST, N, TG>(pPixelSorted, nPixelsSorted, pPixRange, pix_pages, NPixels,
+        PixelIndexes, NIndexes, pCellDens, distribution_size, ppInd, num_threads);
 }
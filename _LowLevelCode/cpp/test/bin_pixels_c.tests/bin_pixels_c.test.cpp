@@ -0,0 +1,85 @@
+#include "bin_pixels_c/BinningArg.h"
+#include <gtest/gtest.h>
+
+// set binning grid of the binning arguments and select binning plan for this grid
+static void set_grid(BinningArg& bin_arg, const std::vector<double>& data_range, const std::vector<uint32_t>& nbins)
+{
+    bin_arg.data_range = data_range;
+    bin_arg.nbins_all_dims = nbins;
+    bin_arg.in_coord_width = 4;
+    bin_arg.n_dims = 0;
+    for (auto nb : nbins) {
+        if (nb > 1)
+            bin_arg.n_dims++;
+    }
+    bin_arg.select_binning_plan();
+}
+
+TEST(TestBinPixelsC, test_repeated_geometry_skips_plan_setup) {
+    BinningArg bin_arg;
+    std::vector<double> range1 = { -1, 1, -2, 2, -3, 3, 0, 10 };
+    std::vector<uint32_t> nbins1 = { 10, 1, 20, 5 };
+    std::vector<double> range2 = { 0, 1, 0, 1, 0, 1, 0, 1 };
+    std::vector<uint32_t> nbins2 = { 3, 4, 1, 1 };
+
+    set_grid(bin_arg, range1, nbins1);
+    EXPECT_EQ(bin_arg.n_plan_setups, 1);
+    auto pax1 = bin_arg.pax;
+    auto stride1 = bin_arg.stride;
+    auto step1 = bin_arg.bin_step;
+    auto idx_range1 = bin_arg.bin_cell_idx_range;
+    size_t distr_size1(0);
+    auto dims_ptr = bin_arg.get_Matlab_acc_dimensions(distr_size1);
+    std::vector<mwSize> dims1(dims_ptr, dims_ptr + bin_arg.get_Matlab_n_dimensions());
+    EXPECT_EQ(distr_size1, 1000);
+    EXPECT_EQ(pax1, std::vector<size_t>({ 0, 2, 3 }));
+    EXPECT_EQ(stride1, std::vector<size_t>({ 1, 10, 200 }));
+    EXPECT_EQ(dims1, std::vector<mwSize>({ 10, 20, 5 }));
+
+    set_grid(bin_arg, range2, nbins2);
+    EXPECT_EQ(bin_arg.n_plan_setups, 2);
+    size_t distr_size2(0);
+    bin_arg.get_Matlab_acc_dimensions(distr_size2);
+    EXPECT_EQ(distr_size2, 12);
+    EXPECT_EQ(bin_arg.pax, std::vector<size_t>({ 0, 1 }));
+
+    // the first geometry is taken from the cache
+    set_grid(bin_arg, range1, nbins1);
+    EXPECT_EQ(bin_arg.n_plan_setups, 2);
+    EXPECT_EQ(bin_arg.pax, pax1);
+    EXPECT_EQ(bin_arg.stride, stride1);
+    EXPECT_EQ(bin_arg.bin_step, step1);
+    EXPECT_EQ(bin_arg.bin_cell_idx_range, idx_range1);
+    size_t distr_size(0);
+    dims_ptr = bin_arg.get_Matlab_acc_dimensions(distr_size);
+    EXPECT_EQ(distr_size, distr_size1);
+    EXPECT_EQ(std::vector<mwSize>(dims_ptr, dims_ptr + bin_arg.get_Matlab_n_dimensions()), dims1);
+
+    // the same geometry again does not change anything
+    set_grid(bin_arg, range1, nbins1);
+    EXPECT_EQ(bin_arg.n_plan_setups, 2);
+}
+
+TEST(TestBinPixelsC, test_least_recently_used_plan_released) {
+    BinningArg bin_arg;
+    std::vector<double> range = { 0, 1, 0, 1, 0, 1, 0, 1 };
+    for (uint32_t i = 0; i < BINNING_PLAN_CACHE_SIZE; i++) {
+        set_grid(bin_arg, range, { 2 + i, 1, 1, 1 });
+    }
+    EXPECT_EQ(bin_arg.n_plan_setups, BINNING_PLAN_CACHE_SIZE);
+    // all plans are in the cache
+    for (uint32_t i = 0; i < BINNING_PLAN_CACHE_SIZE; i++) {
+        set_grid(bin_arg, range, { 2 + i, 1, 1, 1 });
+    }
+    EXPECT_EQ(bin_arg.n_plan_setups, BINNING_PLAN_CACHE_SIZE);
+
+    // new plan releases the least recently used one, which is the first plan
+    set_grid(bin_arg, range, { 100, 1, 1, 1 });
+    EXPECT_EQ(bin_arg.n_plan_setups, BINNING_PLAN_CACHE_SIZE + 1);
+    set_grid(bin_arg, range, { 3, 1, 1, 1 });
+    EXPECT_EQ(bin_arg.n_plan_setups, BINNING_PLAN_CACHE_SIZE + 1);
+    set_grid(bin_arg, range, { 2, 1, 1, 1 });
+    EXPECT_EQ(bin_arg.n_plan_setups, BINNING_PLAN_CACHE_SIZE + 2);
+    EXPECT_EQ(bin_arg.stride, std::vector<size_t>({ 1 }));
+    EXPECT_EQ(bin_arg.bin_step, std::vector<double>({ 2. }));
+}
@@ -0,0 +1,128 @@
+#include "calc_projections_c/calc_projections_c.h"
+#include <gtest/gtest.h>
+#include <random>
+
+/* Runs measured on the same detectors with random signal, projection matrices and energies */
+class TestCalcProjections : public ::testing::Test {
+protected:
+    size_t nDetectors = 150;
+    std::vector<size_t> nEnergies = { 20, 33, 0, 7 };
+    double k_to_e = 2.0721;
+    std::vector<double> phi, psi, group, efix;
+    std::vector<std::vector<double>> energies, signal, error, matrix;
+    size_t nPixels = 0;
+
+    void SetUp() override
+    {
+        std::mt19937_64 gen(12);
+        std::uniform_real_distribution<double> rnd(0, 1);
+        phi.resize(nDetectors);
+        psi.resize(nDetectors);
+        group.resize(nDetectors);
+        for (size_t i = 0; i < nDetectors; i++) {
+            phi[i] = rnd(gen) * 140;
+            psi[i] = rnd(gen) * 360 - 180;
+            group[i] = double(i) + 1;
+        }
+        efix = { 30 };
+        size_t nRuns = nEnergies.size();
+        energies.resize(nRuns);
+        signal.resize(nRuns);
+        error.resize(nRuns);
+        matrix.resize(nRuns);
+        for (size_t nr = 0; nr < nRuns; nr++) {
+            for (size_t j = 0; j < nEnergies[nr]; j++) {
+                energies[nr].push_back(-5 + j * 30.0 / nEnergies[nr] + nr);
+            }
+            for (size_t j = 0; j < nDetectors * nEnergies[nr]; j++) {
+                signal[nr].push_back(rnd(gen));
+                error[nr].push_back(rnd(gen));
+            }
+            for (size_t j = 0; j < 9; j++) {
+                matrix[nr].push_back(rnd(gen) - 0.5);
+            }
+            nPixels += nDetectors * nEnergies[nr];
+        }
+    }
+    // build description of all runs to calculate in one call
+    std::vector<run_projection_data> get_runs()
+    {
+        std::vector<run_projection_data> runs(nEnergies.size());
+        size_t pix_position(0);
+        for (size_t nr = 0; nr < runs.size(); nr++) {
+            runs[nr].runID = double(nr) + 1;
+            runs[nr].pSignal = signal[nr].data();
+            runs[nr].pError = error[nr].data();
+            runs[nr].pMatrix = matrix[nr].data();
+            runs[nr].energies = energies[nr];
+            runs[nr].pix_position = pix_position;
+            pix_position += nDetectors * nEnergies[nr];
+        }
+        return runs;
+    }
+};
+
+TEST_F(TestCalcProjections, test_runs_batch_same_as_single_runs) {
+    for (int nThreads : { 1, 4 }) {
+        auto runs = get_runs();
+        std::vector<double> batch_pix(pix_flds::PIX_WIDTH * nPixels);
+        double batch_range[2 * pix_flds::PIX_WIDTH];
+        calc_projections_runs<double>(batch_range, batch_pix.data(), Direct, urangePixels, runs, group.data(),
+            phi.data(), psi.data(), nDetectors, efix.data(), efix.size(), k_to_e, nThreads);
+
+        std::vector<double> loop_pix(pix_flds::PIX_WIDTH * nPixels);
+        double loop_range[2 * pix_flds::PIX_WIDTH];
+        for (int i = 0; i < pix_flds::PIX_WIDTH; i++) {
+            loop_range[2 * i + 0] = 1.e+38;
+            loop_range[2 * i + 1] = -1.e+38;
+        }
+        for (size_t nr = 0; nr < runs.size(); nr++) {
+            double run_range[2 * pix_flds::PIX_WIDTH];
+            calc_projections_emode(run_range, loop_pix.data() + pix_flds::PIX_WIDTH * runs[nr].pix_position,
+                runs[nr].runID, Direct, urangePixels, signal[nr].data(), error[nr].data(), group.data(),
+                matrix[nr].data(), energies[nr].data(), nEnergies[nr], phi.data(), psi.data(), nDetectors,
+                efix.data(), efix.size(), k_to_e, nThreads);
+            for (int i = 0; i < pix_flds::PIX_WIDTH; i++) {
+                loop_range[2 * i + 0] = std::min(loop_range[2 * i + 0], run_range[2 * i + 0]);
+                loop_range[2 * i + 1] = std::max(loop_range[2 * i + 1], run_range[2 * i + 1]);
+            }
+        }
+        EXPECT_EQ(batch_pix, loop_pix);
+        for (int i = 0; i < 2 * pix_flds::PIX_WIDTH; i++) {
+            EXPECT_EQ(batch_range[i], loop_range[i]);
+        }
+    }
+}
+
+TEST_F(TestCalcProjections, test_single_precision_pixels_same_as_double) {
+    for (int nThreads : { 1, 4 }) {
+        auto runs = get_runs();
+        std::vector<double> pix_double(pix_flds::PIX_WIDTH * nPixels);
+        double range_double[2 * pix_flds::PIX_WIDTH];
+        calc_projections_runs<double>(range_double, pix_double.data(), Direct, urangePixels, runs, group.data(),
+            phi.data(), psi.data(), nDetectors, efix.data(), efix.size(), k_to_e, nThreads);
+
+        runs = get_runs();
+        std::vector<float> pix_single(pix_flds::PIX_WIDTH * nPixels);
+        double range_single[2 * pix_flds::PIX_WIDTH];
+        calc_projections_runs<float>(range_single, pix_single.data(), Direct, urangePixelsSingle, runs, group.data(),
+            phi.data(), psi.data(), nDetectors, efix.data(), efix.size(), k_to_e, nThreads);
+
+        // single precision pixels are double precision pixels rounded to single
+        for (size_t i = 0; i < pix_double.size(); i++) {
+            ASSERT_EQ(pix_single[i], float(pix_double[i])) << "at element " << i;
+        }
+        // ranges are ranges of the stored single precision values
+        for (int fld = 0; fld < pix_flds::PIX_WIDTH; fld++) {
+            float fld_min(FLT_MAX), fld_max(-FLT_MAX);
+            for (size_t np = 0; np < nPixels; np++) {
+                fld_min = std::min(fld_min, pix_single[pix_flds::PIX_WIDTH * np + fld]);
+                fld_max = std::max(fld_max, pix_single[pix_flds::PIX_WIDTH * np + fld]);
+            }
+            EXPECT_EQ(range_single[2 * fld + 0], double(fld_min)) << "field " << fld;
+            EXPECT_EQ(range_single[2 * fld + 1], double(fld_max)) << "field " << fld;
+            EXPECT_NEAR(range_single[2 * fld + 0], range_double[2 * fld + 0], 1.e-5 * (1 + std::abs(range_double[2 * fld + 0])));
+            EXPECT_NEAR(range_single[2 * fld + 1], range_double[2 * fld + 1], 1.e-5 * (1 + std::abs(range_double[2 * fld + 1])));
+        }
+    }
+}
@@ -6,6 +6,11 @@
 
 #include <gtest/gtest.h>
 
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <thread>
 #include <vector>
 
 using namespace Horace::Utility;
@@ -181,6 +186,57 @@ TEST_F(TestCombineSQW, Get_NPix_For_Bins) {
                                            sample_npix[NUM_BINS_IN_FILE - 1]);
 }
 
+TEST_F(TestCombineSQW, Get_NPix_For_Bins_Mapped) {
+  pix_mem_map pix_map;
+
+  pix_map.init(TEST_FILE_NAME, BIN_POS_IN_FILE, NUM_BINS_IN_FILE, 0, false,
+               true);
+  ASSERT_TRUE(pix_map.is_npix_mapped());
+
+  std::size_t first_mem_bin, last_mem_bin, n_tot_bins;
+  pix_map.get_map_param(first_mem_bin, last_mem_bin, n_tot_bins);
+  EXPECT_EQ(first_mem_bin, 0);
+  EXPECT_EQ(last_mem_bin, NUM_BINS_IN_FILE);
+
+  // bins are accessed in random order
+  const std::size_t bins[] = {114, 2400, 0, NUM_BINS_IN_FILE - 2, 600, 511,
+                              NUM_BINS_IN_FILE / 2, 2};
+  std::size_t pix_start, npix;
+  for (std::size_t bin : bins) {
+    pix_map.get_npix_for_bin(bin, pix_start, npix);
+    EXPECT_EQ(sample_npix[bin], npix) << "bin N" << bin;
+    EXPECT_EQ(sample_pix_pos[bin], pix_start) << "bin N" << bin;
+  }
+  // last page of the index has been built, so number of pixels is known
+  EXPECT_EQ(pix_map.num_pix_in_file(), sample_pix_pos[NUM_BINS_IN_FILE - 1] +
+                                           sample_npix[NUM_BINS_IN_FILE - 1]);
+
+  std::vector<uint64_t> block_npix(100000);
+  const std::size_t first_bin = 65000;
+  std::size_t first_pix;
+  pix_map.get_npix_for_bins(first_bin, block_npix.size(), block_npix.data(),
+                            first_pix);
+  EXPECT_EQ(sample_pix_pos[first_bin], first_pix);
+  for (std::size_t i = 0; i < block_npix.size(); i++) {
+    ASSERT_EQ(sample_npix[first_bin + i], block_npix[i]) << "bin N" << i;
+  }
+
+  bool end_pix_reached;
+  const std::size_t pix_buffer_size{512};
+  std::size_t num_pix =
+      pix_map.check_expand_pix_map(4, pix_buffer_size, end_pix_reached);
+  ASSERT_FALSE(end_pix_reached);
+  std::size_t n_bin = 4;
+  while (sample_pix_pos[n_bin + 1] - sample_pix_pos[4] <= pix_buffer_size) {
+    n_bin++;
+  }
+  EXPECT_EQ(sample_pix_pos[n_bin] - sample_pix_pos[4], num_pix);
+
+  num_pix = pix_map.check_expand_pix_map(0, 2 * NUM_PIXELS, end_pix_reached);
+  EXPECT_TRUE(end_pix_reached);
+  EXPECT_EQ(pix_map.num_pix_in_file(), num_pix);
+}
+
 TEST_F(TestCombineSQW, Fully_Expand_Pix_Map_From_Start) {
   pix_mem_map pix_map;
   const std::size_t pix_buffer_size{512};
@@ -866,3 +922,149 @@ TEST_F(TestCombineSQW, MXSQW_Reader_Propagate_Pix_Multi) {
     EXPECT_EQ(buf[i], buf1[i]) << "pix N" << n_pix;
   }
 }
+
+TEST_F(TestCombineSQW, Calc_Combine_Partitions) {
+  fileParameters file_par;
+  file_par.fileName = TEST_FILE_NAME;
+  file_par.nbin_start_pos = BIN_POS_IN_FILE;
+  file_par.pix_start_pos = PIX_POS_IN_FILE;
+  file_par.total_NfileBins = NUM_BINS_IN_FILE;
+  std::vector<fileParameters> files(2, file_par);
+
+  const std::size_t n_partitions = 4;
+  std::vector<std::size_t> part_bins, part_pix;
+  calc_combine_partitions(files, 0, NUM_BINS_IN_FILE, n_partitions, part_bins, part_pix);
+
+  ASSERT_EQ(part_bins.size(), n_partitions + 1);
+  ASSERT_EQ(part_pix.size(), n_partitions + 1);
+  EXPECT_EQ(part_bins[0], 0);
+  EXPECT_EQ(part_pix[0], 0);
+  EXPECT_EQ(part_bins[n_partitions], NUM_BINS_IN_FILE);
+  EXPECT_EQ(part_pix[n_partitions], 2 * NUM_PIXELS);
+  for (std::size_t p = 1; p < n_partitions; p++) {
+    EXPECT_LE(part_bins[p - 1], part_bins[p]);
+    ASSERT_LT(part_bins[p], NUM_BINS_IN_FILE);
+    // pixels, preceding the partition in the combined file
+    EXPECT_EQ(part_pix[p], 2 * sample_pix_pos[part_bins[p]]) << "partition N" << p;
+  }
+  // partitions of a range of bins start from the first bin of the range
+  std::size_t first_bin = NUM_BINS_IN_FILE / 3;
+  calc_combine_partitions(files, first_bin, NUM_BINS_IN_FILE, n_partitions, part_bins, part_pix);
+  EXPECT_EQ(part_bins[0], first_bin);
+  EXPECT_EQ(part_pix[n_partitions], 2 * (NUM_PIXELS - sample_pix_pos[first_bin]));
+  for (std::size_t p = 1; p < n_partitions; p++) {
+    EXPECT_EQ(part_pix[p], 2 * (sample_pix_pos[part_bins[p]] - sample_pix_pos[first_bin])) << "partition N" << p;
+  }
+}
+
+TEST_F(TestCombineSQW, Combine_Partitioned_Same_As_Combine) {
+  fileParameters file_par;
+  file_par.fileName = TEST_FILE_NAME;
+  file_par.nbin_start_pos = BIN_POS_IN_FILE;
+  file_par.pix_start_pos = PIX_POS_IN_FILE;
+  file_par.total_NfileBins = NUM_BINS_IN_FILE;
+  // pixels of the files are relabelled by run id, so the pixels of every file
+  // have to be placed at their own positions
+  std::vector<fileParameters> files(3, file_par);
+  for (std::size_t i = 0; i < files.size(); i++) {
+    files[i].run_id = int(i + 1);
+  }
+  const std::size_t read_buf_size = 1024;
+  // combine files into the output file and return the contents of the file
+  auto combine_files = [&](std::size_t n_partitions, bool map_npix,
+                           int thread_mode) {
+    const std::string out_name =
+        (std::filesystem::temp_directory_path() /
+         ("combine_sqw_test_" + std::to_string(n_partitions) + ".bin"))
+            .string();
+    { std::ofstream out_file(out_name, std::ios::binary | std::ios::trunc); }
+    fileParameters out_par;
+    out_par.fileName = out_name;
+    out_par.nbin_start_pos = 0;
+    out_par.pix_start_pos = 0;
+    out_par.total_NfileBins = NUM_BINS_IN_FILE;
+
+    ProgParameters param;
+    param.totNumBins = NUM_BINS_IN_FILE;
+    param.nBin2read = 0;
+    param.pixBufferSize = 100000;
+    param.log_level = -1;
+    param.num_partitions = n_partitions;
+    param.map_npix = map_npix;
+    {
+      std::vector<sqw_reader> readers(files.size());
+      for (std::size_t i = 0; i < files.size(); i++) {
+        readers[i].init(files[i], true, read_buf_size, thread_mode, map_npix);
+      }
+      if (n_partitions > 1) {
+        combine_sqw_partitioned(param, readers, files, read_buf_size,
+                                thread_mode, out_par);
+      } else {
+        combine_sqw(param, readers, out_par);
+      }
+    }
+    std::ifstream result(out_name, std::ios::binary);
+    std::vector<char> contents((std::istreambuf_iterator<char>(result)),
+                               std::istreambuf_iterator<char>());
+    result.close();
+    std::filesystem::remove(out_name);
+    return contents;
+  };
+  std::vector<char> combined = combine_files(1, false, 0);
+  ASSERT_EQ(combined.size(), files.size() * NUM_PIXELS * NUM_PIXBLOCK_COLS *
+                                 sizeof(float));
+
+  // readers of partitions share pixel files and mapped npix
+  std::vector<char> partitioned = combine_files(4, true, 1);
+  ASSERT_EQ(partitioned.size(), combined.size());
+  EXPECT_TRUE(partitioned == combined);
+  // readers of partitions share pixel files and read their own npix
+  partitioned = combine_files(3, false, 0);
+  ASSERT_EQ(partitioned.size(), combined.size());
+  EXPECT_TRUE(partitioned == combined);
+}
+
+TEST_F(TestCombineSQW, Exchange_Buffer_Ring) {
+  const std::size_t n_slots = 4;
+  const std::size_t buf_pixels = 1000;
+  const std::size_t n_sends = 200;
+  exchange_buffer Buffer(buf_pixels, n_sends, 10, n_slots);
+  ASSERT_EQ(Buffer.num_slots(), n_slots);
+
+  // reader sends slots filled with the number of the send, so the writer can
+  // check the slots arrive in order
+  std::thread reader([&Buffer]() {
+    for (std::size_t n = 0; n < n_sends; n++) {
+      float *buf = Buffer.get_read_buffer();
+      std::size_t npix = 1 + n % buf_pixels;
+      std::fill(buf, buf + npix * NUM_PIXBLOCK_COLS, float(n));
+      Buffer.send_read_buffer_to_writer(npix, n + 1);
+    }
+    Buffer.set_write_allowed();
+  });
+  std::size_t n_bins_processed(0), n_received(0);
+  bool in_order(true);
+  while (n_bins_processed < n_sends) {
+    Buffer.wait_for_reader_data();
+    std::size_t n_pix;
+    const float *buf = reinterpret_cast<const float *>(
+        Buffer.get_write_buffer(n_pix, n_bins_processed));
+    if (buf) {
+      in_order = in_order && n_pix == 1 + n_received % buf_pixels &&
+                 buf[0] == float(n_received) &&
+                 buf[n_pix * NUM_PIXBLOCK_COLS - 1] == float(n_received);
+      n_received++;
+    }
+    if (n_received % 16 == 0) { // let the reader fill the queue
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    Buffer.unlock_write_buffer();
+  }
+  reader.join();
+
+  EXPECT_TRUE(in_order);
+  EXPECT_EQ(n_received, n_sends);
+  EXPECT_EQ(Buffer.num_pix_processed(), n_sends * (n_sends + 1) / 2);
+  EXPECT_LE(Buffer.max_queue_depth(), n_slots);
+  EXPECT_GE(Buffer.average_queue_depth(), 1.);
+}
@@ -42,3 +42,157 @@ TEST_F(TestRecomputePixSums, test_correct_sum_returned_with_4_threads) {
   ASSERT_THAT(signal_sum, ::testing::ElementsAre(1, 8, 4, 9));
   ASSERT_THAT(variance_sum, ::testing::ElementsAre(2, 16, 8, 18));
 }
+
+TEST_F(TestRecomputePixSums, test_column_oriented_page_gives_same_sums) {
+  std::vector<double> signal_sum(distr_size);
+  std::vector<double> variance_sum(distr_size);
+  const int n_threads{4};
+
+  std::vector<double> pix_columns(num_pix * NUM_PIX_COLS);
+  std::array<double *, NUM_PIX_COLS> fields;
+  std::array<double const *, NUM_PIX_COLS> const_fields;
+  for (std::size_t fld = 0; fld < NUM_PIX_COLS; fld++) {
+    fields[fld] = pix_columns.data() + fld * num_pix;
+    const_fields[fld] = fields[fld];
+  }
+  pix_to_columns<double, double>(
+      pix_page_view<double>(pix_data.data(), num_pix), fields);
+  pix_page_view<double> pix(const_fields, num_pix);
+  ASSERT_TRUE(pix.is_column_oriented());
+
+  compute_pix_sums(signal_sum.data(), variance_sum.data(), distr_size,
+                   npix.data(), pix, n_threads);
+
+  ASSERT_THAT(signal_sum, ::testing::ElementsAre(1, 8, 4, 9));
+  ASSERT_THAT(variance_sum, ::testing::ElementsAre(2, 16, 8, 18));
+
+  std::vector<double> pix_back(num_pix * NUM_PIX_COLS);
+  pix_to_interleaved<double, double>(pix, pix_back.data());
+  ASSERT_EQ(pix_back, pix_data);
+}
+
+TEST_F(TestRecomputePixSums, test_reductions_calculated_in_one_pass) {
+  // bins of 3, 0 and 4 pixels with field u1 values 0..6 and NaN in the last
+  std::vector<double> red_npix{3, 0, 4};
+  std::vector<double> pix(7 * NUM_PIX_COLS, 1);
+  for (std::size_t i = 0; i < 7; i++) {
+    pix[i * NUM_PIX_COLS + pix_flds::u1] = double(i);
+  }
+  pix[6 * NUM_PIX_COLS + pix_flds::u1] = std::nan("");
+  const std::size_t n_bins{red_npix.size()};
+  std::vector<std::vector<double>> res(N_REDUCTIONS,
+                                       std::vector<double>(n_bins, -1));
+  std::vector<double> signal_sum(n_bins, -1);
+  std::vector<pix_reduction_request> requests{
+      {pix_flds::iSign, red_sum, signal_sum.data()}};
+  for (int op = 0; op < N_REDUCTIONS; op++) {
+    requests.push_back({pix_flds::u1, pix_reduction(op), res[op].data()});
+  }
+  compute_pix_reductions(requests, n_bins, red_npix.data(),
+                         pix_page_view<double>(pix.data(), 7), 1);
+
+  ASSERT_THAT(signal_sum, ::testing::ElementsAre(3, 0, 4));
+  ASSERT_THAT(res[red_sum], ::testing::ElementsAre(3, 0, 12));
+  ASSERT_THAT(res[red_sum_sq], ::testing::ElementsAre(5, 0, 50));
+  ASSERT_THAT(res[red_mean], ::testing::ElementsAre(1, 0, 4));
+  ASSERT_THAT(res[red_variance], ::testing::ElementsAre(
+                                     ::testing::DoubleEq(2. / 3), 0,
+                                     ::testing::DoubleEq(2. / 3)));
+  ASSERT_THAT(res[red_min],
+              ::testing::ElementsAre(0, ::testing::IsNan(), 3));
+  ASSERT_THAT(res[red_max],
+              ::testing::ElementsAre(2, ::testing::IsNan(), 5));
+  ASSERT_THAT(res[red_count], ::testing::ElementsAre(3, 0, 3));
+}
+
+TEST_F(TestRecomputePixSums, test_nan_omitted_by_all_reductions) {
+  // bins of 2 NaN pixels and of 3 pixels with signal 1, NaN, 3
+  std::vector<double> red_npix{2, 3};
+  std::vector<double> pix(5 * NUM_PIX_COLS, 1);
+  const double nan = std::nan("");
+  pix[0 * NUM_PIX_COLS + pix_flds::iSign] = nan;
+  pix[1 * NUM_PIX_COLS + pix_flds::iSign] = nan;
+  pix[3 * NUM_PIX_COLS + pix_flds::iSign] = nan;
+  pix[4 * NUM_PIX_COLS + pix_flds::iSign] = 3;
+  const pix_page_view<double> page(pix.data(), 5);
+  const std::size_t n_bins{red_npix.size()};
+
+  std::vector<std::vector<double>> res(N_REDUCTIONS,
+                                       std::vector<double>(n_bins, -1));
+  std::vector<pix_reduction_request> requests;
+  for (int op = 0; op < N_REDUCTIONS; op++) {
+    requests.push_back({pix_flds::iSign, pix_reduction(op), res[op].data()});
+  }
+  compute_pix_reductions(requests, n_bins, red_npix.data(), page, 1);
+
+  ASSERT_THAT(res[red_sum], ::testing::ElementsAre(0, 4));
+  ASSERT_THAT(res[red_sum_sq], ::testing::ElementsAre(0, 10));
+  ASSERT_THAT(res[red_mean], ::testing::ElementsAre(0, 2));
+  ASSERT_THAT(res[red_variance], ::testing::ElementsAre(0, 1));
+  ASSERT_THAT(res[red_min], ::testing::ElementsAre(::testing::IsNan(), 1));
+  ASSERT_THAT(res[red_max], ::testing::ElementsAre(::testing::IsNan(), 3));
+  ASSERT_THAT(res[red_count], ::testing::ElementsAre(0, 2));
+
+  // sums requested alone are calculated by the separate loop
+  std::vector<double> sum_only(n_bins, -1);
+  compute_pix_reductions({{pix_flds::iSign, red_sum, sum_only.data()}}, n_bins,
+                         red_npix.data(), page, 1);
+  ASSERT_EQ(sum_only, res[red_sum]);
+
+  // propagated NaN makes all reductions but count of the bins NaN
+  compute_pix_reductions(requests, n_bins, red_npix.data(), page, 1, false);
+  for (int op = 0; op < N_REDUCTIONS; op++) {
+    if (op == red_count) {
+      ASSERT_THAT(res[op], ::testing::ElementsAre(2, 3));
+    } else {
+      ASSERT_THAT(res[op],
+                  ::testing::ElementsAre(::testing::IsNan(), ::testing::IsNan()));
+    }
+  }
+
+  // signal and variance sums propagate NaN as sums of pixels in MATLAB do
+  std::vector<double> signal_sum(n_bins, -1), variance_sum(n_bins, -1);
+  compute_pix_sums(signal_sum.data(), variance_sum.data(), n_bins,
+                   red_npix.data(), page, 1);
+  ASSERT_THAT(signal_sum,
+              ::testing::ElementsAre(::testing::IsNan(), ::testing::IsNan()));
+  ASSERT_THAT(variance_sum, ::testing::ElementsAre(2, 3));
+}
+
+TEST_F(TestRecomputePixSums, test_multithreaded_reductions_same_as_serial) {
+  // enough bins to split them between threads
+  const std::size_t n_bins{100000};
+  std::vector<double> red_npix(n_bins);
+  std::size_t n_pix{0};
+  for (std::size_t i = 0; i < n_bins; i++) {
+    red_npix[i] = double((i * 7) % 5);
+    n_pix += std::size_t(red_npix[i]);
+  }
+  std::vector<double> pix(n_pix * NUM_PIX_COLS);
+  for (std::size_t i = 0; i < pix.size(); i++) {
+    pix[i] = double((i * 13) % 101) - 50;
+  }
+  const pix_page_view<double> page(pix.data(), n_pix);
+  std::vector<std::vector<double>> serial(N_REDUCTIONS),
+      parallel(N_REDUCTIONS);
+  std::vector<pix_reduction_request> ser_requests, par_requests;
+  for (int op = 0; op < N_REDUCTIONS; op++) {
+    serial[op].resize(n_bins);
+    parallel[op].resize(n_bins);
+    ser_requests.push_back({pix_flds::ien, pix_reduction(op), serial[op].data()});
+    par_requests.push_back(
+        {pix_flds::ien, pix_reduction(op), parallel[op].data()});
+  }
+  compute_pix_reductions(ser_requests, n_bins, red_npix.data(), page, 1);
+  compute_pix_reductions(par_requests, n_bins, red_npix.data(), page, 4);
+
+  for (int op = 0; op < N_REDUCTIONS; op++) {
+    for (std::size_t i = 0; i < n_bins; i++) {
+      if (std::isnan(serial[op][i])) {
+        ASSERT_TRUE(std::isnan(parallel[op][i]));
+      } else {
+        ASSERT_EQ(serial[op][i], parallel[op][i]);
+      }
+    }
+  }
+}
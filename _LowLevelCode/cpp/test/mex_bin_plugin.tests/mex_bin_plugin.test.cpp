@@ -1,6 +1,8 @@
+#include "mex_bin_plugin/async_pix_writer.h"
 #include "mex_bin_plugin/bin_io_handler.h"
 #include "utility/environment.h"
 #include <gtest/gtest.h>
+#include <thread>
 
 using namespace Horace::Utility;
 
@@ -161,4 +163,172 @@ TEST(TestMexBinPlugin, write_read_metadata_file_exist) {
 
     del_file(binary_file);
 
-}
\ No newline at end of file
+}
+
+TEST(TestMexBinPlugin, async_write_pixels) {
+    const std::string horace_root{
+        Environment::get_env_variable(Environment::HORACE_ROOT, ".") };
+
+    std::string binary_file{ horace_root + "/_test/async_binary_write.bin" };
+    del_file(binary_file);
+
+    fileParameters file_info;
+    file_info.fileName = binary_file;
+    file_info.nbin_start_pos = 0;
+    file_info.pix_start_pos = 60;
+    file_info.run_id = 0;
+    file_info.total_NfileBins = 0;
+    file_info.pixel_width = 36;
+
+    const size_t n_blocks(20), block_npix(100);
+    std::vector<char> ref_data(n_blocks * block_npix * 36);
+    for (size_t i = 0; i < ref_data.size(); i++) {
+        ref_data[i] = char(i % 127);
+    }
+
+    // limit queue to less then 3 blocks to make writer wait for the writing thread
+    std::unique_ptr<async_pix_writer> my_writer(new async_pix_writer());
+    my_writer->init(file_info, 2 * block_npix * 36 + 10);
+    for (size_t nb = 0; nb < n_blocks / 2; nb++) {
+        my_writer->write_pixels(&ref_data[nb * block_npix * 36], block_npix);
+    }
+    // reading metadata in the middle of writing should not change the place where the following pixels go
+    size_t   n_pixels_out;
+    uint32_t pix_width_out;
+    my_writer->read_pix_info(n_pixels_out, pix_width_out);
+    ASSERT_EQ(pix_width_out, 36);
+    ASSERT_EQ(my_writer->num_pixels_queued(), n_blocks / 2 * block_npix);
+
+    for (size_t nb = n_blocks / 2; nb < n_blocks; nb++) {
+        my_writer->write_pixels(&ref_data[nb * block_npix * 36], block_npix);
+    }
+    std::vector<char> pix_read(5 * 36);
+    size_t n_read = my_writer->read_pixels(pix_read.data(), 5, n_blocks * block_npix - 2);
+    ASSERT_EQ(n_read, 2);
+    my_writer->close();
+    my_writer.reset();
+
+    std::ifstream data_check_stream(binary_file, std::ios::binary);
+    std::vector<char> data_buf(ref_data.size());
+    data_check_stream.seekg(60);
+    data_check_stream.read(&data_buf[0], data_buf.size());
+    ASSERT_TRUE(data_check_stream.good());
+    ASSERT_EQ(ref_data, data_buf);
+
+    std::vector<char> pix_info(fileParameters::PIX_INFO_SIZE);
+    data_check_stream.seekg(60 - fileParameters::PIX_INFO_SIZE);
+    data_check_stream.read(&pix_info[0], fileParameters::PIX_INFO_SIZE);
+    data_check_stream.close();
+    ASSERT_EQ(*(reinterpret_cast<uint32_t*>(&pix_info[0])), 36);
+    ASSERT_EQ(*(reinterpret_cast<uint64_t*>(&pix_info[4])), n_blocks * block_npix);
+
+    del_file(binary_file);
+}
+
+TEST(TestMexBinPlugin, write_pixels_direct_io) {
+    const std::string horace_root{
+        Environment::get_env_variable(Environment::HORACE_ROOT, ".") };
+
+    std::string binary_file{ horace_root + "/_test/direct_binary_write.bin" };
+    del_file(binary_file);
+
+    fileParameters file_info;
+    file_info.fileName = binary_file;
+    file_info.nbin_start_pos = 0;
+    file_info.pix_start_pos = 60;
+    file_info.pixel_width = 36;
+    file_info.total_nPixels = 20000;
+
+    std::vector<char> ref_data(file_info.total_nPixels * 36);
+    for (size_t i = 0; i < ref_data.size(); i++) {
+        ref_data[i] = char(i % 251);
+    }
+    // blocks of various sizes have unaligned heads and tails in the file
+    std::unique_ptr<bin_io_handler> my_writer(new bin_io_handler());
+    my_writer->init(file_info, true);
+    size_t n_written(0), block_npix(1);
+    while (n_written < file_info.total_nPixels) {
+        size_t npix = std::min(block_npix, file_info.total_nPixels - n_written);
+        my_writer->write_pixels(&ref_data[n_written * 36], npix);
+        n_written += npix;
+        block_npix = block_npix * 3 + 7;
+    }
+    std::vector<char> pix_read(10 * 36);
+    ASSERT_EQ(my_writer->read_pixels(pix_read.data(), 10, 1000), 10);
+    ASSERT_EQ(std::vector<char>(&ref_data[1000 * 36], &ref_data[1010 * 36]), pix_read);
+    my_writer.reset();
+
+    ASSERT_EQ(std::filesystem::file_size(binary_file), 60 + ref_data.size());
+    std::ifstream data_check_stream(binary_file, std::ios::binary);
+    std::vector<char> data_buf(ref_data.size());
+    data_check_stream.seekg(60);
+    data_check_stream.read(&data_buf[0], data_buf.size());
+    data_check_stream.close();
+    ASSERT_EQ(ref_data, data_buf);
+
+    del_file(binary_file);
+}
+
+TEST(TestMexBinPlugin, write_pixels_regions_concurrently) {
+    const std::string horace_root{
+        Environment::get_env_variable(Environment::HORACE_ROOT, ".") };
+
+    std::string binary_file{ horace_root + "/_test/regions_binary_write.bin" };
+    del_file(binary_file);
+
+    fileParameters file_info;
+    file_info.fileName = binary_file;
+    file_info.nbin_start_pos = 0;
+    file_info.pix_start_pos = 60;
+    file_info.pixel_width = 36;
+
+    const size_t n_regions(4), region_npix(3001);
+    std::vector<char> ref_data(n_regions * region_npix * 36);
+    for (size_t i = 0; i < ref_data.size(); i++) {
+        ref_data[i] = char(i % 253);
+    }
+    std::vector<std::unique_ptr<bin_io_handler>> writers(n_regions);
+    for (size_t nr = 0; nr < n_regions; nr++) {
+        writers[nr] = std::make_unique<bin_io_handler>();
+        writers[nr]->init(file_info, nr % 2 == 1);
+    }
+    std::vector<char> success(n_regions, 0);
+    std::vector<std::thread> jobs;
+    for (size_t nr = 0; nr < n_regions; nr++) {
+        jobs.emplace_back([&, nr]() {
+            std::string err_mess;
+            bool ok(true);
+            // write region in blocks of 100 pixels from its end to its beginning
+            for (size_t first = region_npix; first > 0;) {
+                size_t npix = std::min(size_t(100), first);
+                first -= npix;
+                size_t pix_num = nr * region_npix + first;
+                ok = ok && writers[nr]->write_pixels_at(&ref_data[pix_num * 36], npix, pix_num, err_mess);
+            }
+            success[nr] = ok;
+            });
+    }
+    for (auto& job : jobs) {
+        job.join();
+    }
+    for (size_t nr = 0; nr < n_regions; nr++) {
+        ASSERT_TRUE(success[nr]);
+    }
+    writers[0]->write_pix_info(n_regions * region_npix);
+    writers.clear();
+
+    std::ifstream data_check_stream(binary_file, std::ios::binary);
+    std::vector<char> data_buf(ref_data.size());
+    data_check_stream.seekg(60);
+    data_check_stream.read(&data_buf[0], data_buf.size());
+    ASSERT_EQ(ref_data, data_buf);
+
+    std::vector<char> pix_info(fileParameters::PIX_INFO_SIZE);
+    data_check_stream.seekg(60 - fileParameters::PIX_INFO_SIZE);
+    data_check_stream.read(&pix_info[0], fileParameters::PIX_INFO_SIZE);
+    data_check_stream.close();
+    ASSERT_EQ(*(reinterpret_cast<uint32_t*>(&pix_info[0])), 36);
+    ASSERT_EQ(*(reinterpret_cast<uint64_t*>(&pix_info[4])), n_regions * region_npix);
+
+    del_file(binary_file);
+}
@@ -1,5 +1,6 @@
 #include "sort_pixels_by_bins/sort_pixels_by_bins.h"
 #include <gtest/gtest.h>
+#include <random>
 
 
 
@@ -28,3 +29,102 @@ TEST(TestSortPixels, test_process_types) {
 
 }
 
+TEST(TestSortPixels, test_sort_multithreaded_same_as_serial) {
+    /* Sort pixels from several blocks serially and using multiple threads
+     * and check that the results are the same */
+    size_t distribution_size = 1000;
+    std::vector<size_t> block_sizes = { 20000, 0, 35001, 17 };
+    std::mt19937 gen(7);
+    std::uniform_int_distribution<int64_t> cell(1, distribution_size);
+    std::uniform_real_distribution<float> val(-10, 10);
+
+    std::vector<std::vector<float>> pix_blocks(block_sizes.size());
+    std::vector<std::vector<int64_t>> ind_blocks(block_sizes.size());
+    std::vector<const void*> PixelData, PixelIndexes;
+    std::vector<double> npix(distribution_size, 0);
+    size_t n_pixels(0);
+    for (size_t nb = 0; nb < block_sizes.size(); nb++) {
+        pix_blocks[nb].resize(block_sizes[nb] * pix_flds::PIX_WIDTH);
+        for (auto& pix_val : pix_blocks[nb]) {
+            pix_val = val(gen);
+        }
+        ind_blocks[nb].resize(block_sizes[nb]);
+        for (auto& ind : ind_blocks[nb]) {
+            ind = cell(gen);
+            npix[ind - 1]++;
+        }
+        PixelData.push_back(block_sizes[nb] > 0 ? pix_blocks[nb].data() : nullptr);
+        PixelIndexes.push_back(block_sizes[nb] > 0 ? ind_blocks[nb].data() : nullptr);
+        n_pixels += block_sizes[nb];
+    }
+    std::vector<size_t> ppInd(distribution_size);
+
+    std::vector<double> sorted_serial(n_pixels * pix_flds::PIX_WIDTH);
+    std::vector<double> range_serial(2 * pix_flds::PIX_WIDTH);
+    sort_pixels_by_bins<float, int64_t, double>(sorted_serial.data(), n_pixels, range_serial.data(),
+        PixelData, block_sizes, PixelIndexes, block_sizes, npix.data(), distribution_size, ppInd.data(), 1);
+
+    std::vector<double> sorted_par(n_pixels * pix_flds::PIX_WIDTH);
+    std::vector<double> range_par(2 * pix_flds::PIX_WIDTH);
+    sort_pixels_by_bins<float, int64_t, double>(sorted_par.data(), n_pixels, range_par.data(),
+        PixelData, block_sizes, PixelIndexes, block_sizes, npix.data(), distribution_size, ppInd.data(), 3);
+
+    EXPECT_EQ(sorted_serial, sorted_par);
+    EXPECT_EQ(range_serial, range_par);
+}
+
+TEST(TestSortPixels, test_sort_column_oriented_pages) {
+    /* Sort the same pixels provided as interleaved and as column-oriented pages
+     * and check that the results are the same */
+    size_t distribution_size = 100;
+    std::vector<size_t> block_sizes = { 300, 0, 1001 };
+    std::mt19937 gen(11);
+    std::uniform_real_distribution<double> cell(1, double(distribution_size) + 0.99);
+    std::uniform_real_distribution<double> val(-10, 10);
+
+    std::vector<std::vector<double>> pix_blocks(block_sizes.size());
+    std::vector<std::vector<double>> pix_columns(block_sizes.size());
+    std::vector<std::vector<double>> ind_blocks(block_sizes.size());
+    std::vector<const void*> PixelData, PixelIndexes;
+    std::vector<pix_page_view<double>> PixelPages;
+    std::vector<double> npix(distribution_size, 0);
+    size_t n_pixels(0);
+    for (size_t nb = 0; nb < block_sizes.size(); nb++) {
+        pix_blocks[nb].resize(block_sizes[nb] * pix_flds::PIX_WIDTH);
+        for (auto& pix_val : pix_blocks[nb]) {
+            pix_val = val(gen);
+        }
+        ind_blocks[nb].resize(block_sizes[nb]);
+        for (auto& ind : ind_blocks[nb]) {
+            ind = std::floor(cell(gen));
+            npix[size_t(ind) - 1]++;
+        }
+        pix_columns[nb].resize(block_sizes[nb] * pix_flds::PIX_WIDTH);
+        std::array<double*, pix_flds::PIX_WIDTH> fields;
+        std::array<double const*, pix_flds::PIX_WIDTH> const_fields;
+        for (size_t fld = 0; fld < pix_flds::PIX_WIDTH; fld++) {
+            fields[fld] = pix_columns[nb].data() + fld * block_sizes[nb];
+            const_fields[fld] = fields[fld];
+        }
+        pix_to_columns<double, double>(pix_page_view<double>(pix_blocks[nb].data(), block_sizes[nb]), fields);
+
+        PixelData.push_back(block_sizes[nb] > 0 ? pix_blocks[nb].data() : nullptr);
+        PixelPages.push_back(block_sizes[nb] > 0 ? pix_page_view<double>(const_fields, block_sizes[nb]) : pix_page_view<double>());
+        PixelIndexes.push_back(block_sizes[nb] > 0 ? ind_blocks[nb].data() : nullptr);
+        n_pixels += block_sizes[nb];
+    }
+    std::vector<size_t> ppInd(distribution_size);
+
+    std::vector<double> sorted_interleaved(n_pixels * pix_flds::PIX_WIDTH);
+    std::vector<double> range_interleaved(2 * pix_flds::PIX_WIDTH);
+    sort_pixels_by_bins<double, double, double>(sorted_interleaved.data(), n_pixels, range_interleaved.data(),
+        PixelData, block_sizes, PixelIndexes, block_sizes, npix.data(), distribution_size, ppInd.data());
+
+    std::vector<double> sorted_columns(n_pixels * pix_flds::PIX_WIDTH);
+    std::vector<double> range_columns(2 * pix_flds::PIX_WIDTH);
+    sort_pixels_by_bins<double, double, double>(sorted_columns.data(), n_pixels, range_columns.data(),
+        PixelPages, block_sizes, PixelIndexes, block_sizes, npix.data(), distribution_size, ppInd.data());
+
+    EXPECT_EQ(sorted_interleaved, sorted_columns);
+    EXPECT_EQ(range_interleaved, range_columns);
+}
@@ -73,6 +73,58 @@ classdef test_main_mex < TestCase
             assertElementsAlmostEqual(pix_matl.data,pix_c.data,'absolute',1.e-8);
         end
 
+        function test_calc_proj_runs(obj)
+            if obj.no_mex
+                skipTest('Can not use and test mex code to calc_projections');
+            end
+            hc = hor_config;
+            hc.saveable = false;
+            hc.use_mex = true;
+
+            rd1 = calc_fake_data(obj);
+            rd1.run_id = 1;
+            rd2 = calc_fake_data(obj);
+            rd2.run_id = 2;
+            lat = rd2.lattice;
+            lat.psi = 30;
+            rd2.lattice = lat;
+
+            % pixels of both runs calculated in one call
+            runs = [rd1,rd2];
+            [pix_range_runs,pix_runs]=runs.calc_projections();
+
+            [pix_range1,pix1]=rd1.calc_projections();
+            [pix_range2,pix2]=rd2.calc_projections();
+
+            assertEqual(pix_runs.data,[pix1.data,pix2.data]);
+            assertEqual(pix_range_runs,minmax_ranges(pix_range1,pix_range2));
+        end
+
+        function test_calc_proj_single(obj)
+            if obj.no_mex
+                skipTest('Can not use and test mex code to calc_projections');
+            end
+            hc = hor_config;
+            hc.saveable = false;
+            rd = calc_fake_data(obj);
+
+            hc.use_mex = true;
+            [pix_range_d,pix_d]=rd.calc_projections();
+            [pix_range_s,pix_s]=rd.calc_projections('-single');
+
+            assertTrue(isa(pix_s.data,'single'));
+            assertEqual(pix_s.data,single(pix_d.data));
+            % ranges are calculated from the stored single precision values
+            assertEqual(pix_range_s,double([min(pix_s.data,[],2)';max(pix_s.data,[],2)']));
+            assertElementsAlmostEqual(pix_range_s,pix_range_d,'relative',1.e-6);
+
+            % MATLAB code returns the same single precision pixels
+            hc.use_mex = false;
+            [~,pix_s_matl]=rd.calc_projections('-single');
+            assertTrue(isa(pix_s_matl.data,'single'));
+            assertElementsAlmostEqual(pix_s_matl.data,pix_s.data,'relative',1.e-6);
+        end
+
         function test_calc_proj_options(obj)
             if obj.no_mex
                 skipTest('Can not use and test mex code for calc_projections with parameters');
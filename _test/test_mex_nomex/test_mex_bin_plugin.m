@@ -41,6 +41,59 @@ classdef test_mex_bin_plugin < TestCase
             assertTrue(valid);
             assertEqual(ver,horace_version)
         end
+        %
+        function test_write_read_pixels(this)
+            if this.skip_tests
+                skipTest('MEX not enabled')
+            end
+            test_file = fullfile(this.tmp_data_folder,'test_mex_bin_plugin_write_read.bin');
+            if is_file(test_file)
+                delete(test_file);
+            end
+            clOb = onCleanup(@()delete(test_file));
+
+            pix_start = 64;
+            fpar = struct('file_name',test_file,'npix_start_pos',0, ...
+                'pix_start_pos',pix_start,'pixel_with',36);
+            wrtr = mex_bin_plugin('init',fpar);
+            % pixels in double precision, as PixelData keeps them in memory,
+            % are written as single precision
+            blocks = {rand(9,10),single(rand(9,7)),rand(9,3)};
+            for i=1:numel(blocks)
+                wrtr = mex_bin_plugin('write',wrtr,blocks{i});
+            end
+            % wrong pixel arrays are rejected
+            assertExceptionThrown(@()mex_bin_plugin('write',wrtr,rand(18,2)), ...
+                'HORACE:mex_bin_plugin:invalid_argument');
+            assertExceptionThrown(@()mex_bin_plugin('write',wrtr,int32(ones(9,2))), ...
+                'HORACE:mex_bin_plugin:invalid_argument');
+
+            [wrtr,npix_written] = mex_bin_plugin('flush',wrtr);
+            assertEqual(npix_written,20);
+
+            ref_pix = single([blocks{:}]);
+            [wrtr,pix_read] = mex_bin_plugin('read',wrtr,20);
+            assertEqual(pix_read,ref_pix);
+            [wrtr,pix_part] = mex_bin_plugin('read',wrtr,5,12);
+            assertEqual(pix_part,ref_pix(:,13:17));
+
+            wrtr = mex_bin_plugin('write_pix_info',wrtr,20);
+            [wrtr,npix_info,pix_width] = mex_bin_plugin('read_pix_info',wrtr);
+            assertEqual(npix_info,20);
+            assertEqual(pix_width,36);
+            mex_bin_plugin('close',wrtr);
+
+            % check file contents
+            fh = fopen(test_file,'rb');
+            fseek(fh,pix_start-12,'bof');
+            pix_width_in_file = fread(fh,1,'*uint32');
+            npix_in_file = fread(fh,1,'*uint64');
+            pix_in_file = fread(fh,[9,Inf],'*single');
+            fclose(fh);
+            assertEqual(pix_width_in_file,uint32(36));
+            assertEqual(npix_in_file,uint64(20));
+            assertEqual(pix_in_file,ref_pix);
+        end
     end
 
 end
@@ -92,12 +92,13 @@ try % mex C++
     mex_single([cpp_in_rel_dir 'GetMD5'], out_rel_dir, ...
         'GetMD5.cpp');
     mex_single([cpp_in_rel_dir 'mex_bin_plugin'], out_rel_dir, ...
-        'mex_bin_plugin.cpp');
+        'mex_bin_plugin.cpp','async_pix_writer.cpp','bin_io_handler.cpp',...
+        '../file_parameters/fileParameters.cpp');
 
     % create the procedure to access hdf files
     if build_hdf_reader
         cof = {'hdf_mex_reader.cpp','hdf_pix_accessor.cpp','input_parser.cpp',...
-            'pix_block_processor.cpp'};
+            'pix_block_processor.cpp','pix_read_plan.cpp'};
         mex_hdf([cpp_in_rel_dir 'hdf_mex_reader'], out_hdf_dir,hdf_root_dir,cof{:} );
     end
 
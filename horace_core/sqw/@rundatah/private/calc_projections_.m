@@ -6,6 +6,11 @@ function [pix_img_range, pix,obj] = calc_projections_(obj, detdcn,proj_mode)
 %
 %   >> [u_to_rlu,pix_range, pix] = obj.calc_projections_(detdcn,detdcn,proj_mode)
 %
+% obj may be an array of rundatah objects. If the runs are measured on the
+% same detectors, pixels of all runs are calculated by mex code in one call.
+% Pixels of all runs are returned together in the order of the runs and
+% pix_img_range covers all runs.
+%
 % Optional inputs:
 % ------
 %   detdcn      Direction of detector in spectrometer coordinates ([3 x ndet] array)
@@ -19,6 +24,8 @@ function [pix_img_range, pix,obj] = calc_projections_(obj, detdcn,proj_mode)
 %               uCoordinates, see below
 %     2 or not present -- pix array will be [9 x nPix] array as described
 %              below
+%     3         the same as 2 but pixel data are single precision, as
+%               they are stored in sqw files
 
 %
 % Output:
@@ -47,22 +54,24 @@ function [pix_img_range, pix,obj] = calc_projections_(obj, detdcn,proj_mode)
 
 % Check input parameters
 % -------------------------
-[ne,ndet]=size(obj.S);
-
 if ~exist('proj_mode','var')
     proj_mode = 2;
 end
-
-%   qspec       4xn_detectors array of qx,qy,qz,eps
-qspec = obj.qpsecs_cache; % if provided, used instead of detchn for calculations
-qspec_provided = ~isempty(qspec);
-
-if proj_mode<0 || proj_mode >2
+if proj_mode<0 || proj_mode >3
     warning('HORACE:calc_projections', ...
-        ' proj_mode can be 0,1 or 2 and got %d. Assuming mode 2(all pixel information)', ...
+        ' proj_mode can be 0,1,2 or 3 and got %d. Assuming mode 2(all pixel information)', ...
         proj_mode);
     proj_mode = 2;
 end
+if numel(obj) > 1
+    [pix_img_range,pix,obj] = calc_projections_runs(obj,detdcn,proj_mode);
+    return;
+end
+[ne,ndet]=size(obj.S);
+
+%   qspec       4xn_detectors array of qx,qy,qz,eps
+qspec = obj.qpsecs_cache; % if provided, used instead of detchn for calculations
+qspec_provided = ~isempty(qspec);
 
 % Create matrix to convert from spectrometer axes to coordinates along crystal Cartesian projection axes
 spec_to_cc = obj.lattice.calc_proj_matrix(1);
@@ -88,7 +97,7 @@ if use_mex
             %proj_mode = 2;
             %nThreads = 1;
             [pix_img_range,pix_arr] =calc_projections_c(spec_to_cc, data, det, efix,k_to_e, emode, nThreads,proj_mode);
-            if proj_mode==2
+            if proj_mode>=2
                 pix = PixelDataMemory();
                 pix = pix.set_raw_data(pix_arr);
                 pix = pix.set_data_range(pix_img_range);
@@ -126,7 +135,7 @@ if ~use_mex
         case 1
             pix_img_range = [min(ucoords,[],2)';max(ucoords,[],2)'];
             pix = ucoords;
-        case 2
+        case {2,3}
             % Fill in pixel data object
             if ~qspec_provided
                 % ensure the detpar structure is in row order. This is probably unnecessary 
@@ -146,7 +155,86 @@ if ~use_mex
             end
             sig_var =[obj.S(:)';((obj.ERR(:)).^2)'];
             run_id = ones(1,numel(detector_idx))*obj.run_id;
-            pix = PixelDataBase.create([ucoords;run_id;detector_idx;energy_idx;sig_var]);
+            pix_arr = [ucoords;run_id;detector_idx;energy_idx;sig_var];
+            if proj_mode == 3
+                pix_arr = single(pix_arr);
+            end
+            pix = PixelDataBase.create(pix_arr);
             pix_img_range=pix.data_range;
     end
 end
+
+function [pix_img_range,pix,obj] = calc_projections_runs(obj,detdcn,proj_mode)
+% Calculate pixels of array of rundatah objects.
+%
+% If mex code is enabled and all runs are measured on the same detectors
+% with the same fixed energy, pixels of all runs are calculated in one call
+% to calc_projections_c. Otherwise the runs are processed one by one.
+%
+n_runs = numel(obj);
+use_mex = config_store.instance().get_value('hor_config','use_mex');
+if use_mex
+    det  = obj(1).get_det_par_rows();
+    for i=2:n_runs
+        if ~isempty(obj(i).qpsecs_cache) || obj(i).emode ~= obj(1).emode || ...
+                ~isequal(obj(i).efix,obj(1).efix) || ...
+                ~isequal(obj(i).get_det_par_rows(),det)
+            use_mex = false;
+            break;
+        end
+    end
+    use_mex = use_mex && isempty(obj(1).qpsecs_cache);
+end
+if use_mex
+    try
+        c=neutron_constants;
+        k_to_e = c.c_k_to_emev;  % used by calc_projections_c;
+        nThreads = config_store.instance().get_value('parallel_config', 'threads');
+
+        data = struct('S',cell(1,n_runs),'ERR',[],'en',[],'run_id',[]);
+        spec_to_cc = zeros(3,3,n_runs);
+        for i=1:n_runs
+            data(i).S = obj(i).S;
+            data(i).ERR = obj(i).ERR;
+            data(i).en = obj(i).en;
+            data(i).run_id = obj(i).run_id;
+            spec_to_cc(:,:,i) = obj(i).lattice.calc_proj_matrix(1);
+        end
+        [pix_img_range,pix_arr] = calc_projections_c(spec_to_cc, data, det, obj(1).efix,k_to_e, obj(1).emode, nThreads,proj_mode);
+        if proj_mode>=2
+            pix = PixelDataMemory();
+            pix = pix.set_raw_data(pix_arr);
+            pix = pix.set_data_range(pix_img_range);
+        else
+            pix = pix_arr;
+            pix_img_range = pix_img_range(:,1:4);
+        end
+        return;
+    catch  ERR % use Matlab routine
+        warning('HORACE:using_mex', ...
+            'Problem with C-code: %s, using Matlab',ERR.message);
+    end
+end
+
+pix_img_range = [];
+pix_arr = cell(1,n_runs);
+for i=1:n_runs
+    [run_range,run_pix,obj(i)] = calc_projections_(obj(i),detdcn,proj_mode);
+    if isempty(pix_img_range)
+        pix_img_range = run_range;
+    else
+        pix_img_range = minmax_ranges(pix_img_range,run_range);
+    end
+    if proj_mode>=2
+        pix_arr{i} = run_pix.data;
+    else
+        pix_arr{i} = run_pix;
+    end
+end
+if proj_mode>=2
+    pix = PixelDataMemory();
+    pix = pix.set_raw_data([pix_arr{:}]);
+    pix = pix.set_data_range(pix_img_range);
+else
+    pix = [pix_arr{:}];
+end
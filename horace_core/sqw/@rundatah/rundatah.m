@@ -166,7 +166,7 @@ classdef rundatah < rundata
             [qspec,en]=calc_qspec(detdcn,obj.efix,en,obj.emode);
         end
 
-        function [pix_or_data_range,pix,obj] = calc_projections(obj,detdcn)
+        function [pix_or_data_range,pix,obj] = calc_projections(obj,detdcn,varargin)
             % main function to transform rundatah information into
             % crystal Cartesian coordinate system
             %
@@ -176,9 +176,15 @@ classdef rundatah < rundata
             % Usage:
             %>> [data_range,pix,obj] = rh.calc_projections()
             %>> [data_range,pix,obj] = rh.calc_projections(detchn)
+            %>> [data_range,pix,obj] = rh.calc_projections([detchn],'-single')
             %
             % Inputs:
-            % rh       -- fully defined (valid) rundatah object
+            % rh       -- fully defined (valid) rundatah object or array
+            %             of such objects. Pixels of all runs of the array
+            %             are returned in one PixelData object in the
+            %             order of the runs.
+            % '-single'-- if provided, pixel data are calculated in single
+            %             precision, as they are stored in sqw files
             %
             %
             % Returns:
@@ -204,14 +210,24 @@ classdef rundatah < rundata
             %             % remove masked data and detectors
             %             [obj.S,obj.ERR,obj.det_par]=obj.rm_masked();
 
+            if nargin <2
+                detdcn = [];
+            elseif ischar(detdcn)
+                varargin = [{detdcn},varargin];
+                detdcn = [];
+            end
+            [ok,mess,calc_single] = parse_char_options(varargin,{'-single'});
+            if ~ok
+                error('HORACE:rundatah:invalid_argument', ...
+                    'calc_projections: %s',mess)
+            end
             if nargout<2
                 proj_mode = 0;
+            elseif calc_single
+                proj_mode = 3;
             else
                 proj_mode = 2;
             end
-            if nargin <2
-                detdcn = [];
-            end
             % Calculate projections
             [pix_or_data_range,pix,obj] = calc_projections_(obj,detdcn,proj_mode);
         end
@@ -97,7 +97,8 @@ if use_mex_to_read
     if ~isempty(obj.mex_read_handler_ )
         obj.mex_read_handler_ = hdf_mex_reader('close',obj.mex_read_handler_);
     end
-    obj.mex_read_handler_ = hdf_mex_reader('init',filename,obj.nexus_group_name_);
+    n_threads = config_store.instance().get_value('parallel_config','threads');
+    obj.mex_read_handler_ = hdf_mex_reader('init',filename,obj.nexus_group_name_,n_threads);
 else
     [file_id,nexus_group_name,fid,file_h,nxsqw_version] = open_or_create_nxsqw_head(filename);
     obj.nexus_group_name_ = nexus_group_name;
@@ -26,6 +26,7 @@ if obj.use_mex_to_read && ~use
     obj.use_mex_to_read = false;
     init_(obj.filename_,obj.max_num_pixels,obj.chunk_size,'-use_matlab_to_read');
 elseif ~obj.use_mex_to_read && use
-    obj.mex_read_handler_ = hdf_mex_reader('init',obj.filename_,obj.nexus_group_name_);
+    n_threads = config_store.instance().get_value('parallel_config','threads');
+    obj.mex_read_handler_ = hdf_mex_reader('init',obj.filename_,obj.nexus_group_name_,n_threads);
     obj.use_mex_to_read_ = true;
 end
@@ -95,13 +95,14 @@ if use_mex
             npix = calc_npix_distribution(pix_ix_retained);
         end
 
+        num_threads = config_store.instance().get_value('parallel_config','threads');
         pix = PixelDataBase.create();
         if use_given_pix_range
             raw_pix = sort_pixels_by_bins(raw_pix, pix_ix_retained, ...
-                npix,keep_type);
+                npix,keep_type,num_threads);
         else
             [raw_pix,data_range_l] = sort_pixels_by_bins(raw_pix, pix_ix_retained, ...
-                npix,keep_type);
+                npix,keep_type,num_threads);
             data_range = data_range_l;
         end
         pix = pix.set_raw_data(raw_pix);